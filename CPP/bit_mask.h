@@ -0,0 +1,196 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(_MSC_VER) && !defined(__CUDA_ARCH__)
+#include <intrin.h>
+#endif
+
+#ifdef __CUDACC__
+#define BIT_MASK_FUNCTION __host__ __device__ inline
+#else
+#define BIT_MASK_FUNCTION inline
+#endif
+
+// Map with one bit for each pixel of a frame. Bit i is the pixel i of the frame (row after row), and the bits are
+// stored in 64 bit words. The CPU and the CUDA layers use the same format, so the map is copied to the GPU as is.
+// It does not depend on Windows.h, so the functions that work on it can be built and measured on any platform.
+// The range functions test a whole word with plain 64 bit operations instead of SIMD intrinsics, which already
+// covers 64 pixels of a row at once on the CPU and builds as is for the device
+namespace bit_mask
+{
+	typedef uint64_t Word;
+	constexpr size_t word_bits = 64;
+
+	BIT_MASK_FUNCTION size_t words_count(const size_t bits)
+	{
+		return (bits + word_bits - 1) / word_bits;
+	}
+
+	BIT_MASK_FUNCTION size_t bytes_count(const size_t bits)
+	{
+		return words_count(bits) * sizeof(Word);
+	}
+
+	BIT_MASK_FUNCTION bool test(const Word* mask, const size_t bit)
+	{
+		return (mask[bit / word_bits] >> (bit % word_bits)) & 1;
+	}
+
+	BIT_MASK_FUNCTION void set(Word* mask, const size_t bit)
+	{
+		mask[bit / word_bits] |= Word(1) << (bit % word_bits);
+	}
+
+	BIT_MASK_FUNCTION void assign(Word* mask, const size_t bit, const bool value)
+	{
+		const auto word_mask = Word(1) << (bit % word_bits);
+		if (value)
+			mask[bit / word_bits] |= word_mask;
+		else
+			mask[bit / word_bits] &= ~word_mask;
+	}
+
+	inline void clear_all(Word* mask, const size_t bits)
+	{
+		memset(mask, 0, bytes_count(bits));
+	}
+
+	// The bits from `from` (included) until the end of its word, without the bits from `to`
+	inline Word range_word_mask(const size_t from, const size_t to)
+	{
+		auto word_mask = ~Word(0) << (from % word_bits);
+		if (to / word_bits == from / word_bits)
+			word_mask &= (Word(1) << (to % word_bits)) - 1;
+		return word_mask;
+	}
+
+	// Set (or clear) the bits in [from, to). The words in the middle of the range are written at once
+	inline void fill_range(Word* mask, size_t from, const size_t to, const bool value)
+	{
+		while (from < to)
+		{
+			const auto word = from / word_bits;
+			if (from % word_bits == 0 && to - from >= word_bits)
+			{
+				const auto words = (to - from) / word_bits;
+				memset(&mask[word], value ? 0xFF : 0, words * sizeof(Word));
+				from += words * word_bits;
+				continue;
+			}
+
+			const auto word_mask = range_word_mask(from, to);
+			if (value)
+				mask[word] |= word_mask;
+			else
+				mask[word] &= ~word_mask;
+			from = (word + 1) * word_bits;
+		}
+	}
+
+	inline int count_trailing_zeros(const Word word)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward64(&index, word);
+		return static_cast<int>(index);
+#else
+		return __builtin_ctzll(word);
+#endif
+	}
+
+	// The first bit in [from, to) that its value is the given value, or `to` when there is none.
+	// Each word is tested at once, so a run of 64 pixels with the same value costs one test
+	inline size_t find_next(const Word* mask, size_t from, const size_t to, const bool value)
+	{
+		if (from >= to)
+			return to;
+
+		const auto flip = value ? Word(0) : ~Word(0);
+		auto word = from / word_bits;
+		auto bits = (mask[word] ^ flip) & (~Word(0) << (from % word_bits));
+		const auto last_word = (to - 1) / word_bits;
+
+		while (!bits)
+		{
+			if (++word > last_word)
+				return to;
+			bits = mask[word] ^ flip;
+		}
+
+		const auto bit = word * word_bits + count_trailing_zeros(bits);
+		return bit < to ? bit : to;
+	}
+
+	inline bool any_in_range(const Word* mask, const size_t from, const size_t to)
+	{
+		return find_next(mask, from, to, true) < to;
+	}
+
+	// Call span(span_from, span_to) for each run of clear bits in [from, to)
+	template <typename Span>
+	void for_each_clear_span(const Word* mask, size_t from, const size_t to, const Span& span)
+	{
+		while (from < to)
+		{
+			const auto span_from = find_next(mask, from, to, false);
+			if (span_from >= to)
+				return;
+
+			const auto span_to = find_next(mask, span_from, to, true);
+			span(span_from, span_to);
+			from = span_to;
+		}
+	}
+
+	// Read count (1 to 64) bits that start in the given bit, the first bit is the lowest bit of the result
+	inline Word read_bits(const Word* mask, const size_t bit, const size_t count)
+	{
+		const auto word = bit / word_bits;
+		const auto shift = bit % word_bits;
+		auto bits = mask[word] >> shift;
+		if (shift && shift + count > word_bits)
+			bits |= mask[word + 1] << (word_bits - shift);
+		return count < word_bits ? bits & ((Word(1) << count) - 1) : bits;
+	}
+
+	inline void write_bits(Word* mask, const size_t bit, const size_t count, const Word bits)
+	{
+		const auto word = bit / word_bits;
+		const auto shift = bit % word_bits;
+		const auto count_mask = count < word_bits ? (Word(1) << count) - 1 : ~Word(0);
+
+		mask[word] = (mask[word] & ~(count_mask << shift)) | ((bits & count_mask) << shift);
+		if (shift && shift + count > word_bits)
+		{
+			const auto high_mask = count_mask >> (word_bits - shift);
+			mask[word + 1] = (mask[word + 1] & ~high_mask) | ((bits & count_mask) >> (word_bits - shift));
+		}
+	}
+
+	// Copy count bits from the bit `from` to the bit `to` of the same mask. The ranges may overlap
+	inline void move_bits(Word* mask, const size_t to, const size_t from, const size_t count)
+	{
+		if (to == from || !count)
+			return;
+
+		if (to < from)
+		{
+			for (size_t i = 0; i < count; i += word_bits)
+			{
+				const auto chunk = count - i < word_bits ? count - i : word_bits;
+				write_bits(mask, to + i, chunk, read_bits(mask, from + i, chunk));
+			}
+			return;
+		}
+
+		// Copy from the end, so the source bits are read before they are overwritten
+		for (auto end = count; end > 0;)
+		{
+			const auto chunk = end < word_bits ? end : word_bits;
+			end -= chunk;
+			write_bits(mask, to + end, chunk, read_bits(mask, from + end, chunk));
+		}
+	}
+}
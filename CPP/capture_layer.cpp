@@ -16,7 +16,9 @@
 #include "direct3d11.interop.h"
 #include "graphic_device.h"
 #include "capture_layer.h"
+#include "timers.h"
 
+#include <atomic>
 #include <iostream>
 
 namespace capture_layer_helpers
@@ -58,26 +60,43 @@ namespace capture_layer_helpers
 
 namespace capture_layer
 {
-	HWND target_hwnd = NULL;
-	TextureData texture_data;
+	// The new size of the frames is taken after it did not change for this long
+	constexpr int resize_frame_delay = 250;
 
-	// WinRT stuff for the logic that used to capture with Win 10 API
-	winrt::Windows::Graphics::Capture::GraphicsCaptureItem capture_item = {nullptr};
-	winrt::Windows::Graphics::SizeInt32 capture_last_size;
-	winrt::Windows::Graphics::Capture::Direct3D11CaptureFramePool::FrameArrived_revoker frame_arrived_revoker;
+	// The thread that takes the frames, woken when a frame arrived
+	std::atomic<timers::Waiter*> frame_waiter(nullptr);
 
+	// The state of the capture of one target window
+	struct Context
+	{
+		HWND target_hwnd = NULL;
+		TextureData texture_data;
+
+		// WinRT stuff for the logic that used to capture with Win 10 API
+		winrt::Windows::Graphics::Capture::GraphicsCaptureItem capture_item = {nullptr};
+		winrt::Windows::Graphics::SizeInt32 capture_last_size = {0};
+		winrt::Windows::Graphics::Capture::Direct3D11CaptureFramePool::FrameArrived_revoker frame_arrived_revoker;
+
+
+		// The 3d device stuff that used for the logic to get the captured data as ID3D11Texture2D
+		winrt::Windows::Graphics::Capture::Direct3D11CaptureFramePool frame_pool{nullptr};
+		winrt::Windows::Graphics::Capture::GraphicsCaptureSession capture_session{nullptr};
 
-	// The 3d device stuff that used for the logic to get the captured data as ID3D11Texture2D
-	winrt::Windows::Graphics::Capture::Direct3D11CaptureFramePool frame_pool{nullptr};
-	winrt::Windows::Graphics::Capture::GraphicsCaptureSession capture_session{nullptr};
+		bool capturing = false;
+		bool new_frame = false;
+		bool first_frame = true;
+		bool is_closed = true;
+		timers::Time resize_frame_timer = 0;
 
-	bool new_frame = false;
-	bool first_frame = true;
-	bool is_closed = true;
-	clock_t resize_frame_timer = 0;
+		// Frames that arrived since the renderer took the count, written by the callback on the main thread
+		volatile LONG arrived_frames = 0;
+	};
 
+	Context default_context;
 
-	//bool capturing = false; // Moved to global
+	// The context that all the functions of the calling thread work on. The frames callback works on the context
+	// that created it, so it is not affected by the selected context
+	thread_local Context* context = &default_context;
 
 	bool init()
 	{
@@ -99,11 +118,27 @@ namespace capture_layer
 	}
 
 
+	// SystemRelativeTime of the frames is the QueryPerformanceCounter time in 100 nanoseconds units
+	LONGLONG to_performance_counter(const winrt::Windows::Foundation::TimeSpan time)
+	{
+		static LONGLONG frequency = 0;
+		if (!frequency)
+		{
+			LARGE_INTEGER value;
+			QueryPerformanceFrequency(&value);
+			frequency = value.QuadPart;
+		}
+
+		constexpr LONGLONG units_per_second = 10000000;
+		const auto units = time.count();
+		return units / units_per_second * frequency + units % units_per_second * frequency / units_per_second;
+	}
+
 	void callback_on_frame_arrived(
-		winrt::Windows::Graphics::Capture::Direct3D11CaptureFramePool const& sender,
-		winrt::Windows::Foundation::IInspectable const& args)
+		Context& context,
+		winrt::Windows::Graphics::Capture::Direct3D11CaptureFramePool const& sender)
 	{
-		if (!capturing) return;
+		if (!context.capturing) return;
 
 #if 0
 		static clock_t timer = clock();
@@ -120,55 +155,52 @@ namespace capture_layer
 		const auto frame_content_size = frame.ContentSize();
 
 		new_size = false;
-		if (frame_content_size.Width != capture_last_size.Width || frame_content_size.Height != capture_last_size.Height
+		if (frame_content_size.Width != context.capture_last_size.Width || frame_content_size.Height != context.
+			capture_last_size.Height
 		)
 		{
-			if (first_frame)
+			if (context.first_frame)
 			{
 				new_size = true;
-				first_frame = false;
+				context.first_frame = false;
 			}
 			else
 			{
-				resize_frame_timer = clock();
-				capture_last_size = frame_content_size;
+				// Checked when the next frame arrives, so no thread waits for it
+				context.resize_frame_timer = timers::now() + resize_frame_delay;
+				context.capture_last_size = frame_content_size;
 			}
 		}
-		else if (resize_frame_timer && clock() - resize_frame_timer > 250)
+		else if (context.resize_frame_timer && timers::is_due(context.resize_frame_timer))
 		{
-			resize_frame_timer = 0;
+			context.resize_frame_timer = 0;
 			new_size = true;
 		}
 
-
-		if (new_size)
-		{
-			// The thing we have been capturing has changed size.
-			// We need to resize our swap chain first, then blit the pixels.
-			// After we do that, retire the frame and then recreate our frame pool.
-
-			graphic_device::resize_swap_chain(capture_last_size.Width, capture_last_size.Height);
-
-		}
+		// The swap chain of the display layer is resized by the renderer when it gets the first frame
+		// of the new size, since the swap chain belongs to the target that the renderer is processing
 
 
 		const auto frame_surface = direct3d11_interop::GetDXGIInterfaceFromObject<ID3D11Texture2D>(frame.Surface());
 
 
-		texture_data.textrue = frame_surface.get();
-		texture_data.x_size = capture_last_size.Width;
-		texture_data.y_size = capture_last_size.Height;
+		context.texture_data.textrue = frame_surface.get();
+		context.texture_data.x_size = context.capture_last_size.Width;
+		context.texture_data.y_size = context.capture_last_size.Height;
+		context.texture_data.capture_time = to_performance_counter(frame.SystemRelativeTime());
 
-		new_frame = true;
+		context.new_frame = true;
+		InterlockedIncrement(&context.arrived_frames);
+		timers::wake(frame_waiter); // The process frame thread waits for the frames
 
 
 		if (new_size)
 		{
-			if (!create_capture_item_for_window(target_hwnd, &capture_item))
+			if (!create_capture_item_for_window(context.target_hwnd, &context.capture_item))
 				return;
 
 
-			frame_pool.Recreate(
+			context.frame_pool.Recreate(
 				graphic_device::device,
 				DirectXPixelFormat::B8G8R8A8UIntNormalized,
 				2,
@@ -178,7 +210,7 @@ namespace capture_layer
 
 	void set_target(const HWND target_hwnd)
 	{
-		capture_layer::target_hwnd = target_hwnd;
+		context->target_hwnd = target_hwnd;
 	}
 
 	bool create_layer()
@@ -190,14 +222,15 @@ namespace capture_layer
 
 		std::cout << "Start capturing window\n";
 
-		if (!create_capture_item_for_window(target_hwnd, &capture_item))
+		if (!create_capture_item_for_window(context->target_hwnd, &context->capture_item))
 		{
 			std::cout << "Failed to create capture item for window\n";
 			return false;
 		}
 
 		RECT target_rect = {0};
-		if (DwmGetWindowAttribute(target_hwnd, DWMWA_EXTENDED_FRAME_BOUNDS, &target_rect, sizeof(RECT)) != S_OK)
+		if (DwmGetWindowAttribute(context->target_hwnd, DWMWA_EXTENDED_FRAME_BOUNDS, &target_rect, sizeof(RECT)) !=
+			S_OK)
 		{
 			std::cout << "DwmGetWindowAttribute(*) failed while trying to get the size of the capture frame\n";
 			return false;
@@ -208,37 +241,44 @@ namespace capture_layer
 		};
 
 
-		frame_pool = Direct3D11CaptureFramePool::Create(
+		context->frame_pool = Direct3D11CaptureFramePool::Create(
 			graphic_device::device,
 			DirectXPixelFormat::B8G8R8A8UIntNormalized,
 			2,
 			size);
 
-		capture_session = frame_pool.CreateCaptureSession(capture_item);
+		context->capture_session = context->frame_pool.CreateCaptureSession(context->capture_item);
 
-		capture_last_size = size;
-		frame_arrived_revoker = frame_pool.FrameArrived(winrt::auto_revoke, &callback_on_frame_arrived);
+		context->capture_last_size = size;
 
-		is_closed = false;
+		auto* const frame_context = context;
+		context->frame_arrived_revoker = context->frame_pool.FrameArrived(
+			winrt::auto_revoke,
+			[frame_context](Direct3D11CaptureFramePool const& sender, winrt::Windows::Foundation::IInspectable const&)
+			{
+				callback_on_frame_arrived(*frame_context, sender);
+			});
+
+		context->is_closed = false;
 		return true;
 	}
 
 
 	void stop_capture_session()
 	{
-		if (!capturing) return;
-		frame_pool.Close();
-		capture_session.Close();
-		capturing = false;
+		if (!context->capturing) return;
+		context->frame_pool.Close();
+		context->capture_session.Close();
+		context->capturing = false;
 	}
 
 	void start_capture_session()
 	{
-		capture_session.StartCapture();
-		capturing = true;
-		capture_session.IsCursorCaptureEnabled(false);
+		context->capture_session.StartCapture();
+		context->capturing = true;
+		context->capture_session.IsCursorCaptureEnabled(false);
 
-		first_frame = true;
+		context->first_frame = true;
 	}
 
 	void dispose()
@@ -246,39 +286,64 @@ namespace capture_layer
 		// stop_capture_session();
 
 #if 1 // I gave up.. there is no way to dispose this shit. It will just crash... 
-		capture_last_size = {0};
+		context->capture_last_size = {0};
 
-		if (!is_closed)
+		if (!context->is_closed)
 		{
-			frame_arrived_revoker.revoke();
-			is_closed = true;
+			context->frame_arrived_revoker.revoke();
+			context->is_closed = true;
 		}
 
-		if (capturing)
+		if (context->capturing)
 		{
 			stop_capture_session();
 		}
 
-		frame_pool = nullptr;
-		capture_session = nullptr;
-		capture_item = nullptr;
-		texture_data = {nullptr};
-		capturing = false;
-		new_frame = false;
-		first_frame = true;
+		context->frame_pool = nullptr;
+		context->capture_session = nullptr;
+		context->capture_item = nullptr;
+		context->texture_data = {nullptr};
+		context->capturing = false;
+		context->new_frame = false;
+		context->first_frame = true;
 #endif
 	}
 
 	bool get_new_frame(TextureData* texture_data)
 	{
-		if (!new_frame)
+		frame_waiter = timers::get_thread_waiter();
+
+		if (!context->new_frame)
 			return false;
 
-		if (capture_layer::texture_data.x_size <= 0 && capture_layer::texture_data.y_size <= 0)
+		if (context->texture_data.x_size <= 0 && context->texture_data.y_size <= 0)
 			return false;
 
-		new_frame = true;
-		*texture_data = capture_layer::texture_data;
+		context->new_frame = true;
+		*texture_data = context->texture_data;
 		return true;
 	}
+
+	int take_arrived_frames()
+	{
+		return InterlockedExchange(&context->arrived_frames, 0);
+	}
+
+	Context* create_context()
+	{
+		return new Context();
+	}
+
+	void destroy_context(Context* context)
+	{
+		select_context(context);
+		dispose();
+		select_context(nullptr);
+		delete context;
+	}
+
+	void select_context(Context* context)
+	{
+		capture_layer::context = context ? context : &default_context;
+	}
 }
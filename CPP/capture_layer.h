@@ -7,18 +7,24 @@ namespace capture_layer
 		ID3D11Texture2D* textrue = nullptr;
 		int x_size = -1;
 		int y_size = -1;
+		LONGLONG capture_time = 0; // QueryPerformanceCounter ticks when the frame was rendered by the system
 	};
 
 
 	// Textrue data that we got from callback
 
 
-	inline bool capturing = false;
-
 	bool init();
 	void set_target(HWND target_hwnd);
 	bool create_layer();
 	void start_capture_session();
 	void dispose();
 	bool get_new_frame(TextureData* texture_data);
+	int take_arrived_frames();  // Returns how many frames arrived since the last call
+
+	// The capture of one target window. All the functions above work on the selected context
+	struct Context;
+	Context* create_context();
+	void destroy_context(Context* context);
+	void select_context(Context* context);
 }
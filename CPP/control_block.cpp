@@ -0,0 +1,165 @@
+#include "control_block.h"
+
+#include <iostream>
+#include <string>
+
+namespace control_block
+{
+	// The layout is shared with Renderer.java. The plugin makes the sequence odd before it writes the settings
+	// and even again after it wrote them
+	struct SharedBlock
+	{
+		volatile LONG sequence;
+		volatile LONG opacity_level;
+		volatile LONG brightness_level;
+		volatile LONG text_brightness;
+		volatile LONG blur_type;
+		volatile LONG analysis_scale;
+	};
+
+	struct Block
+	{
+		HWND target_hwnd;
+		HANDLE mapping;
+		SharedBlock* shared;
+		LONG applied_sequence;
+		Settings applied;
+	};
+
+	const int max_read_retries = 100;
+
+	HANDLE doorbell = nullptr;
+	std::vector<Block> blocks;
+
+
+	bool init(const HWND msg_hwnd)
+	{
+		const auto name = "Local\\GlassCode_Doorbell_" + std::to_string(reinterpret_cast<uintptr_t>(msg_hwnd));
+		doorbell = CreateEventA(nullptr, FALSE, FALSE, name.c_str());
+		if (!doorbell)
+		{
+			std::cout << "Failed to create the settings doorbell event\n";
+			return false;
+		}
+
+		return true;
+	}
+
+	void un_init()
+	{
+		while (!blocks.empty())
+			detach(blocks.back().target_hwnd);
+
+		if (doorbell)
+		{
+			CloseHandle(doorbell);
+			doorbell = nullptr;
+		}
+	}
+
+	HANDLE get_doorbell()
+	{
+		return doorbell;
+	}
+
+	bool attach(const HWND target_hwnd, const Settings& settings)
+	{
+		detach(target_hwnd);
+
+		const auto name = "Local\\GlassCode_Control_" + std::to_string(reinterpret_cast<uintptr_t>(target_hwnd));
+		const auto mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, name.c_str());
+		if (!mapping)
+		{
+			// Plugins that still send the settings with messages do not create the block
+			std::cout << "No settings block for the target window, settings are received only by messages\n";
+			return false;
+		}
+
+		auto* const shared = static_cast<SharedBlock*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0,
+		                                                             sizeof(SharedBlock)));
+		if (!shared)
+		{
+			std::cout << "Failed to map the settings block of the target window\n";
+			CloseHandle(mapping);
+			return false;
+		}
+
+		// An odd sequence is never applied, so the first poll reads the block and applies what differs
+		blocks.push_back({target_hwnd, mapping, shared, -1, settings});
+		return true;
+	}
+
+	void detach(const HWND target_hwnd)
+	{
+		for (auto it = blocks.begin(); it != blocks.end(); ++it)
+		{
+			if (it->target_hwnd != target_hwnd)
+				continue;
+
+			UnmapViewOfFile(it->shared);
+			CloseHandle(it->mapping);
+			blocks.erase(it);
+			return;
+		}
+	}
+
+	// Seqlock read. Fails if the plugin kept writing for all the retries
+	bool read_settings(const SharedBlock* shared, Settings& settings, LONG& sequence)
+	{
+		for (auto retry = 0; retry < max_read_retries; retry++)
+		{
+			const auto start_sequence = shared->sequence;
+			if (start_sequence & 1)
+			{
+				YieldProcessor();
+				continue;
+			}
+
+			MemoryBarrier();
+			settings.opacity_level = shared->opacity_level;
+			settings.brightness_level = shared->brightness_level;
+			settings.text_brightness = shared->text_brightness;
+			settings.blur_type = shared->blur_type;
+			settings.analysis_scale = shared->analysis_scale;
+			MemoryBarrier();
+
+			if (shared->sequence == start_sequence)
+			{
+				sequence = start_sequence;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	std::vector<Change> poll()
+	{
+		std::vector<Change> changes;
+
+		for (auto& block : blocks)
+		{
+			if (block.shared->sequence == block.applied_sequence)
+				continue;
+
+			Settings settings;
+			LONG sequence;
+			if (!read_settings(block.shared, settings, sequence))
+				continue; // The doorbell rings again when the plugin finishes to write
+
+			block.applied_sequence = sequence;
+
+			if (settings.opacity_level == block.applied.opacity_level &&
+				settings.brightness_level == block.applied.brightness_level &&
+				settings.text_brightness == block.applied.text_brightness &&
+				settings.blur_type == block.applied.blur_type &&
+				settings.analysis_scale == block.applied.analysis_scale)
+				continue;
+
+			changes.push_back({block.target_hwnd, settings, block.applied});
+			block.applied = settings;
+		}
+
+		return changes;
+	}
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <Windows.h>
+#include <vector>
+
+// Settings shared with the plugin through memory instead of messages.
+// The plugin creates a block per window before it attaches the window, and writes the settings to it under a
+// seqlock. Then it signals the doorbell event so the main loop wakes up and applies the settings
+namespace control_block
+{
+	struct Settings
+	{
+		int opacity_level;
+		int brightness_level;
+		int text_brightness;
+		int blur_type;
+		int analysis_scale;
+	};
+
+	struct Change
+	{
+		HWND target_hwnd;
+		Settings settings;
+		Settings previous;
+	};
+
+	bool init(HWND msg_hwnd);
+	void un_init();
+
+	// Handle that is signaled when the plugin wrote new settings
+	HANDLE get_doorbell();
+
+	// The settings are the ones that the window was attached with
+	bool attach(HWND target_hwnd, const Settings& settings);
+	void detach(HWND target_hwnd);
+
+	// Returns the blocks that their settings changed since the last call
+	std::vector<Change> poll();
+}
@@ -11,6 +11,7 @@
 
 #include "display_layer.h"
 
+#include <array>
 #include <iostream>
 
 
@@ -91,24 +92,60 @@ namespace display_layer
 
 	HINSTANCE instance = nullptr;
 
-	HWND target_hwnd = nullptr;
-	// RECT target_rect = { 0 }; // Moved to global
-	LONG target_orig_style = NULL;
-	BYTE target_orig_alpha = 255;
+	struct Present
+	{
+		bool full = true;
+		std::vector<RECT> rects;
+	};
+
+	constexpr UINT previous_presents_count = graphic_device::swap_chain_buffers_count - 1;
+	static_assert(previous_presents_count > 0, "The swap chain must have a back buffer besides the presented one");
 
-	HWND display_hwnd = nullptr;
-	HWND display_hwnd2 = nullptr;
-	HWND display_hwnd_mask = nullptr;
+	// The state of the display layer of one target window
+	struct Context
+	{
+		HWND target_hwnd = nullptr;
+		RECT target_rect = {0};
+		LONG target_orig_style = NULL;
+		BYTE target_orig_alpha = 255;
+
+		HWND display_hwnd = nullptr;
+		HWND display_hwnd2 = nullptr;
+		HWND display_hwnd_mask = nullptr;
+
+		BlurType blur_type = BlurType::NONE;
+		int transparent_level = 0;
+		bool is_target_window_transparent = false;
+
+		winrt::Windows::UI::Composition::Compositor display_compositor{nullptr};
+		winrt::Windows::UI::Composition::ContainerVisual container_root{nullptr};
+		winrt::Windows::UI::Composition::Desktop::DesktopWindowTarget desktop_window_target{nullptr};
+		winrt::Windows::UI::Composition::SpriteVisual render_element{nullptr};
+		winrt::Windows::UI::Composition::CompositionSurfaceBrush brush{nullptr};
+
+		Buffer buffer = {0};
+
+		// Selected in graphic_device with the context
+		winrt::com_ptr<IDXGISwapChain1> com_ptr_swap_chain{nullptr};
+
+		FrameSink* frame_sink = nullptr;
+
+		// What was presented to the swap chain, to know what the back buffer is missing. A back buffer
+		// has the frame from swap_chain_buffers_count presents ago, so the rects of the presents since
+		// then are copied too
+		IDXGISwapChain1* presented_swap_chain = nullptr;
+		UINT presented_x_size = 0;
+		UINT presented_y_size = 0;
+		UINT full_presents_left = 0;
+
+		// The newest first
+		std::array<Present, previous_presents_count> previous_presents;
+	};
 
-	BlurType blur_type = BlurType::NONE;
-	int transparent_level = 0;
-	bool is_target_window_transparent = false;
+	Context default_context;
 
-	winrt::Windows::UI::Composition::Compositor display_compositor{nullptr};
-	winrt::Windows::UI::Composition::ContainerVisual container_root{nullptr};
-	winrt::Windows::UI::Composition::Desktop::DesktopWindowTarget desktop_window_target{nullptr};
-	winrt::Windows::UI::Composition::SpriteVisual render_element{nullptr};
-	winrt::Windows::UI::Composition::CompositionSurfaceBrush brush{nullptr};
+	// The context that all the functions of the calling thread work on
+	thread_local Context* context = &default_context;
 
 
 	bool init()
@@ -150,67 +187,72 @@ namespace display_layer
 		// desktop_window_target.Close();
 		// render_element.Close();
 		// brush.Close();
-		DestroyWindow(display_hwnd_mask);
-		DestroyWindow(display_hwnd2);
-		DestroyWindow(display_hwnd);
+		DestroyWindow(context->display_hwnd_mask);
+		DestroyWindow(context->display_hwnd2);
+		DestroyWindow(context->display_hwnd);
 
-		if (target_orig_alpha > 0)
-			SetLayeredWindowAttributes(target_hwnd, NULL, target_orig_alpha, LWA_ALPHA);
+		if (context->target_orig_alpha > 0)
+			SetLayeredWindowAttributes(context->target_hwnd, NULL, context->target_orig_alpha, LWA_ALPHA);
 	}
 
 	void set_target(const HWND target_hwnd)
 	{
-		display_layer::target_hwnd = target_hwnd;
+		context->target_hwnd = target_hwnd;
 	}
 
+	// hide_target_hwnd, show_target_hwnd and move_layer_to_target are called also from the frames thread while it
+	// holds the mutex of the target, so they don't wait for the main thread that owns the layer windows
+
 	void hide_target_hwnd()
 	{
-		if (!is_target_window_transparent)
+		if (!context->is_target_window_transparent)
 		{
 			DWORD flags = LWA_ALPHA;
-			GetLayeredWindowAttributes(target_hwnd, nullptr, &target_orig_alpha, &flags);
+			GetLayeredWindowAttributes(context->target_hwnd, nullptr, &context->target_orig_alpha, &flags);
 		}
 		
-		SetWindowLong(target_hwnd, GWL_EXSTYLE, GetWindowLong(target_hwnd, GWL_EXSTYLE) | WS_EX_LAYERED);
+		SetWindowLong(context->target_hwnd, GWL_EXSTYLE,
+		              GetWindowLong(context->target_hwnd, GWL_EXSTYLE) | WS_EX_LAYERED);
 
-		SetLayeredWindowAttributes(target_hwnd, NULL, 1, LWA_ALPHA);
+		SetLayeredWindowAttributes(context->target_hwnd, NULL, 1, LWA_ALPHA);
 
-		ShowWindow(display_hwnd, SW_HIDE);
-		ShowWindow(display_hwnd2, SW_HIDE);
-		ShowWindow(display_hwnd_mask, SW_HIDE);
+		ShowWindowAsync(context->display_hwnd, SW_HIDE);
+		ShowWindowAsync(context->display_hwnd2, SW_HIDE);
+		ShowWindowAsync(context->display_hwnd_mask, SW_HIDE);
 	}
 
 	void show_target_hwnd()
 	{
-		if (target_orig_alpha > 0 && !is_target_window_transparent)
-			SetLayeredWindowAttributes(target_hwnd, NULL, target_orig_alpha, LWA_ALPHA);
+		if (context->target_orig_alpha > 0 && !context->is_target_window_transparent)
+			SetLayeredWindowAttributes(context->target_hwnd, NULL, context->target_orig_alpha, LWA_ALPHA);
 
-		ShowWindow(display_hwnd, SW_SHOWNA);
-		ShowWindow(display_hwnd2, SW_SHOWNA);
-		ShowWindow(display_hwnd_mask, SW_SHOWNA);
+		ShowWindowAsync(context->display_hwnd, SW_SHOWNA);
+		ShowWindowAsync(context->display_hwnd2, SW_SHOWNA);
+		ShowWindowAsync(context->display_hwnd_mask, SW_SHOWNA);
 	}
 
 	void hide_layer()
 	{
-		ShowWindow(display_hwnd, SW_HIDE);
-		ShowWindow(display_hwnd2, SW_HIDE);
-		ShowWindow(display_hwnd_mask, SW_HIDE);
+		ShowWindow(context->display_hwnd, SW_HIDE);
+		ShowWindow(context->display_hwnd2, SW_HIDE);
+		ShowWindow(context->display_hwnd_mask, SW_HIDE);
 	}
 
 	void show_layer()
 	{
-		ShowWindow(display_hwnd, SW_SHOWNA);
-		ShowWindow(display_hwnd2, SW_SHOWNA);
-		ShowWindow(display_hwnd_mask, SW_SHOWNA);
+		ShowWindow(context->display_hwnd, SW_SHOWNA);
+		ShowWindow(context->display_hwnd2, SW_SHOWNA);
+		ShowWindow(context->display_hwnd_mask, SW_SHOWNA);
 	}
 
 	bool update_target_rect()
 	{
-		const auto res = DwmGetWindowAttribute(target_hwnd, DWMWA_EXTENDED_FRAME_BOUNDS, &target_rect, sizeof(RECT));
+		const auto res = DwmGetWindowAttribute(context->target_hwnd, DWMWA_EXTENDED_FRAME_BOUNDS, &context->target_rect,
+		                                       sizeof(RECT));
 		if (res != S_OK)
 		{
 			std::stringstream ss;
-			ss << "Failed to get window size for " << target_hwnd << " , HRESULT=" << res << std::endl;
+			ss << "Failed to get window size for " << context->target_hwnd << " , HRESULT=" << res << std::endl;
 			std::cout << ss.str();
 			return false;
 		}
@@ -219,42 +261,47 @@ namespace display_layer
 		return true;
 	}
 
+	RECT& get_target_rect()
+	{
+		return context->target_rect;
+	}
+
 	void move_layer_to_target()
 	{
 		
 		SetWindowPos
 		(
-			display_hwnd,
+			context->display_hwnd,
 			HWND_TOPMOST,
-			target_rect.left,
-			target_rect.top,
-			target_rect.right - target_rect.left,
-			target_rect.bottom - target_rect.top,
-			SWP_NOSENDCHANGING | SWP_NOACTIVATE | SWP_NOZORDER
+			context->target_rect.left,
+			context->target_rect.top,
+			context->target_rect.right - context->target_rect.left,
+			context->target_rect.bottom - context->target_rect.top,
+			SWP_NOSENDCHANGING | SWP_NOACTIVATE | SWP_NOZORDER | SWP_ASYNCWINDOWPOS
 		);
 
 
 		SetWindowPos
 		(
-			display_hwnd_mask,
-			display_hwnd,
-			target_rect.left,
-			target_rect.top,
-			target_rect.right - target_rect.left,
-			target_rect.bottom - target_rect.top,
-			SWP_NOSENDCHANGING | SWP_NOACTIVATE | SWP_NOZORDER
+			context->display_hwnd_mask,
+			context->display_hwnd,
+			context->target_rect.left,
+			context->target_rect.top,
+			context->target_rect.right - context->target_rect.left,
+			context->target_rect.bottom - context->target_rect.top,
+			SWP_NOSENDCHANGING | SWP_NOACTIVATE | SWP_NOZORDER | SWP_ASYNCWINDOWPOS
 		);
 
 
 		SetWindowPos
 		(
-			display_hwnd2,
-			display_hwnd_mask,
-			target_rect.left,
-			target_rect.top,
-			target_rect.right - target_rect.left,
-			target_rect.bottom - target_rect.top,
-			SWP_NOSENDCHANGING | SWP_NOACTIVATE | SWP_NOZORDER
+			context->display_hwnd2,
+			context->display_hwnd_mask,
+			context->target_rect.left,
+			context->target_rect.top,
+			context->target_rect.right - context->target_rect.left,
+			context->target_rect.bottom - context->target_rect.top,
+			SWP_NOSENDCHANGING | SWP_NOACTIVATE | SWP_NOZORDER | SWP_ASYNCWINDOWPOS
 		);
 	}
 
@@ -268,34 +315,36 @@ namespace display_layer
 			return false;
 		}
 
-		display_hwnd = CreateWindowEx(WS_EX_NOACTIVATE | 0x080000 | WS_EX_TRANSPARENT | WS_EX_LAYERED , class_name,
-		                              nullptr, 0x80000000 | WS_POPUP,
-		                              target_rect.top, target_rect.left, target_rect.right - target_rect.left,
-		                              target_rect.bottom - target_rect.top, target_hwnd, nullptr, instance, nullptr);
+		const auto& target_rect = context->target_rect;
+		context->display_hwnd = CreateWindowEx(WS_EX_NOACTIVATE | 0x080000 | WS_EX_TRANSPARENT | WS_EX_LAYERED ,
+		                                       class_name, nullptr, 0x80000000 | WS_POPUP,
+		                                       target_rect.top, target_rect.left, target_rect.right - target_rect.left,
+		                                       target_rect.bottom - target_rect.top, context->target_hwnd, nullptr,
+		                                       instance, nullptr);
 
-		if (!display_hwnd)
+		if (!context->display_hwnd)
 		{
 			std::cout << "Failed to create layer window\n";
 			return false;
 		}
 
 
-		ShowWindow(display_hwnd, SW_SHOWNOACTIVATE);
+		ShowWindow(context->display_hwnd, SW_SHOWNOACTIVATE);
 
 
-		display_hwnd_mask = CreateWindowEx(
+		context->display_hwnd_mask = CreateWindowEx(
 			WS_EX_NOACTIVATE | 0x080000 | WS_EX_TRANSPARENT | WS_EX_LAYERED /*| WS_EX_TOPMOST*/ , class_name, nullptr,
 			0x80000000 | WS_POPUP,
-			0, 0, target_rect.right - target_rect.left, target_rect.bottom - target_rect.top, display_hwnd, nullptr,
-			instance, nullptr);
-		ShowWindow(display_hwnd_mask, SW_SHOWNOACTIVATE);
+			0, 0, target_rect.right - target_rect.left, target_rect.bottom - target_rect.top, context->display_hwnd,
+			nullptr, instance, nullptr);
+		ShowWindow(context->display_hwnd_mask, SW_SHOWNOACTIVATE);
 
-		display_hwnd2 = CreateWindowEx(
+		context->display_hwnd2 = CreateWindowEx(
 			WS_EX_NOACTIVATE | 0x080000 | WS_EX_TRANSPARENT | WS_EX_LAYERED /*| WS_EX_TOPMOST*/ , class_name, nullptr,
 			0x80000000 | WS_POPUP,
-			0, 0, target_rect.right - target_rect.left, target_rect.bottom - target_rect.top, display_hwnd_mask,
-			nullptr, instance, nullptr);
-		ShowWindow(display_hwnd2, SW_SHOWNOACTIVATE);
+			0, 0, target_rect.right - target_rect.left, target_rect.bottom - target_rect.top,
+			context->display_hwnd_mask, nullptr, instance, nullptr);
+		ShowWindow(context->display_hwnd2, SW_SHOWNOACTIVATE);
 
 
 		move_layer_to_target();
@@ -312,40 +361,41 @@ namespace display_layer
 			options, reinterpret_cast<ABI::Windows::System::IDispatcherQueueController**>(winrt::put_abi(controller)));
 
 
-		display_compositor = winrt::Windows::UI::Composition::Compositor();
+		context->display_compositor = winrt::Windows::UI::Composition::Compositor();
 
-		auto interop = display_compositor.as<ABI::Windows::UI::Composition::Desktop::ICompositorDesktopInterop>();
+		auto interop = context->display_compositor.as<
+			ABI::Windows::UI::Composition::Desktop::ICompositorDesktopInterop>();
 
-		const auto res = interop->CreateDesktopWindowTarget(display_hwnd2, true,
+		const auto res = interop->CreateDesktopWindowTarget(context->display_hwnd2, true,
 		                                                    reinterpret_cast<
 			                                                    ABI::Windows::UI::Composition::Desktop::IDesktopWindowTarget
-			                                                    **>(winrt::put_abi(desktop_window_target)));
+			                                                    **>(winrt::put_abi(context->desktop_window_target)));
 		if (res != S_OK)
 			return false;
 
 
-		container_root = display_compositor.CreateContainerVisual();
-		desktop_window_target.Root(container_root);
+		context->container_root = context->display_compositor.CreateContainerVisual();
+		context->desktop_window_target.Root(context->container_root);
 
 
-		render_element = display_compositor.CreateSpriteVisual();
+		context->render_element = context->display_compositor.CreateSpriteVisual();
 
-		container_root.RelativeSizeAdjustment({1, 1});
+		context->container_root.RelativeSizeAdjustment({1, 1});
 
-		render_element.AnchorPoint({0.5f, 0.5f});
-		render_element.RelativeOffsetAdjustment({0.5f, 0.5f, 0});
-		render_element.RelativeSizeAdjustment({1, 1});
+		context->render_element.AnchorPoint({0.5f, 0.5f});
+		context->render_element.RelativeOffsetAdjustment({0.5f, 0.5f, 0});
+		context->render_element.RelativeSizeAdjustment({1, 1});
 
 
 		// Create brush for the render element
-		brush = display_compositor.CreateSurfaceBrush();
-		render_element.Brush(brush);
-		brush.HorizontalAlignmentRatio(0.5f);
-		brush.VerticalAlignmentRatio(0.5f);
-		brush.Stretch(winrt::Windows::UI::Composition::CompositionStretch::None);
+		context->brush = context->display_compositor.CreateSurfaceBrush();
+		context->render_element.Brush(context->brush);
+		context->brush.HorizontalAlignmentRatio(0.5f);
+		context->brush.VerticalAlignmentRatio(0.5f);
+		context->brush.Stretch(winrt::Windows::UI::Composition::CompositionStretch::None);
 
 		// Add the render element to the container root
-		container_root.Children().InsertAtTop(render_element);
+		context->container_root.Children().InsertAtTop(context->render_element);
 
 
 		return true;
@@ -355,8 +405,8 @@ namespace display_layer
 	void set_layer_to_foreground()
 	{
 		// Move the display layer in z-order to be above the target window
-		SetForegroundWindow(target_hwnd);
-		SetForegroundWindow(display_hwnd);
+		SetForegroundWindow(context->target_hwnd);
+		SetForegroundWindow(context->display_hwnd);
 	}
 
 
@@ -372,19 +422,24 @@ namespace display_layer
 			graphic_device::delete_swap_chain();
 		}
 
-		buffer.x_size = target_rect.right - target_rect.left;
-		buffer.y_size = target_rect.bottom - target_rect.top;
+		context->buffer.x_size = context->target_rect.right - context->target_rect.left;
+		context->buffer.y_size = context->target_rect.bottom - context->target_rect.top;
 
 		// Option 2 to create the swap chain - did not work perfect .....
-		if (!graphic_device::create_swap_chain(buffer.x_size, buffer.y_size))
+		if (!graphic_device::create_swap_chain(context->buffer.x_size, context->buffer.y_size))
 		{
 			std::cout << "Failed to create swap chain for display layer\n";
 		}
+		context->com_ptr_swap_chain = graphic_device::com_ptr_swap_chain;
+
+		// The new swap chain may get the address of the deleted one
+		context->presented_swap_chain = nullptr;
 
 
 		// Next, use this swap chain
-		const auto surface = create_composition_surface_for_swap_chain(display_compositor, graphic_device::swap_chain);
-		brush.Surface(surface);
+		const auto surface = create_composition_surface_for_swap_chain(context->display_compositor,
+		                                                               graphic_device::swap_chain);
+		context->brush.Surface(surface);
 
 
 		return true;
@@ -392,21 +447,22 @@ namespace display_layer
 
 	bool set_target_window_transparent()
 	{
-		if (!is_target_window_transparent)
+		if (!context->is_target_window_transparent)
 		{
 			DWORD flags = LWA_ALPHA;
-			GetLayeredWindowAttributes(target_hwnd, nullptr, &target_orig_alpha, &flags);
+			GetLayeredWindowAttributes(context->target_hwnd, nullptr, &context->target_orig_alpha, &flags);
 		}
-		SetWindowLong(target_hwnd, GWL_EXSTYLE, GetWindowLong(target_hwnd, GWL_EXSTYLE) | WS_EX_LAYERED);
+		SetWindowLong(context->target_hwnd, GWL_EXSTYLE,
+		              GetWindowLong(context->target_hwnd, GWL_EXSTYLE) | WS_EX_LAYERED);
 
-		is_target_window_transparent = true;
-		return SetLayeredWindowAttributes(target_hwnd, NULL, 1, LWA_ALPHA) != 0;
+		context->is_target_window_transparent = true;
+		return SetLayeredWindowAttributes(context->target_hwnd, NULL, 1, LWA_ALPHA) != 0;
 	}
 
 	void un_set_target_window_transparent()
 	{
-		SetLayeredWindowAttributes(target_hwnd, NULL, target_orig_alpha, LWA_ALPHA);
-		is_target_window_transparent = false;
+		SetLayeredWindowAttributes(context->target_hwnd, NULL, context->target_orig_alpha, LWA_ALPHA);
+		context->is_target_window_transparent = false;
 	}
 
 	void set_blur_type(const BlurType blur_type)
@@ -414,33 +470,116 @@ namespace display_layer
 		using namespace display_layer_helpers;
 
 		//if (this->blurType == blurType) return;
-		display_layer::blur_type = blur_type;
+		context->blur_type = blur_type;
 
-		dwm10_set_window_blur(display_hwnd, dwm10_blur_accent::accent_disable);
+		dwm10_set_window_blur(context->display_hwnd, dwm10_blur_accent::accent_disable);
 
 		switch (blur_type)
 		{
 		case BlurType::LOW:
-			dwm10_set_window_blur(display_hwnd, dwm10_blur_accent::accent_enable_blurbehind);
+			dwm10_set_window_blur(context->display_hwnd, dwm10_blur_accent::accent_enable_blurbehind);
 			break;
 		case BlurType::HIGH:
-			dwm10_set_window_blur(display_hwnd, dwm10_blur_accent::accent_enable_fluent, 0, RGB(1, 1, 1));
+			dwm10_set_window_blur(context->display_hwnd, dwm10_blur_accent::accent_enable_fluent, 0, RGB(1, 1, 1));
 			break;
 		}
 	}
 
 	void set_brightness_level(const int level)
 	{
-		transparent_level = level;
+		context->transparent_level = level;
 
-		SetLayeredWindowAttributes(display_hwnd_mask, 0, 255 - level, LWA_ALPHA);
+		SetLayeredWindowAttributes(context->display_hwnd_mask, 0, 255 - level, LWA_ALPHA);
 	}
 
 
 	void draw_texture(ID3D11Texture2D* texture)
 	{
-		graphic_device::draw_texture_on_back_buffer(texture);
+		draw_texture(texture, {});
+	}
+
+	void draw_texture(ID3D11Texture2D* texture, const std::vector<RECT>& dirty_rects)
+	{
+		if (context->frame_sink)
+		{
+			context->frame_sink->present(texture, dirty_rects);
+			return;
+		}
+
+		// A new or resized swap chain has buffers without content, so all of them get the whole frame
+		DXGI_SWAP_CHAIN_DESC1 desc;
+		graphic_device::swap_chain->GetDesc1(&desc);
+		if (graphic_device::swap_chain != context->presented_swap_chain || desc.Width != context->presented_x_size ||
+			desc.Height != context->presented_y_size)
+		{
+			context->presented_swap_chain = graphic_device::swap_chain;
+			context->presented_x_size = desc.Width;
+			context->presented_y_size = desc.Height;
+			context->full_presents_left = graphic_device::swap_chain_buffers_count;
+		}
+
+		const auto full = dirty_rects.empty() || context->full_presents_left > 0;
+		if (context->full_presents_left > 0)
+			context->full_presents_left--;
+
+		auto is_previous_full = false;
+		for (const auto& present : context->previous_presents)
+			if (present.full)
+				is_previous_full = true;
+
+		if (full || is_previous_full)
+		{
+			graphic_device::draw_texture_on_back_buffer(texture);
+		}
+		else
+		{
+			auto copy_rects = dirty_rects;
+			for (const auto& present : context->previous_presents)
+				copy_rects.insert(copy_rects.end(), present.rects.begin(), present.rects.end());
+			graphic_device::draw_texture_on_back_buffer(texture, copy_rects);
+		}
+
 		DXGI_PRESENT_PARAMETERS presentParameters = {0};
+		if (!full)
+		{
+			presentParameters.DirtyRectsCount = static_cast<UINT>(dirty_rects.size());
+			presentParameters.pDirtyRects = const_cast<RECT*>(dirty_rects.data());
+		}
 		graphic_device::swap_chain->Present1(1, 0, &presentParameters);
+
+		for (auto i = previous_presents_count - 1; i > 0; i--)
+			context->previous_presents[i] = std::move(context->previous_presents[i - 1]);
+		context->previous_presents[0].full = full;
+		if (full)
+			context->previous_presents[0].rects.clear();
+		else
+			context->previous_presents[0].rects = dirty_rects;
+	}
+
+	void set_frame_sink(FrameSink* frame_sink)
+	{
+		context->frame_sink = frame_sink;
+	}
+
+	Context* create_context()
+	{
+		return new Context();
+	}
+
+	void destroy_context(Context* destroyed)
+	{
+		select_context(destroyed);
+		if (graphic_device::swap_chain)
+			graphic_device::delete_swap_chain();
+
+		select_context(nullptr);
+		delete destroyed;
+	}
+
+	void select_context(Context* selected)
+	{
+		context = selected ? selected : &default_context;
+		graphic_device::com_ptr_swap_chain = context->com_ptr_swap_chain;
+		graphic_device::swap_chain = context->com_ptr_swap_chain.get();
 	}
 }
@@ -1,4 +1,5 @@
 #include <Windows.h>
+#include "frame_sink.h"
 
 namespace display_layer
 {
@@ -10,9 +11,6 @@ namespace display_layer
 		unsigned buffer_size = 0;
 	};
 
-	inline Buffer buffer = {0};
-	inline RECT target_rect = {0};
-
 	bool init();
 	void dispose();
 	void set_target(HWND target_hwnd);
@@ -30,7 +28,13 @@ namespace display_layer
 	void set_brightness_level(int level);
 	bool create_screen_buffer();
 	void draw_texture(ID3D11Texture2D* texture);
+	// Draw only the dirty rects of the texture. Empty dirty rects draw the whole texture
+	void draw_texture(ID3D11Texture2D* texture, const std::vector<RECT>& dirty_rects);
+	// Send the frames of the selected context to the sink instead of the swap chain. nullptr restores the swap chain
+	void set_frame_sink(FrameSink* frame_sink);
 	bool update_target_rect();
+	// The rect of the target window that move_layer_to_target moves the layer to
+	RECT& get_target_rect();
 	void move_layer_to_target();
 	void hide_target_hwnd();
 	void show_target_hwnd();
@@ -39,4 +43,11 @@ namespace display_layer
 	void set_layer_to_foreground();
 	bool set_target_window_transparent();
 	void un_set_target_window_transparent();
+
+	// The display layer of one target window. All the functions above work on the selected context, that is also
+	// the swap chain of graphic_device
+	struct Context;
+	Context* create_context();
+	void destroy_context(Context* context);
+	void select_context(Context* context);
 }
@@ -0,0 +1,41 @@
+#pragma once
+#include <Windows.h>
+#include <d3d11.h>
+
+#include <vector>
+
+namespace display_layer
+{
+	// Where the display layer sends the processed frames of a target window instead of its swap chain.
+	// The dirty rects are the parts of the frame that were changed since the previous frame, they are
+	// empty when the whole frame should be presented
+	class FrameSink
+	{
+	public:
+		virtual ~FrameSink() = default;
+		virtual void present(ID3D11Texture2D* texture, const std::vector<RECT>& dirty_rects) = 0;
+	};
+
+	// Headless sink that only records which rects were presented in each frame
+	class RecordingFrameSink : public FrameSink
+	{
+	public:
+		struct Frame
+		{
+			bool full = true;
+			std::vector<RECT> dirty_rects;
+		};
+
+		std::vector<Frame> frames;
+
+		void present(ID3D11Texture2D* texture, const std::vector<RECT>& dirty_rects) override
+		{
+			frames.push_back({dirty_rects.empty(), dirty_rects});
+		}
+
+		void clear()
+		{
+			frames.clear();
+		}
+	};
+}
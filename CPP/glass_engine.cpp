@@ -0,0 +1,233 @@
+#include "glass_engine.h"
+
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <new>
+#include <vector>
+#include "pixel_kernels.h"
+#include "process_layer_cpu.h"
+
+struct GlassEngine
+{
+	process_layer_cpu::Context* context = nullptr;
+	GlassEngineSettings settings = {};
+	int width = 0, height = 0;
+	std::vector<GlassEngineRect> changed_rects;
+};
+
+namespace glass_engine
+{
+	// process_layer_cpu works on the selected context and its scratch buffers are shared by all the contexts
+	std::mutex engines_mutex;
+	int engines_count = 0;
+
+	constexpr size_t tile_cache_max_bytes = 16 * 1024 * 1024;
+
+	void apply_settings(GlassEngine& engine)
+	{
+		const auto& settings = engine.settings;
+
+		// The buffers are allocated again for the enabled stages on the next frame
+		process_layer_cpu::free_resources();
+		process_layer_cpu::set_default_settings();
+		process_layer_cpu::set_analysis_scale(settings.analysis_scale);
+		process_layer_cpu::enable_cache_buffer(false);
+
+		if (settings.filter_images)
+			process_layer_cpu::map_images::enable();
+		else
+			process_layer_cpu::map_images::disable();
+
+		process_layer_cpu::scroll_detection::enable();
+
+		if (settings.glass_mode)
+			process_layer_cpu::glass_effect::enable(settings.glass_background, settings.glass_dark_background != 0,
+			                                        settings.glass_images, settings.glass_shapes);
+		else
+			process_layer_cpu::glass_effect::disable();
+
+		// The previous output was processed with other settings
+		process_layer_cpu::scroll_detection::invalidate();
+		engine.width = engine.height = 0;
+	}
+
+	void set_whole_frame_changed(GlassEngine& engine)
+	{
+		engine.changed_rects.assign(1, {0, 0, engine.width, engine.height});
+	}
+
+	// The same stages as process_frame_in_cpu of the renderer, on a frame that is already in memory
+	void process(GlassEngine& engine, const bool force)
+	{
+		const auto& settings = engine.settings;
+
+		if (process_layer_cpu::scroll_detection::detect(force, {}))
+		{
+			const auto& dirty_rects = process_layer_cpu::scroll_detection::get_dirty_rects();
+			const auto& process_rects = process_layer_cpu::scroll_detection::get_process_rects();
+
+			if (settings.filter_images)
+				for (const auto& rect : process_layer_cpu::scroll_detection::get_search_rects())
+					process_layer_cpu::map_images::map_images(false, rect);
+
+			if (settings.dark_mode)
+				for (const auto& rect : process_rects)
+					process_layer_cpu::invert_colors(rect);
+
+			if (settings.glass_mode)
+				process_layer_cpu::glass_effect::map_shapes(dirty_rects, process_rects, settings.dark_mode != 0);
+
+			process_layer_cpu::scroll_detection::apply();
+
+			engine.changed_rects.clear();
+			for (const auto& rect : process_layer_cpu::scroll_detection::get_changed_rects())
+				engine.changed_rects.push_back({rect.left, rect.top, rect.right, rect.bottom});
+			return;
+		}
+
+		if (settings.filter_images)
+			process_layer_cpu::map_images::map_images(force);
+
+		process_layer_cpu::process_in_strips(settings.dark_mode != 0, settings.glass_mode != 0);
+		set_whole_frame_changed(engine);
+	}
+}
+
+extern "C" {
+
+uint32_t glass_engine_get_version(void)
+{
+	return GLASS_ENGINE_VERSION;
+}
+
+GlassEngine* glass_engine_create(void)
+{
+	auto* const engine = new(std::nothrow) GlassEngine();
+	if (!engine)
+		return nullptr;
+
+	std::lock_guard<std::mutex> lock(glass_engine::engines_mutex);
+
+	if (glass_engine::engines_count == 0)
+	{
+		pixel_kernels::select_isa(pixel_kernels::get_best_isa());
+		process_layer_cpu::glass_effect::tile_cache::enable(glass_engine::tile_cache_max_bytes);
+	}
+
+	engine->context = process_layer_cpu::create_context();
+	glass_engine_get_default_settings(&engine->settings);
+
+	process_layer_cpu::select_context(engine->context);
+	glass_engine::apply_settings(*engine);
+
+	glass_engine::engines_count++;
+	return engine;
+}
+
+void glass_engine_destroy(GlassEngine* engine)
+{
+	if (!engine)
+		return;
+
+	std::lock_guard<std::mutex> lock(glass_engine::engines_mutex);
+
+	process_layer_cpu::destroy_context(engine->context);
+	delete engine;
+
+	if (--glass_engine::engines_count == 0)
+		process_layer_cpu::free_shared_resources();
+}
+
+void glass_engine_get_default_settings(GlassEngineSettings* settings)
+{
+	if (!settings)
+		return;
+
+	*settings = {};
+	settings->size = sizeof(GlassEngineSettings);
+	settings->dark_mode = 1;
+	settings->glass_background = 1;
+	settings->glass_images = 1;
+	settings->glass_shapes = 1;
+	settings->analysis_scale = 1;
+}
+
+int32_t glass_engine_set_settings(GlassEngine* engine, const GlassEngineSettings* settings)
+{
+	if (!engine || !settings || settings->size < sizeof(uint32_t))
+		return GLASS_ENGINE_ERROR_ARGUMENT;
+
+	// A caller that was built with an older header passes a smaller struct, the new fields keep their defaults
+	GlassEngineSettings new_settings;
+	glass_engine_get_default_settings(&new_settings);
+	memcpy(&new_settings, settings,
+	       settings->size < sizeof(GlassEngineSettings) ? settings->size : sizeof(GlassEngineSettings));
+	new_settings.size = sizeof(GlassEngineSettings);
+
+	std::lock_guard<std::mutex> lock(glass_engine::engines_mutex);
+
+	engine->settings = new_settings;
+	process_layer_cpu::select_context(engine->context);
+	glass_engine::apply_settings(*engine);
+	return GLASS_ENGINE_OK;
+}
+
+int32_t glass_engine_process(GlassEngine* engine, uint8_t* pixels, const int32_t width, const int32_t height,
+                             const int32_t stride, const int32_t force)
+{
+	if (!engine || !pixels || width <= 0 || height <= 0 || stride % 4 || stride / 4 < width)
+		return GLASS_ENGINE_ERROR_ARGUMENT;
+
+	std::lock_guard<std::mutex> lock(glass_engine::engines_mutex);
+
+	process_layer_cpu::select_context(engine->context);
+
+	// load_frame allocates the buffers again only when the stride or the height changed
+	if (width != engine->width || height != engine->height)
+	{
+		process_layer_cpu::free_resources();
+		engine->width = width;
+		engine->height = height;
+	}
+
+	if (!process_layer_cpu::load_frame(pixels, stride / 4, height, width, height))
+	{
+		std::cout << "process_layer_cpu::load_frame(*) failed\n";
+		engine->width = engine->height = 0;
+		engine->changed_rects.clear();
+		return GLASS_ENGINE_ERROR_PROCESS;
+	}
+
+	glass_engine::process(*engine, force != 0);
+	return GLASS_ENGINE_OK;
+}
+
+int32_t glass_engine_get_changed_rects(const GlassEngine* engine, GlassEngineRect* rects, const int32_t capacity)
+{
+	if (!engine || capacity < 0 || (capacity && !rects))
+		return GLASS_ENGINE_ERROR_ARGUMENT;
+
+	const auto count = static_cast<int32_t>(engine->changed_rects.size());
+	for (auto i = 0; i < count && i < capacity; i++)
+		rects[i] = engine->changed_rects[i];
+
+	return count;
+}
+
+int32_t glass_engine_get_memory_stats(GlassEngineMemoryStats* stats)
+{
+	if (!stats || stats->size < sizeof(uint32_t))
+		return GLASS_ENGINE_ERROR_ARGUMENT;
+
+	const auto allocation_stats = process_layer_cpu::get_allocation_stats();
+
+	GlassEngineMemoryStats new_stats;
+	new_stats.size = stats->size < sizeof(GlassEngineMemoryStats) ? stats->size : sizeof(GlassEngineMemoryStats);
+	new_stats.allocations = allocation_stats.count;
+	new_stats.allocated_bytes = allocation_stats.bytes;
+	memcpy(stats, &new_stats, new_stats.size);
+	return GLASS_ENGINE_OK;
+}
+
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include <stdint.h>
+
+// The C interface of GlassEngine.dll: the CPU effect engine (process_layer_cpu) without the capture and the
+// display layers, so other processes (a JNI binding of the IDE plugin, tools and load tests) can process their
+// own frames. Only C types cross the interface and the structs are passed with their size, so new fields can be
+// added at the end without breaking the callers that were built with an older header
+
+#ifdef _WIN32
+#ifdef GLASS_ENGINE_EXPORTS
+#define GLASS_ENGINE_API __declspec(dllexport)
+#else
+#define GLASS_ENGINE_API __declspec(dllimport)
+#endif
+#else
+#define GLASS_ENGINE_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GLASS_ENGINE_VERSION 1
+
+#define GLASS_ENGINE_OK 0
+#define GLASS_ENGINE_ERROR_ARGUMENT (-1)
+#define GLASS_ENGINE_ERROR_PROCESS (-2)
+
+typedef struct GlassEngine GlassEngine;
+
+typedef struct GlassEngineSettings
+{
+	uint32_t size; // sizeof(GlassEngineSettings), set by glass_engine_get_default_settings
+	int32_t dark_mode;
+	int32_t glass_mode;
+	int32_t filter_images;
+	double glass_background; // 0 to 1
+	int32_t glass_dark_background;
+	double glass_images; // 0 to 1
+	double glass_shapes; // 0 to 1
+	int32_t analysis_scale; // 1, 2 or 4
+} GlassEngineSettings;
+
+typedef struct GlassEngineRect
+{
+	int32_t left;
+	int32_t top;
+	int32_t right;
+	int32_t bottom;
+} GlassEngineRect;
+
+typedef struct GlassEngineMemoryStats
+{
+	uint32_t size; // sizeof(GlassEngineMemoryStats)
+	uint64_t allocations; // The buffers that the engines of the process allocated since it started
+	uint64_t allocated_bytes;
+} GlassEngineMemoryStats;
+
+// The version of the interface that the library implements (GLASS_ENGINE_VERSION of its header)
+GLASS_ENGINE_API uint32_t glass_engine_get_version(void);
+
+// Returns NULL when out of memory. The engines of the process share scratch buffers, so the calls on all the
+// engines are serialized
+GLASS_ENGINE_API GlassEngine* glass_engine_create(void);
+GLASS_ENGINE_API void glass_engine_destroy(GlassEngine* engine);
+
+GLASS_ENGINE_API void glass_engine_get_default_settings(GlassEngineSettings* settings);
+GLASS_ENGINE_API int32_t glass_engine_set_settings(GlassEngine* engine, const GlassEngineSettings* settings);
+
+// Process a frame of BGRA pixels in place. The stride is the distance between the rows in bytes, a multiple of 4
+// that is at least width * 4. Only the parts of the frame that changed since the last frame are processed, unless
+// force is set
+GLASS_ENGINE_API int32_t glass_engine_process(GlassEngine* engine, uint8_t* pixels, int32_t width, int32_t height,
+                                              int32_t stride, int32_t force);
+
+// The rects of the last processed frame that are different from its previous output. Returns how many rects there
+// are, and copies up to capacity of them. 0 means that the output was not changed
+GLASS_ENGINE_API int32_t glass_engine_get_changed_rects(const GlassEngine* engine, GlassEngineRect* rects,
+                                                        int32_t capacity);
+
+// Fills up to stats->size bytes of the stats, the caller sets the size
+GLASS_ENGINE_API int32_t glass_engine_get_memory_stats(GlassEngineMemoryStats* stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,366 @@
+#ifdef _WIN32
+#include <Windows.h>
+#include <psapi.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "glass_engine.h"
+#include "workload.h"
+
+// Benchmarks of GlassEngine (GlassEngine.dll, or libglassengine.so of CMakeLists.txt) on the synthetic frames of
+// workload.h:
+// - A workload preset (dark, light, dense, images, ...) reports the processing time of the frames and how much of
+//   the frames was changed.
+// - Resize storm: the size of the frames is changed every few frames, like a window that is resized by dragging
+//   its border. Each new size reallocates the buffers of the engine, so it reports the time until the first
+//   processed frame of each size, the allocations of each resize, and the peak memory and the fragmentation of
+//   the heap after thousands of resizes. The heap is walked only on Windows.
+// Usage: GlassEngineBench.exe resize [resizes] [frames per resize] [seed]
+//        GlassEngineBench.exe <preset> [frames] [seed]
+
+#define ARGS_SCENARIO_IDX 1
+#define ARGS_RESIZES_IDX 2
+#define ARGS_FRAMES_PER_RESIZE_IDX 3
+#define ARGS_RESIZE_SEED_IDX 4
+#define ARGS_FRAMES_IDX 2
+#define ARGS_SEED_IDX 3
+
+namespace bench
+{
+	// Every so many resizes the memory is sampled and a progress line is printed
+	constexpr int sample_interval = 250;
+
+#ifdef _WIN32
+	struct HeapStats
+	{
+		size_t busy_bytes = 0;
+		size_t free_bytes = 0;
+		size_t largest_free_block = 0;
+	};
+
+	// The CRT allocates from the process heap, so the buffers of the engine are there too
+	HeapStats get_heap_stats()
+	{
+		HeapStats stats;
+		const auto heap = GetProcessHeap();
+		if (!HeapLock(heap))
+			return stats;
+
+		PROCESS_HEAP_ENTRY entry = {};
+		while (HeapWalk(heap, &entry))
+		{
+			if (entry.wFlags & PROCESS_HEAP_ENTRY_BUSY)
+			{
+				stats.busy_bytes += entry.cbData;
+			}
+			else if (!(entry.wFlags & (PROCESS_HEAP_REGION | PROCESS_HEAP_UNCOMMITTED_RANGE)))
+			{
+				stats.free_bytes += entry.cbData;
+				if (entry.cbData > stats.largest_free_block)
+					stats.largest_free_block = entry.cbData;
+			}
+		}
+
+		HeapUnlock(heap);
+		return stats;
+	}
+
+	// 0 when all the free memory of the heap is one block, near 1 when it is split to many small blocks
+	double get_fragmentation(const HeapStats& stats)
+	{
+		return stats.free_bytes ? 1 - static_cast<double>(stats.largest_free_block) / stats.free_bytes : 0;
+	}
+
+#endif
+
+	struct MemoryCounters
+	{
+		size_t private_bytes = 0;
+		size_t peak_working_set = 0;
+	};
+
+	MemoryCounters get_memory_counters()
+	{
+		MemoryCounters counters;
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS_EX process_counters = {};
+		if (GetProcessMemoryInfo(GetCurrentProcess(), reinterpret_cast<PROCESS_MEMORY_COUNTERS*>(&process_counters),
+		                         sizeof(process_counters)))
+		{
+			counters.private_bytes = process_counters.PrivateUsage;
+			counters.peak_working_set = process_counters.PeakWorkingSetSize;
+		}
+#else
+		// The resident anonymous memory is the closest to the private memory of Windows. The sizes are in kB
+		std::ifstream status("/proc/self/status");
+		std::string line;
+		while (std::getline(status, line))
+		{
+			if (line.compare(0, 8, "RssAnon:") == 0)
+				counters.private_bytes = strtoull(line.c_str() + 8, nullptr, 10) * 1024;
+			else if (line.compare(0, 6, "VmHWM:") == 0)
+				counters.peak_working_set = strtoull(line.c_str() + 6, nullptr, 10) * 1024;
+		}
+#endif
+		return counters;
+	}
+
+	GlassEngineMemoryStats get_engine_stats()
+	{
+		GlassEngineMemoryStats stats = {};
+		stats.size = sizeof(stats);
+		glass_engine_get_memory_stats(&stats);
+		return stats;
+	}
+
+	double percentile(std::vector<double> values, const double p)
+	{
+		if (values.empty())
+			return 0;
+
+		std::sort(values.begin(), values.end());
+		auto index = static_cast<size_t>(p * (values.size() - 1) + 0.5);
+		if (index >= values.size()) index = values.size() - 1;
+		return values[index];
+	}
+
+	void print_times(const char* name, const std::vector<double>& times)
+	{
+		printf("%-24s p50 %8.3f ms  p95 %8.3f ms  p99 %8.3f ms  max %8.3f ms\n", name, percentile(times, 0.5),
+		       percentile(times, 0.95), percentile(times, 0.99), percentile(times, 1));
+	}
+
+	double to_mb(const size_t bytes)
+	{
+		return bytes / (1024.0 * 1024.0);
+	}
+
+	GlassEngine* create_engine()
+	{
+		auto* const engine = glass_engine_create();
+		if (!engine)
+		{
+			std::cout << "glass_engine_create() failed\n";
+			return nullptr;
+		}
+
+		GlassEngineSettings settings;
+		glass_engine_get_default_settings(&settings);
+		settings.glass_mode = 1;
+		settings.glass_background = 0.5;
+		settings.filter_images = 1;
+		glass_engine_set_settings(engine, &settings);
+		return engine;
+	}
+
+	// Returns the time of the processing in milliseconds, or a negative time if it failed
+	double process_frame(GlassEngine* engine, const workload::Frame& frame)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		if (glass_engine_process(engine, frame.pixels, frame.width, frame.height, frame.stride, 0) != GLASS_ENGINE_OK)
+		{
+			std::cout << "glass_engine_process(*) failed at " << frame.width << "x" << frame.height << "\n";
+			return -1;
+		}
+
+		const std::chrono::duration<double, std::milli> time = std::chrono::steady_clock::now() - start;
+		return time.count();
+	}
+
+	// The part of the frame that the engine reported as changed
+	double get_changed_ratio(const GlassEngine* engine, const workload::Frame& frame)
+	{
+		static std::vector<GlassEngineRect> rects(64);
+		const auto count = glass_engine_get_changed_rects(engine, rects.data(), static_cast<int32_t>(rects.size()));
+		if (count > static_cast<int32_t>(rects.size()))
+		{
+			rects.resize(count);
+			glass_engine_get_changed_rects(engine, rects.data(), count);
+		}
+
+		double area = 0;
+		for (auto i = 0; i < count; i++)
+			area += static_cast<double>(rects[i].right - rects[i].left) * (rects[i].bottom - rects[i].top);
+		return area / (static_cast<double>(frame.width) * frame.height);
+	}
+
+	int run_workload(const workload::Preset preset, const int frames_count, const unsigned int seed)
+	{
+		auto* const engine = create_engine();
+		if (!engine)
+			return 1;
+
+		auto settings = workload::get_preset(preset);
+		settings.seed = seed;
+		workload::Generator generator;
+		workload::init(generator, settings);
+
+		std::vector<double> times, changed_ratios;
+		times.reserve(frames_count);
+		changed_ratios.reserve(frames_count);
+
+		for (auto i = 0; i < frames_count; i++)
+		{
+			const auto& frame = workload::next_frame(generator);
+			const auto time = process_frame(engine, frame);
+			if (time < 0)
+			{
+				glass_engine_destroy(engine);
+				return 1;
+			}
+
+			times.push_back(time);
+			changed_ratios.push_back(get_changed_ratio(engine, frame) * 100);
+		}
+
+		printf("%s workload, %d frames, seed %u\n", workload::get_preset_name(preset), frames_count, seed);
+		print_times("Frame", times);
+		printf("%-24s p50 %8.1f %%   p95 %8.1f %%   max %8.1f %%\n", "Changed area", percentile(changed_ratios, 0.5),
+		       percentile(changed_ratios, 0.95), percentile(changed_ratios, 1));
+
+		glass_engine_destroy(engine);
+		return 0;
+	}
+
+	int run_resize_storm(const int resizes, const int frames_per_resize, const unsigned int seed)
+	{
+		auto* const engine = create_engine();
+		if (!engine)
+			return 1;
+
+		// The frames of the generator are in one buffer for the biggest frame, so the benchmark itself does not
+		// allocate while resizing
+		auto settings = workload::get_preset(workload::Preset::mixed);
+		settings.seed = seed;
+		settings.resize_probability = 0;
+		workload::Generator generator;
+		workload::init(generator, settings);
+
+		std::vector<double> first_frame_times, next_frame_times, allocations, allocated_mb;
+		first_frame_times.reserve(resizes);
+		next_frame_times.reserve(static_cast<size_t>(resizes) * (frames_per_resize - 1));
+		allocations.reserve(resizes);
+		allocated_mb.reserve(resizes);
+
+#ifdef _WIN32
+		auto max_fragmentation = 0.0;
+#endif
+		const auto start_counters = get_memory_counters();
+		const auto start_time = std::chrono::steady_clock::now();
+
+		for (auto resize = 0; resize < resizes; resize++)
+		{
+			workload::random_resize(generator);
+			const auto before = get_engine_stats();
+
+			for (auto i = 0; i < frames_per_resize; i++)
+			{
+				const auto time = process_frame(engine, workload::next_frame(generator));
+				if (time < 0)
+				{
+					glass_engine_destroy(engine);
+					return 1;
+				}
+
+				if (i == 0)
+					first_frame_times.push_back(time);
+				else
+					next_frame_times.push_back(time);
+			}
+
+			// The later frames of the same size should not allocate, so all the allocations are of the resize
+			const auto after = get_engine_stats();
+			allocations.push_back(static_cast<double>(after.allocations - before.allocations));
+			allocated_mb.push_back(to_mb(static_cast<size_t>(after.allocated_bytes - before.allocated_bytes)));
+
+			if ((resize + 1) % sample_interval == 0 || resize + 1 == resizes)
+			{
+				const auto counters = get_memory_counters();
+				printf("%6d resizes  private %8.1f MB", resize + 1, to_mb(counters.private_bytes));
+#ifdef _WIN32
+				const auto heap_stats = get_heap_stats();
+				const auto fragmentation = get_fragmentation(heap_stats);
+				if (fragmentation > max_fragmentation)
+					max_fragmentation = fragmentation;
+
+				printf("  heap busy %8.1f MB  free %8.1f MB  fragmentation %.3f", to_mb(heap_stats.busy_bytes),
+				       to_mb(heap_stats.free_bytes), fragmentation);
+#endif
+				printf("\n");
+			}
+		}
+
+		const std::chrono::duration<double> total_time = std::chrono::steady_clock::now() - start_time;
+		const auto end_counters = get_memory_counters();
+
+		printf("\n%d resizes, %d frames per resize, seed %u, %.1f s\n", resizes, frames_per_resize, seed,
+		       total_time.count());
+		print_times("First frame after resize", first_frame_times);
+		print_times("Next frames", next_frame_times);
+		printf("%-24s p50 %8.0f     p95 %8.0f     max %8.0f\n", "Allocations per resize",
+		       percentile(allocations, 0.5), percentile(allocations, 0.95), percentile(allocations, 1));
+		printf("%-24s p50 %8.1f MB  p95 %8.1f MB  max %8.1f MB\n", "Allocated per resize",
+		       percentile(allocated_mb, 0.5), percentile(allocated_mb, 0.95), percentile(allocated_mb, 1));
+		printf("Peak working set %.1f MB, private memory %.1f MB at start and %.1f MB at end\n",
+		       to_mb(end_counters.peak_working_set), to_mb(start_counters.private_bytes),
+		       to_mb(end_counters.private_bytes));
+#ifdef _WIN32
+		printf("Max heap fragmentation %.3f\n", max_fragmentation);
+#endif
+
+		glass_engine_destroy(engine);
+		return 0;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	const auto* const scenario = argc - 1 >= ARGS_SCENARIO_IDX ? argv[ARGS_SCENARIO_IDX] : "resize";
+
+	if (strcmp(scenario, "resize") == 0)
+	{
+		auto resizes = 2000;
+		auto frames_per_resize = 4;
+		unsigned int seed = 1;
+
+		if (argc - 1 >= ARGS_RESIZES_IDX)
+			resizes = atoi(argv[ARGS_RESIZES_IDX]);
+		if (argc - 1 >= ARGS_FRAMES_PER_RESIZE_IDX)
+			frames_per_resize = atoi(argv[ARGS_FRAMES_PER_RESIZE_IDX]);
+		if (argc - 1 >= ARGS_RESIZE_SEED_IDX)
+			seed = static_cast<unsigned int>(atoi(argv[ARGS_RESIZE_SEED_IDX]));
+
+		if (resizes >= 1 && frames_per_resize >= 1)
+			return bench::run_resize_storm(resizes, frames_per_resize, seed);
+	}
+	else
+	{
+		auto frames_count = 1000;
+		unsigned int seed = 1;
+
+		if (argc - 1 >= ARGS_FRAMES_IDX)
+			frames_count = atoi(argv[ARGS_FRAMES_IDX]);
+		if (argc - 1 >= ARGS_SEED_IDX)
+			seed = static_cast<unsigned int>(atoi(argv[ARGS_SEED_IDX]));
+
+		workload::Preset preset;
+		if (workload::parse_preset(scenario, preset) && frames_count >= 1)
+			return bench::run_workload(preset, frames_count, seed);
+	}
+
+	std::cout << "Usage: GlassEngineBench.exe resize [resizes] [frames per resize] [seed]\n"
+		<< "       GlassEngineBench.exe <preset> [frames] [seed]\n"
+		<< "The presets are:";
+	for (auto i = 0; i < static_cast<int>(workload::Preset::count); i++)
+		std::cout << " " << workload::get_preset_name(static_cast<workload::Preset>(i));
+	std::cout << "\n";
+	return 1;
+}
@@ -3,11 +3,14 @@
 #include <unknwn.h>
 #include <inspectable.h>
 #include <iostream>
+#include <thread>
 #include <winrt/windows.graphics.directx.direct3d11.h>
 #include <wincodec.h>
 #include <plog/Log.h>
 
+#include <cuda_d3d11_interop.h>
 #include "direct3d11.interop.h"
+#include "metrics.h"
 #pragma comment(lib, "D3D11.lib")
 #pragma comment(lib, "DXGI.lib")
 #pragma comment(lib,"windowsapp.lib")
@@ -125,11 +128,27 @@ namespace graphic_device
 		}
 	}
 
-	bool init_device(const bool cuda_acceleration)
+	std::thread cuda_probe_thread;
+
+	// Check if the CUDA runtime runs on the graphic adapter. It is slow since it initializes the CUDA runtime,
+	// so it runs in its own thread and wait_for_cuda_probe collects the result
+	void probe_cuda(IDXGIAdapter* graphic_adapter)
+	{
+		auto devices_count = 0;
+		if (cudaGetDeviceCount(&devices_count) == cudaSuccess && devices_count > 0 &&
+			cudaD3D11GetDevice(&cuda_device, graphic_adapter) == cudaSuccess &&
+			cudaGetDeviceProperties(&cuda_device_prop_var, cuda_device) == cudaSuccess)
+		{
+			is_cuda_adapter = true;
+		}
+
+		graphic_adapter->Release();
+	}
+
+	bool create_d3d_device(const bool cuda_acceleration)
 	{
-		std::cout << "Creating graphic device";
+		std::cout << "Creating graphic device\n";
 
-		// Iterate through the candidate adapters
 		IDXGIFactory* p_factory;
 		auto hr = CreateDXGIFactory(__uuidof(IDXGIFactory), reinterpret_cast<void**>(&p_factory));
 
@@ -140,31 +159,17 @@ namespace graphic_device
 			return false;
 		}
 
-
-		auto device_id = 0;
-
+		// The first adapter is the one that the desktop is displayed by
 		IDXGIAdapter* graphic_adapter = nullptr;
-		while (true)
-		{
-			hr = p_factory->EnumAdapters(device_id, &graphic_adapter);
-			if (FAILED(hr)) break;
-
-			DXGI_ADAPTER_DESC desc = {0};
-			graphic_adapter->GetDesc(&desc);
-
-
-			if (cuda_acceleration && cudaGetDeviceProperties(&cuda_device_prop_var, device_id) == cudaSuccess)
-			{
-				is_cuda_adapter = true;
-				break;
-			}
-
-			device_id++;
-		}
+		if (FAILED(p_factory->EnumAdapters(0, &graphic_adapter)))
+			graphic_adapter = nullptr;
+		p_factory->Release();
 
 		if (helpers::create_d_3d_device(&d3d_device, graphic_adapter) != S_OK)
 		{
 			std::cout << "Failed to create d3d device using adapter\n";
+			if (graphic_adapter)
+				graphic_adapter->Release();
 			close();
 			return false;
 		}
@@ -173,6 +178,8 @@ namespace graphic_device
 		if (d3d_device->QueryInterface(__uuidof(IDXGIDevice), reinterpret_cast<void**>(&dxgi_device)) != S_OK)
 		{
 			std::cout << "Failed to get IDXGIDevice interface from the d3dDevice\n";
+			if (graphic_adapter)
+				graphic_adapter->Release();
 			close();
 			return false;
 		}
@@ -182,10 +189,35 @@ namespace graphic_device
 		if (d3d_context == nullptr)
 		{
 			std::cout << "Failed to get d3dContext from the D3D device\n";
+			if (graphic_adapter)
+				graphic_adapter->Release();
 			close();
 			return false;
 		}
 
+		// The main thread and the process frame thread both use the immediate context, each for its own target
+		ID3D11Multithread* multithread = nullptr;
+		if (SUCCEEDED(d3d_context->QueryInterface(__uuidof(ID3D11Multithread), reinterpret_cast<void**>(&multithread))))
+		{
+			multithread->SetMultithreadProtected(TRUE);
+			multithread->Release();
+		}
+		else
+		{
+			std::cout << "Failed to protect the d3dContext for the use of more than one thread\n";
+		}
+
+		is_cuda_adapter = false;
+		if (cuda_acceleration && graphic_adapter)
+			cuda_probe_thread = std::thread(probe_cuda, graphic_adapter);
+		else if (graphic_adapter)
+			graphic_adapter->Release();
+
+		return true;
+	}
+
+	bool create_winrt_device()
+	{
 		device = direct3d11_interop::CreateDirect3DDevice(dxgi_device);
 		if (device == nullptr)
 		{
@@ -197,6 +229,16 @@ namespace graphic_device
 		return true;
 	}
 
+	void wait_for_cuda_probe()
+	{
+		if (cuda_probe_thread.joinable())
+			cuda_probe_thread.join();
+
+		// The CUDA device is selected per thread, the process frame thread selects it too
+		if (is_cuda_adapter)
+			cudaSetDevice(cuda_device);
+	}
+
 	bool create_swap_chain(const int buffer_x_size, const int buffer_y_size)
 	{
 		if (swap_chain)
@@ -213,7 +255,7 @@ namespace graphic_device
 			static_cast<uint32_t>(buffer_x_size),
 			static_cast<uint32_t>(buffer_y_size),
 			static_cast<DXGI_FORMAT>(winrt::Windows::Graphics::DirectX::DirectXPixelFormat::B8G8R8A8UIntNormalized),
-			2);
+			swap_chain_buffers_count);
 
 		swap_chain = com_ptr_swap_chain.get();
 		if (swap_chain == nullptr)
@@ -232,7 +274,7 @@ namespace graphic_device
 
 		swap_chain->ResizeBuffers
 		(
-			2,
+			swap_chain_buffers_count,
 			static_cast<uint32_t>(buffer_x_size),
 			static_cast<uint32_t>(buffer_y_size),
 			static_cast<DXGI_FORMAT>(winrt::Windows::Graphics::DirectX::DirectXPixelFormat::B8G8R8A8UIntNormalized),
@@ -284,6 +326,7 @@ namespace graphic_device
 		try
 		{
 			d3d_context->CopyResource(dest_texture, src_texture);
+			metrics::add_copies();
 		}
 		catch (std::exception&)
 		{
@@ -331,5 +374,24 @@ namespace graphic_device
 		winrt::check_hresult(swap_chain->GetBuffer(0, winrt::guid_of<ID3D11Texture2D>(), back_buffer.put_void()));
 
 		d3d_context->CopyResource(back_buffer.get(), texture);
+		metrics::add_copies();
+	}
+
+	void draw_texture_on_back_buffer(ID3D11Texture2D* texture, const std::vector<RECT>& rects)
+	{
+		winrt::com_ptr<ID3D11Texture2D> back_buffer;
+		winrt::check_hresult(swap_chain->GetBuffer(0, winrt::guid_of<ID3D11Texture2D>(), back_buffer.put_void()));
+
+		for (const auto& rect : rects)
+		{
+			const D3D11_BOX box = {
+				static_cast<UINT>(rect.left), static_cast<UINT>(rect.top), 0,
+				static_cast<UINT>(rect.right), static_cast<UINT>(rect.bottom), 1
+			};
+			d3d_context->CopySubresourceRegion(back_buffer.get(), 0, box.left, box.top, 0, texture, 0, &box);
+		}
+
+		// The rects are one copy of the frame
+		metrics::add_copies();
 	}
 }
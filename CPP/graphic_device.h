@@ -6,6 +6,8 @@
 
 #include "cuda_runtime.h"
 
+#include <vector>
+
 namespace graphic_device
 {
 	struct GraphicDeviceMappedCPUTexture
@@ -16,19 +18,31 @@ namespace graphic_device
 	};
 
 
-	inline winrt::com_ptr<IDXGISwapChain1> com_ptr_swap_chain{nullptr};
+	// The swap chain of the context of the display layer that the calling thread selected
+	inline thread_local winrt::com_ptr<IDXGISwapChain1> com_ptr_swap_chain{nullptr};
+	inline thread_local IDXGISwapChain1* swap_chain{nullptr};
+
 	inline ID3D11Device* d3d_device = nullptr;
 	inline IDXGIDevice* dxgi_device = nullptr;
 	inline winrt::Windows::Graphics::DirectX::Direct3D11::IDirect3DDevice device{nullptr};
-	inline IDXGISwapChain1* swap_chain{nullptr};
 	inline ID3D11DeviceContext* d3d_context{nullptr};
 
+	// The content of a back buffer is from the frame that was presented swap_chain_buffers_count frames ago
+	constexpr UINT swap_chain_buffers_count = 2;
+
+	// Valid only after wait_for_cuda_probe
 	inline bool is_cuda_adapter = false;
+	inline int cuda_device = 0;
 	inline cudaDeviceProp cuda_device_prop_var = {0};
 
 
 	void close();
-	bool init_device(bool cuda_acceleration);
+	// The device is created in three steps so they can overlap with the rest of the startup.
+	// create_d3d_device can run on any thread and starts to probe CUDA in the background,
+	// create_winrt_device must run on the thread of the capture layer
+	bool create_d3d_device(bool cuda_acceleration);
+	bool create_winrt_device();
+	void wait_for_cuda_probe();
 	bool create_swap_chain(int buffer_x_size, int buffer_y_size);
 	void resize_swap_chain(int buffer_x_size, int buffer_y_size);
 	void delete_swap_chain();
@@ -39,4 +53,5 @@ namespace graphic_device
 	bool get_mapped_cpu_texture(ID3D11Texture2D* cpu_access_texture, GraphicDeviceMappedCPUTexture* cpu_texture_data);
 	void unmap_cpu_access_texture(ID3D11Texture2D* cpu_access_texture);
 	void draw_texture_on_back_buffer(ID3D11Texture2D* texture);
+	void draw_texture_on_back_buffer(ID3D11Texture2D* texture, const std::vector<RECT>& rects);
 }
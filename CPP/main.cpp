@@ -6,7 +6,12 @@
 #include <plog/Formatters/FuncMessageFormatter.h>
 #include <plog/Initializers/RollingFileInitializer.h>
 
+#include "control_block.h"
+#include "metrics.h"
+#include "pixel_kernels.h"
 #include "renderer.h"
+#include "thread_placement.h"
+#include "timers.h"
 
 // forward declarations
 LRESULT CALLBACK window_proc(
@@ -22,6 +27,10 @@ LRESULT CALLBACK window_proc(
 #define ARGS_BRIGHTNESS_LEVEL_IDX 4
 #define ARGS_TEXT_EXTRA_BRIGHTNESS_LEVEL_IDX 5
 #define ARGS_BLUR_TYPE_IDX 6
+#define ARGS_ANALYSIS_SCALE_IDX 7 // Optional
+#define ARGS_CPU_ISA_IDX 8 // Optional. Forces the pixel kernels of scalar, sse41, avx2 or avx512 (for benchmarks)
+#define ARGS_THREAD_PLACEMENT_IDX 9 // Optional. auto (default), performance, efficiency or off
+#define ARGS_FILTER_IMAGES_IDX 10 // Optional. 1 leaves the images out of the glass effect, 0 (default) does not
 #define ARGS_COUNT 6
 
 
@@ -30,6 +39,9 @@ LRESULT CALLBACK window_proc(
 #define COMMAND_SET_BRIGHTNESS 2
 #define COMMAND_SET_TEXT_BRIGHTNESS 3
 #define COMMAND_SET_BLUR_TYPE 4
+#define COMMAND_SET_ANALYSIS_SCALE 5
+#define COMMAND_ATTACH_TARGET 6 // value1-4: OPACITY_LEVEL BRIGHTNESS_LEVEL TEXT_EXTRA_BRIGHTNESS_LEVEL BLUR_TYPE
+#define COMMAND_DETACH_TARGET 7
 
 
 #ifndef _DEBUG
@@ -43,9 +55,108 @@ int opacity_level = 70;
 int brightness_level = 70;
 int blur_type = 0;
 int text_brightness = 100;
+int analysis_scale = 0;
+const char* cpu_isa = nullptr;
+const char* thread_placement_mode = nullptr;
+bool filter_images = false;
 
 bool should_exit = false;
 
+bool check_settings(const int opacity_level, const int brightness_level, const int text_brightness,
+                    const int blur_type)
+{
+	if (opacity_level < 0 || opacity_level > 100)
+	{
+		std::cout << "Invalid opacity level provided\n";
+		return false;
+	}
+
+	if (brightness_level < 0 || brightness_level > 100)
+	{
+		std::cout << "Invalid brightness level provided\n";
+		return false;
+	}
+
+	if (blur_type < 0 || blur_type > 2)
+	{
+		std::cout << "Invalid blur type provided\n";
+		return false;
+	}
+
+	if (text_brightness < 0 || text_brightness > 100)
+	{
+		std::cout << "Invalid text brightness provided\n";
+		return false;
+	}
+
+	return true;
+}
+
+// Start to re render the given window in this process
+bool attach_target(const HWND target_hwnd, const int opacity_level, const int brightness_level,
+                   const int text_brightness, const int blur_type)
+{
+	renderer::attach_target(target_hwnd);
+	renderer::set_analysis_scale(analysis_scale);
+
+	if (!renderer::enable_glass_mode
+		(
+			filter_images,
+			static_cast<renderer::GlassBlurType>(blur_type),
+			brightness_level / 100.0,
+			false,
+			opacity_level / 100.0,
+			0.0,
+			text_brightness / 100.0
+		))
+	{
+		std::cout << "Failed to enable glass mode\n";
+		renderer::detach_target(target_hwnd);
+		return false;
+	}
+
+	control_block::attach(target_hwnd, {
+		                      opacity_level, brightness_level, text_brightness, blur_type, analysis_scale
+	                      });
+	return true;
+}
+
+bool check_analysis_scale(const int analysis_scale)
+{
+	return analysis_scale == 0 || analysis_scale == 1 || analysis_scale == 2 || analysis_scale == 4;
+}
+
+// Apply the settings that the plugin wrote to the control blocks since the last call
+void apply_settings_changes()
+{
+	for (const auto& change : control_block::poll())
+	{
+		if (!renderer::set_target(change.target_hwnd))
+		{
+			// The renderer already removed the window
+			control_block::detach(change.target_hwnd);
+			continue;
+		}
+
+		const auto& settings = change.settings;
+		const auto& previous = change.previous;
+		if (!check_settings(settings.opacity_level, settings.brightness_level, settings.text_brightness,
+		                    settings.blur_type))
+			continue;
+
+		if (settings.opacity_level != previous.opacity_level)
+			renderer::glass_set_background_level(settings.opacity_level / 100.0);
+		if (settings.brightness_level != previous.brightness_level)
+			renderer::glass_set_brightness_level(settings.brightness_level / 100.0);
+		if (settings.text_brightness != previous.text_brightness)
+			renderer::glass_set_shapes_level(settings.text_brightness / 100.0);
+		if (settings.blur_type != previous.blur_type)
+			renderer::set_glass_blur_level(static_cast<renderer::GlassBlurType>(settings.blur_type));
+		if (settings.analysis_scale != previous.analysis_scale && check_analysis_scale(settings.analysis_scale))
+			renderer::set_analysis_scale(settings.analysis_scale);
+	}
+}
+
 // Input arguments: WINDOW_HANDLE OPACITY_LEVEL BRIGHTNESS_LEVEL BLUR_TYPE
 int main(const int argc, char* argv[])
 {
@@ -69,6 +180,14 @@ int main(const int argc, char* argv[])
 	brightness_level = atoi(argv[ARGS_BRIGHTNESS_LEVEL_IDX]);
 	text_brightness = atoi(argv[ARGS_TEXT_EXTRA_BRIGHTNESS_LEVEL_IDX]);
 	blur_type = atoi(argv[ARGS_BLUR_TYPE_IDX]);
+	if (argc - 1 >= ARGS_ANALYSIS_SCALE_IDX)
+		analysis_scale = atoi(argv[ARGS_ANALYSIS_SCALE_IDX]);
+	if (argc - 1 >= ARGS_CPU_ISA_IDX)
+		cpu_isa = argv[ARGS_CPU_ISA_IDX];
+	if (argc - 1 >= ARGS_THREAD_PLACEMENT_IDX)
+		thread_placement_mode = argv[ARGS_THREAD_PLACEMENT_IDX];
+	if (argc - 1 >= ARGS_FILTER_IMAGES_IDX)
+		filter_images = atoi(argv[ARGS_FILTER_IMAGES_IDX]) != 0;
 #endif
 
 
@@ -79,30 +198,45 @@ int main(const int argc, char* argv[])
 		return EXIT_FAILURE;
 	}
 
-	if (opacity_level < 0 || opacity_level > 100)
+	if (!check_settings(opacity_level, brightness_level, text_brightness, blur_type))
+		return EXIT_FAILURE;
+
+	if (!check_analysis_scale(analysis_scale))
 	{
-		std::cout << "Invalid opacity level provided\n";
+		std::cout << "Invalid analysis scale provided\n";
 		return EXIT_FAILURE;
 	}
 
-	if (brightness_level < 0 || brightness_level > 100)
+	auto isa = pixel_kernels::get_best_isa();
+	if (cpu_isa && !pixel_kernels::parse_isa(cpu_isa, isa))
 	{
-		std::cout << "Invalid brightness level provided\n";
+		std::cout << "Invalid CPU instruction set provided\n";
 		return EXIT_FAILURE;
 	}
 
-	if (blur_type < 0 || blur_type > 2)
+	if (!pixel_kernels::select_isa(isa))
 	{
-		std::cout << "Invalid blur type provided\n";
+		std::cout << "The CPU does not support the " << pixel_kernels::get_isa_name(isa) << " instruction set\n";
 		return EXIT_FAILURE;
 	}
 
-	if (text_brightness < 0 || text_brightness > 100)
+	std::cout << "Using the " << pixel_kernels::get_isa_name(isa) << " pixel kernels\n";
+
+	auto placement_mode = thread_placement::Mode::AUTO;
+	if (thread_placement_mode && !thread_placement::parse_mode(thread_placement_mode, placement_mode))
 	{
-		std::cout << "Invalid text brightness provided\n";
+		std::cout << "Invalid thread placement provided\n";
 		return EXIT_FAILURE;
 	}
 
+	// The timers that the main thread starts wake the message loop
+	timers::Waiter main_waiter;
+	timers::set_thread_waiter(&main_waiter);
+
+	// The threads are placed by their priority also when the cores were not found
+	thread_placement::init(placement_mode);
+	std::cout << "Using the " << thread_placement::get_mode_name(placement_mode) << " thread placement\n";
+
 
 	std::cout << "Creating messages-only window\n";
 
@@ -126,9 +260,16 @@ int main(const int argc, char* argv[])
 	};
 
 
+	// The plugin waits for this line, so it is published before anything else is initialized
 	auto msg_window = create_message_only_window();
 	std::cout << "MSG_WINDOW=" << msg_window << std::endl;
 
+	if (!control_block::init(msg_window))
+		return EXIT_FAILURE;
+
+	// The renderer works also when the metrics can't be published
+	metrics::init(msg_window);
+
 	std::cout << "Creating a renderer window for the target window\n";
 	if (!renderer::init(is_cuda_enabled))
 	{
@@ -136,51 +277,36 @@ int main(const int argc, char* argv[])
 		return EXIT_FAILURE;
 	}
 
-	renderer::set_target(target_hwnd);
-
-	if (!renderer::enable_glass_mode
-		(
-			false,
-			static_cast<renderer::GlassBlurType>(blur_type),
-			brightness_level / 100.0,
-			false,
-			opacity_level / 100.0,
-			0.0,
-			text_brightness / 100.0
-		))
-	{
-		std::cout << "Failed to enable glass mode\n";
+	// The window in the arguments is the first target. More windows are attached with COMMAND_ATTACH_TARGET
+	if (!attach_target(target_hwnd, opacity_level, brightness_level, text_brightness, blur_type))
 		return EXIT_FAILURE;
-	}
 
 
-	clock_t check_window_timer = clock();
+	// The loop sleeps until a message arrives (a command, a window event of a target or a captured frame), the plugin
+	// rings the doorbell after it wrote new settings, the renderer signals its event or a timer of the renderer is
+	// due. The wait is limited only in case that an event of the windows was missed
+	const HANDLE events[] = {control_block::get_doorbell(), renderer::get_loop_event()};
+	constexpr int max_wait = 1000;
 
+	// The renderer removes the targets that their window was closed, and the loop ends when no target is left
 	while (!should_exit && renderer::process_loop())
 	{
+		MsgWaitForMultipleObjectsEx(ARRAYSIZE(events), events, timers::get_wait_time(max_wait), QS_ALLINPUT,
+		                            MWMO_INPUTAVAILABLE);
+
 		MSG msg = {nullptr};
-		if (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE) > 0)
+		while (!should_exit && PeekMessage(&msg, NULL, 0, 0, PM_REMOVE) > 0)
 		{
 			TranslateMessage(&msg);
 			DispatchMessage(&msg);
 		}
-		else
-		{
-			Sleep(10);
-		}
-
-		if (clock() - check_window_timer >= 1000)
-		{
-			if (!IsWindow(target_hwnd))
-			{
-				renderer::disable_glass_mode();
-				should_exit = true;
-			}
 
-			check_window_timer = clock();
-		}
+		apply_settings_changes();
 	}
 
+	control_block::un_init();
+	metrics::un_init();
+
 	return !renderer::have_fatal_error() ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
@@ -188,6 +314,9 @@ struct s_request_command
 {
 	int command_id;
 	int value1;
+	int value2;
+	int value3;
+	int value4;
 };
 
 
@@ -204,6 +333,25 @@ LRESULT CALLBACK window_proc(
 
 		auto* const request = static_cast<s_request_command*>(copy_data_struct->lpData);
 
+		// The window that the command is for
+		const auto request_target_hwnd = reinterpret_cast<HWND>(w_param);
+
+		if (request->command_id == COMMAND_ATTACH_TARGET)
+		{
+			if (copy_data_struct->cbData < sizeof(s_request_command) || !IsWindow(request_target_hwnd) ||
+				!check_settings(request->value1, request->value2, request->value3, request->value4))
+				return 1;
+
+			return attach_target(request_target_hwnd, request->value1, request->value2, request->value3,
+			                     request->value4) ? 0 : 1;
+		}
+
+		if (request->command_id != COMMAND_EXIT && !renderer::set_target(request_target_hwnd))
+		{
+			std::cout << "Received command for a window that is not attached\n";
+			return 1;
+		}
+
 		switch (request->command_id)
 		{
 		case COMMAND_SET_OPACITY:
@@ -218,6 +366,13 @@ LRESULT CALLBACK window_proc(
 		case COMMAND_SET_BLUR_TYPE:
 			renderer::set_glass_blur_level(static_cast<renderer::GlassBlurType>(request->value1));
 			break;
+		case COMMAND_SET_ANALYSIS_SCALE:
+			renderer::set_analysis_scale(request->value1);
+			break;
+		case COMMAND_DETACH_TARGET:
+			renderer::detach_target(request_target_hwnd);
+			control_block::detach(request_target_hwnd);
+			break;
 		default:
 		case COMMAND_EXIT:
 			renderer::register_exit_event();
@@ -0,0 +1,308 @@
+#include "metrics.h"
+
+#include <psapi.h>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include "thread_placement.h"
+
+namespace metrics
+{
+	constexpr auto counters_count = static_cast<int>(Counter::COUNT);
+	constexpr auto stages_count = static_cast<int>(Stage::COUNT);
+	constexpr auto latencies_count = static_cast<int>(Latency::COUNT);
+
+	// The layout is shared with RendererMetrics.java. All the fields are 64 bit
+	struct SharedHeader
+	{
+		volatile LONG64 layout_version;
+		volatile LONG64 slots_count;
+		volatile LONG64 slot_size;
+		volatile LONG64 published_count; // The last published slot is (published_count - 1) % slots_count
+	};
+
+	struct SharedSlot
+	{
+		volatile LONG64 sequence; // Odd while the slot is written
+		volatile LONG64 timestamp; // GetTickCount64() when the slot was written
+		volatile LONG64 backend; // 0 - CPU, 1 - CUDA
+		volatile LONG64 frames[counters_count]; // Since the renderer was started
+		volatile LONG64 fps_x100; // Processed frames per second in the last second
+		volatile LONG64 resident_bytes; // Working set of the renderer process
+		volatile LONG64 stage_p50_us[stages_count];
+		volatile LONG64 stage_p99_us[stages_count];
+		volatile LONG64 copies_per_frame_x100; // Texture copies per processed or unchanged frame in the last second
+		volatile LONG64 latency_p50_us[latencies_count];
+		volatile LONG64 latency_p95_us[latencies_count];
+		volatile LONG64 latency_p99_us[latencies_count];
+		volatile LONG64 thread_policy; // thread_placement::Policy of the process frame thread
+		volatile LONG64 performance_cores_percent; // Of the samples in the last second, -1 if the CPU is not hybrid
+		volatile LONG64 cores_mask; // The logical processors that the thread ran on in the last second
+	};
+
+	constexpr LONG64 layout_version = 4;
+	constexpr int slots_count = 64;
+	constexpr int samples_per_stage = 512;
+	constexpr LONGLONG publish_interval_ms = 1000;
+
+	HANDLE mapping = nullptr;
+	SharedHeader* header = nullptr;
+	SharedSlot* slots = nullptr;
+
+	LONG64 backend = 0;
+	LONGLONG ticks_per_second = 1;
+
+	LONG64 frames[counters_count] = {0};
+	LONG64 processed_at_last_publish = 0;
+	LONG64 copies = 0;
+	LONG64 copies_at_last_publish = 0;
+	LONG64 checked_at_last_publish = 0;
+	ULONGLONG last_publish_time = 0;
+
+	// The last samples of each stage in microseconds, used as a ring
+	float samples[stages_count][samples_per_stage];
+	int samples_count[stages_count] = {0};
+	int samples_next[stages_count] = {0};
+
+	// Histograms of the latencies in microseconds, with 4 buckets for each power of 2 from latency_base_us. A
+	// percentile of the histogram is the upper bound of its bucket, so it is at most 19% above the exact value.
+	// The percentiles are of the last 10 to 20 seconds: there are two histograms, and every 10 seconds the older
+	// one is cleared and takes the new samples
+	constexpr int latency_buckets_per_octave = 4;
+	constexpr int latency_buckets_count = 72; // Up to about 8 seconds
+	constexpr double latency_base_us = 32;
+	constexpr ULONGLONG latency_window_ms = 10000;
+
+	LONG64 latency_histograms[2][latencies_count][latency_buckets_count] = {{{0}}};
+	int latency_histogram_current = 0;
+	ULONGLONG latency_histogram_start_time = 0;
+
+	bool init(const HWND msg_hwnd)
+	{
+		LARGE_INTEGER frequency;
+		QueryPerformanceFrequency(&frequency);
+		ticks_per_second = frequency.QuadPart;
+
+		const auto size = sizeof(SharedHeader) + sizeof(SharedSlot) * slots_count;
+		const auto name = "Local\\GlassCode_Metrics_" + std::to_string(reinterpret_cast<uintptr_t>(msg_hwnd));
+		mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, static_cast<DWORD>(size),
+		                             name.c_str());
+		if (!mapping)
+		{
+			std::cout << "Failed to create the metrics memory\n";
+			return false;
+		}
+
+		header = static_cast<SharedHeader*>(MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, size));
+		if (!header)
+		{
+			std::cout << "Failed to map the metrics memory\n";
+			un_init();
+			return false;
+		}
+
+		slots = reinterpret_cast<SharedSlot*>(header + 1);
+		ZeroMemory(header, size);
+		header->slots_count = slots_count;
+		header->slot_size = sizeof(SharedSlot);
+		MemoryBarrier();
+		header->layout_version = layout_version;
+
+		last_publish_time = latency_histogram_start_time = GetTickCount64();
+		return true;
+	}
+
+	void un_init()
+	{
+		if (header)
+		{
+			UnmapViewOfFile(header);
+			header = nullptr;
+			slots = nullptr;
+		}
+
+		if (mapping)
+		{
+			CloseHandle(mapping);
+			mapping = nullptr;
+		}
+	}
+
+	void set_backend(const bool cuda)
+	{
+		backend = cuda ? 1 : 0;
+	}
+
+	LONGLONG now()
+	{
+		LARGE_INTEGER counter;
+		QueryPerformanceCounter(&counter);
+		return counter.QuadPart;
+	}
+
+	void add_stage_time(const Stage stage, const LONGLONG start)
+	{
+		const auto index = static_cast<int>(stage);
+		const auto microseconds = static_cast<double>(now() - start) * 1000000.0 / ticks_per_second;
+
+		samples[index][samples_next[index]] = static_cast<float>(microseconds);
+		samples_next[index] = (samples_next[index] + 1) % samples_per_stage;
+		if (samples_count[index] < samples_per_stage)
+			samples_count[index]++;
+	}
+
+	int get_latency_bucket(const double microseconds)
+	{
+		if (microseconds < latency_base_us)
+			return 0;
+
+		const auto bucket = static_cast<int>(std::log2(microseconds / latency_base_us) * latency_buckets_per_octave);
+		return bucket < latency_buckets_count ? bucket : latency_buckets_count - 1;
+	}
+
+	void add_latency(const Latency latency, const LONGLONG ticks)
+	{
+		const auto microseconds = static_cast<double>(ticks) * 1000000.0 / ticks_per_second;
+		latency_histograms[latency_histogram_current][static_cast<int>(latency)][get_latency_bucket(microseconds)]++;
+	}
+
+	void add_frame_latency(const LONGLONG capture_time, const LONGLONG process_start)
+	{
+		const auto present_end = now();
+
+		// The capture time is of the system, so a wrong time is dropped and not counted as a huge latency
+		if (capture_time <= 0 || capture_time > process_start)
+			return;
+
+		add_latency(Latency::TOTAL, present_end - capture_time);
+		add_latency(Latency::QUEUE, process_start - capture_time);
+		add_latency(Latency::COMPUTE, present_end - process_start);
+	}
+
+	void add_frames(const Counter counter, const int count)
+	{
+		frames[static_cast<int>(counter)] += count;
+	}
+
+	void add_copies(const int count)
+	{
+		copies += count;
+	}
+
+	// The percentile of the last samples of the stage in microseconds
+	LONG64 get_percentile(const int stage, const int percent)
+	{
+		const auto count = samples_count[stage];
+		if (count == 0)
+			return 0;
+
+		static float sorted[samples_per_stage];
+		std::copy(samples[stage], samples[stage] + count, sorted);
+
+		const auto position = (count - 1) * percent / 100;
+		std::nth_element(sorted, sorted + position, sorted + count);
+		return static_cast<LONG64>(sorted[position]);
+	}
+
+	// The percentile of the latency in microseconds, from both histograms
+	LONG64 get_latency_percentile(const int latency, const int percent)
+	{
+		LONG64 count = 0;
+		for (auto bucket = 0; bucket < latency_buckets_count; bucket++)
+			count += latency_histograms[0][latency][bucket] + latency_histograms[1][latency][bucket];
+
+		if (count == 0)
+			return 0;
+
+		const auto position = (count - 1) * percent / 100;
+		LONG64 seen = 0;
+		auto bucket = 0;
+		for (; bucket < latency_buckets_count - 1; bucket++)
+		{
+			seen += latency_histograms[0][latency][bucket] + latency_histograms[1][latency][bucket];
+			if (seen > position)
+				break;
+		}
+
+		return static_cast<LONG64>(latency_base_us * std::exp2(static_cast<double>(bucket + 1) /
+		                                                        latency_buckets_per_octave));
+	}
+
+	void rotate_latency_histograms(const ULONGLONG time)
+	{
+		if (time - latency_histogram_start_time < latency_window_ms)
+			return;
+
+		latency_histogram_current = 1 - latency_histogram_current;
+		ZeroMemory(latency_histograms[latency_histogram_current], sizeof(latency_histograms[0]));
+		latency_histogram_start_time = time;
+	}
+
+	void publish()
+	{
+		if (!header)
+			return;
+
+		const auto time = GetTickCount64();
+		const auto elapsed = time - last_publish_time;
+		if (elapsed < publish_interval_ms)
+			return;
+
+		const auto processed = frames[static_cast<int>(Counter::PROCESSED)];
+		const auto fps_x100 = (processed - processed_at_last_publish) * 100000 / static_cast<LONG64>(elapsed);
+		processed_at_last_publish = processed;
+		last_publish_time = time;
+
+		// The unchanged frames are copied and checked too, so they are counted
+		const auto checked = processed + frames[static_cast<int>(Counter::UNCHANGED)];
+		const auto checked_frames = checked - checked_at_last_publish;
+		const auto copies_per_frame_x100 = checked_frames ? (copies - copies_at_last_publish) * 100 / checked_frames : 0;
+		checked_at_last_publish = checked;
+		copies_at_last_publish = copies;
+
+		const auto core_usage = thread_placement::take_core_usage();
+		const auto core_samples = core_usage.performance_samples + core_usage.efficiency_samples;
+		auto performance_cores_percent = static_cast<LONG64>(-1);
+		if (thread_placement::is_hybrid())
+			performance_cores_percent = core_samples ? core_usage.performance_samples * 100 / core_samples : 0;
+
+		PROCESS_MEMORY_COUNTERS memory_counters = {0};
+		GetProcessMemoryInfo(GetCurrentProcess(), &memory_counters, sizeof(memory_counters));
+
+		// Seqlock write of the slot, so the plugin never reads a slot that is half written
+		auto& slot = slots[header->published_count % slots_count];
+		const auto sequence = slot.sequence;
+		slot.sequence = sequence + 1;
+		MemoryBarrier();
+
+		slot.timestamp = static_cast<LONG64>(time);
+		slot.backend = backend;
+		for (auto i = 0; i < counters_count; i++)
+			slot.frames[i] = frames[i];
+		slot.fps_x100 = fps_x100;
+		slot.resident_bytes = static_cast<LONG64>(memory_counters.WorkingSetSize);
+		for (auto i = 0; i < stages_count; i++)
+		{
+			slot.stage_p50_us[i] = get_percentile(i, 50);
+			slot.stage_p99_us[i] = get_percentile(i, 99);
+		}
+		slot.copies_per_frame_x100 = copies_per_frame_x100;
+		for (auto i = 0; i < latencies_count; i++)
+		{
+			slot.latency_p50_us[i] = get_latency_percentile(i, 50);
+			slot.latency_p95_us[i] = get_latency_percentile(i, 95);
+			slot.latency_p99_us[i] = get_latency_percentile(i, 99);
+		}
+		slot.thread_policy = static_cast<LONG64>(thread_placement::get_policy());
+		slot.performance_cores_percent = performance_cores_percent;
+		slot.cores_mask = static_cast<LONG64>(core_usage.cores_mask);
+
+		MemoryBarrier();
+		slot.sequence = sequence + 2;
+		MemoryBarrier();
+		header->published_count = header->published_count + 1;
+
+		rotate_latency_histograms(time);
+	}
+}
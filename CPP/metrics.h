@@ -0,0 +1,53 @@
+#pragma once
+#include <Windows.h>
+
+// Rolling metrics of the renderer. They are published once per second to a shared memory ring
+// that the plugin maps as read only and shows in the tool window.
+// All the functions except init, un_init and set_backend are called only by the process frame thread
+namespace metrics
+{
+	enum class Counter
+	{
+		CAPTURED, // Frames that the capture layer received
+		PROCESSED, // Frames that were processed and presented
+		UNCHANGED, // Frames that were skipped since nothing was changed
+		DROPPED, // Frames that were replaced by a newer frame or arrived while waiting for a resize
+		COUNT
+	};
+
+	enum class Stage
+	{
+		DETECT, // Copy of the captured frame and the check if it was changed
+		EFFECT, // Processing of the changed frame
+		PRESENT, // Drawing of the processed frame
+		TOTAL, // The whole frame
+		MAP, // Map of the staging texture of the frame, mostly the wait for its copy
+		COUNT
+	};
+
+	// The parts of the latency of a presented frame, from the capture of the frame until its present ended
+	enum class Latency
+	{
+		TOTAL,
+		QUEUE, // Until the process frame thread started the frame: the delivery and the wait for the thread
+		COMPUTE, // The processing and the present of the frame
+		COUNT
+	};
+
+	bool init(HWND msg_hwnd);
+	void un_init();
+	void set_backend(bool cuda);
+
+	LONGLONG now();
+	void add_stage_time(Stage stage, LONGLONG start);
+	void add_frames(Counter counter, int count = 1);
+	// Copies of whole textures (or of their dirty rects) by the graphic device
+	void add_copies(int count = 1);
+
+	// A presented frame that its content was changed. The times are of now(), the capture time is the one that
+	// the capture layer got with the frame
+	void add_frame_latency(LONGLONG capture_time, LONGLONG process_start);
+
+	// Publish the metrics if a second passed since they were published
+	void publish();
+}
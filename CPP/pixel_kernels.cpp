@@ -0,0 +1,107 @@
+#include "pixel_kernels.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+namespace pixel_kernels
+{
+	const Kernels* kernels = &scalar::kernels;
+	Isa selected_isa = Isa::scalar;
+
+	const char* const isa_names[] = {"scalar", "sse41", "avx2", "avx512"};
+	const Kernels* const isa_kernels[] = {&scalar::kernels, &sse41::kernels, &avx2::kernels, &avx512::kernels};
+
+	void cpuid(const int leaf, const int sub_leaf, uint32_t registers[4])
+	{
+#ifdef _MSC_VER
+		int info[4];
+		__cpuidex(info, leaf, sub_leaf);
+		for (auto i = 0; i < 4; i++)
+			registers[i] = static_cast<uint32_t>(info[i]);
+#else
+		__cpuid_count(leaf, sub_leaf, registers[0], registers[1], registers[2], registers[3]);
+#endif
+	}
+
+	// The registers that the OS saves on context switches
+	uint64_t get_xcr0()
+	{
+#ifdef _MSC_VER
+		return _xgetbv(0);
+#else
+		uint32_t eax, edx;
+		__asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+		return static_cast<uint64_t>(edx) << 32 | eax;
+#endif
+	}
+
+	Isa get_best_isa()
+	{
+		uint32_t registers[4];
+		cpuid(0, 0, registers);
+		const auto max_leaf = registers[0];
+		if (max_leaf < 1)
+			return Isa::scalar;
+
+		cpuid(1, 0, registers);
+		const auto features = registers[2];
+		if (!(features & 1u << 19)) // SSE4.1
+			return Isa::scalar;
+
+		// /arch:AVX2 may also use FMA, BMI1 and BMI2. The OS must save the AVX registers (OSXSAVE and XCR0)
+		constexpr uint32_t avx_features = 1u << 12 | 1u << 27 | 1u << 28; // FMA, OSXSAVE, AVX
+		if ((features & avx_features) != avx_features || max_leaf < 7)
+			return Isa::sse41;
+
+		const auto xcr0 = get_xcr0();
+		if ((xcr0 & 0x6) != 0x6) // XMM and YMM
+			return Isa::sse41;
+
+		cpuid(7, 0, registers);
+		const auto extended_features = registers[1];
+		constexpr uint32_t avx2_features = 1u << 3 | 1u << 5 | 1u << 8; // BMI1, AVX2, BMI2
+		if ((extended_features & avx2_features) != avx2_features)
+			return Isa::sse41;
+
+		constexpr uint32_t avx512_features = 1u << 16 | 1u << 17 | 1u << 28 | 1u << 30 | 1u << 31; // F, DQ, CD, BW, VL
+		if ((extended_features & avx512_features) != avx512_features || (xcr0 & 0xE6) != 0xE6) // And opmask and ZMM
+			return Isa::avx2;
+
+		return Isa::avx512;
+	}
+
+	bool select_isa(const Isa isa)
+	{
+		if (isa >= Isa::count || isa > get_best_isa())
+			return false;
+
+		selected_isa = isa;
+		kernels = isa_kernels[static_cast<int>(isa)];
+		return true;
+	}
+
+	Isa get_selected_isa()
+	{
+		return selected_isa;
+	}
+
+	const char* get_isa_name(const Isa isa)
+	{
+		return isa < Isa::count ? isa_names[static_cast<int>(isa)] : "unknown";
+	}
+
+	bool parse_isa(const char* name, Isa& isa)
+	{
+		for (auto i = 0; i < static_cast<int>(Isa::count); i++)
+			if (strcmp(name, isa_names[i]) == 0)
+			{
+				isa = static_cast<Isa>(i);
+				return true;
+			}
+
+		return false;
+	}
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// The pixel loops of the CPU layer. They are built once for each instruction set (pixel_kernels_<isa>.cpp,
+// each with its own architecture flags) and the best set that the CPU supports is selected at startup.
+// It does not depend on Windows.h, so the kernels can be built and measured on any x64 platform
+namespace pixel_kernels
+{
+	enum class Isa
+	{
+		scalar, // The loops are not vectorized
+		sse41,
+		avx2,
+		avx512, // AVX-512 F, CD, BW, DQ and VL
+		count
+	};
+
+	// How the mark pass of the glass effect changes the background pixels
+	enum class BackgroundMode
+	{
+		keep, // background_level is 1
+		scale,
+		clear, // background_level is 0
+		count
+	};
+
+	typedef void (*MarkCube)(uint8_t* cube, int stride, int width, int height, const uint64_t* image_rows,
+	                         uint8_t reduced_color, double shapes_level, double background_level,
+	                         bool dark_background);
+
+	// The pixels arguments point to BGRA pixels. The cube kernels get a rect of pixels with the distance between
+	// its rows in bytes (stride), and optionally a bit mask for each of its rows (image_rows) where bit x is set
+	// for the pixels x of the row that are part of images and must be skipped. A cube is up to 64 pixels wide
+	struct Kernels
+	{
+		// Hash of size bytes of a row of pixels, that used to find the rows that changed since the last frame
+		uint64_t (*hash_row)(const uint8_t* row, size_t size);
+
+		// Invert the colors (not the alpha) of count pixels
+		void (*invert_pixels)(uint8_t* pixels, int count);
+
+		// The most common brightness in the cube, sampled every step pixels in both axes. A brightness must be
+		// found more than max_color_count times to replace max_color
+		uint8_t (*reduce_cube)(const uint8_t* cube, int stride, int width, int height, int step,
+		                       const uint64_t* image_rows, int max_color_count, uint8_t max_color);
+
+		// How many of the pixels of the cube that reduce_cube samples have the given brightness, a single compare
+		// for each pixel instead of the histogram. The amount of the sampled pixels is set to samples_count
+		int (*count_color)(const uint8_t* cube, int stride, int width, int height, int step,
+		                   const uint64_t* image_rows, uint8_t color, int* samples_count);
+
+		// The mark pass of the glass effect on a cube, with the kernel of each BackgroundMode
+		MarkCube mark_cube[static_cast<int>(BackgroundMode::count)];
+	};
+
+	namespace scalar { extern const Kernels kernels; }
+	namespace sse41 { extern const Kernels kernels; }
+	namespace avx2 { extern const Kernels kernels; }
+	namespace avx512 { extern const Kernels kernels; }
+
+	// The selected kernels. The scalar kernels are used until select_isa is called
+	extern const Kernels* kernels;
+
+	// The best instruction set that the CPU and the OS support, by CPUID
+	Isa get_best_isa();
+
+	// Returns false (and keeps the selected kernels) when the CPU does not support the given instruction set
+	bool select_isa(Isa isa);
+	Isa get_selected_isa();
+
+	const char* get_isa_name(Isa isa);
+	bool parse_isa(const char* name, Isa& isa);
+}
@@ -0,0 +1,261 @@
+// The kernels of one instruction set. It is included by pixel_kernels_<isa>.cpp, after PIXEL_KERNELS_ISA is
+// defined as the name of the instruction set.
+// The code here is built with the instructions of the including file, so it must not call inline functions or
+// templates of other headers. The linker may keep the copy of such a function from this file for the whole program
+#ifndef PIXEL_KERNELS_ISA
+#error "Define PIXEL_KERNELS_ISA before including pixel_kernels.inl"
+#endif
+
+// Put before the loops that should not be vectorized in the scalar kernels
+#ifndef PIXEL_KERNELS_LOOP
+#define PIXEL_KERNELS_LOOP
+#endif
+
+namespace pixel_kernels
+{
+	namespace PIXEL_KERNELS_ISA
+	{
+		uint64_t hash_row(const uint8_t* row, const size_t size)
+		{
+			// Independent lanes so the multiplications of the words are not serialized. 8 lanes hash the
+			// rows about as fast as memcmp compares them
+			constexpr auto lanes_count = 8;
+			uint64_t lanes[lanes_count];
+			for (auto lane = 0; lane < lanes_count; lane++)
+				lanes[lane] = (lane + 1) * 0x9E3779B97F4A7C15ull;
+
+			size_t i = 0;
+			for (; i + lanes_count * sizeof(uint64_t) <= size; i += lanes_count * sizeof(uint64_t))
+			{
+				PIXEL_KERNELS_LOOP
+				for (auto lane = 0; lane < lanes_count; lane++)
+				{
+					uint64_t word;
+					memcpy(&word, row + i + lane * sizeof(uint64_t), sizeof(uint64_t));
+					lanes[lane] = (lanes[lane] ^ word) * 0x100000001B3ull;
+				}
+			}
+
+			for (; i + sizeof(uint32_t) <= size; i += sizeof(uint32_t))
+			{
+				uint32_t pixel;
+				memcpy(&pixel, row + i, sizeof(uint32_t));
+				lanes[0] = (lanes[0] ^ pixel) * 0x100000001B3ull;
+			}
+
+			// Each step is a bijection of the lane and of the word (the multipliers are odd), so a change inside
+			// one word always changes the hash
+			auto hash = lanes[0];
+			for (auto lane = 1; lane < lanes_count; lane++)
+				hash = (hash ^ lanes[lane]) * 0x9E3779B97F4A7C15ull;
+
+			return hash;
+		}
+
+		void invert_pixels(uint8_t* pixels, const int count)
+		{
+			PIXEL_KERNELS_LOOP
+			for (auto i = 0; i < count; i++)
+			{
+				uint32_t pixel;
+				memcpy(&pixel, pixels + i * 4, sizeof(uint32_t));
+				pixel ^= 0x00FFFFFF;
+				memcpy(pixels + i * 4, &pixel, sizeof(uint32_t));
+			}
+		}
+
+		uint8_t reduce_cube(const uint8_t* cube, const int stride, const int width, const int height, const int step,
+		                    const uint64_t* image_rows, int max_color_count, uint8_t max_color)
+		{
+			int colors[256] = {0};
+
+			for (auto y = 0; y < height; y += step)
+			{
+				const auto* const row = cube + y * stride;
+				const auto images = image_rows ? image_rows[y] : 0;
+				for (auto x = 0; x < width; x += step)
+				{
+					if ((images >> x) & 1) continue;
+					const auto point = x * 4;
+					const uint8_t avg_color = (row[point] + row[point + 1] + row[point + 2]) / 3;
+					colors[avg_color]++;
+					if (colors[avg_color] > max_color_count)
+					{
+						max_color = avg_color;
+						max_color_count = colors[avg_color];
+					}
+				}
+			}
+
+			return max_color;
+		}
+
+		int count_color(const uint8_t* cube, const int stride, const int width, const int height, const int step,
+		                const uint64_t* image_rows, const uint8_t color, int* samples_count)
+		{
+			auto count = 0, samples = 0;
+
+			for (auto y = 0; y < height; y += step)
+			{
+				const auto* const row = cube + y * stride;
+				const auto images = image_rows ? image_rows[y] : 0;
+
+				PIXEL_KERNELS_LOOP
+				for (auto x = 0; x < width; x += step)
+				{
+					if ((images >> x) & 1) continue;
+					const auto point = x * 4;
+					samples++;
+					if ((row[point] + row[point + 1] + row[point + 2]) / 3 == color)
+						count++;
+				}
+			}
+
+			*samples_count = samples;
+			return count;
+		}
+
+		// The pixel loop of the mark pass for one combination of the settings. The settings that are the same for
+		// the whole frame or the whole cube are template parameters, so the loop has no branches on them
+		template <BackgroundMode Background, bool HasImages, bool ScaleShapes, bool InvertBackground>
+		void mark_pixels(uint8_t* cube, const int stride, const int width, const int height,
+		                 const uint64_t* image_rows, const uint8_t reduced_color, const float scalar,
+		                 const double background_level)
+		{
+			for (auto y = 0; y < height; y++)
+			{
+				auto* const row = cube + y * stride;
+				const auto images = HasImages ? image_rows[y] : 0;
+
+				PIXEL_KERNELS_LOOP
+				for (auto x = 0; x < width; x++)
+				{
+					if (HasImages && (images >> x) & 1) continue;
+					const auto point = x * 4;
+
+					const auto is_shape_color = (row[point] + row[point + 1] + row[point + 2]) / 3 != reduced_color;
+
+					if (is_shape_color)
+					{
+						if constexpr (ScaleShapes)
+						{
+							int b = row[point];
+							int g = row[point + 1];
+							int r = row[point + 2];
+
+							b *= scalar;
+							g *= scalar;
+							r *= scalar;
+
+							auto max = r > g ? r : g;
+							if (b > max) max = b;
+
+							if (max > 255)
+							{
+								const auto reduce_scalar = 255 / static_cast<float>(max);
+								b *= reduce_scalar;
+								g *= reduce_scalar;
+								r *= reduce_scalar;
+							}
+
+							row[point] = b;
+							row[point + 1] = g;
+							row[point + 2] = r;
+						}
+					}
+					else
+					{
+						if constexpr (InvertBackground)
+						{
+							row[point] = 255 - row[point];
+							row[point + 1] = 255 - row[point + 1];
+							row[point + 2] = 255 - row[point + 2];
+						}
+
+						if constexpr (Background == BackgroundMode::scale)
+						{
+							row[point] *= background_level;
+							row[point + 1] *= background_level;
+							row[point + 2] *= background_level;
+							row[point + 3] *= background_level;
+						}
+						else if constexpr (Background == BackgroundMode::clear)
+						{
+							memset(&row[point], 0, sizeof(uint8_t) * 4);
+						}
+					}
+				}
+			}
+		}
+
+		template <BackgroundMode Background, bool HasImages>
+		void mark_cube(uint8_t* cube, const int stride, const int width, const int height,
+		               const uint64_t* image_rows, const uint8_t reduced_color, const double shapes_level,
+		               const double background_level, const bool dark_background)
+		{
+			uint8_t shape_max_brightness = 0;
+
+			for (auto y = 0; y < height; y++)
+			{
+				const auto* const row = cube + y * stride;
+				const auto images = HasImages ? image_rows[y] : 0;
+
+				for (auto x = 0; x < width; x++)
+				{
+					if (HasImages && (images >> x) & 1) continue;
+					const auto point = x * 4;
+
+					const uint8_t avg_color = (row[point] + row[point + 1] + row[point + 2]) / 3;
+					if (avg_color != reduced_color && avg_color > shape_max_brightness)
+						shape_max_brightness = avg_color;
+				}
+			}
+
+			float scalar = 255.0 / static_cast<float>(shape_max_brightness);
+
+			scalar *= shapes_level;
+
+			// The choices that are the same for all the pixels of the cube
+			const auto scale_shapes = scalar > 1;
+			const auto invert_background = dark_background && reduced_color > 128;
+
+			if (scale_shapes && invert_background)
+				mark_pixels<Background, HasImages, true, true>(cube, stride, width, height, image_rows,
+				                                               reduced_color, scalar, background_level);
+			else if (scale_shapes)
+				mark_pixels<Background, HasImages, true, false>(cube, stride, width, height, image_rows,
+				                                                reduced_color, scalar, background_level);
+			else if (invert_background)
+				mark_pixels<Background, HasImages, false, true>(cube, stride, width, height, image_rows,
+				                                                reduced_color, scalar, background_level);
+			else
+				mark_pixels<Background, HasImages, false, false>(cube, stride, width, height, image_rows,
+				                                                 reduced_color, scalar, background_level);
+		}
+
+		template <BackgroundMode Background>
+		void mark_cube(uint8_t* cube, const int stride, const int width, const int height,
+		               const uint64_t* image_rows, const uint8_t reduced_color, const double shapes_level,
+		               const double background_level, const bool dark_background)
+		{
+			if (image_rows)
+				mark_cube<Background, true>(cube, stride, width, height, image_rows, reduced_color, shapes_level,
+				                            background_level, dark_background);
+			else
+				mark_cube<Background, false>(cube, stride, width, height, image_rows, reduced_color, shapes_level,
+				                             background_level, dark_background);
+		}
+
+		extern const Kernels kernels = {
+			hash_row,
+			invert_pixels,
+			reduce_cube,
+			count_color,
+			{
+				mark_cube<BackgroundMode::keep>,
+				mark_cube<BackgroundMode::scale>,
+				mark_cube<BackgroundMode::clear>
+			}
+		};
+	}
+}
@@ -0,0 +1,9 @@
+// The kernels for AVX2. Renderer.vcxproj builds this file with /arch:AVX2
+#include "pixel_kernels.h"
+
+#ifndef _MSC_VER
+#pragma GCC target("avx2,fma,bmi,bmi2")
+#endif
+
+#define PIXEL_KERNELS_ISA avx2
+#include "pixel_kernels.inl"
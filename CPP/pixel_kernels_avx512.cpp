@@ -0,0 +1,9 @@
+// The kernels for AVX-512. Renderer.vcxproj builds this file with /arch:AVX512
+#include "pixel_kernels.h"
+
+#ifndef _MSC_VER
+#pragma GCC target("avx2,fma,bmi,bmi2,avx512f,avx512cd,avx512bw,avx512dq,avx512vl")
+#endif
+
+#define PIXEL_KERNELS_ISA avx512
+#include "pixel_kernels.inl"
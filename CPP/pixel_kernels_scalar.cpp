@@ -0,0 +1,11 @@
+// The kernels without vectorization, the baseline of the benchmarks
+#include "pixel_kernels.h"
+
+#ifdef _MSC_VER
+#define PIXEL_KERNELS_LOOP __pragma(loop(no_vector))
+#else
+#pragma GCC optimize("no-tree-vectorize")
+#endif
+
+#define PIXEL_KERNELS_ISA scalar
+#include "pixel_kernels.inl"
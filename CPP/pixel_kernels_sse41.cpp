@@ -0,0 +1,10 @@
+// The kernels for SSE4.1. The MSVC toolset of the project has no /arch for SSE4.1, so with MSVC this file
+// is built with the x64 baseline (SSE2) vectorization
+#include "pixel_kernels.h"
+
+#ifndef _MSC_VER
+#pragma GCC target("sse4.1")
+#endif
+
+#define PIXEL_KERNELS_ISA sse41
+#include "pixel_kernels.inl"
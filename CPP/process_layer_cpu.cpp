@@ -1,27 +1,59 @@
-﻿#include <d3d11.h>
-#include <plog/Log.h>
+﻿#ifdef _WIN32
+#include <Windows.h>
+#include <psapi.h>
+#else
+#include <malloc.h>
+#include <unistd.h>
+#endif
 
 #include "process_layer_cpu.h"
+#include "pixel_kernels.h"
+#include "thread_placement.h"
+#include "timers.h"
 
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <iostream>
-#include <psapi.h>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 
 
 namespace process_layer_cpu
 {
 	// The x_end, y_end and x_end*y_end of the buffers 
 	int x_size = 0, y_size = 0, xy_size = 0;
-	int x_end = 0, y_end = 0;
 
-	// The pixels and texture
-	ID3D11Device* d3d_device = nullptr;
+	// The pixels of the frame
 	byte* pixels = nullptr;
-	byte* cached_pixels = nullptr;
-	ID3D11Texture2D* texture = nullptr;
-	ID3D11DeviceContext* d3d_context = nullptr;
 
-	bool is_enable_cached_buffer = false;
+	// Used when the size of the L2 cache can't be read from the system
+	constexpr size_t default_l2_cache_size = 1024 * 1024;
+
+	// Counters of the buffers that were allocated, to measure the allocation churn of the resizes
+	std::atomic<unsigned long long> allocations_count(0);
+	std::atomic<unsigned long long> allocated_bytes(0);
+
+	void* allocate(const size_t size)
+	{
+		allocations_count++;
+		allocated_bytes += size;
+		return malloc(size);
+	}
+
+	// Return the pages of the freed buffers to the system
+	void reduce_memory_usage()
+	{
+#ifdef _WIN32
+		EmptyWorkingSet(GetCurrentProcess());
+#elif defined(__GLIBC__)
+		malloc_trim(0);
+#endif
+	}
 
 
 	// The sizes of the buffers in different way...
@@ -33,86 +65,342 @@ namespace process_layer_cpu
 	int xa_start, xa_end;
 	int xb_start, xb_end;
 
+	void set_frame_geometry(const int x_size, const int y_size)
+	{
+		process_layer_cpu::x_size = x_size;
+		process_layer_cpu::y_size = y_size;
+
+		xb_size = x_size * 4;
+		xa_size = (y_size - 1) * xb_size;
+		xb_size0_b = xb_size - 4;
+		xab_size = x_size * (y_size - 1) * 4;
+
+		xy_size = x_size * (y_size + 1);
+
+		xa_start = xb_size * 4;
+		xa_end = xa_size - xb_size * 4;
+		xb_start = 4 * 8;
+		xb_end = xb_size - 4 * 8;
+	}
 
-#define GET_XA(point) (((point) / xb_size) * xb_size)
-#define GET_XB(point) ((point) - GET_XA(point))
 
 	namespace map_images
 	{
-		bool is_enabled = false;
+		struct Job;
+	}
+
+	namespace glass_effect::background_model
+	{
+		struct Region;
+	}
+
+	// The state of one target window. The functions of the layer work on it through context, while the frame
+	// geometry above is of the frame that load_frame loaded last
+	struct Context
+	{
+		int x_size = 0, y_size = 0;
+		int x_end = 0, y_end = 0;
 
-		// Amount of pixels to skip for few image process functions
-		int img_proc_xa_skip, img_proc_xb_skip;
-		// Amount of pixels to skip of the isImageArea function
-		int is_img_area_xa_skip, is_img_area_xb_skip;
+		// Hash of each row of the last frame, to find the new frames without keeping a copy of its pixels
+		uint64_t* cached_row_hashes = nullptr;
+		bool is_enable_cached_buffer = false;
 
-		// Map array that map the area of each shapes groups
-		bool* image_area_data = nullptr;
+		// The first row of cached_row_hashes that was not updated yet with the current frame
+		int cached_rows_pending_row = -1;
+
+		// Only every analysis_scale pixel (in each axis) is analyzed when detecting images and building
+		// the reduced map. The mark pass always works on the full resolution
+		int analysis_scale = 1;
+		std::atomic<int> requested_analysis_scale{1};
+
+		bool map_images_enabled = false;
+		bool async_detection = false;
+
+		// Bit mask of the pixels that are part of images (see bit_mask.h)
+		bit_mask::Word* image_area_data = nullptr;
+
+		// Size in pixels of the grid of is_image_area
+		int is_image_area_grid_size = 0;
 
 		// Map array of common colors that used for detecting images
 		bool common_colors[256] = {false};
 
 		// Timer about when to update the common color data
+		timers::Time update_common_colors_timer = 0;
+
+		map_images::Job* detection_job = nullptr;
+
+		// Each frame of map_images gets the next version. The images map is of the frame of detected_version,
+		// that is -1 until the images of a whole frame were searched once
+		int images_frame_version = 0;
+		int images_detected_version = -1;
+
+		// Milliseconds of the last search in a whole frame
+		double images_detection_time = 0;
+
+		// Decimated copy of the frame and of image_area_data that used when analysis_scale > 1. They only grow
+		byte* analysis_pixels = nullptr;
+		bit_mask::Word* analysis_image_area_data = nullptr;
+		int analysis_x_size = 0, analysis_y_size = 0;
+		int analysis_pixels_capacity = 0, analysis_image_area_capacity = 0;
+
+		bool glass_effect_enabled = false;
+		double images_level = 0, shapes_level = 0, background_level = 0;
+		bool dark_background_mode = false;
+
+		// The reduced maps only grow. The cubes that a partial frame did not build are of the last frames of the
+		// context, moved with the content. pixels_reduced_built has the colors of the cubes before the noise
+		// reduction, so a partial frame can reduce the noise of the whole map again
+		byte* pixels_reduced = nullptr;
+		byte* pixels_reduced_built = nullptr;
+		int pixels_reduced_capacity = 0;
+		int x_size_reduced = 0, y_size_reduced = 0, xy_size_reduced = 0;
+
+		// The cube x_r starts at the pixel x_r * cube_size - grid_x_offset (see glass_effect::set_grid)
+		int grid_x_offset = 0, grid_y_offset = 0;
+
+		glass_effect::background_model::Region* background_regions = nullptr;
+		int background_regions_x = 0, background_regions_y = 0;
+
+		bool scroll_detection_enabled = false;
+		int tiles_x = 0, tiles_y = 0;
+
+		// Hash of each row inside each column of tiles (band) and hash of each column inside each
+		// row of tiles (strip). Index 0 is the current frame and index 1 is the previous frame.
+		// The hashes are stored per lane, hashes[lane * line_count + line]
+		uint32_t* row_hashes[2] = {nullptr, nullptr};
+		uint32_t* column_hashes[2] = {nullptr, nullptr};
+
+		byte* tiles_state = nullptr;
+		int* shift_votes = nullptr;
+
+		// The output of the last processed frame
+		byte* processed_pixels = nullptr;
+
+		// Any change in the effect settings makes the previous output useless
+		std::atomic<int> settings_version{0};
+		int frame_settings_version = 0;
+		int processed_settings_version = -1;
+	};
+
+	Context default_context;
+
+	// The context that all the functions of the calling thread work on
+	thread_local Context* context = &default_context;
+
+
+#define GET_XA(point) (((point) / xb_size) * xb_size)
+#define GET_XB(point) ((point) - GET_XA(point))
+
+	namespace map_images
+	{
+		// Interval of the updates of the common color data
 		constexpr int update_common_color_interval = 5000;
-		clock_t update_common_colors_timer = 0;
 
 
 		constexpr double is_image_area_grid = 0.0028116213683224;
 		constexpr int is_image_area_grid_points = 4;
 
-		void enable()
+		// The frame that the images are searched in. The functions of the search take it by the names of the
+		// globals, so they search the same in the frame of the context and in a copy of it
+		struct Frame
+		{
+			byte* pixels = nullptr;
+			int x_size = 0, y_size = 0;
+			int xb_size = 0, xa_size = 0, xb_size0_b = 0;
+			int xa_start = 0, xa_end = 0, xb_start = 0, xb_end = 0;
+
+			// Amount of pixels to skip for few image process functions
+			int img_proc_xa_skip = 0, img_proc_xb_skip = 0;
+			// Amount of pixels to skip of the isImageArea function
+			int is_img_area_xa_skip = 0, is_img_area_xb_skip = 0;
+
+			bit_mask::Word* image_area_data = nullptr;
+			bool* common_colors = nullptr;
+		};
+
+		// With async detection, the images of the whole frame are searched by the detection thread in a copy of
+		// the frame, and the frames are processed meanwhile with the images map of the last detection that
+		// finished. Each context has its own job
+		enum class JobState
+		{
+			IDLE,
+			QUEUED,
+			RUNNING,
+			DONE // The images were found, and they wait for the frame thread to take them
+		};
+
+		struct Job
 		{
-			is_enabled = true;
+			std::atomic<JobState> state{JobState::IDLE};
+
+			// The copy of the frame at the analysis scale, and the images that were found in it
+			byte* pixels = nullptr;
+			bit_mask::Word* image_area_data = nullptr;
+			int pixels_capacity = 0, image_area_capacity = 0;
+			int x_size = 0, y_size = 0;
+			int grid_size = 0;
+			bool common_colors[256] = {false};
+			bool update_common_colors = false;
+
+			// The frame that was copied
+			int frame_x_size = 0, frame_y_size = 0;
+			int analysis_scale = 1;
+			int frame_version = 0;
+
+			// Changes of the frames after the copy, set by the frame thread: the rects that were searched again,
+			// and if the frame was shifted (so the images of the copy are not at their place anymore)
+			std::vector<Rect> refreshed_rects;
+			bool is_shifted = false;
+
+			double detection_time = 0; // Milliseconds, set by the detection thread
+			timers::Time next_detection_timer = 0;
+			timers::Waiter* waiter = nullptr; // Of the thread that queued the job, woken when it is done
+		};
+
+		// A frame whose last search took less milliseconds than this is searched by the frame thread, since then
+		// the copy of the frame for the detection thread costs about as much as the search
+		constexpr double max_frame_thread_detection_time = 2;
+
+		// The jobs that wait for the detection thread, of all the contexts
+		std::mutex jobs_mutex;
+		std::condition_variable jobs_changed;
+		std::deque<Job*> queued_jobs;
+		bool is_detection_thread_started = false;
+		bool stop_detection_thread = false;
+
+		// After each detection the next one waits twice its time, so on frames that are changed all the time the
+		// detection thread works a third of the time at most
+		constexpr double detection_delay_ratio = 2;
+		constexpr int min_detection_delay = 30;
+		constexpr int max_detection_delay = 1000;
+
+		// The images of the rects that were searched again after the copy are kept. With more rects than this
+		// the images of the copy are dropped
+		constexpr size_t max_refreshed_rects = 256;
+		std::vector<bit_mask::Word> refreshed_bits;
+
+		// The rects of the map that the last images of the detection thread changed, in bands of this many rows,
+		// and the map before it took them
+		constexpr int changed_band_rows = 8;
+		std::vector<Rect> changed_rects;
+		std::vector<bit_mask::Word> previous_image_area;
+
+		void free_detection_job();
+
+		void enable(const bool async_detection)
+		{
+			context->map_images_enabled = true;
+			context->async_detection = async_detection;
 		}
 
 		void disable()
 		{
-			is_enabled = false;
+			context->map_images_enabled = false;
 		}
 
 		void free_resources()
 		{
-			if (image_area_data)
+			free_detection_job();
+
+			if (context->image_area_data)
+			{
+				free(context->image_area_data);
+				context->image_area_data = nullptr;
+			}
+		}
+
+		void free_analysis_buffers()
+		{
+			if (context->analysis_pixels)
+			{
+				free(context->analysis_pixels);
+				context->analysis_pixels = nullptr;
+			}
+
+			if (context->analysis_image_area_data)
 			{
-				free(image_area_data);
-				image_area_data = nullptr;
+				free(context->analysis_image_area_data);
+				context->analysis_image_area_data = nullptr;
 			}
+
+			context->analysis_pixels_capacity = context->analysis_image_area_capacity = 0;
+		}
+
+		// The geometry of the frame is the same as set_frame_geometry gives to the globals
+		Frame get_frame(byte* pixels, const int x_size, const int y_size, bit_mask::Word* image_area_data,
+		                bool* common_colors, const int grid_size)
+		{
+			Frame frame;
+			frame.pixels = pixels;
+			frame.x_size = x_size;
+			frame.y_size = y_size;
+			frame.image_area_data = image_area_data;
+			frame.common_colors = common_colors;
+
+			frame.xb_size = x_size * 4;
+			frame.xa_size = (y_size - 1) * frame.xb_size;
+			frame.xb_size0_b = frame.xb_size - 4;
+			frame.xa_start = frame.xb_size * 4;
+			frame.xa_end = frame.xa_size - frame.xb_size * 4;
+			frame.xb_start = 4 * 8;
+			frame.xb_end = frame.xb_size - 4 * 8;
+
+			// IsImageArea grid
+			frame.is_img_area_xa_skip = grid_size * frame.xb_size;
+			frame.is_img_area_xb_skip = grid_size * 4;
+
+			// Update image poses grid
+			frame.img_proc_xa_skip = frame.is_img_area_xa_skip * is_image_area_grid_points;
+			frame.img_proc_xb_skip = frame.is_img_area_xb_skip * is_image_area_grid_points;
+			return frame;
+		}
+
+		// The grid of is_image_area in the pixels of the analyzed frame
+		int get_analysis_grid_size()
+		{
+			const auto grid_size = context->is_image_area_grid_size / context->analysis_scale;
+			return grid_size ? grid_size : 1;
 		}
 
 		bool init()
 		{
 			free_resources();
 
-			image_area_data = static_cast<bool*>(malloc(xy_size * sizeof(bool)));
-			if (!image_area_data)
+			context->image_area_data = static_cast<bit_mask::Word*>(allocate(bit_mask::bytes_count(xy_size)));
+			if (!context->image_area_data)
 			{
 				std::cout << "Failed to malloc CPU memory for d_image_area_data\n";
 				return false;
 			}
 
+#ifdef _WIN32
 			RECT rect_screen_size = {0};
 			GetWindowRect(GetDesktopWindow(), &rect_screen_size);
 
 			const int xy_screen_size = rect_screen_size.right + rect_screen_size.bottom;
+#else
+			// There is no desktop window to measure, so the grid follows the size of the frame
+			const int xy_screen_size = x_size + y_size;
+#endif
 
 
-			// IsImageArea grid
-			const int tmp = is_image_area_grid * xy_screen_size;
-			is_img_area_xa_skip = tmp * xb_size;
-			is_img_area_xb_skip = tmp * 4;
-
-			// Update image poses grid
-			img_proc_xa_skip = is_img_area_xa_skip * is_image_area_grid_points;
-			img_proc_xb_skip = is_img_area_xb_skip * is_image_area_grid_points;
+			context->is_image_area_grid_size = is_image_area_grid * xy_screen_size;
 
-			memset(image_area_data, false, xy_size * sizeof(bool));
+			bit_mask::clear_all(context->image_area_data, xy_size);
 
-			update_common_colors_timer = -update_common_color_interval;
+			context->update_common_colors_timer = 0;
+			context->images_frame_version = 0;
+			context->images_detected_version = -1;
 			return true;
 		}
 
-		void update_common_colors()
+		void update_common_colors(const Frame& frame)
 		{
+			auto* const pixels = frame.pixels;
+			auto* const common_colors = frame.common_colors;
+			const auto x_size = frame.x_size, y_size = frame.y_size, xb_size = frame.xb_size;
+
 			auto add_color = [&](const byte* color)
 			{
 				common_colors[(color[2] + color[1] + color[0]) / 3] = true;
@@ -257,16 +545,61 @@ namespace process_layer_cpu
 			}
 		}
 
-		bool* map_images(bool force_update_common_colors)
+		// Bounding box of the connected busy cells of the grid of detect_images
+		struct GridBox
 		{
-			if (force_update_common_colors || clock() - update_common_colors_timer >= update_common_color_interval)
+			int col1, row1, col2, row2;
+			bool has_seed; // Indicates if one of the cells is inside the searched range
+		};
+
+		// Scratch buffers of detect_images. They are shared by all the contexts and only grow, and the detection
+		// thread has its own
+		thread_local std::vector<int> grid_parents;
+		thread_local std::vector<int> grid_run_starts, grid_run_ends;
+		thread_local std::vector<GridBox> grid_boxes;
+
+		// Rows of cells that are labeled together before the labels of the bands are joined
+		constexpr int grid_band_rows = 8;
+		// Cells that the grid of detect_images covers around the searched range
+		constexpr int grid_margin_cells = 4;
+		// An image must be wider than 3 cells of the grid, like the greedy search required
+		constexpr int min_image_cols = 5;
+		// How many cells the runs of busy cells of adjacent rows may differ and still be one image
+		constexpr int max_run_shift = 1;
+
+		int find_grid_root(int cell)
+		{
+			while (grid_parents[cell] != cell)
 			{
-				update_common_colors();
-				update_common_colors_timer = clock();
+				grid_parents[cell] = grid_parents[grid_parents[cell]];
+				cell = grid_parents[cell];
 			}
 
-			memset(image_area_data, false, sizeof(bool) * xy_size);
+			return cell;
+		}
+
+		// The root of the joined label is the first cell of both, so the box starts in its row
+		void union_grid_cells(const int cell1, const int cell2)
+		{
+			const auto root1 = find_grid_root(cell1);
+			const auto root2 = find_grid_root(cell2);
+			if (root1 < root2)
+				grid_parents[root2] = root1;
+			else if (root2 < root1)
+				grid_parents[root1] = root2;
+		}
 
+		// Search for images that their seed point is inside the given xa/xb range.
+		// The found images are allowed to grow outside of this range
+		void detect_images(const Frame& frame, const int xa_from, const int xa_to, const int xb_from, const int xb_to)
+		{
+			auto* const pixels = frame.pixels;
+			auto* const image_area_data = frame.image_area_data;
+			const auto* const common_colors = frame.common_colors;
+			const auto xb_size = frame.xb_size, xa_size = frame.xa_size, xb_size0_b = frame.xb_size0_b;
+			const auto xa_start = frame.xa_start, xa_end = frame.xa_end, xb_start = frame.xb_start, xb_end = frame.xb_end;
+			const auto img_proc_xa_skip = frame.img_proc_xa_skip, img_proc_xb_skip = frame.img_proc_xb_skip;
+			const auto is_img_area_xa_skip = frame.is_img_area_xa_skip, is_img_area_xb_skip = frame.is_img_area_xb_skip;
 
 			auto is_image_area = [&](const int point, int level = 5)
 			{
@@ -310,840 +643,3184 @@ namespace process_layer_cpu
 			};
 
 
-			for (auto xa = xa_start; xa <= xa_end; xa += img_proc_xa_skip)
+			// Classify each cell of the grid as busy or flat, label the connected busy cells with union-find
+			// and take the bounding box of each label. Each cell is visited once, so the cost is linear.
+			// The grid covers a margin around the given range, so images can grow out of it
+			auto grid_xa_from = xa_from, grid_xb_from = xb_from;
+			for (auto i = 0; i < grid_margin_cells && grid_xa_from - img_proc_xa_skip >= xa_start; i++)
+				grid_xa_from -= img_proc_xa_skip;
+			for (auto i = 0; i < grid_margin_cells && grid_xb_from - img_proc_xb_skip >= xb_start; i++)
+				grid_xb_from -= img_proc_xb_skip;
+
+			const auto seed_row_from = (xa_from - grid_xa_from) / img_proc_xa_skip;
+			const auto seed_col_from = (xb_from - grid_xb_from) / img_proc_xb_skip;
+			auto seed_rows = 0, seed_cols = 0;
+			for (auto xa = xa_from; xa <= xa_to; xa += img_proc_xa_skip) seed_rows++;
+			for (auto xb = xb_from; xb < xb_to; xb += img_proc_xb_skip) seed_cols++;
+			if (seed_rows == 0 || seed_cols == 0)
+				return;
+
+			auto rows = seed_row_from + seed_rows, cols = seed_col_from + seed_cols;
+			for (auto i = 0; i < grid_margin_cells && grid_xa_from + rows * img_proc_xa_skip < xa_end; i++) rows++;
+			for (auto i = 0; i < grid_margin_cells && grid_xb_from + cols * img_proc_xb_skip < xb_end; i++) cols++;
+
+			grid_parents.resize(rows * cols);
+			grid_run_starts.resize(rows * cols);
+			grid_run_ends.resize(rows * cols);
+
+			// Busy cells of the same row are joined, and busy cells of adjacent rows are joined only when their
+			// runs start and end at about the same columns. So an image that touches another image or a busy
+			// line of text is kept as its own box, instead of one box around both
+			auto is_same_image = [&](const int cell1, const int cell2)
 			{
-				for (auto xb = xb_start; xb < xb_end; xb += img_proc_xb_skip)
-				{
-					auto point = xa + xb;
-
-					if (image_area_data[point / 4]) continue;
-
-					if (!is_image_area(point)) continue;
-
-					auto point_a = point;
-					auto point_b = -1;
+				return abs(grid_run_starts[cell1] - grid_run_starts[cell2]) <= max_run_shift &&
+					abs(grid_run_ends[cell1] - grid_run_ends[cell2]) <= max_run_shift;
+			};
 
-					int xb2, xb1 = xb, xa1 = xa;
+			// The bands are labeled independently (the root of a label is its first cell, so it is inside
+			// the band), and then the labels are joined across the borders of the bands
+			for (auto band_row = 0; band_row < rows; band_row += grid_band_rows)
+			{
+				auto band_row_end = band_row + grid_band_rows;
+				if (band_row_end > rows) band_row_end = rows;
 
-					for (xb += img_proc_xb_skip; xb < xb_end; xb += img_proc_xb_skip)
+				for (auto row = band_row; row < band_row_end; row++)
+				{
+					const auto xa = grid_xa_from + row * img_proc_xa_skip;
+					auto* const row_parents = &grid_parents[row * cols];
+					for (auto col = 0; col < cols; col++)
 					{
-						point = xa + xb;
-						if (image_area_data[point / 4]) break;
-						if (!is_image_area(point, 10)) break;
-						point_b = point;
-						xb2 = xb;
+						const auto point = xa + grid_xb_from + col * img_proc_xb_skip;
+
+						// The images that were already found are not searched again
+						const auto busy = !bit_mask::test(image_area_data, point / 4) && is_image_area(point);
+						row_parents[col] = busy ? row * cols + col : -1;
 					}
 
-					if (point_b == -1 || (xb2 - xb1) / img_proc_xb_skip <= 3) continue;
+					for (auto col = 0; col < cols;)
+					{
+						if (row_parents[col] < 0)
+						{
+							col++;
+							continue;
+						}
 
-					auto point_c = -1, xa2 = -1;
+						auto col_end = col + 1;
+						while (col_end < cols && row_parents[col_end] >= 0)
+							col_end++;
 
-					for (auto xb_2 = xb1; xb_2 < xb2; xb_2 += img_proc_xb_skip)
-						for (auto xa_2 = xa1; xa_2 < xa_size; xa_2 += img_proc_xa_skip)
+						for (auto col2 = col; col2 < col_end; col2++)
 						{
-							point = xa_2 + xb_2;
-							if (image_area_data[point / 4]) break;
-							if (!is_image_area(point)) break;
-							if (xa_2 <= xa2) continue;
-							xa2 = xa_2;
-							point_c = point;
+							const auto cell = row * cols + col2;
+							grid_run_starts[cell] = col;
+							grid_run_ends[cell] = col_end;
+							if (col2 > col)
+								union_grid_cells(cell - 1, cell);
+							if (row > band_row && grid_parents[cell - cols] >= 0 && is_same_image(cell - cols, cell))
+								union_grid_cells(cell - cols, cell);
 						}
 
+						col = col_end;
+					}
+				}
+			}
 
-					if (xa2 == -1) continue;
+			for (auto row = grid_band_rows; row < rows; row += grid_band_rows)
+				for (auto col = 0; col < cols; col++)
+				{
+					const auto cell = row * cols + col;
+					if (grid_parents[cell] >= 0 && grid_parents[cell - cols] >= 0 && is_same_image(cell - cols, cell))
+						union_grid_cells(cell - cols, cell);
+				}
 
+			// The box of each label is kept in the index of its root
+			grid_boxes.resize(rows * cols);
+			for (auto row = 0; row < rows; row++)
+				for (auto col = 0; col < cols; col++)
+				{
+					const auto cell = row * cols + col;
+					if (grid_parents[cell] < 0)
+						continue;
 
-#if 1 // Filter 1 - PROCESS_LAYER_HANDLE_UNSTABLE_IMAGE
+					const auto is_seed = row >= seed_row_from && row < seed_row_from + seed_rows &&
+						col >= seed_col_from && col < seed_col_from + seed_cols;
 
-					while (true)
+					auto& box = grid_boxes[find_grid_root(cell)];
+					if (find_grid_root(cell) == cell)
 					{
-						auto b_xb_size_new = false;
-
-						for (auto xa_2 = xa1; xa_2 <= xa2; xa_2 += img_proc_xa_skip)
-						{
-							for (auto xb_2 = xb2 + img_proc_xb_skip; xb_2 <= xb_end; xb_2 += img_proc_xb_skip)
-							{
-								point = xa_2 + xb_2;
-								if (image_area_data[point / 4]) break;
-								if (!is_image_area(point, 10)) break;
-								if (xb_2 <= xb2) continue;
-								xb2 = xb_2;
-								point_b = point;
-								b_xb_size_new = true;
-								//DrawDebugPixelPoint2(iPointB, RGB(0, 0, 255), 5);
-							}
-
-							for (auto xb_2 = xb1 - img_proc_xb_skip; xb_2 > xb_start; xb_2 -= img_proc_xb_skip)
-							{
-								point = xa_2 + xb_2;
-								if (image_area_data[point / 4]) break;
-								if (!is_image_area(point, 10)) break;
-								if (xb_2 >= xb1) continue;
-								xb1 = xb_2;
-								point_a = point;
-								b_xb_size_new = true;
-								//DrawDebugPixelPoint2(iPointA, RGB(0, 0, 255), 5);
-							}
-						}
+						box = {col, row, col, row, is_seed};
+						continue;
+					}
 
-						if (!b_xb_size_new) break;
+					if (col < box.col1) box.col1 = col;
+					if (col > box.col2) box.col2 = col;
+					box.row2 = row;
+					box.has_seed = box.has_seed || is_seed;
+				}
 
+			for (auto cell = 0; cell < rows * cols; cell++)
+			{
+				if (grid_parents[cell] != cell)
+					continue;
 
-						auto is_xa_size_new = false;
+				const auto& box = grid_boxes[cell];
+				if (!box.has_seed || box.col2 - box.col1 < min_image_cols - 1)
+					continue;
 
-						for (auto xb_2 = xb1; xb_2 <= xb2; xb_2 += img_proc_xb_skip)
-						{
-							for (auto xa_2 = xa2 + img_proc_xa_skip; xa_2 < xa_end; xa_2 += img_proc_xa_skip)
-							{
-								point = xa_2 + xb_2;
-								if (image_area_data[point / 4]) break;
-								if (!is_image_area(point, 10)) break;
-								if (xa_2 <= xa2) continue;
-								xa2 = xa_2;
-								point_c = point;
-								is_xa_size_new = true;
-							}
+				auto xa1 = grid_xa_from + box.row1 * img_proc_xa_skip;
+				auto xa2 = grid_xa_from + box.row2 * img_proc_xa_skip;
+				auto xb1 = grid_xb_from + box.col1 * img_proc_xb_skip;
+				auto xb2 = grid_xb_from + box.col2 * img_proc_xb_skip;
 
-							for (auto xa_2 = xa1 - img_proc_xa_skip; xa_2 > xa_start; xa_2 -= img_proc_xa_skip)
-							{
-								point = xa_2 + xb_2;
-								if (image_area_data[point / 4]) break;
-								if (!is_image_area(point, 10)) break;
-								if (xa_2 >= xa1) continue;
-								xa1 = xa_2;
-								point_a = point;
-								is_xa_size_new = true;
-							}
+				// The corners that the border refinement starts from
+				auto point_a = xa1 + xb1;
+				auto point_b = xa1 + xb2;
+				const auto point_c = xa2 + xb1;
 
-							if (!is_xa_size_new) break;
-						}
-					}
-#endif
+				// The refined border of a box before may already cover this one, like the greedy search
+				// skipped the seed points inside the images that it found
+				const auto point_center = GET_XA((xa1 + xa2) / 2) + GET_XB((xb1 + xb2) / 2) / 4 * 4;
+				if (bit_mask::test(image_area_data, point_center / 4))
+					continue;
 
 #if 1 // Filter 2 - PROCESS_LAYER_IMPROVE_POINTS
 
-					for (auto point = point_c + xb_size; point < xa_size; point += xb_size)
+				for (auto point = point_c + xb_size; point < xa_size; point += xb_size)
+				{
+					if (
+						common_colors[(pixels[point + 2] + pixels[point + 1] + pixels[point]) / 3]
+						||
+						bit_mask::test(image_area_data, point / 4))
 					{
-						if (
-							common_colors[(pixels[point + 2] + pixels[point + 1] + pixels[point]) / 3]
-							||
-							image_area_data[point / 4])
-						{
-							xa2 = GET_XA(point - xb_size);
-							break;
-						}
+						xa2 = GET_XA(point - xb_size);
+						break;
 					}
+				}
 
 
-					auto point_end = xa1 + xb_size0_b;
-					for (auto point = point_b + 4; point < point_end; point += 4)
+				auto point_end = xa1 + xb_size0_b;
+				for (auto point = point_b + 4; point < point_end; point += 4)
+				{
+					if (
+						common_colors[(pixels[point + 2] + pixels[point + 1] + pixels[point]) / 3]
+						||
+						bit_mask::test(image_area_data, point / 4))
 					{
-						if (
-							common_colors[(pixels[point + 2] + pixels[point + 1] + pixels[point]) / 3]
-							||
-							image_area_data[point / 4])
-						{
-							xb2 = GET_XB(point - 4);
-							break;
-						}
+						xb2 = GET_XB(point - 4);
+						break;
 					}
+				}
 
 
-					for (auto point = point_a - 4; point > xa1; point -= 4)
+				for (auto point = point_a - 4; point > xa1; point -= 4)
+				{
+					if (common_colors[(pixels[point + 2] + pixels[point + 1] + pixels[point]) / 3]
+						||
+						bit_mask::test(image_area_data, point / 4))
 					{
-						if (common_colors[(pixels[point + 2] + pixels[point + 1] + pixels[point]) / 3]
-							||
-							image_area_data[point / 4])
-						{
-							xb1 = GET_XB(point + 4);
-							break;
-						}
+						xb1 = GET_XB(point + 4);
+						break;
 					}
+				}
 
 
-					for (auto point = point_a - xb_size; point > 0; point -= xb_size)
+				for (auto point = point_a - xb_size; point > 0; point -= xb_size)
+				{
+					if (
+						common_colors[(pixels[point + 2] + pixels[point + 1] + pixels[point]) / 3]
+						||
+						bit_mask::test(image_area_data, point / 4))
 					{
-						if (
-							common_colors[(pixels[point + 2] + pixels[point + 1] + pixels[point]) / 3]
-							||
-							image_area_data[point / 4])
-						{
-							xa1 = GET_XA(point + xb_size);
-							break;
-						}
+						xa1 = GET_XA(point + xb_size);
+						break;
 					}
+				}
 
 #endif
 
 #if 1 // Filter 3 - PROCESS_LAYER_IMPROVE_BORDERS
 
 
-					auto is_uniform_color_from_line_exists = [&](int point_a, int point_b, int skipLevel)
-					{
-						auto unique_pixels = 0;
-
-						for (auto point = point_a + skipLevel; point <= point_b; point += skipLevel)
-							if (!common_colors[(pixels[point + 2] + pixels[point + 1] + pixels[point]) / 3])
-								unique_pixels++;
-							else
-								unique_pixels--;
+				auto is_uniform_color_from_line_exists = [&](int point_a, int point_b, int skipLevel)
+				{
+					auto unique_pixels = 0;
 
-						if (unique_pixels > 0)
-							return false;
+					for (auto point = point_a + skipLevel; point <= point_b; point += skipLevel)
+						if (!common_colors[(pixels[point + 2] + pixels[point + 1] + pixels[point]) / 3])
+							unique_pixels++;
 						else
-							return true;
-					};
+							unique_pixels--;
+
+					if (unique_pixels > 0)
+						return false;
+					else
+						return true;
+				};
+
+
+				// Improve iXa1
+
+				auto xa_2 = xa1 - xb_size;
+				if (xa_2 > 0)
+				{
+					point_a = xa_2 + xb1;
+					point_b = xa_2 + xb2;
+					///wp(iPointA); wp(iPointB);
+					if (!is_uniform_color_from_line_exists(point_a, point_b, 4))
+					{
+						///DrawDebugPixelPoint2r(iPointA, RGB(0, 255, 0), 10);
+						for (xa_2 -= xb_size; xa_2 > 0; xa_2 -= xb_size)
+							if (is_uniform_color_from_line_exists(xa_2 + xb1, xa_2 + xb2, 4))
+							{
+								xa1 = xa_2 + xb_size;
+								break;
+							}
+					}
+				}
 
 
-					// Improve iXa1
+				// Improve iXa2
 
-					auto xa_2 = xa1 - xb_size;
-					if (xa_2 > 0)
+				if (!is_uniform_color_from_line_exists(xa2 + xb1, xa2 + xb2, 4))
+				{
+					xa_2 = xa2 + xb_size;
+					auto xa_max = xa_end - xb_size;
+					if (xa_2 < xa_max)
 					{
-						point_a = xa_2 + xb1;
-						point_b = xa_2 + xb2;
-						///wp(iPointA); wp(iPointB);
-						if (!is_uniform_color_from_line_exists(point_a, point_b, 4))
+						if (!is_uniform_color_from_line_exists(xa_2 + xb1, xa_2 + xb2, 4))
 						{
-							///DrawDebugPixelPoint2r(iPointA, RGB(0, 255, 0), 10);
-							for (xa_2 -= xb_size; xa_2 > 0; xa_2 -= xb_size)
+							for (xa_2 += xb_size; xa_2 < xa_max; xa_2 += xb_size)
 								if (is_uniform_color_from_line_exists(xa_2 + xb1, xa_2 + xb2, 4))
 								{
-									xa1 = xa_2 + xb_size;
+									xa2 = xa_2 - xb_size;
 									break;
 								}
 						}
 					}
-
-
-					// Improve iXa2
-
-					if (!is_uniform_color_from_line_exists(xa2 + xb1, xa2 + xb2, 4))
-					{
-						xa_2 = xa2 + xb_size;
-						auto xa_max = xa_end - xb_size;
-						if (xa_2 < xa_max)
+				}
+				else
+				{
+					for (xa_2 = xa2 - xb_size; xa_2 > xa1; xa_2 -= xb_size)
+						if (!is_uniform_color_from_line_exists(xa_2 + xb1, xa_2 + xb2, 4))
 						{
-							if (!is_uniform_color_from_line_exists(xa_2 + xb1, xa_2 + xb2, 4))
-							{
-								for (xa_2 += xb_size; xa_2 < xa_max; xa_2 += xb_size)
-									if (is_uniform_color_from_line_exists(xa_2 + xb1, xa_2 + xb2, 4))
-									{
-										xa2 = xa_2 - xb_size;
-										break;
-									}
-							}
+							xa2 = xa_2;
+							break;
 						}
-					}
-					else
-					{
-						for (xa_2 = xa2 - xb_size; xa_2 > xa1; xa_2 -= xb_size)
-							if (!is_uniform_color_from_line_exists(xa_2 + xb1, xa_2 + xb2, 4))
-							{
-								xa2 = xa_2;
-								break;
-							}
-					}
+				}
 
 
-					int xb_2;
-					if (!is_uniform_color_from_line_exists(xa1 + xb1, xa2 + xb1, xb_size))
+				int xb_2;
+				if (!is_uniform_color_from_line_exists(xa1 + xb1, xa2 + xb1, xb_size))
+				{
+					xb_2 = xb1 - 4;
+					if (xb_2 > 0)
 					{
-						xb_2 = xb1 - 4;
-						if (xb_2 > 0)
+						if (!is_uniform_color_from_line_exists(xa1 + xb_2, xa2 + xb_2, xb_size))
 						{
-							if (!is_uniform_color_from_line_exists(xa1 + xb_2, xa2 + xb_2, xb_size))
-							{
-								for (xb_2 -= 4; xb_2 > 0; xb_2 -= 4)
-									if (is_uniform_color_from_line_exists(xb_2 + xa1, xb_2 + xa2, xb_size))
-									{
-										xb1 = xb_2 + 4;
-										break;
-									}
-							}
+							for (xb_2 -= 4; xb_2 > 0; xb_2 -= 4)
+								if (is_uniform_color_from_line_exists(xb_2 + xa1, xb_2 + xa2, xb_size))
+								{
+									xb1 = xb_2 + 4;
+									break;
+								}
 						}
 					}
-					else
-					{
-						for (auto xb_2 = xb1 + 4; xb_2 < xb2; xb_2 += 4)
-							if (!is_uniform_color_from_line_exists(xa1 + xb_2, xa2 + xb_2, xb_size))
-							{
-								xb1 = xb_2;
-								break;
-							}
-					}
+				}
+				else
+				{
+					for (auto xb_2 = xb1 + 4; xb_2 < xb2; xb_2 += 4)
+						if (!is_uniform_color_from_line_exists(xa1 + xb_2, xa2 + xb_2, xb_size))
+						{
+							xb1 = xb_2;
+							break;
+						}
+				}
 
 
-					if (!is_uniform_color_from_line_exists(xb2 + xa1, xb2 + xa2, xb_size))
+				if (!is_uniform_color_from_line_exists(xb2 + xa1, xb2 + xa2, xb_size))
+				{
+					xb_2 = xb2 + 4;
+					if (xb_2 < xb_size)
 					{
-						xb_2 = xb2 + 4;
-						if (xb_2 < xb_size)
+						if (!is_uniform_color_from_line_exists(xb_2 + xa1, xb_2 + xa2, xb_size))
 						{
-							if (!is_uniform_color_from_line_exists(xb_2 + xa1, xb_2 + xa2, xb_size))
-							{
-								for (xb_2 += 4; xb_2 < xb_size; xb_2 += 4)
-									if (is_uniform_color_from_line_exists(xb_2 + xa1, xb_2 + xa2, xb_size))
-									{
-										xb2 = xb_2 - 4;
-										break;
-									}
-							}
+							for (xb_2 += 4; xb_2 < xb_size; xb_2 += 4)
+								if (is_uniform_color_from_line_exists(xb_2 + xa1, xb_2 + xa2, xb_size))
+								{
+									xb2 = xb_2 - 4;
+									break;
+								}
 						}
 					}
-					else
-					{
-						for (xb_2 = xb2 - 4; xb_2 > xb1; xb_2 -= 4)
-							if (!is_uniform_color_from_line_exists(xb_2 + xa1, xb_2 + xa2, xb_size))
-							{
-								xb2 = xb_2;
-								break;
-							}
-					}
-
-#endif
-
-					for (auto xa_2 = xa1; xa_2 <= xa2; xa_2 += xb_size)
-						for (auto xb_2 = xb1; xb_2 <= xb2; xb_2 += 4)
+				}
+				else
+				{
+					for (xb_2 = xb2 - 4; xb_2 > xb1; xb_2 -= 4)
+						if (!is_uniform_color_from_line_exists(xb_2 + xa1, xb_2 + xa2, xb_size))
 						{
-							auto point = xa_2 + xb_2;
-							image_area_data[point / 4] = true;
+							xb2 = xb_2;
+							break;
 						}
 				}
-			}
 
+#endif
 
-			return image_area_data;
+				for (auto xa_2 = xa1; xa_2 <= xa2; xa_2 += xb_size)
+					bit_mask::fill_range(image_area_data, (xa_2 + xb1) / 4, (xa_2 + xb2) / 4 + 1, true);
+			}
 		}
-	}
 
+		void update_common_colors_if_needed(const Frame& frame, const bool force_update_common_colors)
+		{
+			if (force_update_common_colors || timers::is_due(context->update_common_colors_timer))
+			{
+				update_common_colors(frame);
+				context->update_common_colors_timer = timers::start(update_common_color_interval);
+			}
+		}
 
-	namespace glass_effect
-	{
-		bool is_enabled = false;
-		double images_level, shapes_level, background_level;
-		bool dark_background_mode = false;
+		void detect_images_in_rect(const Frame& frame, const Rect& rect)
+		{
+			const auto x_size = frame.x_size, xb_size = frame.xb_size;
+			const auto xa_start = frame.xa_start, xa_end = frame.xa_end, xb_start = frame.xb_start, xb_end = frame.xb_end;
+			const auto img_proc_xa_skip = frame.img_proc_xa_skip, img_proc_xb_skip = frame.img_proc_xb_skip;
 
-		byte* pixels_reduced = nullptr;
-		int x_size_reduced, y_size_reduced;
-		int xy_size_reduced;
+			for (auto y = rect.top; y < rect.bottom; y++)
+				bit_mask::fill_range(frame.image_area_data, y * x_size + rect.left, y * x_size + rect.right, false);
 
+			// Keep the seed points on the same grid as the full frame search
+			auto align_to_grid = [](const int value, const int grid_start, const int grid_skip)
+			{
+				if (value <= grid_start) return grid_start;
+				return grid_start + ((value - grid_start + grid_skip - 1) / grid_skip) * grid_skip;
+			};
 
-		constexpr int cube_size = 5;
-		constexpr int cube_dim = cube_size * cube_size;
+			const auto xa_from = align_to_grid(rect.top * xb_size, xa_start, img_proc_xa_skip);
+			const auto xb_from = align_to_grid(rect.left * 4, xb_start, img_proc_xb_skip);
+			auto xa_to = (rect.bottom - 1) * xb_size;
+			if (xa_to > xa_end) xa_to = xa_end;
+			auto xb_to = rect.right * 4;
+			if (xb_to > xb_end) xb_to = xb_end;
 
-		void enable(const double glass_background, const bool glass_dark_background,
-		            const double glass_images, const double glass_shapes)
-		{
-			is_enabled = true;
-			glass_effect::background_level = glass_background;
-			glass_effect::images_level = glass_images;
-			glass_effect::shapes_level = glass_shapes;
-			glass_effect::dark_background_mode = glass_dark_background;
+			detect_images(frame, xa_from, xa_to, xb_from, xb_to);
 		}
 
-		void set_background_level(const double glass_background)
+		bool init_analysis_buffers()
 		{
-			glass_effect::background_level = glass_background;
-		}
+			context->analysis_x_size = (x_size + context->analysis_scale - 1) / context->analysis_scale;
+			context->analysis_y_size = (y_size + context->analysis_scale - 1) / context->analysis_scale;
 
-		void set_shapes_level(const double glass_shapes)
-		{
-			glass_effect::shapes_level = glass_shapes;
+			const auto pixels_size = context->analysis_x_size * 4 * context->analysis_y_size;
+			const auto image_area_size = context->analysis_x_size * (context->analysis_y_size + 1);
+
+			if (pixels_size > context->analysis_pixels_capacity ||
+			    image_area_size > context->analysis_image_area_capacity)
+			{
+				free_analysis_buffers();
+
+				context->analysis_pixels = static_cast<byte*>(allocate(pixels_size * sizeof(byte)));
+				context->analysis_image_area_data = static_cast<bit_mask::Word*>(
+					allocate(bit_mask::bytes_count(image_area_size)));
+				if (!context->analysis_pixels || !context->analysis_image_area_data)
+				{
+					std::cout << "Failed to malloc CPU memory for the analysis buffers\n";
+					free_analysis_buffers();
+					return false;
+				}
+
+				context->analysis_pixels_capacity = pixels_size;
+				context->analysis_image_area_capacity = image_area_size;
+			}
+
+			// The buffers may hold a frame of another size, so the row after the last one is cleared again
+			bit_mask::fill_range(context->analysis_image_area_data, context->analysis_x_size * context->analysis_y_size,
+			                     image_area_size, false);
+			return true;
 		}
 
-		void set_dark_background_mode(const bool enable)
+		void decimate_frame(byte* destination, const bool with_image_area)
 		{
-			glass_effect::dark_background_mode = enable;
+			const auto scale = context->analysis_scale;
+			const auto analysis_x_size = context->analysis_x_size;
+			for (auto y = 0; y < context->analysis_y_size; y++)
+			{
+				const auto* const row = reinterpret_cast<const uint32_t*>(&pixels[y * scale * xb_size]);
+				auto* const analysis_row = reinterpret_cast<uint32_t*>(&destination[y * analysis_x_size * 4]);
+				for (auto x = 0; x < analysis_x_size; x++)
+					analysis_row[x] = row[x * scale];
+
+				if (!with_image_area) continue;
+
+				const auto area_row = y * scale * x_size;
+				const auto analysis_area_row = y * analysis_x_size;
+				for (auto x = 0; x < analysis_x_size; x++)
+					bit_mask::assign(context->analysis_image_area_data, analysis_area_row + x,
+					                 bit_mask::test(context->image_area_data, area_row + x * scale));
+			}
 		}
 
-		void disable()
+		// Write the image area that found in the decimated frame back to the full resolution map
+		void upsample_image_area(const bit_mask::Word* source, const int source_x_size, const Rect& rect)
 		{
-			is_enabled = false;
+			const auto scale = context->analysis_scale;
+			for (auto y = rect.top; y < rect.bottom; y++)
+			{
+				const auto analysis_area_row = static_cast<size_t>(y / scale) * source_x_size;
+				const auto area_row = static_cast<size_t>(y) * x_size;
+				bit_mask::fill_range(context->image_area_data, area_row + rect.left, area_row + rect.right, false);
+
+				// Each run of analysis pixels of images is written as one span
+				const auto from = analysis_area_row + rect.left / scale;
+				const auto to = analysis_area_row + (rect.right + scale - 1) / scale;
+				for (auto run = bit_mask::find_next(source, from, to, true); run < to;)
+				{
+					const auto run_end = bit_mask::find_next(source, run, to, false);
+
+					auto x_from = static_cast<int>(run - analysis_area_row) * scale;
+					auto x_to = static_cast<int>(run_end - analysis_area_row) * scale;
+					if (x_from < rect.left) x_from = rect.left;
+					if (x_to > rect.right) x_to = rect.right;
+					bit_mask::fill_range(context->image_area_data, area_row + x_from, area_row + x_to, true);
+
+					run = bit_mask::find_next(source, run_end, to, true);
+				}
+			}
+		}
+
+		// Search the images of the whole frame in the calling thread
+		void detect_frame_images(const bool force_update_common_colors)
+		{
+			context->images_detected_version = context->images_frame_version;
+
+			if (context->analysis_scale > 1 && init_analysis_buffers())
+			{
+				decimate_frame(context->analysis_pixels, false);
+				bit_mask::clear_all(context->analysis_image_area_data,
+				                    context->analysis_x_size * (context->analysis_y_size + 1));
+
+				const auto frame = get_frame(context->analysis_pixels, context->analysis_x_size,
+				                             context->analysis_y_size, context->analysis_image_area_data,
+				                             context->common_colors, get_analysis_grid_size());
+				update_common_colors_if_needed(frame, force_update_common_colors);
+				detect_images(frame, frame.xa_start, frame.xa_end, frame.xb_start, frame.xb_end);
+
+				Rect frame_rect;
+				frame_rect.right = x_size;
+				frame_rect.bottom = y_size;
+				upsample_image_area(context->analysis_image_area_data, context->analysis_x_size, frame_rect);
+				return;
+			}
+
+			const auto frame = get_frame(pixels, x_size, y_size, context->image_area_data, context->common_colors,
+			                             get_analysis_grid_size());
+			update_common_colors_if_needed(frame, force_update_common_colors);
+
+			bit_mask::clear_all(context->image_area_data, xy_size);
+
+			detect_images(frame, frame.xa_start, frame.xa_end, frame.xb_start, frame.xb_end);
+		}
+
+		void detection_thread()
+		{
+			while (true)
+			{
+				Job* job;
+				{
+					std::unique_lock<std::mutex> lock(jobs_mutex);
+					jobs_changed.wait(lock, []() { return !queued_jobs.empty() || stop_detection_thread; });
+
+					// The queued jobs are done before the thread stops
+					if (queued_jobs.empty())
+					{
+						is_detection_thread_started = false;
+						jobs_changed.notify_all();
+						return;
+					}
+
+					job = queued_jobs.front();
+					queued_jobs.pop_front();
+					job->state = JobState::RUNNING;
+				}
+
+				// The detection follows the placement of the frame thread that queued it
+				thread_placement::update_thread();
+				const auto start = std::chrono::steady_clock::now();
+
+				const auto frame = get_frame(job->pixels, job->x_size, job->y_size, job->image_area_data,
+				                             job->common_colors, job->grid_size);
+				bit_mask::clear_all(job->image_area_data, job->x_size * (job->y_size + 1));
+				if (job->update_common_colors)
+					update_common_colors(frame);
+				detect_images(frame, frame.xa_start, frame.xa_end, frame.xb_start, frame.xb_end);
+
+				const std::chrono::duration<double, std::milli> time = std::chrono::steady_clock::now() - start;
+				timers::Waiter* waiter;
+				{
+					std::lock_guard<std::mutex> lock(jobs_mutex);
+					job->detection_time = time.count();
+					job->state = JobState::DONE;
+					waiter = job->waiter;
+				}
+				jobs_changed.notify_all();
+
+				// The frame thread processes the frame again with the new images
+				timers::wake(waiter);
+			}
+		}
+
+		// Copy the frame for the detection thread. Returns false if the copy could not be allocated
+		bool start_detection()
+		{
+			if (!context->detection_job)
+				context->detection_job = new Job();
+			auto& job = *context->detection_job;
+
+			if (context->analysis_scale > 1)
+			{
+				if (!init_analysis_buffers())
+					return false;
+				job.x_size = context->analysis_x_size;
+				job.y_size = context->analysis_y_size;
+			}
+			else
+			{
+				job.x_size = x_size;
+				job.y_size = y_size;
+			}
+
+			const auto pixels_size = job.x_size * 4 * job.y_size;
+			const auto image_area_size = job.x_size * (job.y_size + 1);
+			if (pixels_size > job.pixels_capacity || image_area_size > job.image_area_capacity)
+			{
+				free(job.pixels);
+				free(job.image_area_data);
+				job.pixels = static_cast<byte*>(allocate(pixels_size * sizeof(byte)));
+				job.image_area_data = static_cast<bit_mask::Word*>(allocate(bit_mask::bytes_count(image_area_size)));
+				job.pixels_capacity = job.image_area_capacity = 0;
+				if (!job.pixels || !job.image_area_data)
+				{
+					std::cout << "Failed to malloc CPU memory for the detection of images\n";
+					return false;
+				}
+
+				job.pixels_capacity = pixels_size;
+				job.image_area_capacity = image_area_size;
+			}
+
+			if (context->analysis_scale > 1)
+				decimate_frame(job.pixels, false);
+			else
+				memcpy(job.pixels, pixels, pixels_size * sizeof(byte));
+
+			job.grid_size = get_analysis_grid_size();
+			memcpy(job.common_colors, context->common_colors, sizeof(context->common_colors));
+			job.update_common_colors = timers::is_due(context->update_common_colors_timer);
+			if (job.update_common_colors)
+				context->update_common_colors_timer = timers::start(update_common_color_interval);
+
+			job.frame_x_size = x_size;
+			job.frame_y_size = y_size;
+			job.analysis_scale = context->analysis_scale;
+			job.frame_version = context->images_frame_version;
+			job.refreshed_rects.clear();
+			job.is_shifted = false;
+			job.waiter = timers::get_thread_waiter();
+
+			{
+				std::lock_guard<std::mutex> lock(jobs_mutex);
+				job.state = JobState::QUEUED;
+				queued_jobs.push_back(&job);
+
+				if (!is_detection_thread_started)
+				{
+					std::thread(detection_thread).detach();
+					is_detection_thread_started = true;
+					stop_detection_thread = false;
+				}
+			}
+			jobs_changed.notify_all();
+			return true;
+		}
+
+		// The rects of the rows in which the map is different from previous_image_area. The words of the map are
+		// compared, so a rect may be up to a word wider than the pixels that were changed
+		void find_changed_rects()
+		{
+			const auto bands = (y_size + changed_band_rows - 1) / changed_band_rows;
+			std::vector<Rect> band_rects(bands, {x_size, 0, 0, 0});
+
+			const auto frame_bits = static_cast<size_t>(x_size) * y_size;
+			for (size_t word = 0; word < bit_mask::words_count(frame_bits); word++)
+			{
+				if (context->image_area_data[word] == previous_image_area[word])
+					continue;
+
+				const auto from = word * bit_mask::word_bits;
+				const auto to = from + bit_mask::word_bits < frame_bits ? from + bit_mask::word_bits : frame_bits;
+				for (auto y = static_cast<int>(from / x_size); y <= static_cast<int>((to - 1) / x_size); y++)
+				{
+					const auto row = static_cast<size_t>(y) * x_size;
+					const auto x_from = from > row ? static_cast<int>(from - row) : 0;
+					const auto x_to = to < row + x_size ? static_cast<int>(to - row) : x_size;
+
+					auto& rect = band_rects[y / changed_band_rows];
+					if (x_from < rect.left) rect.left = x_from;
+					if (x_to > rect.right) rect.right = x_to;
+				}
+			}
+
+			for (auto band = 0; band < bands; band++)
+			{
+				auto& rect = band_rects[band];
+				if (rect.left >= rect.right)
+					continue;
+
+				rect.top = band * changed_band_rows;
+				rect.bottom = rect.top + changed_band_rows < y_size ? rect.top + changed_band_rows : y_size;
+				changed_rects.push_back(rect);
+			}
+		}
+
+		// Take the images that the detection thread found, if they are of a newer frame than the images map
+		void finish_detection()
+		{
+			changed_rects.clear();
+			if (!context->detection_job || context->detection_job->state != JobState::DONE)
+				return;
+
+			auto& job = *context->detection_job;
+			job.state = JobState::IDLE;
+
+			auto delay = static_cast<int>(job.detection_time * detection_delay_ratio);
+			if (delay < min_detection_delay) delay = min_detection_delay;
+			if (delay > max_detection_delay) delay = max_detection_delay;
+			job.next_detection_timer = timers::start(delay);
+
+			if (job.frame_version <= context->images_detected_version || job.is_shifted ||
+				job.refreshed_rects.size() > max_refreshed_rects || job.frame_x_size != x_size ||
+				job.frame_y_size != y_size || job.analysis_scale != context->analysis_scale)
+				return;
+
+			// The rects that were searched again after the copy keep their newer images
+			constexpr auto part_bits = static_cast<int>(bit_mask::word_bits);
+			auto for_each_refreshed_part = [&](const auto& part)
+			{
+				for (const auto& rect : job.refreshed_rects)
+					for (auto y = rect.top; y < rect.bottom; y++)
+						for (auto x = rect.left; x < rect.right; x += part_bits)
+						{
+							const auto count = rect.right - x < part_bits ? rect.right - x : part_bits;
+							part(static_cast<size_t>(y) * x_size + x, static_cast<size_t>(count));
+						}
+			};
+
+			refreshed_bits.clear();
+			for_each_refreshed_part([&](const size_t bit, const size_t count)
+			{
+				refreshed_bits.push_back(bit_mask::read_bits(context->image_area_data, bit, count));
+			});
+			previous_image_area.assign(context->image_area_data,
+			                           context->image_area_data + bit_mask::words_count(xy_size));
+
+			if (job.analysis_scale > 1)
+			{
+				Rect frame_rect;
+				frame_rect.right = x_size;
+				frame_rect.bottom = y_size;
+				upsample_image_area(job.image_area_data, job.x_size, frame_rect);
+			}
+			else
+			{
+				memcpy(context->image_area_data, job.image_area_data, bit_mask::bytes_count(xy_size));
+			}
+
+			size_t part_index = 0;
+			for_each_refreshed_part([&](const size_t bit, const size_t count)
+			{
+				bit_mask::write_bits(context->image_area_data, bit, count, refreshed_bits[part_index++]);
+			});
+			find_changed_rects();
+
+			for (auto i = 0; i < 256; i++)
+				if (job.common_colors[i])
+					context->common_colors[i] = true;
+
+			context->images_detected_version = job.frame_version;
+			context->images_detection_time = job.detection_time;
+		}
+
+		// When the images map is of an older frame, copy this frame for the detection thread once it is free and
+		// the delay after its last detection passed
+		void update_detection()
+		{
+			if (context->images_detected_version == context->images_frame_version)
+				return;
+
+			if (context->detection_job && (context->detection_job->state != JobState::IDLE ||
+				!timers::is_due(context->detection_job->next_detection_timer)))
+				return;
+
+			if (!start_detection())
+				detect_frame_images(false);
+		}
+
+		// Wait until the detection thread does not work on the job of the context
+		void cancel_detection()
+		{
+			std::unique_lock<std::mutex> lock(jobs_mutex);
+
+			const auto it = std::find(queued_jobs.begin(), queued_jobs.end(), context->detection_job);
+			if (it != queued_jobs.end())
+				queued_jobs.erase(it);
+
+			jobs_changed.wait(lock, []() { return context->detection_job->state != JobState::RUNNING; });
+			context->detection_job->state = JobState::IDLE;
+		}
+
+		void free_detection_job()
+		{
+			if (!context->detection_job)
+				return;
+
+			cancel_detection();
+			free(context->detection_job->pixels);
+			free(context->detection_job->image_area_data);
+			delete context->detection_job;
+			context->detection_job = nullptr;
+		}
+
+		// The thread is started again by the next detection
+		void stop_detection()
+		{
+			std::unique_lock<std::mutex> lock(jobs_mutex);
+			stop_detection_thread = true;
+			jobs_changed.notify_all();
+			jobs_changed.wait(lock, []() { return !is_detection_thread_started; });
+		}
+
+		void invalidate_detection()
+		{
+			if (context->detection_job && context->detection_job->state != JobState::IDLE)
+				context->detection_job->is_shifted = true;
+		}
+
+		bit_mask::Word* map_images(bool force_update_common_colors)
+		{
+			context->images_frame_version++;
+
+			// The first frame, a forced update (a new size or new settings) and the frames that are searched fast
+			// are searched before they are processed, also with async detection
+			if (!context->async_detection || force_update_common_colors || context->images_detected_version < 0 ||
+				context->images_detection_time < max_frame_thread_detection_time)
+			{
+				const auto start = std::chrono::steady_clock::now();
+				detect_frame_images(force_update_common_colors);
+				const std::chrono::duration<double, std::milli> time = std::chrono::steady_clock::now() - start;
+				context->images_detection_time = time.count();
+				return context->image_area_data;
+			}
+
+			finish_detection();
+			update_detection();
+			return context->image_area_data;
+		}
+
+		bit_mask::Word* map_images(bool force_update_common_colors, const Rect& rect)
+		{
+			if (context->analysis_scale > 1 && init_analysis_buffers())
+			{
+				decimate_frame(context->analysis_pixels, true);
+
+				Rect analysis_rect;
+				analysis_rect.left = rect.left / context->analysis_scale;
+				analysis_rect.top = rect.top / context->analysis_scale;
+				analysis_rect.right = (rect.right + context->analysis_scale - 1) / context->analysis_scale;
+				analysis_rect.bottom = (rect.bottom + context->analysis_scale - 1) / context->analysis_scale;
+
+				const auto frame = get_frame(context->analysis_pixels, context->analysis_x_size,
+				                             context->analysis_y_size, context->analysis_image_area_data,
+				                             context->common_colors, get_analysis_grid_size());
+				update_common_colors_if_needed(frame, force_update_common_colors);
+				detect_images_in_rect(frame, analysis_rect);
+
+				upsample_image_area(context->analysis_image_area_data, context->analysis_x_size, rect);
+			}
+			else
+			{
+				const auto frame = get_frame(pixels, x_size, y_size, context->image_area_data, context->common_colors,
+				                             get_analysis_grid_size());
+				update_common_colors_if_needed(frame, force_update_common_colors);
+				detect_images_in_rect(frame, rect);
+			}
+
+			// The images of the rect are of a newer frame than the copy that the detection thread searches
+			if (context->detection_job && context->detection_job->state != JobState::IDLE)
+				context->detection_job->refreshed_rects.push_back(rect);
+
+			return context->image_area_data;
+		}
+
+		bit_mask::Word* update_images()
+		{
+			finish_detection();
+			update_detection();
+			return context->image_area_data;
+		}
+
+		const std::vector<Rect>& get_changed_rects()
+		{
+			return changed_rects;
+		}
+
+		bool is_refresh_needed()
+		{
+			if (!context->map_images_enabled || !context->async_detection || !context->detection_job ||
+			    context->images_detected_version == context->images_frame_version)
+				return false;
+
+			const auto state = context->detection_job->state.load();
+			return state == JobState::DONE ||
+				(state == JobState::IDLE && timers::is_due(context->detection_job->next_detection_timer));
+		}
+	}
+
+	// Call span(x_from, x_to) for each run of pixels in [x_from, x_to) of the row y that are not part of images.
+	// The images map is tested 64 pixels at once, so a row part without images is one span.
+	// HasImages tells if there is an images map, so the kernels that are instantiated for it don't check it
+	template <bool HasImages, typename Span>
+	void for_each_non_image_span(const int y, const int x_from, const int x_to, const Span& span)
+	{
+		if constexpr (!HasImages)
+		{
+			span(x_from, x_to);
+		}
+		else
+		{
+			const auto row = static_cast<size_t>(y) * x_size;
+			bit_mask::for_each_clear_span(context->image_area_data, row + x_from, row + x_to,
+			                              [&](const size_t span_from, const size_t span_to)
+			                              {
+				                              span(static_cast<int>(span_from - row), static_cast<int>(span_to - row));
+			                              });
+		}
+	}
+
+	template <typename Span>
+	void for_each_non_image_span(const int y, const int x_from, const int x_to, const Span& span)
+	{
+		if (context->image_area_data)
+			for_each_non_image_span<true>(y, x_from, x_to, span);
+		else
+			for_each_non_image_span<false>(y, x_from, x_to, span);
+	}
+
+
+	namespace glass_effect
+	{
+		constexpr int cube_size = 5;
+		constexpr int cube_dim = cube_size * cube_size;
+
+		void enable(const double glass_background, const bool glass_dark_background,
+		            const double glass_images, const double glass_shapes)
+		{
+			context->glass_effect_enabled = true;
+			context->background_level = glass_background;
+			context->images_level = glass_images;
+			context->shapes_level = glass_shapes;
+			context->dark_background_mode = glass_dark_background;
+			scroll_detection::invalidate();
+		}
+
+		void set_background_level(const double glass_background)
+		{
+			context->background_level = glass_background;
+			scroll_detection::invalidate();
+		}
+
+		void set_shapes_level(const double glass_shapes)
+		{
+			context->shapes_level = glass_shapes;
+			scroll_detection::invalidate();
+		}
+
+		void set_dark_background_mode(const bool enable)
+		{
+			context->dark_background_mode = enable;
+			scroll_detection::invalidate();
+		}
+
+		void disable()
+		{
+			context->glass_effect_enabled = false;
+		}
+
+		// Unload the resources that used for the algorithem that detect each pixel that is text or image
+		void free_resources()
+		{
+			if (context->pixels_reduced)
+			{
+				free(context->pixels_reduced);
+				context->pixels_reduced = nullptr;
+			}
+
+			if (context->pixels_reduced_built)
+			{
+				free(context->pixels_reduced_built);
+				context->pixels_reduced_built = nullptr;
+			}
+
+			context->pixels_reduced_capacity = 0;
+		}
+
+		// The grid of the cubes moves with the content of the frame, so the cubes of a shifted (scrolled) part of
+		// the frame have the same pixels as before, also when the shift is not a whole amount of cubes. The
+		// offsets are in [0, cube_size), and the first cube of a row or a column may be cut by the border of the
+		// frame. The reduced map has a cube more than the frame needs in each axis, like with no offset
+		void set_grid(const int x_offset, const int y_offset)
+		{
+			context->grid_x_offset = x_offset;
+			context->grid_y_offset = y_offset;
+			context->x_size_reduced = (x_size + x_offset) / cube_size + 1;
+			context->y_size_reduced = (y_size + y_offset) / cube_size + 1;
+			context->xy_size_reduced = context->x_size_reduced * context->y_size_reduced;
+		}
+
+		// The offset of the grid after the content was shifted, where the shift is the offset from a pixel in
+		// the current frame to its source pixel in the previous frame
+		int get_moved_offset(const int offset, const int shift)
+		{
+			return ((offset + shift) % cube_size + cube_size) % cube_size;
+		}
+
+		// The size of the reduced map with the largest offset, in each axis
+		int get_max_size_reduced(const int size)
+		{
+			return (size + cube_size - 1) / cube_size + 1;
+		}
+
+		bool init()
+		{
+			set_grid(0, 0);
+
+			const auto capacity = get_max_size_reduced(x_size) * get_max_size_reduced(y_size);
+			if (capacity > context->pixels_reduced_capacity)
+			{
+				free_resources();
+				context->pixels_reduced = static_cast<byte*>(allocate(capacity));
+				context->pixels_reduced_built = static_cast<byte*>(allocate(capacity));
+				if (!context->pixels_reduced || !context->pixels_reduced_built)
+				{
+					std::cout << "Failed to malloc CPU memory for pixels_reduced\n";
+					free_resources();
+					return false;
+				}
+				context->pixels_reduced_capacity = capacity;
+			}
+
+			return true;
+		}
+
+
+		// Range of cubes in the reduced map (the end is exclusive)
+		struct CubeRange
+		{
+			int x_r_start, x_r_end;
+			int y_r_start, y_r_end;
+		};
+
+		// Amount of cubes around the dirty tiles of a partial update whose pixels are prepared (inverted and
+		// searched for images). It must include the cubes that the border of a dirty tile cuts, since they are
+		// built and marked from all their pixels
+		constexpr int halo_x_cubes = 5;
+		constexpr int halo_y_cubes = 4;
+		static_assert(halo_x_cubes >= 1 && halo_y_cubes >= 1, "The halo must include the cubes that a rect cuts");
+
+		// The cubes that have pixels in the rect
+		CubeRange get_cube_range(const Rect& rect)
+		{
+			const auto x_offset = context->grid_x_offset, y_offset = context->grid_y_offset;
+
+			CubeRange range;
+			range.x_r_start = (rect.left + x_offset) / cube_size;
+			range.y_r_start = (rect.top + y_offset) / cube_size;
+			range.x_r_end = (rect.right + x_offset + cube_size - 1) / cube_size;
+			range.y_r_end = (rect.bottom + y_offset + cube_size - 1) / cube_size;
+			if (rect.right >= x_size) range.x_r_end = context->x_size_reduced;
+			if (rect.bottom >= y_size) range.y_r_end = context->y_size_reduced;
+			return range;
+		}
+
+		// The cubes that have all their pixels (inside the frame) in the rect
+		CubeRange get_inner_cube_range(const Rect& rect)
+		{
+			const auto x_offset = context->grid_x_offset, y_offset = context->grid_y_offset;
+
+			CubeRange range;
+			range.x_r_start = rect.left <= 0 ? 0 : (rect.left + x_offset + cube_size - 1) / cube_size;
+			range.y_r_start = rect.top <= 0 ? 0 : (rect.top + y_offset + cube_size - 1) / cube_size;
+			range.x_r_end = rect.right >= x_size ? context->x_size_reduced : (rect.right + x_offset) / cube_size;
+			range.y_r_end = rect.bottom >= y_size ? context->y_size_reduced : (rect.bottom + y_offset) / cube_size;
+			return range;
+		}
+
+		// The pixels of the cube inside the frame. The last row and column of the reduced map may be outside of
+		// the frame, and then the rect is empty
+		Rect get_cube_rect(const int x_r, const int y_r)
+		{
+			Rect rect;
+			rect.left = x_r * cube_size - context->grid_x_offset;
+			rect.top = y_r * cube_size - context->grid_y_offset;
+			rect.right = rect.left + cube_size;
+			rect.bottom = rect.top + cube_size;
+			if (rect.left < 0) rect.left = 0;
+			if (rect.top < 0) rect.top = 0;
+			if (rect.right > x_size) rect.right = x_size;
+			if (rect.bottom > y_size) rect.bottom = y_size;
+			return rect;
+		}
+
+		// The bits of the images map of the rows of a cube, in the format of the cube kernels of pixel_kernels
+		void read_image_rows(const int x, const int y, const int x_max, const int y_max, uint64_t* image_rows)
+		{
+			for (auto y2 = y; y2 < y_max; y2++)
+				image_rows[y2 - y] = bit_mask::read_bits(context->image_area_data, y2 * x_size + x, x_max - x);
+		}
+
+		// The background color of each region of region_cubes x region_cubes cubes, kept between the frames of
+		// the context. An editor pane has the same background in most frames, so the cubes of a known region are
+		// first checked against its color with count_color. A color of more than half of the samples of a cube is
+		// the one that reduce_cube finds, so the histogram is built only for the cubes where the check fails.
+		// The color of a region is replaced when most of its cubes failed the check in the last build. In a busy
+		// region (dense text) the check fails even with the right color, so it is paused there for a few builds
+		namespace background_model
+		{
+			// Same as the tiles of the tile cache, so a band of process_in_strips never splits a region
+			constexpr int region_cubes = 4;
+			constexpr int paused_builds = 8;
+
+			struct Region
+			{
+				byte color;
+				bool is_known;
+				byte candidate; // The majority vote of the colors of the cubes that failed the check
+				byte candidate_votes;
+				byte paused_builds; // The builds left until the cubes are checked again
+				uint16_t hits, misses; // The cubes since the last update
+			};
+
+			void free_resources()
+			{
+				if (context->background_regions)
+				{
+					free(context->background_regions);
+					context->background_regions = nullptr;
+				}
+
+				context->background_regions_x = context->background_regions_y = 0;
+			}
+
+			bool init()
+			{
+				free_resources();
+
+				// Of the largest reduced map, so the model is kept when the grid moves
+				context->background_regions_x = (get_max_size_reduced(x_size) + region_cubes - 1) / region_cubes;
+				context->background_regions_y = (get_max_size_reduced(y_size) + region_cubes - 1) / region_cubes;
+				const auto regions_count = context->background_regions_x * context->background_regions_y;
+				context->background_regions = static_cast<Region*>(allocate(regions_count * sizeof(Region)));
+				if (!context->background_regions)
+				{
+					std::cout << "Failed to malloc CPU memory for the background model\n";
+					context->background_regions_x = context->background_regions_y = 0;
+					return false;
+				}
+
+				memset(context->background_regions, 0, regions_count * sizeof(Region));
+				return true;
+			}
+
+			Region& get_region(const int x_r, const int y_r)
+			{
+				const auto region = y_r / region_cubes * context->background_regions_x + x_r / region_cubes;
+				return context->background_regions[region];
+			}
+
+			void add_miss(Region& region, const byte color)
+			{
+				region.misses++;
+				if (region.candidate_votes == 0)
+				{
+					region.candidate = color;
+					region.candidate_votes = 1;
+				}
+				else if (region.candidate == color)
+				{
+					if (region.candidate_votes < 255) region.candidate_votes++;
+				}
+				else
+				{
+					region.candidate_votes--;
+				}
+			}
+
+			// Called after the cubes of the range were built
+			void update(const CubeRange& range)
+			{
+				for (auto y = range.y_r_start / region_cubes; y <= (range.y_r_end - 1) / region_cubes; y++)
+					for (auto x = range.x_r_start / region_cubes; x <= (range.x_r_end - 1) / region_cubes; x++)
+					{
+						auto& region = context->background_regions[y * context->background_regions_x + x];
+						if (region.paused_builds)
+							region.paused_builds--;
+						else if (region.is_known && region.misses > region.hits && region.candidate == region.color)
+							region.paused_builds = paused_builds;
+
+						if ((!region.is_known || region.misses > region.hits) && region.candidate_votes)
+						{
+							region.color = region.candidate;
+							region.is_known = true;
+						}
+
+						region.hits = region.misses = 0;
+						region.candidate_votes = 0;
+					}
+			}
+		}
+
+		template <bool HasImages>
+		void build_reduced_map(const CubeRange& range)
+		{
+			// The model is of the size of the reduced map, so it is allocated again after a resize. Without it
+			// all the cubes are reduced with the histogram
+			const auto has_model = context->background_regions || background_model::init();
+			const auto scale = context->analysis_scale;
+
+			for (auto y_r = range.y_r_start; y_r < range.y_r_end; y_r++)
+				for (auto x_r = range.x_r_start; x_r < range.x_r_end; x_r++)
+				{
+					// On a decimated grid the cube has only few samples, so a single sample is enough
+					auto max_color_count = scale > 1 ? 0 : 1;
+					const auto point_r = y_r * context->x_size_reduced + x_r;
+
+					const auto cube_rect = get_cube_rect(x_r, y_r);
+					const auto y = cube_rect.top, x = cube_rect.left;
+					const auto y_max = cube_rect.bottom, x_max = cube_rect.right;
+
+					// The color of the first pixel of the cube is used when no color is repeated.
+					// The last row and column of the reduced map may be outside of the frame
+					byte max_color = 0;
+					if (y < y_max && x < x_max)
+					{
+						const auto point = y * xb_size + x * 4;
+						max_color = (pixels[point] + pixels[point + 1] + pixels[point + 2]) / 3;
+					}
+
+
+					// Sample only the pixels on the analysis grid
+					const auto y_first = (y + scale - 1) / scale * scale;
+					const auto x_first = (x + scale - 1) / scale * scale;
+
+					if (y_first < y_max && x_first < x_max)
+					{
+						uint64_t image_rows[cube_size];
+						if (HasImages)
+							read_image_rows(x_first, y_first, x_max, y_max, image_rows);
+
+						const auto* const cube = &pixels[y_first * xb_size + x_first * 4];
+						auto* const region = has_model ? &background_model::get_region(x_r, y_r) : nullptr;
+
+						auto color_count = 0, samples_count = 0;
+						if (region && region->is_known && !region->paused_builds)
+							color_count = pixel_kernels::kernels->count_color(
+								cube, xb_size, x_max - x_first, y_max - y_first, scale,
+								HasImages ? image_rows : nullptr, region->color, &samples_count);
+
+						if (color_count * 2 > samples_count && color_count > max_color_count)
+						{
+							region->hits++;
+							max_color = region->color;
+						}
+						else
+						{
+							max_color = pixel_kernels::kernels->reduce_cube(
+								cube, xb_size, x_max - x_first, y_max - y_first, scale,
+								HasImages ? image_rows : nullptr, max_color_count, max_color);
+							if (region)
+								background_model::add_miss(*region, max_color);
+						}
+					}
+
+					context->pixels_reduced[point_r] = max_color;
+				}
+
+			if (has_model)
+				background_model::update(range);
+		}
+
+		void build_reduced_map(const CubeRange& range)
+		{
+			if (context->image_area_data)
+				build_reduced_map<true>(range);
+			else
+				build_reduced_map<false>(range);
+		}
+
+		// The regions of the background model that the rects touch, built_regions[region_y * regions_x + region_x]
+		std::vector<byte> built_regions;
+
+		// Build the cubes of the rects in whole regions of the background model, and each region once. The rects
+		// may overlap and are not aligned to the regions, and a region that is updated from a part of its cubes,
+		// or twice in a frame, moves its color away from the background
+		void build_reduced_map(const std::vector<Rect>& rects)
+		{
+			using background_model::region_cubes;
+			const auto regions_x = (context->x_size_reduced + region_cubes - 1) / region_cubes;
+			const auto regions_y = (context->y_size_reduced + region_cubes - 1) / region_cubes;
+			built_regions.assign(regions_x * regions_y, 0);
+
+			for (const auto& rect : rects)
+			{
+				const auto range = get_cube_range(rect);
+				if (range.x_r_start >= range.x_r_end || range.y_r_start >= range.y_r_end)
+					continue;
+
+				for (auto y = range.y_r_start / region_cubes; y <= (range.y_r_end - 1) / region_cubes; y++)
+					for (auto x = range.x_r_start / region_cubes; x <= (range.x_r_end - 1) / region_cubes; x++)
+						built_regions[y * regions_x + x] = 1;
+			}
+
+			// Each run of regions in a row of regions is built as one range
+			for (auto y = 0; y < regions_y; y++)
+				for (auto x = 0; x < regions_x;)
+				{
+					if (!built_regions[y * regions_x + x])
+					{
+						x++;
+						continue;
+					}
+
+					auto x_end = x + 1;
+					while (x_end < regions_x && built_regions[y * regions_x + x_end])
+						x_end++;
+
+					CubeRange range;
+					range.x_r_start = x * region_cubes;
+					range.x_r_end = std::min(x_end * region_cubes, context->x_size_reduced);
+					range.y_r_start = y * region_cubes;
+					range.y_r_end = std::min((y + 1) * region_cubes, context->y_size_reduced);
+					build_reduced_map(range);
+
+					x = x_end;
+				}
+		}
+
+		// Paint the gaps of the run of colors that starts in the given point with its color,
+		// and return the last point of the run
+		int reduce_noise_run(const int point_start, const int point_max, const int point_jump, const int max_count)
+		{
+			auto* const pixels_reduced = context->pixels_reduced;
+			int point_end = point_start;
+			const auto color = pixels_reduced[point_start];
+
+			auto count = 0;
+			for (auto point = point_start; point < point_max; point += point_jump)
+			{
+				if (color == pixels_reduced[point])
+				{
+					point_end = point;
+					count = 0;
+				}
+				else if (++count >= max_count)
+				{
+					break;
+				}
+			}
+
+			if (point_start < point_end)
+			{
+				for (auto point_2 = point_start; point_2 <= point_end; point_2 += point_jump)
+					pixels_reduced[point_2] = color;
+			}
+
+
+			return point_end;
+		}
+
+		constexpr int noise_row_max_count = 5;
+		constexpr int noise_column_max_count = 4;
+
+		void reduce_noise_rows(const CubeRange& range)
+		{
+			const auto x_size_reduced = context->x_size_reduced;
+
+			// The last row and column of the reduced map are never used as a start point
+			auto x_r_end = range.x_r_end;
+			if (x_r_end > x_size_reduced - 1) x_r_end = x_size_reduced - 1;
+			auto y_r_end = range.y_r_end;
+			if (y_r_end > context->y_size_reduced - 1) y_r_end = context->y_size_reduced - 1;
+
+			for (auto y = range.y_r_start; y < y_r_end; y++)
+			{
+				auto point = y * x_size_reduced + range.x_r_start;
+				const auto point_max = y * x_size_reduced + x_r_end;
+				while (point < point_max)
+					point = reduce_noise_run(point, point_max, 1, noise_row_max_count) + 1;
+			}
+		}
+
+		// The runs depend on all the cubes of a row or a column before them, so the noise is always reduced in the
+		// whole map
+		void reduce_noise()
+		{
+			const auto x_size_reduced = context->x_size_reduced;
+			const auto y_r_end = context->y_size_reduced - 1;
+
+			reduce_noise_rows({0, x_size_reduced, 0, y_r_end});
+
+			for (auto x = 0; x < x_size_reduced; x++)
+			{
+				auto point = x;
+				const auto point_max = x + y_r_end * x_size_reduced;
+				while (point < point_max)
+					point = reduce_noise_run(point, point_max, x_size_reduced, noise_column_max_count) + x_size_reduced;
+			}
+		}
+
+		// The vertical noise reduction of the whole frame, done while the rows of the reduced map
+		// are still being built. Each column keeps the run that it is in the middle of, and the
+		// rows that no run can change anymore are reported as final
+		namespace column_noise
+		{
+			struct ColumnRun
+			{
+				int start; // First row of the current run, or -1 between runs
+				int end; // Last row of the current run that has the color of the run
+				int next; // Next row to scan
+				int count;
+			};
+
+			std::vector<ColumnRun> runs;
+
+			void begin()
+			{
+				runs.resize(context->x_size_reduced);
+				for (auto& run : runs)
+					run = {-1, -1, 0, 0};
+			}
+
+			// Advance all the columns over the rows before rows_ready (that were built and reduced
+			// horizontally) and return the amount of rows from the top that are final
+			int advance(const int rows_ready)
+			{
+				auto* const pixels_reduced = context->pixels_reduced;
+				const auto x_size_reduced = context->x_size_reduced;
+
+				// The last row is never used by the runs, like in reduce_noise
+				const auto row_max = context->y_size_reduced - 1;
+				auto final_rows = rows_ready;
+
+				for (auto x = 0; x < x_size_reduced; x++)
+				{
+					auto& run = runs[x];
+
+					while (true)
+					{
+						if (run.start < 0)
+						{
+							if (run.next >= row_max || run.next >= rows_ready)
+								break;
+
+							run.start = run.end = run.next++;
+							run.count = 0;
+						}
+
+						const auto color = pixels_reduced[run.start * x_size_reduced + x];
+						auto is_run_ended = false;
+
+						for (; run.next < row_max && run.next < rows_ready; run.next++)
+						{
+							if (color == pixels_reduced[run.next * x_size_reduced + x])
+							{
+								// The rows of the run are painted right away, the run can only grow
+								for (auto y = run.end + 1; y < run.next; y++)
+									pixels_reduced[y * x_size_reduced + x] = color;
+								run.end = run.next;
+								run.count = 0;
+							}
+							else if (++run.count >= noise_column_max_count)
+							{
+								is_run_ended = true;
+								break;
+							}
+						}
+
+						if (!is_run_ended && run.next < row_max)
+							break; // Wait for more rows
+
+						run.next = run.end + 1;
+						run.start = -1;
+					}
+
+					const auto column_final_rows =
+						run.start >= 0 ? run.end + 1 : run.next >= row_max ? context->y_size_reduced : run.next;
+					if (column_final_rows < final_rows)
+						final_rows = column_final_rows;
+				}
+
+				return final_rows;
+			}
+		}
+
+		// Keep the colors of the built rows of the range before their noise is reduced
+		void keep_built_rows(const CubeRange& range)
+		{
+			const auto x_size_reduced = context->x_size_reduced;
+			memcpy(&context->pixels_reduced_built[range.y_r_start * x_size_reduced],
+			       &context->pixels_reduced[range.y_r_start * x_size_reduced],
+			       static_cast<size_t>(range.y_r_end - range.y_r_start) * x_size_reduced);
+		}
+
+		template <bool HasImages>
+		void mark_cube(const pixel_kernels::MarkCube mark, const int x_r, const int y_r)
+		{
+			const auto point_r = y_r * context->x_size_reduced + x_r;
+			const auto cube_rect = get_cube_rect(x_r, y_r);
+			const auto y = cube_rect.top, x = cube_rect.left;
+			const auto y_max = cube_rect.bottom, x_max = cube_rect.right;
+
+			// The last row and column of the reduced map may be outside of the frame
+			if (y >= y_max || x >= x_max)
+				return;
+
+			uint64_t image_rows[cube_size];
+			if (HasImages)
+				read_image_rows(x, y, x_max, y_max, image_rows);
+
+			mark(&pixels[y * xb_size + x * 4], xb_size, x_max - x, y_max - y, HasImages ? image_rows : nullptr,
+			     context->pixels_reduced[point_r], context->shapes_level, context->background_level,
+			     context->dark_background_mode);
+		}
+
+		// Content addressed cache of the output of the mark pass. Each entry holds a tile of
+		// tile_cubes x tile_cubes cubes, keyed by the hash of its pixels, its reduced colors,
+		// its image area and the effect settings. The entries are evicted in LRU order
+		namespace tile_cache
+		{
+			constexpr int tile_cubes = 4;
+			constexpr int tile_size = tile_cubes * cube_size;
+			constexpr int tile_bytes = tile_size * tile_size * 4;
+
+			// The cache is used by the thread that processes the frames, while other threads may enable it and read
+			// its stats
+			std::atomic<bool> is_enabled{false};
+			size_t max_bytes = 0;
+
+			int capacity = 0;
+			int used = 0;
+			uint64_t* keys = nullptr;
+			byte* outputs = nullptr;
+
+			// Doubly linked LRU list of the slots, the head is the most recently used slot
+			int* lru_prev = nullptr;
+			int* lru_next = nullptr;
+			int lru_head = -1, lru_tail = -1;
+
+			std::unordered_map<uint64_t, int> slots;
+
+			uint64_t settings_key = 0;
+			std::atomic<unsigned long long> hits{0}, misses{0}, evictions{0};
+			std::atomic<size_t> entries{0};
+
+			void free_resources()
+			{
+				if (keys)
+				{
+					free(keys);
+					keys = nullptr;
+				}
+
+				if (outputs)
+				{
+					free(outputs);
+					outputs = nullptr;
+				}
+
+				if (lru_prev)
+				{
+					free(lru_prev);
+					lru_prev = nullptr;
+				}
+
+				if (lru_next)
+				{
+					free(lru_next);
+					lru_next = nullptr;
+				}
+
+				slots = std::unordered_map<uint64_t, int>();
+				capacity = used = 0;
+				lru_head = lru_tail = -1;
+				entries = 0;
+			}
+
+			bool init()
+			{
+				free_resources();
+
+				capacity = static_cast<int>(max_bytes / tile_bytes);
+				if (capacity <= 0)
+					return false;
+
+				keys = static_cast<uint64_t*>(allocate(capacity * sizeof(uint64_t)));
+				outputs = static_cast<byte*>(allocate(static_cast<size_t>(capacity) * tile_bytes));
+				lru_prev = static_cast<int*>(allocate(capacity * sizeof(int)));
+				lru_next = static_cast<int*>(allocate(capacity * sizeof(int)));
+				if (!keys || !outputs || !lru_prev || !lru_next)
+				{
+					std::cout << "Failed to malloc CPU memory for the tile cache\n";
+					free_resources();
+					return false;
+				}
+
+				slots.reserve(capacity);
+				return true;
+			}
+
+			void enable(const size_t max_bytes)
+			{
+				if (tile_cache::max_bytes != max_bytes)
+				{
+					free_resources();
+					tile_cache::max_bytes = max_bytes;
+				}
+
+				is_enabled = true;
+			}
+
+			void disable()
+			{
+				is_enabled = false;
+				free_resources();
+			}
+
+			TileCacheStats get_stats()
+			{
+				TileCacheStats stats;
+				stats.hits = hits;
+				stats.misses = misses;
+				stats.evictions = evictions;
+				stats.entries = entries;
+				stats.bytes = stats.entries * tile_bytes;
+				return stats;
+			}
+
+			void reset_stats()
+			{
+				hits = misses = evictions = 0;
+			}
+
+			void unlink(const int slot)
+			{
+				if (lru_prev[slot] >= 0) lru_next[lru_prev[slot]] = lru_next[slot];
+				else lru_head = lru_next[slot];
+
+				if (lru_next[slot] >= 0) lru_prev[lru_next[slot]] = lru_prev[slot];
+				else lru_tail = lru_prev[slot];
+			}
+
+			void link_to_head(const int slot)
+			{
+				lru_prev[slot] = -1;
+				lru_next[slot] = lru_head;
+				if (lru_head >= 0) lru_prev[lru_head] = slot;
+				lru_head = slot;
+				if (lru_tail < 0) lru_tail = slot;
+			}
+
+			int find(const uint64_t key)
+			{
+				const auto it = slots.find(key);
+				if (it == slots.end())
+					return -1;
+
+				if (it->second != lru_head)
+				{
+					unlink(it->second);
+					link_to_head(it->second);
+				}
+
+				return it->second;
+			}
+
+			int insert(const uint64_t key)
+			{
+				int slot;
+				if (used < capacity)
+				{
+					slot = used++;
+				}
+				else
+				{
+					slot = lru_tail;
+					unlink(slot);
+					slots.erase(keys[slot]);
+					evictions++;
+				}
+
+				keys[slot] = key;
+				slots[key] = slot;
+				link_to_head(slot);
+
+				entries = used;
+				return slot;
+			}
+
+			void update_settings_key()
+			{
+				uint64_t shapes_bits, background_bits;
+				memcpy(&shapes_bits, &context->shapes_level, sizeof(uint64_t));
+				memcpy(&background_bits, &context->background_level, sizeof(uint64_t));
+
+				settings_key = (shapes_bits * 0x9E3779B97F4A7C15ull) ^ (background_bits * 0xC2B2AE3D27D4EB4Full) ^
+					(context->dark_background_mode ? 0x165667B19E3779F9ull : 0);
+			}
+
+			uint64_t hash_tile(const int x, const int y, const int x_r, const int y_r)
+			{
+				// Few independent lanes so the multiplications of the words are not serialized
+				uint64_t lanes[4] = {settings_key, 0x9E3779B97F4A7C15ull, 0xC2B2AE3D27D4EB4Full, 0x165667B19E3779F9ull};
+
+				for (auto y2 = y; y2 < y + tile_size; y2++)
+				{
+					const auto* const row = reinterpret_cast<const uint64_t*>(&pixels[y2 * xb_size + x * 4]);
+					for (auto i = 0; i < tile_size / 2; i++)
+						lanes[i & 3] = (lanes[i & 3] ^ row[i]) * 0x100000001B3ull;
+				}
+
+				for (auto y2_r = y_r; y2_r < y_r + tile_cubes; y2_r++)
+				{
+					uint32_t reduced_colors;
+					memcpy(&reduced_colors, &context->pixels_reduced[y2_r * context->x_size_reduced + x_r],
+					       sizeof(uint32_t));
+					lanes[y2_r & 3] = (lanes[y2_r & 3] ^ reduced_colors) * 0x100000001B3ull;
+				}
+
+				if (context->image_area_data)
+				{
+					// Up to 64 pixels of the images map are hashed at once
+					for (auto y2 = y; y2 < y + tile_size; y2++)
+						for (size_t x2 = 0; x2 < tile_size; x2 += bit_mask::word_bits)
+						{
+							const auto count = tile_size - x2 < bit_mask::word_bits ? tile_size - x2 : bit_mask::word_bits;
+							const auto bits = bit_mask::read_bits(context->image_area_data, y2 * x_size + x + x2, count);
+							lanes[y2 & 3] = (lanes[y2 & 3] ^ bits) * 0x100000001B3ull;
+						}
+				}
+
+				auto hash = lanes[0];
+				for (auto i = 1; i < 4; i++)
+					hash = (hash ^ (lanes[i] >> 29)) * 0x9E3779B97F4A7C15ull ^ lanes[i];
+
+				return hash;
+			}
+
+			template <typename MarkCube>
+			void mark_tile(const int x_r, const int y_r, const MarkCube& mark_cube)
+			{
+				const auto x = x_r * cube_size - context->grid_x_offset;
+				const auto y = y_r * cube_size - context->grid_y_offset;
+				const auto key = hash_tile(x, y, x_r, y_r);
+
+				auto slot = find(key);
+				if (slot >= 0)
+				{
+					hits++;
+					const auto* const output = &outputs[static_cast<size_t>(slot) * tile_bytes];
+					for (auto y2 = 0; y2 < tile_size; y2++)
+						memcpy(&pixels[(y + y2) * xb_size + x * 4], &output[y2 * tile_size * 4], tile_size * 4);
+					return;
+				}
+
+				misses++;
+				for (auto y2_r = y_r; y2_r < y_r + tile_cubes; y2_r++)
+					for (auto x2_r = x_r; x2_r < x_r + tile_cubes; x2_r++)
+						mark_cube(x2_r, y2_r);
+
+				slot = insert(key);
+				auto* const output = &outputs[static_cast<size_t>(slot) * tile_bytes];
+				for (auto y2 = 0; y2 < tile_size; y2++)
+					memcpy(&output[y2 * tile_size * 4], &pixels[(y + y2) * xb_size + x * 4], tile_size * 4);
+			}
+		}
+
+		// Mark the cubes of the range for which is_marked(x_r, y_r) is true
+		template <bool HasImages, typename IsMarked>
+		void mark_shapes(const CubeRange& range, const pixel_kernels::MarkCube mark, const IsMarked& is_marked)
+		{
+			const auto mark_cube = [mark, &is_marked](const int x_r, const int y_r)
+			{
+				if (is_marked(x_r, y_r))
+					glass_effect::mark_cube<HasImages>(mark, x_r, y_r);
+			};
+
+			if (tile_cache::is_enabled && !tile_cache::keys)
+				tile_cache::init();
+
+			if (!tile_cache::is_enabled || !tile_cache::keys)
+			{
+				for (auto y_r = range.y_r_start; y_r < range.y_r_end; y_r++)
+					for (auto x_r = range.x_r_start; x_r < range.x_r_end; x_r++)
+						mark_cube(x_r, y_r);
+				return;
+			}
+
+			tile_cache::update_settings_key();
+
+			// Walk the range by the tiles of the cache grid. Tiles that are not fully inside the range,
+			// the frame or the marked cubes are marked cube by cube
+			const auto tile_cubes = tile_cache::tile_cubes;
+			const auto x_offset = context->grid_x_offset, y_offset = context->grid_y_offset;
+			for (auto y_r = range.y_r_start; y_r < range.y_r_end;)
+			{
+				const auto tile_y_r_end = (y_r / tile_cubes + 1) * tile_cubes;
+				auto y_r_to = tile_y_r_end;
+				if (y_r_to > range.y_r_end) y_r_to = range.y_r_end;
+				const auto is_full_rows = y_r % tile_cubes == 0 && y_r_to == tile_y_r_end &&
+					y_r * cube_size >= y_offset && tile_y_r_end * cube_size - y_offset <= y_size;
+
+				for (auto x_r = range.x_r_start; x_r < range.x_r_end;)
+				{
+					const auto tile_x_r_end = (x_r / tile_cubes + 1) * tile_cubes;
+					auto x_r_to = tile_x_r_end;
+					if (x_r_to > range.x_r_end) x_r_to = range.x_r_end;
+
+					auto is_full_tile = is_full_rows && x_r % tile_cubes == 0 && x_r_to == tile_x_r_end &&
+						x_r * cube_size >= x_offset && tile_x_r_end * cube_size - x_offset <= x_size;
+					for (auto y2_r = y_r; y2_r < y_r_to && is_full_tile; y2_r++)
+						for (auto x2_r = x_r; x2_r < x_r_to && is_full_tile; x2_r++)
+							is_full_tile = is_marked(x2_r, y2_r);
+
+					if (is_full_tile)
+					{
+						tile_cache::mark_tile(x_r, y_r, mark_cube);
+					}
+					else
+					{
+						for (auto y2_r = y_r; y2_r < y_r_to; y2_r++)
+							for (auto x2_r = x_r; x2_r < x_r_to; x2_r++)
+								mark_cube(x2_r, y2_r);
+					}
+
+					x_r = x_r_to;
+				}
+
+				y_r = y_r_to;
+			}
+		}
+
+		// Select the kernel of the mark pass for the settings of the frame
+		template <typename IsMarked>
+		void mark_shapes(const CubeRange& range, const IsMarked& is_marked)
+		{
+			auto background_mode = pixel_kernels::BackgroundMode::scale;
+			if (context->background_level == 1)
+				background_mode = pixel_kernels::BackgroundMode::keep;
+			else if (context->background_level == 0)
+				background_mode = pixel_kernels::BackgroundMode::clear;
+
+			const auto mark = pixel_kernels::kernels->mark_cube[static_cast<int>(background_mode)];
+			if (context->image_area_data)
+				mark_shapes<true>(range, mark, is_marked);
+			else
+				mark_shapes<false>(range, mark, is_marked);
+		}
+
+		void mark_shapes(const CubeRange& range)
+		{
+			mark_shapes(range, [](const int x_r, const int y_r) { return true; });
+		}
+
+		void map_shapes(double background)
+		{
+			const auto range = get_cube_range({0, 0, x_size, y_size});
+
+			build_reduced_map(range);
+			keep_built_rows(range);
+			reduce_noise();
+
+#if 0 // Debug - pring reduced map
+			for (auto y_r = 0; y_r < y_size_reduced; y_r++)
+				for (auto x_r = 0; x_r < x_size_reduced; x_r++)
+				{
+					auto point_r = y_r * x_size_reduced + x_r;
+					auto y = y_r * cube_size;
+					auto x = x_r * cube_size;
+					auto y_max = y + cube_size; if (y_max > y_end) y_max = y_end;
+					auto x_max = x + cube_size; if (x_max > x_end) x_max = x_end;
+
+					for (auto y2 = y; y2 < y_max; y2++)
+						for (auto x2 = x; x2 < x_max; x2++)
+						{
+							auto point = y2 * x_end * 4 + x2 * 4;
+							pixels[point] = pixels[point + 1] = pixels[point + 2] = pixels_reduced[point_r];
+						}
+				}
+
+
+#endif
+
+			mark_shapes(range);
+		}
+
+		enum CubeState : byte
+		{
+			cube_built = 1, // It has pixels in the dirty rects, so it is built and marked again
+			cube_inside = 2, // All its pixels are in the dirty rects
+			cube_ready = 4, // Its pixels are in the process rects, so they were inverted already
+			cube_marked = 8
+		};
+
+		// The scratch of a partial update: the state of each cube, and the reduced map of the last frame
+		std::vector<byte> cubes_state;
+		std::vector<byte> last_pixels_reduced;
+
+		// The marked cubes of the last partial update that have pixels outside of the dirty rects, joined in runs
+		// of each row of cubes. Their output is stored with the previous output, so scroll_detection::apply takes
+		// them from it
+		std::vector<Rect> marked_rects;
+
+		// The reduced maps of the last frame, while their cubes are moved to the grid of the current frame
+		std::vector<byte> moved_cubes;
+
+		void add_cubes_state(const CubeRange& range, const byte state)
+		{
+			for (auto y_r = range.y_r_start; y_r < range.y_r_end; y_r++)
+				for (auto x_r = range.x_r_start; x_r < range.x_r_end; x_r++)
+					cubes_state[y_r * context->x_size_reduced + x_r] |= state;
+		}
+
+		// The cubes of the dirty rects are built again, and the noise of the whole map is reduced again from the
+		// colors that the cubes were built with, since a run may reach far from the dirty rects. Then the cubes of
+		// the dirty rects and the cubes whose color was changed are marked, so the output is the same as a full
+		// frame on the same grid
+		void map_shapes(const std::vector<Rect>& dirty_rects, const std::vector<Rect>& process_rects, const bool invert)
+		{
+			const auto x_size_reduced = context->x_size_reduced;
+			const auto xy_size_reduced = context->xy_size_reduced;
+			auto* const pixels_reduced = context->pixels_reduced;
+			auto* const pixels_reduced_built = context->pixels_reduced_built;
+
+			cubes_state.assign(xy_size_reduced, 0);
+			for (const auto& rect : dirty_rects)
+			{
+				add_cubes_state(get_cube_range(rect), cube_built);
+				add_cubes_state(get_inner_cube_range(rect), cube_inside);
+			}
+
+			// The process rects are on the grid of the cubes
+			for (const auto& rect : process_rects)
+				add_cubes_state(get_cube_range(rect), cube_ready);
+
+			// All the reduced cubes must be built from pixels that were not marked yet,
+			// so the marking starts only after the whole reduced map was updated.
+			// The regions of the background model are built whole, so the other cubes of the regions are
+			// taken back from the colors that they were built with
+			last_pixels_reduced.assign(pixels_reduced, pixels_reduced + xy_size_reduced);
+			build_reduced_map(dirty_rects);
+			for (auto i = 0; i < xy_size_reduced; i++)
+			{
+				if (cubes_state[i] & cube_built)
+					pixels_reduced_built[i] = pixels_reduced[i];
+				else
+					pixels_reduced[i] = pixels_reduced_built[i];
+			}
+
+			reduce_noise();
+
+			for (auto i = 0; i < xy_size_reduced; i++)
+				if (cubes_state[i] & cube_built || pixels_reduced[i] != last_pixels_reduced[i])
+					cubes_state[i] |= cube_marked;
+
+			// The cubes outside of the process rects have the pixels of the captured frame
+			if (invert)
+				for (auto y_r = 0; y_r < context->y_size_reduced; y_r++)
+					for (auto x_r = 0; x_r < x_size_reduced; x_r++)
+					{
+						if ((cubes_state[y_r * x_size_reduced + x_r] & (cube_marked | cube_ready)) != cube_marked)
+							continue;
+
+						const auto rect = get_cube_rect(x_r, y_r);
+						for (auto y = rect.top; y < rect.bottom; y++)
+							for_each_non_image_span(y, rect.left, rect.right, [&](const int x_from, const int x_to)
+							{
+								pixel_kernels::kernels->invert_pixels(&pixels[y * xb_size + x_from * 4], x_to - x_from);
+							});
+					}
+
+			mark_shapes(get_cube_range({0, 0, x_size, y_size}), [x_size_reduced](const int x_r, const int y_r)
+			{
+				return (cubes_state[y_r * x_size_reduced + x_r] & cube_marked) != 0;
+			});
+
+			// Store the output of the marked cubes outside of the dirty rects with the previous output
+			marked_rects.clear();
+			for (auto y_r = 0; y_r < context->y_size_reduced; y_r++)
+				for (auto x_r = 0; x_r < x_size_reduced;)
+				{
+					const auto is_stored = [&](const int x2_r)
+					{
+						return (cubes_state[y_r * x_size_reduced + x2_r] & (cube_marked | cube_inside)) == cube_marked;
+					};
+
+					if (!is_stored(x_r))
+					{
+						x_r++;
+						continue;
+					}
+
+					auto x_r_end = x_r + 1;
+					while (x_r_end < x_size_reduced && is_stored(x_r_end))
+						x_r_end++;
+
+					auto rect = get_cube_rect(x_r, y_r);
+					rect.right = get_cube_rect(x_r_end - 1, y_r).right;
+					if (rect.left < rect.right && rect.top < rect.bottom)
+					{
+						for (auto y = rect.top; y < rect.bottom; y++)
+							memcpy(&context->processed_pixels[y * xb_size + rect.left * 4],
+							       &pixels[y * xb_size + rect.left * 4], (rect.right - rect.left) * 4);
+						marked_rects.push_back(rect);
+					}
+
+					x_r = x_r_end;
+				}
+		}
+
+		// Move the grid of the cubes with the content, by the shift of the frame (see set_grid)
+		void move_grid(const int shift_x, const int shift_y)
+		{
+			set_grid(get_moved_offset(context->grid_x_offset, shift_x),
+			         get_moved_offset(context->grid_y_offset, shift_y));
+		}
+
+		// Move the grid, and the cubes of the reduced maps with it. is_shifted(x, y) tells if the pixel is in a
+		// shifted part of the frame, and the cubes of the other parts keep their place. A cube that has pixels
+		// of both kinds, or that the grid cut to other pixels, must be built again
+		template <typename IsShifted>
+		void move_grid(const int shift_x, const int shift_y, const IsShifted& is_shifted)
+		{
+			if (!shift_x && !shift_y)
+				return;
+
+			const auto last_x_offset = context->grid_x_offset, last_y_offset = context->grid_y_offset;
+			const auto last_x_size_reduced = context->x_size_reduced, last_y_size_reduced = context->y_size_reduced;
+			const auto last_xy_size_reduced = context->xy_size_reduced;
+			moved_cubes.resize(static_cast<size_t>(last_xy_size_reduced) * 2);
+			memcpy(&moved_cubes[0], context->pixels_reduced, last_xy_size_reduced);
+			memcpy(&moved_cubes[last_xy_size_reduced], context->pixels_reduced_built, last_xy_size_reduced);
+
+			move_grid(shift_x, shift_y);
+
+			// The offset from a shifted cube to the cube of the last frame with the same pixels
+			const auto cube_shift_x = (last_x_offset + shift_x - context->grid_x_offset) / cube_size;
+			const auto cube_shift_y = (last_y_offset + shift_y - context->grid_y_offset) / cube_size;
+
+			for (auto y_r = 0; y_r < context->y_size_reduced; y_r++)
+				for (auto x_r = 0; x_r < context->x_size_reduced; x_r++)
+				{
+					const auto point_r = y_r * context->x_size_reduced + x_r;
+					const auto cube_rect = get_cube_rect(x_r, y_r);
+
+					// A cube outside of the frame has no pixels, like in a full frame
+					if (cube_rect.left >= cube_rect.right || cube_rect.top >= cube_rect.bottom)
+					{
+						context->pixels_reduced[point_r] = context->pixels_reduced_built[point_r] = 0;
+						continue;
+					}
+
+					auto last_x_r = x_r, last_y_r = y_r;
+					if (is_shifted(cube_rect.left, cube_rect.top))
+					{
+						last_x_r += cube_shift_x;
+						last_y_r += cube_shift_y;
+					}
+
+					if (last_x_r < 0 || last_x_r >= last_x_size_reduced)
+						continue;
+					if (last_y_r < 0 || last_y_r >= last_y_size_reduced)
+						continue;
+
+					const auto last_point_r = last_y_r * last_x_size_reduced + last_x_r;
+					context->pixels_reduced[point_r] = moved_cubes[last_point_r];
+					context->pixels_reduced_built[point_r] = moved_cubes[last_xy_size_reduced + last_point_r];
+				}
+		}
+	}
+
+	namespace scroll_detection
+	{
+		// Size of the tiles that are reused or processed again. It is a multiple of the cube size
+		// of the glass effect so a dirty tile splits no cube while the grid of the cubes has no offset
+		constexpr int tile_size = glass_effect::cube_size * 8;
+
+		// When more than this part of the tiles is dirty, the whole frame is processed
+		constexpr double max_dirty_tiles_ratio = 0.6;
+
+		// Amount of lines that are sampled in each lane (band or strip) to vote for the shift
+		constexpr int anchors_per_lane = 16;
+		constexpr int min_shift_votes = 3;
+
+		enum TileState : byte
+		{
+			tile_same = 0,
+			tile_shifted = 1,
+			tile_dirty = 2,
+			// Processed again with the same pixels, since the images map was changed in it or the grid of the cubes
+			// of the glass effect was moved
+			tile_same_pixels = 3
+		};
+
+		bool is_processed(const byte state)
+		{
+			return state == tile_dirty || state == tile_same_pixels;
+		}
+
+		uint32_t row_hash_weights[tile_size];
+
+		int shift_x = 0, shift_y = 0;
+
+		std::vector<Rect> dirty_rects;
+		std::vector<Rect> process_rects;
+		std::vector<Rect> search_rects;
+		std::vector<Rect> changed_rects;
+		std::vector<Rect> pixels_dirty_rects;
+		std::vector<Rect> shifted_images_rects;
+
+		void enable()
+		{
+			context->scroll_detection_enabled = true;
+		}
+
+		void disable()
+		{
+			context->scroll_detection_enabled = false;
+		}
+
+		void invalidate()
+		{
+			++context->settings_version;
+		}
+
+		void free_resources()
+		{
+			for (auto i = 0; i < 2; i++)
+			{
+				if (context->row_hashes[i])
+				{
+					free(context->row_hashes[i]);
+					context->row_hashes[i] = nullptr;
+				}
+
+				if (context->column_hashes[i])
+				{
+					free(context->column_hashes[i]);
+					context->column_hashes[i] = nullptr;
+				}
+			}
+
+			if (context->tiles_state)
+			{
+				free(context->tiles_state);
+				context->tiles_state = nullptr;
+			}
+
+			if (context->shift_votes)
+			{
+				free(context->shift_votes);
+				context->shift_votes = nullptr;
+			}
+
+			if (context->processed_pixels)
+			{
+				free(context->processed_pixels);
+				context->processed_pixels = nullptr;
+			}
+
+			context->processed_settings_version = -1;
+		}
+
+		bool init()
+		{
+			free_resources();
+
+			context->tiles_x = (x_size + tile_size - 1) / tile_size;
+			context->tiles_y = (y_size + tile_size - 1) / tile_size;
+
+			for (auto i = 0; i < 2; i++)
+			{
+				context->row_hashes[i] = static_cast<uint32_t*>(
+					allocate(context->tiles_x * y_size * sizeof(uint32_t)));
+				context->column_hashes[i] = static_cast<uint32_t*>(
+					allocate(context->tiles_y * x_size * sizeof(uint32_t)));
+				if (!context->row_hashes[i] || !context->column_hashes[i])
+				{
+					std::cout << "Failed to malloc CPU memory for the scroll detection hashes\n";
+					free_resources();
+					return false;
+				}
+			}
+
+			context->tiles_state = static_cast<byte*>(allocate(context->tiles_x * context->tiles_y * sizeof(byte)));
+			context->shift_votes = static_cast<int*>(allocate(((x_size > y_size ? x_size : y_size) + 1) * sizeof(int)));
+			context->processed_pixels = static_cast<byte*>(allocate(xb_size * y_size * sizeof(byte)));
+			if (!context->tiles_state || !context->shift_votes || !context->processed_pixels)
+			{
+				std::cout << "Failed to malloc CPU memory for the scroll detection\n";
+				free_resources();
+				return false;
+			}
+
+			for (auto i = 0; i < tile_size; i++)
+				row_hash_weights[i] = (i + 1) * 2654435761u | 1;
+
+			return true;
+		}
+
+		// Hash the rows of each band and the columns of each strip in one pass over the frame.
+		// Both loops have no dependency between pixels so the compiler can vectorize them
+		void compute_hashes()
+		{
+			auto* const row_hash = context->row_hashes[0];
+			auto* const column_hash = context->column_hashes[0];
+
+			for (auto i = 0; i < context->tiles_y * x_size; i++)
+				column_hash[i] = 2166136261u;
+
+			for (auto y = 0; y < y_size; y++)
+			{
+				const auto* const row = reinterpret_cast<const uint32_t*>(&pixels[y * xb_size]);
+
+				auto* const strip_hash = &column_hash[(y / tile_size) * x_size];
+				for (auto x = 0; x < x_size; x++)
+					strip_hash[x] = (strip_hash[x] ^ row[x]) * 16777619u;
+
+				for (auto band = 0; band < context->tiles_x; band++)
+				{
+					const auto x_from = band * tile_size;
+					auto x_to = x_from + tile_size;
+					if (x_to > x_size) x_to = x_size;
+
+					uint32_t hash = 0;
+					for (auto x = x_from; x < x_to; x++)
+						hash += row[x] * row_hash_weights[x - x_from];
+
+					row_hash[band * y_size + y] = hash;
+				}
+			}
+		}
+
+		// Find the most common shift between the lines of the previous and the current frame.
+		// The returned shift is the offset from a line in the current frame to its source line
+		// in the previous frame, or 0 when there is no shift
+		int estimate_shift(uint32_t* const hashes[2], const int lane_count, const int line_count)
+		{
+			const auto max_shift = line_count / 2;
+			memset(context->shift_votes, 0, (max_shift * 2 + 1) * sizeof(int));
+
+			auto line_skip = line_count / anchors_per_lane;
+			if (line_skip < 1) line_skip = 1;
+
+			for (auto lane = 0; lane < lane_count; lane++)
+			{
+				const auto* const current = &hashes[0][lane * line_count];
+				const auto* const previous = &hashes[1][lane * line_count];
+
+				for (auto line = 1; line < line_count; line += line_skip)
+				{
+					// Only lines that changed and that are not part of uniform area can tell the shift
+					if (current[line] == previous[line] || current[line] == current[line - 1])
+						continue;
+
+					for (auto distance = 1; distance <= max_shift; distance++)
+					{
+						const auto line_up = line - distance;
+						const auto line_down = line + distance;
+
+						if (line_down < line_count && previous[line_down] == current[line])
+						{
+							context->shift_votes[max_shift + distance]++;
+							break;
+						}
+
+						if (line_up >= 0 && previous[line_up] == current[line])
+						{
+							context->shift_votes[max_shift - distance]++;
+							break;
+						}
+
+						if (line_up < 0 && line_down >= line_count)
+							break;
+					}
+				}
+			}
+
+			auto best_shift = 0;
+			auto best_votes = min_shift_votes - 1;
+			for (auto i = 0; i <= max_shift * 2; i++)
+			{
+				if (context->shift_votes[i] > best_votes)
+				{
+					best_votes = context->shift_votes[i];
+					best_shift = i - max_shift;
+				}
+			}
+
+			return best_shift;
+		}
+
+		bool lines_match(const uint32_t* current, const uint32_t* previous, const int line_from, const int line_to,
+		                 const int line_count, const int shift)
+		{
+			if (line_from + shift < 0 || line_to + shift > line_count)
+				return false;
+
+			for (auto line = line_from; line < line_to; line++)
+				if (current[line] != previous[line + shift])
+					return false;
+
+			return true;
+		}
+
+		// Returns the amount of dirty tiles
+		int classify_tiles()
+		{
+			auto dirty_tiles = 0;
+
+			for (auto ty = 0; ty < context->tiles_y; ty++)
+			{
+				const auto y_from = ty * tile_size;
+				auto y_to = y_from + tile_size;
+				if (y_to > y_size) y_to = y_size;
+
+				for (auto tx = 0; tx < context->tiles_x; tx++)
+				{
+					const auto x_from = tx * tile_size;
+					auto x_to = x_from + tile_size;
+					if (x_to > x_size) x_to = x_size;
+
+					const auto* const current_rows = &context->row_hashes[0][tx * y_size];
+					const auto* const previous_rows = &context->row_hashes[1][tx * y_size];
+					const auto* const current_columns = &context->column_hashes[0][ty * x_size];
+					const auto* const previous_columns = &context->column_hashes[1][ty * x_size];
+
+					auto& state = context->tiles_state[ty * context->tiles_x + tx];
+
+					if (lines_match(current_rows, previous_rows, y_from, y_to, y_size, 0))
+						state = tile_same;
+					else if (shift_y && lines_match(current_rows, previous_rows, y_from, y_to, y_size, shift_y))
+						state = tile_shifted;
+					else if (shift_x && lines_match(current_columns, previous_columns, x_from, x_to, x_size, shift_x))
+						state = tile_shifted;
+					else
+					{
+						state = tile_dirty;
+						dirty_tiles++;
+					}
+				}
+			}
+
+			return dirty_tiles;
+		}
+
+		// With an offset of the grid of the glass effect, a cube on the border of a tile has pixels of the tile next
+		// to it, and the cubes on the border of the frame are cut by it. So a tile next to a tile that was changed
+		// in another way, or a shifted tile on the border of the frame, has other cubes than before even when its
+		// own pixels are the same. Those tiles become dirty too, and the amount of them is returned
+		int add_neighbor_dirty_tiles()
+		{
+			static_assert(tile_size >= glass_effect::halo_x_cubes * glass_effect::cube_size &&
+			              tile_size >= glass_effect::halo_y_cubes * glass_effect::cube_size,
+			              "The halo must not reach beyond the tiles around a tile");
+
+			// Set on the tiles that become dirty, until all the tiles were compared with their original neighbors.
+			// A tile that is next only to tiles of the same pixels keeps its pixels, so it is not searched again
+			constexpr byte neighbor_flag = 0x80;
+			constexpr byte same_pixels_flag = 0x40;
+			constexpr byte neighbor_flags = neighbor_flag | same_pixels_flag;
+			auto dirty_tiles = 0;
+
+			const auto tiles_x = context->tiles_x, tiles_y = context->tiles_y;
+			auto* const tiles_state = context->tiles_state;
+			for (auto ty = 0; ty < tiles_y; ty++)
+				for (auto tx = 0; tx < tiles_x; tx++)
+				{
+					auto& state = tiles_state[ty * tiles_x + tx];
+					if (is_processed(state))
+						continue;
+
+					auto is_neighbor_changed = false;
+					auto is_same_pixels_neighbor = false;
+					for (auto ny = ty - 1; ny <= ty + 1; ny++)
+						for (auto nx = tx - 1; nx <= tx + 1; nx++)
+						{
+							// Nothing moves outside of the frame
+							const auto is_outside = ny < 0 || ny >= tiles_y || nx < 0 || nx >= tiles_x;
+							const auto neighbor_state =
+								is_outside ? tile_same : tiles_state[ny * tiles_x + nx] & ~neighbor_flags;
+							if (neighbor_state == tile_same_pixels)
+								is_same_pixels_neighbor = true;
+							else if (neighbor_state != state)
+								is_neighbor_changed = true;
+						}
+
+					if (is_neighbor_changed || is_same_pixels_neighbor)
+					{
+						state |= is_neighbor_changed ? neighbor_flag : same_pixels_flag;
+						dirty_tiles++;
+					}
+				}
+
+			for (auto i = 0; i < tiles_x * tiles_y; i++)
+			{
+				if (tiles_state[i] & neighbor_flag)
+					tiles_state[i] = tile_dirty;
+				else if (tiles_state[i] & same_pixels_flag)
+					tiles_state[i] = tile_same_pixels;
+			}
+
+			return dirty_tiles;
+		}
+
+		// Join the tiles that match the predicate in each row of tiles into runs, and join a run with
+		// the rect of the previous row when they have the same columns
+		template <typename Predicate>
+		void build_tile_rects(std::vector<Rect>& rects, Predicate predicate)
+		{
+			rects.clear();
+
+			for (auto ty = 0; ty < context->tiles_y; ty++)
+			{
+				const auto* const tile_row = &context->tiles_state[ty * context->tiles_x];
+				const auto top = ty * tile_size;
+				auto bottom = top + tile_size;
+				if (bottom > y_size) bottom = y_size;
+
+				for (auto tx = 0; tx < context->tiles_x;)
+				{
+					if (!predicate(tile_row[tx]))
+					{
+						tx++;
+						continue;
+					}
+
+					auto tx_end = tx + 1;
+					while (tx_end < context->tiles_x && predicate(tile_row[tx_end]))
+						tx_end++;
+
+					const auto left = tx * tile_size;
+					auto right = tx_end * tile_size;
+					if (right > x_size) right = x_size;
+
+					auto joined = false;
+					for (auto i = static_cast<int>(rects.size()) - 1; i >= 0 && rects[i].bottom >= top; i--)
+					{
+						if (rects[i].bottom == top && rects[i].left == left && rects[i].right == right)
+						{
+							rects[i].bottom = bottom;
+							joined = true;
+							break;
+						}
+					}
+
+					if (!joined)
+						rects.push_back({left, top, right, bottom});
+
+					tx = tx_end;
+				}
+			}
 		}
 
-		// Unload the resources that used for the algorithem that detect each pixel that is text or image
-		void free_resources()
+		// The processed area includes a halo of cubes around each dirty rect, and the
+		// processed rects must not overlap so no pixel is processed twice. The rects are on the grid of
+		// the cubes, so each cube is processed whole or not at all
+		void build_halo_rects(const std::vector<Rect>& rects, std::vector<Rect>& halo_rects)
 		{
-			// Allocate memory
-			if (pixels_reduced)
+			halo_rects.clear();
+
+			const auto cube_size = glass_effect::cube_size;
+			const auto halo_x = glass_effect::halo_x_cubes * cube_size;
+			const auto halo_y = glass_effect::halo_y_cubes * cube_size;
+			const auto x_offset = context->grid_x_offset, y_offset = context->grid_y_offset;
+			for (const auto& rect : rects)
 			{
-				delete pixels_reduced;
-				pixels_reduced = nullptr;
+				Rect process_rect = {rect.left - halo_x, rect.top - halo_y, rect.right + halo_x, rect.bottom + halo_y};
+				if (process_rect.left < 0) process_rect.left = 0;
+				if (process_rect.top < 0) process_rect.top = 0;
+				process_rect.left -= (process_rect.left + x_offset) % cube_size;
+				process_rect.top -= (process_rect.top + y_offset) % cube_size;
+				process_rect.right += (cube_size - (process_rect.right + x_offset) % cube_size) % cube_size;
+				process_rect.bottom += (cube_size - (process_rect.bottom + y_offset) % cube_size) % cube_size;
+				if (process_rect.left < 0) process_rect.left = 0;
+				if (process_rect.top < 0) process_rect.top = 0;
+				if (process_rect.right > x_size) process_rect.right = x_size;
+				if (process_rect.bottom > y_size) process_rect.bottom = y_size;
+				halo_rects.push_back(process_rect);
 			}
-		}
 
+			auto merged = true;
+			while (merged)
+			{
+				merged = false;
+				for (size_t i = 0; i < halo_rects.size() && !merged; i++)
+					for (auto j = i + 1; j < halo_rects.size(); j++)
+					{
+						auto& a = halo_rects[i];
+						const auto& b = halo_rects[j];
+						if (a.left >= b.right || b.left >= a.right || a.top >= b.bottom || b.top >= a.bottom)
+							continue;
+
+						if (b.left < a.left) a.left = b.left;
+						if (b.top < a.top) a.top = b.top;
+						if (b.right > a.right) a.right = b.right;
+						if (b.bottom > a.bottom) a.bottom = b.bottom;
+						halo_rects.erase(halo_rects.begin() + j);
+						merged = true;
+						break;
+					}
+			}
+		}
 
-		bool init()
+		void build_rects()
 		{
-			free_resources();
+			build_tile_rects(dirty_rects, is_processed);
 
-			x_size_reduced = x_size / cube_size + 1;
-			y_size_reduced = y_size / cube_size + 1;
-			xy_size_reduced = x_size_reduced * y_size_reduced;
+			// The output of the shifted tiles is moved, so it is changed too
+			build_tile_rects(changed_rects, [](const byte state) { return state != tile_same; });
 
-			pixels_reduced = pixels_reduced = new byte[xy_size_reduced];
+			build_halo_rects(dirty_rects, process_rects);
 
-			return true;
+			// The images are searched again only around the tiles whose pixels were changed
+			build_tile_rects(pixels_dirty_rects, [](const byte state) { return state == tile_dirty; });
+			build_halo_rects(pixels_dirty_rects, search_rects);
 		}
 
-
-		void map_shapes(double background)
+		// The tiles that the rects touch become tiles of changed images, unless they are dirty already
+		int mark_images_tiles(const std::vector<Rect>& rects)
 		{
-			// Build reduced map
+			auto images_tiles = 0;
+			for (const auto& rect : rects)
 			{
-				for (auto y_r = 0; y_r < y_size_reduced; y_r++)
-					for (auto x_r = 0; x_r < x_size_reduced; x_r++)
-					{
-						int colors[256] = {0};
-						auto max_color_count = 1;
-						const auto point_r = y_r * x_size_reduced + x_r;
+				const auto tx_from = rect.left > 0 ? rect.left / tile_size : 0;
+				const auto ty_from = rect.top > 0 ? rect.top / tile_size : 0;
+				const auto tx_to = rect.right < x_size ? (rect.right + tile_size - 1) / tile_size : context->tiles_x;
+				const auto ty_to = rect.bottom < y_size ? (rect.bottom + tile_size - 1) / tile_size : context->tiles_y;
 
-						const auto y = y_r * cube_size;
-						const auto x = x_r * cube_size;
-
-						const auto point = y * x_size + x;
-						byte max_color = (pixels[point] + pixels[point + 1] + pixels[point + 2]) / 3;
+				for (auto ty = ty_from; ty < ty_to; ty++)
+					for (auto tx = tx_from; tx < tx_to; tx++)
+					{
+						auto& state = context->tiles_state[ty * context->tiles_x + tx];
+						if (is_processed(state))
+							continue;
 
+						state = tile_same_pixels;
+						images_tiles++;
+					}
+			}
 
-						auto y_max = y + cube_size;
-						if (y_max > y_size) y_max = y_size;
-						auto x_max = x + cube_size;
-						if (x_max > x_size) x_max = x_size;
+			return images_tiles;
+		}
 
+		// Move the shifted tiles of the previous frame to their place in the current frame.
+		// move_span(y, x_from, x_to) moves the pixels [x_from, x_to) of the row y from their place in the previous frame
+		template <typename MoveSpan>
+		void shift_tiles(const MoveSpan& move_span)
+		{
+			if (shift_y)
+			{
+				// Copy the rows in an order that never overwrites a source row before it was used
+				for (auto i = 0; i < y_size; i++)
+				{
+					const auto y = shift_y > 0 ? i : y_size - 1 - i;
+					const auto* const tile_row = &context->tiles_state[(y / tile_size) * context->tiles_x];
+					for (auto tx = 0; tx < context->tiles_x; tx++)
+					{
+						if (tile_row[tx] != tile_shifted) continue;
 
-						for (auto y2 = y; y2 < y_max; y2++)
-							for (auto x2 = x; x2 < x_max; x2++)
-							{
-								const auto xy_point = y2 * x_size + x2;
-								if (map_images::image_area_data && map_images::image_area_data[xy_point]) continue;
-								auto point = y2 * x_size * 4 + x2 * 4;
-								const byte avg_color = (pixels[point] + pixels[point + 1] + pixels[point + 2]) / 3;
-								colors[avg_color]++;
-								if (colors[avg_color] > max_color_count)
-								{
-									max_color = avg_color;
-									max_color_count = colors[avg_color];
-								}
-							}
+						const auto x_from = tx * tile_size;
+						auto x_to = x_from + tile_size;
+						if (x_to > x_size) x_to = x_size;
 
-						pixels_reduced[point_r] = max_color;
+						move_span(y, x_from, x_to);
 					}
+				}
 			}
-
-			// Reduce noise in the map
+			else if (shift_x)
 			{
-				auto process = [&](unsigned int point, const int point_max, const int point_jump, const int max_count)
+				for (auto y = 0; y < y_size; y++)
 				{
-					const int point_start = point;
-					int point_end = point;
-					const auto color = pixels_reduced[point];
-
-					auto count = 0;
-					for (; point < point_max; point += point_jump)
+					const auto* const tile_row = &context->tiles_state[(y / tile_size) * context->tiles_x];
+					for (auto i = 0; i < context->tiles_x; i++)
 					{
-						if (color == pixels_reduced[point])
-						{
-							point_end = point;
-							count = 0;
-						}
-						else if (++count >= max_count)
-						{
-							break;
-						}
-					}
+						const auto tx = shift_x > 0 ? i : context->tiles_x - 1 - i;
+						if (tile_row[tx] != tile_shifted) continue;
 
-					if (point_start < point_end)
-					{
-						for (auto point_2 = point_start; point_2 <= point_end; point_2 += point_jump)
-							pixels_reduced[point_2] = color;
-					}
+						const auto x_from = tx * tile_size;
+						auto x_to = x_from + tile_size;
+						if (x_to > x_size) x_to = x_size;
 
+						move_span(y, x_from, x_to);
+					}
+				}
+			}
+		}
 
-					return point_end;
-				};
+		void shift_buffer(byte* buffer, const int pixel_size)
+		{
+			const auto row_size = x_size * pixel_size;
+			shift_tiles([&](const int y, const int x_from, const int x_to)
+			{
+				memmove(&buffer[y * row_size + x_from * pixel_size],
+				        &buffer[(y + shift_y) * row_size + (x_from + shift_x) * pixel_size],
+				        (x_to - x_from) * pixel_size);
+			});
+		}
 
+		void shift_mask(bit_mask::Word* mask)
+		{
+			shift_tiles([&](const int y, const int x_from, const int x_to)
+			{
+				bit_mask::move_bits(mask, y * x_size + x_from, (y + shift_y) * x_size + x_from + shift_x, x_to - x_from);
+			});
+		}
 
-				for (auto y = 0; y < y_size_reduced - 1; y++)
+		// When the grid of the cubes of the glass effect moves, the tiles that were not shifted are cut to other
+		// cubes, so they are processed again. Returns the amount of them
+		int add_cut_tiles()
+		{
+			auto cut_tiles = 0;
+			for (auto i = 0; i < context->tiles_x * context->tiles_y; i++)
+				if (context->tiles_state[i] == tile_same)
 				{
-					auto point = y * x_size_reduced;
-					const auto point_max = point + x_size_reduced - 1;
-					while (point < point_max)
-						point = process(point, point_max, 1, 5) + 1;
+					context->tiles_state[i] = tile_same_pixels;
+					cut_tiles++;
 				}
 
-				for (auto x = 0; x < x_size_reduced; x++)
-				{
-					auto point = x;
-					auto point_max = x + (y_size_reduced - 1) * x_size_reduced;
-					while (point < point_max)
-						point = process(point, point_max, x_size_reduced, 4) + x_size_reduced;
-				}
-			}
+			return cut_tiles;
+		}
 
-#if 0 // Debug - pring reduced map
-			for (auto y_r = 0; y_r < y_size_reduced; y_r++)
-				for (auto x_r = 0; x_r < x_size_reduced; x_r++)
-				{
-					auto point_r = y_r * x_size_reduced + x_r;
-					auto y = y_r * cube_size;
-					auto x = x_r * cube_size;
-					auto y_max = y + cube_size; if (y_max > y_end) y_max = y_end;
-					auto x_max = x + cube_size; if (x_max > x_end) x_max = x_end;
+		bool detect(const bool force_render, const std::vector<Rect>& images_rects)
+		{
+			if (!context->scroll_detection_enabled || !context->processed_pixels)
+				return false;
 
-					for (auto y2 = y; y2 < y_max; y2++)
-						for (auto x2 = x; x2 < x_max; x2++)
-						{
-							auto point = y2 * x_end * 4 + x2 * 4;
-							pixels[point] = pixels[point + 1] = pixels[point + 2] = pixels_reduced[point_r];
-						}
-				}
+			std::swap(context->row_hashes[0], context->row_hashes[1]);
+			std::swap(context->column_hashes[0], context->column_hashes[1]);
+			compute_hashes();
 
+			context->frame_settings_version = context->settings_version;
+			glass_effect::marked_rects.clear();
 
-#endif
+			// The hashes of the previous frame are taken since the buffers were allocated
+			if (context->processed_settings_version < 0)
+				return false;
 
-			// Mark shapes
-			{
-				for (auto y_r = 0; y_r < y_size_reduced; y_r++)
-					for (auto x_r = 0; x_r < x_size_reduced; x_r++)
-					{
-						const auto point_r = y_r * x_size_reduced + x_r;
-						const auto reduced_color = pixels_reduced[point_r];
-						const auto y = y_r * cube_size;
-						const auto x = x_r * cube_size;
-						auto y_max = y + cube_size;
-						if (y_max > y_size) y_max = y_size;
-						auto x_max = x + cube_size;
-						if (x_max > x_size) x_max = x_size;
+			shift_y = estimate_shift(context->row_hashes, context->tiles_x, y_size);
+			shift_x = shift_y ? 0 : estimate_shift(context->column_hashes, context->tiles_y, x_size);
 
+			// The analysis grid is not moved with the content, so a shift that is not on the grid
+			// would sample other pixels of the shifted tiles than a full frame
+			if (shift_y % context->analysis_scale) shift_y = 0;
+			if (shift_x % context->analysis_scale) shift_x = 0;
+
+			// The grid of the cubes of the glass effect is moved with the content also when the frame is processed
+			// whole, so a frame has the same cubes on both paths
+			if (force_render || context->processed_settings_version != context->frame_settings_version)
+			{
+				if (context->glass_effect_enabled)
+					glass_effect::move_grid(shift_x, shift_y);
+				return false;
+			}
 
-						byte shape_max_brightness = 0;
+			auto dirty_tiles = classify_tiles();
+			const auto is_grid_cut = shift_x % glass_effect::cube_size || shift_y % glass_effect::cube_size;
+			if (context->glass_effect_enabled && is_grid_cut)
+				dirty_tiles += add_cut_tiles();
+
+			// The images map is moved with the content also when the frame is processed whole
+			shift_buffer(context->processed_pixels, 4);
+			if (context->image_area_data)
+				shift_mask(context->image_area_data);
+			if (shift_y || shift_x)
+				map_images::invalidate_detection();
+
+			// The rects of the changed images are of the map before it was shifted, so the tiles at both places
+			// are processed again
+			dirty_tiles += mark_images_tiles(images_rects);
+			if ((shift_y || shift_x) && !images_rects.empty())
+			{
+				shifted_images_rects.clear();
+				for (const auto& rect : images_rects)
+					shifted_images_rects.push_back({rect.left - shift_x, rect.top - shift_y, rect.right - shift_x,
+					                                rect.bottom - shift_y});
+				dirty_tiles += mark_images_tiles(shifted_images_rects);
+			}
 
-						for (auto y2 = y; y2 < y_max; y2++)
-							for (auto x2 = x; x2 < x_max; x2++)
-							{
-								const auto xy_point = y2 * x_size + x2;
-								if (map_images::image_area_data && map_images::image_area_data[xy_point]) continue;
-								const auto point = y2 * x_size * 4 + x2 * 4;
+			if (context->glass_effect_enabled)
+				dirty_tiles += add_neighbor_dirty_tiles();
+			const auto is_partial = dirty_tiles <= context->tiles_x * context->tiles_y * max_dirty_tiles_ratio;
 
-								const byte avg_color = (pixels[point] + pixels[point + 1] + pixels[point + 2]) / 3;
+			if (context->glass_effect_enabled && is_partial)
+			{
+				// The cubes of the dirty tiles are built again, so only the cubes of the shifted tiles are moved
+				glass_effect::move_grid(shift_x, shift_y, [](const int x, const int y)
+				{
+					return context->tiles_state[(y / tile_size) * context->tiles_x + x / tile_size] == tile_shifted;
+				});
+			}
+			else if (context->glass_effect_enabled)
+			{
+				glass_effect::move_grid(shift_x, shift_y);
+			}
 
-								const auto is_shape_color = avg_color != reduced_color;
+			if (!is_partial)
+				return false;
 
-								if (is_shape_color)
-								{
-									if (avg_color > shape_max_brightness)
-										shape_max_brightness = avg_color;
-								}
-							}
+			build_rects();
+			return true;
+		}
 
+		const std::vector<Rect>& get_dirty_rects()
+		{
+			return dirty_rects;
+		}
 
-						float scalar = 255.0 / static_cast<float>(shape_max_brightness);
+		const std::vector<Rect>& get_process_rects()
+		{
+			return process_rects;
+		}
 
-						scalar *= shapes_level;
-						
+		const std::vector<Rect>& get_search_rects()
+		{
+			return search_rects;
+		}
 
-						for (auto y2 = y; y2 < y_max; y2++)
-							for (auto x2 = x; x2 < x_max; x2++)
-							{
-								const auto xy_point = y2 * x_size + x2;
-								if (map_images::image_area_data && map_images::image_area_data[xy_point]) continue;
-								const auto point = y2 * x_size * 4 + x2 * 4;
+		const std::vector<Rect>& get_changed_rects()
+		{
+			return changed_rects;
+		}
 
-								const auto is_shape_color = (pixels[point] + pixels[point + 1] + pixels[point + 2]) / 3
-									!= reduced_color;
+		void apply()
+		{
+			// Copy all the tiles that are not dirty from the previous output
+			for (auto y = 0; y < y_size; y++)
+			{
+				const auto* const tile_row = &context->tiles_state[(y / tile_size) * context->tiles_x];
+				auto* const row = &pixels[y * xb_size];
+				const auto* const processed_row = &context->processed_pixels[y * xb_size];
 
+				for (auto tx = 0; tx < context->tiles_x;)
+				{
+					if (is_processed(tile_row[tx]))
+					{
+						tx++;
+						continue;
+					}
 
-								if (is_shape_color)
-								{
+					auto tx_end = tx + 1;
+					while (tx_end < context->tiles_x && !is_processed(tile_row[tx_end]))
+						tx_end++;
 
-									if (scalar > 1)
-									{
+					const auto x_from = tx * tile_size;
+					auto x_to = tx_end * tile_size;
+					if (x_to > x_size) x_to = x_size;
 
-										int b = pixels[point];
-										int g = pixels[point + 1];
-										int r = pixels[point + 2];
+					memcpy(&row[x_from * 4], &processed_row[x_from * 4], (x_to - x_from) * 4);
+					tx = tx_end;
+				}
+			}
 
+			// The cubes of the glass effect that were marked outside of the dirty tiles are changed too
+			changed_rects.insert(changed_rects.end(), glass_effect::marked_rects.begin(),
+			                     glass_effect::marked_rects.end());
 
-										b *= scalar;
-										g *= scalar;
-										r *= scalar;
+			// Keep the new output of the dirty tiles for the next frames
+			for (const auto& rect : dirty_rects)
+				for (auto y = rect.top; y < rect.bottom; y++)
+					memcpy(&context->processed_pixels[y * xb_size + rect.left * 4], &pixels[y * xb_size + rect.left * 4],
+					       (rect.right - rect.left) * 4);
 
-										auto max = r > g ? r : g;
-										if (b > max) max = b;
+			context->processed_settings_version = context->frame_settings_version;
+		}
 
-										if (max > 255)
-										{
+		void store_output()
+		{
+			store_output(0, y_size);
+		}
 
-											const auto reduce_scalar = 255 / static_cast<float>(max);
-											b *= reduce_scalar;
-											g *= reduce_scalar;
-											r *= reduce_scalar;
-										}
+		void store_output(const int y_from, const int y_to)
+		{
+			if (!context->scroll_detection_enabled || !context->processed_pixels)
+				return;
 
-										pixels[point] = b;
-										pixels[point + 1] = g;
-										pixels[point + 2] = r;
-									}
-								}
-								else
-								{
-									if (dark_background_mode)
-									{
-										if (reduced_color > 128)
-										{
-											pixels[point] = 255 - pixels[point];
-											pixels[point + 1] = 255 - pixels[point + 1];
-											pixels[point + 2] = 255 - pixels[point + 2];
-										}
-									}
-
-									if (background_level != 1)
-									{
-										if (background_level != 0)
-										{
-											pixels[point] *= background_level;
-											pixels[point + 1] *= background_level;
-											pixels[point + 2] *= background_level;
-											pixels[point + 3] *= background_level;
-										}
-										else
-										{
-											memset(&pixels[point], 0, sizeof(unsigned char) * 4);
-										}
-									}
-								}
-							}
-					}
-			}
+			memcpy(&context->processed_pixels[y_from * xb_size], &pixels[y_from * xb_size],
+			       xb_size * (y_to - y_from) * sizeof(byte));
+			context->processed_settings_version = context->frame_settings_version;
 		}
 	}
 
+	AllocationStats get_allocation_stats()
+	{
+		return {allocations_count.load(), allocated_bytes.load()};
+	}
+
 	void set_default_settings()
 	{
-		map_images::is_enabled = false;
-		glass_effect::is_enabled = false;
+		context->map_images_enabled = false;
+		context->async_detection = false;
+		context->glass_effect_enabled = false;
+		context->scroll_detection_enabled = false;
+		context->requested_analysis_scale = 1;
+	}
+
+	void set_analysis_scale(const int scale)
+	{
+		context->requested_analysis_scale = scale == 2 || scale == 4 ? scale : 1;
 	}
 
 	void free_resources()
 	{
 		map_images::free_resources();
+		map_images::free_analysis_buffers();
+		scroll_detection::free_resources();
 		glass_effect::free_resources();
+		glass_effect::background_model::free_resources();
 
-		if (cached_pixels)
+		if (context->cached_row_hashes)
 		{
-			free(cached_pixels);
-			cached_pixels = nullptr;
+			free(context->cached_row_hashes);
+			context->cached_row_hashes = nullptr;
 		}
 
-		x_size = y_size = 0;
+		context->x_size = context->y_size = 0;
 
-		EmptyWorkingSet(GetCurrentProcess()); // Reduce memory usage
+		reduce_memory_usage();
 	}
 
-	void enable_cache_buffer(const bool enable)
+	void free_shared_resources()
 	{
-		is_enable_cached_buffer = enable;
-		if (!enable && cached_pixels)
-		{
-			free(cached_pixels);
-			cached_pixels = nullptr;
-		}
+		map_images::stop_detection();
+		glass_effect::column_noise::runs = std::vector<glass_effect::column_noise::ColumnRun>();
+		glass_effect::built_regions = std::vector<byte>();
+		glass_effect::cubes_state = std::vector<byte>();
+		glass_effect::last_pixels_reduced = std::vector<byte>();
+		glass_effect::marked_rects = std::vector<Rect>();
+		glass_effect::moved_cubes = std::vector<byte>();
+		glass_effect::tile_cache::free_resources();
+
+		reduce_memory_usage();
 	}
 
-	void init(ID3D11DeviceContext* d3d_context)
+	void enable_cache_buffer(const bool enable)
 	{
-		process_layer_cpu::d3d_context = d3d_context;
+		context->is_enable_cached_buffer = enable;
+		if (!enable && context->cached_row_hashes)
+		{
+			free(context->cached_row_hashes);
+			context->cached_row_hashes = nullptr;
+		}
 	}
 
 	// Free resources that used by this object. This method called also when you use `delete` keyword
 	bool load_frame(byte* pixels, int x_size, int y_size, int x_end,
 	                int y_end)
 	{
+		// The geometry is shared by the contexts, so it is set for each frame of the context that processes it
 		process_layer_cpu::pixels = pixels;
+		set_frame_geometry(x_size, y_size);
 
-		if (process_layer_cpu::x_size != x_size || process_layer_cpu::y_size != y_size)
+		// The scale is changed only between frames, so all the stages of a frame use the same scale
+		const auto new_analysis_scale = context->requested_analysis_scale.load();
+		if (context->analysis_scale != new_analysis_scale)
 		{
-			process_layer_cpu::x_size = x_size;
-			process_layer_cpu::y_size = y_size;
-			process_layer_cpu::x_end = x_end ? x_end : x_size;
-			process_layer_cpu::y_end = y_end ? y_end : y_size;
-
-			xb_size = x_size * 4;
-			xa_size = (y_size - 1) * xb_size;
-			xb_size0_b = xb_size - 4;
-			xab_size = x_size * (y_size - 1) * 4;
-
-			xy_size = x_size * (y_size + 1);
+			context->analysis_scale = new_analysis_scale;
+			scroll_detection::invalidate();
+		}
 
-			xa_start = xb_size * 4;
-			xa_end = xa_size - xb_size * 4;
-			xb_start = 4 * 8;
-			xb_end = xb_size - 4 * 8;
+		if (context->x_size != x_size || context->y_size != y_size)
+		{
+			context->x_size = x_size;
+			context->y_size = y_size;
+			context->x_end = x_end ? x_end : x_size;
+			context->y_end = y_end ? y_end : y_size;
+			context->cached_rows_pending_row = -1;
 
-			if (cached_pixels)
+			if (context->cached_row_hashes)
 			{
-				free(cached_pixels);
-				cached_pixels = nullptr;
+				free(context->cached_row_hashes);
+				context->cached_row_hashes = nullptr;
 			}
 
-			if (is_enable_cached_buffer)
+			if (context->is_enable_cached_buffer)
 			{
-				cached_pixels = static_cast<byte*>(malloc(x_size * 4 * y_size * sizeof(byte)));
-				if (!cached_pixels)
+				context->cached_row_hashes = static_cast<uint64_t*>(allocate(y_size * sizeof(uint64_t)));
+				if (!context->cached_row_hashes)
 				{
-					std::cout << "Failed to allocate memory for cached_pixels\n";
+					std::cout << "Failed to allocate memory for cached_row_hashes\n";
 					return false;
 				}
 
-				memcpy(cached_pixels, pixels, x_size * 4 * y_size * sizeof(byte));
+				context->cached_rows_pending_row = 0;
+				update_cached_rows();
 			}
 
 			map_images::free_resources();
-			glass_effect::free_resources();
+			scroll_detection::free_resources();
+			glass_effect::background_model::free_resources();
 
-			if (map_images::is_enabled && !map_images::init())
+			if (context->map_images_enabled && !map_images::init())
 			{
 				std::cout << "map_images::init() failed\n";
 				return false;
 			}
 
-			if (glass_effect::is_enabled && !glass_effect::init())
+			if (context->glass_effect_enabled && !glass_effect::init())
 			{
 				std::cout << "glass_effect::init() failed\n";
 				return false;
 			}
 
-			EmptyWorkingSet(GetCurrentProcess());
+			if (context->scroll_detection_enabled && !scroll_detection::init())
+			{
+				std::cout << "scroll_detection::init() failed\n";
+				return false;
+			}
+
+			reduce_memory_usage();
 		}
 
 		return true;
 	}
 
 
-	bool is_new_pixels()
+	// Hash of the compared part of a row (all the pixels except the last one, like before)
+	uint64_t hash_row(const int y)
 	{
-		auto same_pixels = true;
-		for (auto y = 0; y < y_end; y++)
+		return pixel_kernels::kernels->hash_row(&pixels[y * xb_size], static_cast<size_t>(context->x_end - 1) * 4);
+	}
+
+	bool is_new_pixels(const bool defer_copy)
+	{
+		auto first_new_row = -1;
+		for (auto y = 0; y < context->y_end; y++)
 		{
-			const unsigned int offset = y * x_size * 4;
-			if (memcmp(cached_pixels + offset, pixels + offset, (x_end - 1) * 4 * sizeof(byte)) != 0)
+			const auto hash = hash_row(y);
+			if (context->cached_row_hashes[y] != hash)
 			{
-				same_pixels = false;
+				context->cached_row_hashes[y] = hash;
+				first_new_row = y;
 				break;
 			}
 		}
 
-		if (same_pixels)
+		if (first_new_row == -1)
 			return false;
 
-		memcpy(cached_pixels, pixels, xab_size);
+		// The rows above the first new row are the same, so only the rest is hashed. It is deferred
+		// so the rows are hashed while they are in the cache for their processing
+		context->cached_rows_pending_row = first_new_row + 1;
+		if (!defer_copy)
+			update_cached_rows();
+
 		return true;
 	}
 
-	bool begin_process(ID3D11Texture2D* texture, const int x_end, const int y_end)
+	unsigned long long get_analysis_hash()
 	{
-		// map the texture
-		D3D11_MAPPED_SUBRESOURCE map_info;
-		ZeroMemory(&map_info, sizeof(D3D11_MAPPED_SUBRESOURCE));
-
-		const auto hr = d3d_context->Map
-		(
-			texture,
-			0, // Subresource
-			D3D11_MAP_READ,
-			0, // MapFlags
-			&map_info
-		);
-
-		if (hr != S_OK)
-		{
-			std::cout << "Failed to get mapped cpu texture\n";
-			return false;
-		}
+		// FNV-1a over 8 bytes at a time, it only needs to tell if the state was changed
+		auto hash = 14695981039346656037ull;
+		auto add_bytes = [&hash](const void* data, const size_t size)
+		{
+			const auto* const bytes = static_cast<const byte*>(data);
+			size_t i = 0;
+			for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+			{
+				uint64_t word;
+				memcpy(&word, bytes + i, sizeof(uint64_t));
+				hash = (hash ^ word) * 1099511628211ull;
+			}
+			for (; i < size; i++)
+				hash = (hash ^ bytes[i]) * 1099511628211ull;
+		};
+
+		add_bytes(context->common_colors, sizeof(context->common_colors));
+
+		if (context->map_images_enabled && context->image_area_data)
+			add_bytes(context->image_area_data, bit_mask::bytes_count(xy_size));
+
+		if (context->glass_effect_enabled && context->pixels_reduced)
+			add_bytes(context->pixels_reduced, context->xy_size_reduced);
+
+		return hash;
+	}
+
+	void update_cached_rows(const int y_to)
+	{
+		// Only the compared rows are hashed
+		auto y_max = y_to;
+		if (y_max > context->y_end) y_max = context->y_end;
 
-		process_layer_cpu::texture = texture;
-		return load_frame(static_cast<byte*>(map_info.pData), map_info.RowPitch / 4,
-		                  map_info.DepthPitch / map_info.RowPitch,
-		                  x_end, y_end);
+		if (context->cached_rows_pending_row < 0 || context->cached_rows_pending_row >= y_max)
+			return;
+
+		for (auto y = context->cached_rows_pending_row; y < y_max; y++)
+			context->cached_row_hashes[y] = hash_row(y);
+
+		context->cached_rows_pending_row = y_max < context->y_end ? y_max : -1;
 	}
 
+	void update_cached_rows()
+	{
+		update_cached_rows(y_size);
+	}
 
-	void end_process()
+	void invert_colors(const int y_from, const int y_to)
 	{
-		if (texture)
-		{
-			d3d_context->Unmap(texture, 0);
-			texture = nullptr;
-		}
+		for (auto y = y_from; y < y_to; y++)
+			for_each_non_image_span(y, 0, x_size, [&](const int x_from, const int x_to)
+			{
+				pixel_kernels::kernels->invert_pixels(&pixels[y * xb_size + x_from * 4], x_to - x_from);
+			});
 	}
 
+
 	void invert_colors()
 	{
-		if (!map_images::image_area_data)
+		invert_colors(0, y_size);
+	}
+
+	void invert_colors(const Rect& rect)
+	{
+		for (auto y = rect.top; y < rect.bottom; y++)
+			for_each_non_image_span(y, rect.left, rect.right, [&](const int x_from, const int x_to)
+			{
+				pixel_kernels::kernels->invert_pixels(&pixels[y * xb_size + x_from * 4], x_to - x_from);
+			});
+	}
+
+
+	namespace brightness_estimator
+	{
+		// The frame is divided to strata_count x strata_count cells, and each round takes one random pixel
+		// from each cell. After each round a Hoeffding bound tells if the majority is known with
+		// confidence 1 - 2 * e^-(2 * n * margin^2), and the sampling stops as soon as it is
+		constexpr int strata_count = 8;
+		constexpr int max_rounds = 64;
+		constexpr double confidence_log = 5.3; // -ln(0.01 / 2)
+
+		thread_local uint32_t random_state = 0x9E3779B9;
+
+		uint32_t next_random()
 		{
-			// Code to process the pixels goes here
-			for (auto y = 0; y < y_size; y++)
-				for (auto x = 0; x < x_size; x++)
-				{
-					const unsigned int point = y * x_size * 4 + x * 4;
-					pixels[point] = ~pixels[point];
-					pixels[point + 1] = ~pixels[point + 1];
-					pixels[point + 2] = ~pixels[point + 2];
-				}
+			// xorshift32
+			random_state ^= random_state << 13;
+			random_state ^= random_state >> 17;
+			random_state ^= random_state << 5;
+			return random_state;
 		}
-		else
+
+		bool is_bright(const byte* pixels, const int x_size, const int y_size, const int stride,
+		               const bit_mask::Word* skip_map)
 		{
-			for (auto y = 0; y < y_size; y++)
-				for (auto x = 0; x < x_size; x++)
+			if (x_size <= 0 || y_size <= 0)
+				return false;
+
+			auto samples = 0;
+			auto bright_samples = 0;
+
+			for (auto round = 0; round < max_rounds; round++)
+			{
+				for (auto cell_y = 0; cell_y < strata_count; cell_y++)
 				{
-					unsigned int point = y * x_size + x;
-					if (map_images::image_area_data[point]) continue;
-					point *= 4;
-					pixels[point] = ~pixels[point];
-					pixels[point + 1] = ~pixels[point + 1];
-					pixels[point + 2] = ~pixels[point + 2];
+					const auto y_from = cell_y * y_size / strata_count;
+					const auto y_cell_size = (cell_y + 1) * y_size / strata_count - y_from;
+					if (y_cell_size <= 0)
+						continue;
+
+					for (auto cell_x = 0; cell_x < strata_count; cell_x++)
+					{
+						const auto x_from = cell_x * x_size / strata_count;
+						const auto x_cell_size = (cell_x + 1) * x_size / strata_count - x_from;
+						if (x_cell_size <= 0)
+							continue;
+
+						const auto x = x_from + static_cast<int>(next_random() % x_cell_size);
+						const auto y = y_from + static_cast<int>(next_random() % y_cell_size);
+						const auto point = static_cast<size_t>(y) * stride + x;
+						if (skip_map && bit_mask::test(skip_map, point))
+							continue;
+
+						const auto* const pixel = &pixels[point * 4];
+						samples++;
+						if ((pixel[0] + pixel[1] + pixel[2]) / 3 > 127)
+							bright_samples++;
+					}
 				}
+
+				if (samples == 0)
+					continue;
+
+				// Stop when the distance of the bright ratio from 0.5 is bigger than the bound
+				const auto margin = bright_samples / static_cast<double>(samples) - 0.5;
+				if (2.0 * samples * margin * margin > confidence_log)
+					break;
+			}
+
+			return bright_samples * 2 > samples;
 		}
 	}
 
+	bool is_pixels_bright(const byte* pixels, const int x_size, const int y_size, const int stride)
+	{
+		return brightness_estimator::is_bright(pixels, x_size, y_size, stride, nullptr);
+	}
 
 	bool is_pixels_bright(byte* cpu_texture_pixels, const int x_size, const int y_size)
 	{
-		const auto pixels_skip = 30;
-		auto total_points = 0;
-		auto bright_points = 0;
-		if (!map_images::image_area_data)
+		return is_pixels_bright(cpu_texture_pixels, x_size, y_size, x_size);
+	}
+
+	bool is_current_pixels_bright()
+	{
+		// The images are not part of the background, so their pixels are skipped
+		const auto* const skip_map = context->map_images_enabled ? context->image_area_data : nullptr;
+		return brightness_estimator::is_bright(pixels, x_size, y_size, x_size, skip_map);
+	}
+
+	size_t get_l2_cache_size()
+	{
+		static size_t l2_cache_size = 0;
+		if (l2_cache_size)
+			return l2_cache_size;
+
+		l2_cache_size = default_l2_cache_size;
+
+#ifdef _WIN32
+		DWORD buffer_size = 0;
+		GetLogicalProcessorInformation(nullptr, &buffer_size);
+		std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> processors_info(
+			buffer_size / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+		if (processors_info.empty() || !GetLogicalProcessorInformation(processors_info.data(), &buffer_size))
 		{
-			for (auto y = 0; y < y_size; y += pixels_skip)
-				for (auto x = 0; x < x_size; x += pixels_skip)
-				{
-					const unsigned int point = y * x_size * 4 + x * 4;
-					total_points++;
-					if ((cpu_texture_pixels[point] + cpu_texture_pixels[point + 1] + cpu_texture_pixels[point + 2]) / 3
-						> 127)
-						bright_points++;
-				}
+			std::cout << "GetLogicalProcessorInformation failed. Using the default L2 cache size\n";
+			return l2_cache_size;
 		}
+
+		for (const auto& processor_info : processors_info)
+			if (processor_info.Relationship == RelationCache && processor_info.Cache.Level == 2)
+			{
+				l2_cache_size = processor_info.Cache.Size;
+				break;
+			}
+#elif defined(_SC_LEVEL2_CACHE_SIZE)
+		const auto cache_size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+		if (cache_size > 0)
+			l2_cache_size = static_cast<size_t>(cache_size);
 		else
+			std::cout << "sysconf(_SC_LEVEL2_CACHE_SIZE) failed. Using the default L2 cache size\n";
+#endif
+
+		return l2_cache_size;
+	}
+
+	int get_band_rows()
+	{
+		// The band is a whole amount of tiles of the tile cache, so each band starts on a row of tiles.
+		// Half of the cache is left for the reduced map, the tile cache and the rows of the previous band
+		constexpr auto band_alignment = glass_effect::cube_size * glass_effect::tile_cache::tile_cubes;
+
+		auto band_rows = static_cast<int>(get_l2_cache_size() / 2 / xb_size);
+		band_rows -= band_rows % band_alignment;
+		if (band_rows < band_alignment) band_rows = band_alignment;
+		return band_rows;
+	}
+
+	void process_in_strips(const bool invert, const bool glass)
+	{
+		const auto band_rows = get_band_rows();
+
+		if (glass)
+			glass_effect::column_noise::begin();
+
+		auto built_rows_r = 0, marked_rows_r = 0;
+
+		for (auto y_from = 0; y_from < y_size; y_from += band_rows)
 		{
-			for (auto y = 0; y < y_size; y += pixels_skip)
-				for (auto x = 0; x < x_size; x += pixels_skip)
-				{
-					unsigned int point = y * x_size + x;
-					if (map_images::image_area_data[point]) continue;
-					total_points++;
-					point *= 4;
-					if ((cpu_texture_pixels[point] + cpu_texture_pixels[point + 1] + cpu_texture_pixels[point + 2]) / 3
-						> 127)
-						bright_points++;
-				}
+			auto y_to = y_from + band_rows;
+			if (y_to > y_size) y_to = y_size;
+
+			update_cached_rows(y_to);
+
+			if (invert)
+				invert_colors(y_from, y_to);
+
+			if (!glass)
+			{
+				scroll_detection::store_output(y_from, y_to);
+				continue;
+			}
+
+			// Build the cubes that all their pixels are ready
+			glass_effect::CubeRange range;
+			range.x_r_start = 0;
+			range.x_r_end = context->x_size_reduced;
+			range.y_r_start = built_rows_r;
+			range.y_r_end = (y_to + context->grid_y_offset) / glass_effect::cube_size;
+			if (y_to == y_size) range.y_r_end = context->y_size_reduced;
+
+			glass_effect::build_reduced_map(range);
+			glass_effect::keep_built_rows(range);
+			glass_effect::reduce_noise_rows(range);
+			built_rows_r = range.y_r_end;
+
+			// Mark the rows of tiles that the noise reduction can't change anymore. They are still in the cache
+			auto final_rows_r = glass_effect::column_noise::advance(built_rows_r);
+			if (final_rows_r < context->y_size_reduced)
+				final_rows_r -= final_rows_r % glass_effect::tile_cache::tile_cubes;
+
+			if (final_rows_r > marked_rows_r)
+			{
+				range.y_r_start = marked_rows_r;
+				range.y_r_end = final_rows_r;
+				glass_effect::mark_shapes(range);
+
+				// The first row of cubes may be cut by the top of the frame
+				auto y_stored = marked_rows_r * glass_effect::cube_size - context->grid_y_offset;
+				if (y_stored < 0) y_stored = 0;
+				auto y_marked = final_rows_r * glass_effect::cube_size - context->grid_y_offset;
+				if (y_marked > y_size) y_marked = y_size;
+				scroll_detection::store_output(y_stored, y_marked);
+
+				marked_rows_r = final_rows_r;
+			}
 		}
+	}
+
+
+	Context* create_context()
+	{
+		return new Context();
+	}
 
-		return bright_points / static_cast<double>(total_points) > 0.5;
+	void destroy_context(Context* context)
+	{
+		select_context(context);
+		free_resources();
+		select_context(nullptr);
+		delete context;
 	}
 
-	bool is_current_pixels_bright()
+	void select_context(Context* context)
 	{
-		return is_pixels_bright(pixels, x_size, y_size);
+		process_layer_cpu::context = context ? context : &default_context;
 	}
 }
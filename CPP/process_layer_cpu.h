@@ -1,14 +1,44 @@
 #pragma once
-#include <d3d11.h>
-#include "capture_layer.h"
+#include <vector>
+#include "bit_mask.h"
+
+// The same type as the byte of the Windows headers, so the layer doesn't need them. The loading of the frames from
+// Direct3D textures is in process_layer_cpu_d3d11.h
+typedef unsigned char byte;
 
 namespace process_layer_cpu
 {
+	struct Rect
+	{
+		int left = 0;
+		int top = 0;
+		int right = 0;
+		int bottom = 0;
+	};
+
 	namespace map_images
 	{
-		void enable();
+		// With async_detection, the images of the whole frame are searched by a detection thread in a copy of the
+		// frame, at a rate that follows the time of the search, and the frames are processed meanwhile with the
+		// images of the last search that finished
+		void enable(bool async_detection = false);
 		void disable();
-		bool* map_images(bool force_update_common_colors);
+		// The returned map has a bit for each pixel of the frame, that is set for the pixels of images. A forced
+		// update searches the frame before it returns, also with async_detection. The images of a rect are
+		// always searched before it returns
+		bit_mask::Word* map_images(bool force_update_common_colors);
+		bit_mask::Word* map_images(bool force_update_common_colors, const Rect& rect);
+		// The map of the same frame as the last call, with the images that the detection thread found since
+		bit_mask::Word* update_images();
+		// The rects in which the last update_images or map_images took images of the detection thread that changed
+		// the map, so only they are processed again
+		const std::vector<Rect>& get_changed_rects();
+		// The detection thread found images that are newer than the map, or it can search the last frame, so the
+		// frame should be processed again with update_images
+		bool is_refresh_needed();
+		// The frame was shifted (scrolled), so the images of the copy that the detection thread searches are
+		// not at their place anymore
+		void invalidate_detection();
 	}
 
 	namespace glass_effect
@@ -17,25 +47,102 @@ namespace process_layer_cpu
 		            const double glass_images, const double glass_shapes);
 		void disable();
 		void map_shapes(double background);
+		// The shapes of the dirty rects of scroll_detection are mapped again, and the cubes around them whose color
+		// was changed. With invert, the pixels of those cubes outside of the process rects are inverted first
+		void map_shapes(const std::vector<Rect>& dirty_rects, const std::vector<Rect>& process_rects, bool invert);
 		void set_background_level(const double glass_background);
 		void set_shapes_level(const double glass_shapes);
 		void set_dark_background_mode(const bool enable);
-		
+
+		struct TileCacheStats
+		{
+			unsigned long long hits = 0;
+			unsigned long long misses = 0;
+			unsigned long long evictions = 0;
+			size_t entries = 0;
+			size_t bytes = 0;
+		};
+
+		// Cache of the processed output of repeated tiles (glyphs, icons, blank lines...)
+		namespace tile_cache
+		{
+			void enable(size_t max_bytes);
+			void disable();
+			TileCacheStats get_stats();
+			void reset_stats();
+		}
+	}
+
+	// Detects scrolling and other changes between following frames, so only the dirty
+	// tiles are processed and the rest of the frame is copied from the previous output
+	namespace scroll_detection
+	{
+		void enable();
+		void disable();
+		void invalidate();
+		// The tiles that images_rects touch are processed again also when their pixels are the same, since the
+		// images map was changed in them
+		bool detect(bool force_render, const std::vector<Rect>& images_rects);
+		const std::vector<Rect>& get_dirty_rects();
+		const std::vector<Rect>& get_process_rects();
+		// The process rects around the tiles whose pixels were changed, where the images are searched again
+		const std::vector<Rect>& get_search_rects();
+		// The rects of the output that are different from the previous output (the dirty and the shifted tiles, and
+		// the cubes of the glass effect that were marked around the dirty tiles)
+		const std::vector<Rect>& get_changed_rects();
+		void apply();
+		void store_output();
+		void store_output(int y_from, int y_to);
 	}
 
 	void enable_cache_buffer(bool enable);
-	void init(ID3D11DeviceContext* d3d_context);
 	bool load_frame(byte* pixels, int x_size, int y_size, int x_end,
 	                int y_end);
 	void set_default_settings();
+	void set_analysis_scale(int scale);
 	void free_resources();
-	ID3D11Texture2D* begin_process(capture_layer::TextureData captured_texture);
-	bool begin_process(ID3D11Texture2D* texture, int x_end, int y_end);
-	void end_process();
+	void free_shared_resources();
 	bool load_frame(byte* pixels, int x_size, int y_size, int x_end,
 	                int y_end);
 	void invert_colors();
+	void invert_colors(int y_from, int y_to);
+	void invert_colors(const Rect& rect);
+	// Sampled estimation if most of the pixels are bright. The stride is the distance between the rows in pixels
+	bool is_pixels_bright(const byte* pixels, int x_size, int y_size, int stride);
 	bool is_pixels_bright(byte* cpu_texture_pixels, int x_size, int y_size);
 	bool is_current_pixels_bright();
-	bool is_new_pixels();
+	// Compares the hashes of the rows with the ones of the last frame. With defer_copy the hashes of the rows
+	// after the first new row are updated later, by update_cached_rows. A change inside one 8 byte word of a row
+	// (one pixel) is always found. A row with more changed words is missed with a chance of about 2^-64, and
+	// then the frame is processed with its next change
+	bool is_new_pixels(bool defer_copy = false);
+	void update_cached_rows();
+	void update_cached_rows(int y_to);
+
+	// The buffers that were allocated by the process layer since the process started
+	struct AllocationStats
+	{
+		unsigned long long count = 0;
+		unsigned long long bytes = 0;
+	};
+
+	AllocationStats get_allocation_stats();
+
+	// Hash of the analysis state of the last frame of the selected context (common colors, images map and the
+	// reduced map of the glass effect). It reads only buffers of the context, so the frames of other targets that
+	// were processed in between don't change it. Used to know when the processing of a new size converged
+	unsigned long long get_analysis_hash();
+
+	// Run the stages of a full frame (invert colors, then the glass effect) band by band, where each
+	// band fits in the L2 cache. The hashes of the cached rows and the output of scroll_detection are stored
+	// in the same pass
+	void process_in_strips(bool invert, bool glass);
+
+	// The state of one target window, with its reduced map and analysis frame. All the functions above work on
+	// the context that the calling thread selected. The tile cache and the scratch buffers of a single call are
+	// shared, so the frames are processed by one thread at a time
+	struct Context;
+	Context* create_context();
+	void destroy_context(Context* context);
+	void select_context(Context* context);
 }
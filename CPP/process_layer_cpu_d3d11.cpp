@@ -0,0 +1,62 @@
+#include "process_layer_cpu_d3d11.h"
+
+#include <iostream>
+
+namespace process_layer_cpu
+{
+	// The texture that is mapped to the pixels of the frame
+	ID3D11Texture2D* texture = nullptr;
+	ID3D11DeviceContext* d3d_context = nullptr;
+
+	void init(ID3D11DeviceContext* d3d_context)
+	{
+		process_layer_cpu::d3d_context = d3d_context;
+	}
+
+	bool begin_process(ID3D11Texture2D* texture, const int x_end, const int y_end)
+	{
+		auto ready = true;
+		return begin_process(texture, x_end, y_end, true, ready);
+	}
+
+	bool begin_process(ID3D11Texture2D* texture, const int x_end, const int y_end, const bool wait, bool& ready)
+	{
+		// map the texture
+		D3D11_MAPPED_SUBRESOURCE map_info;
+		ZeroMemory(&map_info, sizeof(D3D11_MAPPED_SUBRESOURCE));
+
+		const auto hr = d3d_context->Map
+		(
+			texture,
+			0, // Subresource
+			D3D11_MAP_READ,
+			wait ? 0 : D3D11_MAP_FLAG_DO_NOT_WAIT, // MapFlags
+			&map_info
+		);
+
+		ready = hr != DXGI_ERROR_WAS_STILL_DRAWING;
+		if (!ready)
+			return true;
+
+		if (hr != S_OK)
+		{
+			std::cout << "Failed to get mapped cpu texture\n";
+			return false;
+		}
+
+		process_layer_cpu::texture = texture;
+		return load_frame(static_cast<byte*>(map_info.pData), map_info.RowPitch / 4,
+		                  map_info.DepthPitch / map_info.RowPitch,
+		                  x_end, y_end);
+	}
+
+
+	void end_process()
+	{
+		if (texture)
+		{
+			d3d_context->Unmap(texture, 0);
+			texture = nullptr;
+		}
+	}
+}
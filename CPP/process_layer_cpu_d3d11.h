@@ -0,0 +1,14 @@
+#pragma once
+#include <d3d11.h>
+#include "process_layer_cpu.h"
+
+// Loads the frames of the process layer from the staging textures of Direct3D 11. Only the renderer uses it, so the
+// rest of the layer (and GlassEngine) is built without the Windows headers
+namespace process_layer_cpu
+{
+	void init(ID3D11DeviceContext* d3d_context);
+	bool begin_process(ID3D11Texture2D* texture, int x_end, int y_end);
+	// Without wait, ready is set to false (and nothing is mapped) while the GPU still writes to the texture
+	bool begin_process(ID3D11Texture2D* texture, int x_end, int y_end, bool wait, bool& ready);
+	void end_process();
+}
@@ -39,83 +39,92 @@ namespace process_layer_gpu
 {
 	// ID3D11DeviceContext* d3d_context = nullptr; // TODO: Maybe remove this
 
-	int x_size, y_size; // x and y size of the texture
-	int x_end, y_end; // x and y size of the frame inside the texture
-	bool* d_image_area_data = nullptr;
-	unsigned char* d_pixels = nullptr;
-	unsigned char* d_cached_pixels = nullptr;
-	cudaArray* cu_array = nullptr;
-
-	bool is_enable_cached_buffer = false;
-	cudaGraphicsResource* cuda_resource = nullptr;
-
-	bool* d_is_new_pixels = nullptr;
-	int* d_bright_pixels_count = nullptr;
+	// The state of one target window
+	struct Context
+	{
+		int x_size = 0, y_size = 0; // x and y size of the texture
+		int x_end = 0, y_end = 0; // x and y size of the frame inside the texture
+		bit_mask::Word* d_image_area_data = nullptr;
+		unsigned char* d_pixels = nullptr;
+		unsigned char* d_cached_pixels = nullptr;
+		cudaArray* cu_array = nullptr;
 
-	ID3D11DeviceContext* d3d_context{nullptr};
+		bool is_enable_cached_buffer = false;
+		cudaGraphicsResource* cuda_resource = nullptr;
 
-	namespace glass_effect
-	{
-		bool is_enabled = false;
+		bool glass_effect_enabled = false;
 
 		unsigned char* pixels_reduced = nullptr;
 		unsigned char* d_pixels_reduced = nullptr;
 
-		int x_size_reduced;
-		int y_size_reduced;
-		int xy_size_reduced;
+		int x_size_reduced = 0;
+		int y_size_reduced = 0;
+		int xy_size_reduced = 0;
 
-		double background_level;
-		double dark_background;
-		double images_level;
-		double shapes_level;
+		double background_level = 0;
+		double dark_background = 0;
+		double images_level = 0;
+		double shapes_level = 0;
+	};
 
+	Context default_context;
 
+	// The context that all the functions of the calling thread work on
+	thread_local Context* context = &default_context;
+
+	// Shared by all the contexts
+	bool* d_is_new_pixels = nullptr;
+	int* d_bright_pixels_count = nullptr;
+
+	ID3D11DeviceContext* d3d_context{nullptr};
+
+	namespace glass_effect
+	{
 		void enable(const double glass_background, const bool glass_dark_background, const double glass_images,
 		            const double glass_shapes)
 		{
-			glass_effect::background_level = glass_background;
-			glass_effect::dark_background = glass_dark_background;
-			glass_effect::images_level = glass_images;
-			glass_effect::shapes_level = glass_shapes;
+			context->background_level = glass_background;
+			context->dark_background = glass_dark_background;
+			context->images_level = glass_images;
+			context->shapes_level = glass_shapes;
 
-			is_enabled = true;
+			context->glass_effect_enabled = true;
 		}
 
 		void set_background_level(const double glass_background)
 		{
-			glass_effect::background_level = glass_background;
+			context->background_level = glass_background;
 		}
 		
 		void set_shapes_level(const double glass_shapes)
 		{
-			glass_effect::shapes_level = glass_shapes;
+			context->shapes_level = glass_shapes;
 		}
 		
 		void set_dark_background(const bool enable)
 		{
-			glass_effect::dark_background = enable;
+			context->dark_background = enable;
 		}
 
 		void disable()
 		{
-			is_enabled = false;
+			context->glass_effect_enabled = false;
 		}
 
 		void dispose()
 		{
 			// Free GPU memory
-			if (d_pixels_reduced)
+			if (context->d_pixels_reduced)
 			{
-				cudaFree(d_pixels_reduced);
-				d_pixels_reduced = nullptr;
+				cudaFree(context->d_pixels_reduced);
+				context->d_pixels_reduced = nullptr;
 			}
 
 			// Free CPU memory
-			if (pixels_reduced)
+			if (context->pixels_reduced)
 			{
-				free(pixels_reduced);
-				pixels_reduced = nullptr;
+				free(context->pixels_reduced);
+				context->pixels_reduced = nullptr;
 			}
 		}
 
@@ -132,21 +141,22 @@ namespace process_layer_gpu
 			dispose();
 
 			// Init variables
-			x_size_reduced = x_end / GLASS_MODE_WARP_SIZE_SQRT + 1;
-			y_size_reduced = y_end / GLASS_MODE_WARP_SIZE_SQRT + 1;
-			xy_size_reduced = x_size_reduced * y_size_reduced;
+			context->x_size_reduced = context->x_end / GLASS_MODE_WARP_SIZE_SQRT + 1;
+			context->y_size_reduced = context->y_end / GLASS_MODE_WARP_SIZE_SQRT + 1;
+			context->xy_size_reduced = context->x_size_reduced * context->y_size_reduced;
 
 			// Allocate memory
 
 			// Allocate memory in GPU
-			const auto result = cudaMalloc(&d_pixels_reduced, sizeof(unsigned char) * xy_size_reduced);
+			const auto result = cudaMalloc(&context->d_pixels_reduced, sizeof(unsigned char) * context->xy_size_reduced);
 
 			if (result != cudaSuccess)
 				return on_error("Failed to malloc d_pixels_reduced on GPU");
 
 			// Allocate memory in CPU
-			pixels_reduced = static_cast<unsigned char*>(malloc(sizeof(unsigned char) * xy_size_reduced));
-			if (pixels_reduced == nullptr) return on_error("Failed to malloc pixels_reduced on CPU");
+			context->pixels_reduced = static_cast<unsigned char*>(
+				malloc(sizeof(unsigned char) * context->xy_size_reduced));
+			if (context->pixels_reduced == nullptr) return on_error("Failed to malloc pixels_reduced on CPU");
 
 			return true;
 		}
@@ -154,14 +164,14 @@ namespace process_layer_gpu
 
 		__global__ void kernel_perform_images_opacity(unsigned char* pixels, int x_size, int y_size,
 		                                              const int xy_size,
-		                                              const bool* image_area,
+		                                              const bit_mask::Word* image_area,
 		                                              const float images_level)
 		{
 			const auto thread_4_point = blockIdx.x * blockDim.x + threadIdx.x;
 			const auto thread_point = thread_4_point >> 2;
 
 			if (thread_point >= xy_size) return;
-			if (!image_area[thread_point]) return;
+			if (!bit_mask::test(image_area, thread_point)) return;
 
 			pixels[thread_4_point] *= images_level;
 		}
@@ -308,7 +318,7 @@ namespace process_layer_gpu
 		                                   const int x_size, int y_size,
 		                                   const int xy_size,
 		                                   const int x_end, const int y_end,
-		                                   bool* image_area_data, const float texts_level,
+		                                   const bit_mask::Word* image_area_data, const float texts_level,
 		                                   const float background_level, const bool dark_background)
 		{
 			const auto block_x = (blockIdx.x % x_reduced) * GLASS_MODE_WARP_SIZE_SQRT;
@@ -320,7 +330,7 @@ namespace process_layer_gpu
 			if (block_y + thread_y >= y_end) return;
 
 
-			if (image_area_data && image_area_data[(block_y + thread_y) * x_size + (block_x + thread_x)]) 
+			if (image_area_data && bit_mask::test(image_area_data, (block_y + thread_y) * x_size + (block_x + thread_x)))
 				return;
 
 
@@ -433,12 +443,12 @@ namespace process_layer_gpu
 		bool map_shapes()
 		{
 			cudaError_t cuda_result;
-			if (images_level < 1.0 && d_image_area_data)
+			if (context->images_level < 1.0 && context->d_image_area_data)
 			{
 				kernel_perform_images_opacity
-					<< < ((y_end) * (x_end) * 4) / GLASS_MODE_WARP_SIZE, GLASS_MODE_WARP_SIZE >> >
-					(d_pixels, x_end, y_end, (y_end - 1) * x_end,
-					 d_image_area_data, images_level); 
+					<< < ((context->y_end) * (context->x_end) * 4) / GLASS_MODE_WARP_SIZE, GLASS_MODE_WARP_SIZE >> >
+					(context->d_pixels, context->x_end, context->y_end, (context->y_end - 1) * context->x_end,
+					 context->d_image_area_data, context->images_level); 
 
 				cuda_result = cudaDeviceSynchronize();
 				if (cuda_result != cudaSuccess)
@@ -450,8 +460,9 @@ namespace process_layer_gpu
 
 
 			kernel_build_reduced_pixels
-				<< < xy_size_reduced, GLASS_MODE_WARP_SIZE >> >
-				(d_pixels, x_end, (y_end - 1) * x_end, d_pixels_reduced, x_size_reduced);
+				<< < context->xy_size_reduced, GLASS_MODE_WARP_SIZE >> >
+				(context->d_pixels, context->x_end, (context->y_end - 1) * context->x_end, context->d_pixels_reduced,
+				 context->x_size_reduced);
 
 
 			cuda_result = cudaDeviceSynchronize();
@@ -462,15 +473,16 @@ namespace process_layer_gpu
 			}
 
 
-			cuda_result = cudaMemcpy(pixels_reduced, d_pixels_reduced, sizeof(unsigned char) * xy_size_reduced,
-			                         cudaMemcpyDeviceToHost);
+			cuda_result = cudaMemcpy(context->pixels_reduced, context->d_pixels_reduced,
+			                         sizeof(unsigned char) * context->xy_size_reduced, cudaMemcpyDeviceToHost);
 			if (cuda_result != cudaSuccess)
 			{
 				CudaCheckError(cuda_result);
 				return false;
 			}
 
-			reduce_noise(pixels_reduced, x_size_reduced, y_size_reduced, xy_size_reduced);
+			reduce_noise(context->pixels_reduced, context->x_size_reduced, context->y_size_reduced,
+			             context->xy_size_reduced);
 
 
 #if 0 // Display reduced pixels (For debug only)
@@ -486,8 +498,8 @@ namespace process_layer_gpu
 			return;
 #endif
 
-			cuda_result = cudaMemcpy(d_pixels_reduced, pixels_reduced, sizeof(unsigned char) * xy_size_reduced,
-			                         cudaMemcpyHostToDevice);
+			cuda_result = cudaMemcpy(context->d_pixels_reduced, context->pixels_reduced,
+			                         sizeof(unsigned char) * context->xy_size_reduced, cudaMemcpyHostToDevice);
 			if (cuda_result != cudaSuccess)
 			{
 				CudaCheckError(cuda_result);
@@ -497,10 +509,11 @@ namespace process_layer_gpu
 
 			// GPU-Process(pixels_reduced,pixels)
 			kernel_mark_shapes
-				<< < xy_size_reduced, GLASS_MODE_WARP_SIZE >> >
-				(d_pixels_reduced, x_size_reduced, y_size_reduced, d_pixels, x_size, y_size,
-				 x_size * (y_size - 1), x_end, y_end,
-				 d_image_area_data, shapes_level, background_level, dark_background);
+				<< < context->xy_size_reduced, GLASS_MODE_WARP_SIZE >> >
+				(context->d_pixels_reduced, context->x_size_reduced, context->y_size_reduced, context->d_pixels,
+				 context->x_size, context->y_size,
+				 context->x_size * (context->y_size - 1), context->x_end, context->y_end,
+				 context->d_image_area_data, context->shapes_level, context->background_level, context->dark_background);
 
 
 			cuda_result = cudaDeviceSynchronize();
@@ -522,19 +535,13 @@ namespace process_layer_gpu
 
 	bool enable_cache_buffer(const bool enable)
 	{
-		is_enable_cached_buffer = enable;
+		context->is_enable_cached_buffer = enable;
 		if (!enable)
 		{
-			if (d_cached_pixels)
-			{
-				cudaFree(d_cached_pixels);
-				d_cached_pixels = nullptr;
-			}
-
-			if (d_is_new_pixels)
+			if (context->d_cached_pixels)
 			{
-				cudaFree(d_is_new_pixels);
-				d_is_new_pixels = nullptr;
+				cudaFree(context->d_cached_pixels);
+				context->d_cached_pixels = nullptr;
 			}
 		}
 		else
@@ -555,46 +562,46 @@ namespace process_layer_gpu
 
 	bool init_frame(int x_size, int y_size, int x_end, int y_end)
 	{
-		process_layer_gpu::x_end = x_size;
-		process_layer_gpu::y_end = y_size;
-		process_layer_gpu::x_end = x_end ? x_end : x_size;
-		process_layer_gpu::y_end = y_end ? y_end : y_size;
+		context->x_end = x_size;
+		context->y_end = y_size;
+		context->x_end = x_end ? x_end : x_size;
+		context->y_end = y_end ? y_end : y_size;
 		return true;
 	}
 
 	void set_default_settings()
 	{
-		glass_effect::is_enabled = false;
-		is_enable_cached_buffer = false;
+		context->glass_effect_enabled = false;
+		context->is_enable_cached_buffer = false;
 	}
 
 	void free_resources()
 	{
-		if (d_pixels)
+		if (context->d_pixels)
 		{
-			cudaFree(d_pixels);
-			d_pixels = nullptr;
+			cudaFree(context->d_pixels);
+			context->d_pixels = nullptr;
 		}
 
-		if (d_cached_pixels)
+		if (context->d_cached_pixels)
 		{
-			cudaFree(d_cached_pixels);
-			d_cached_pixels = nullptr;
+			cudaFree(context->d_cached_pixels);
+			context->d_cached_pixels = nullptr;
 		}
 
-		if (d_image_area_data)
+		if (context->d_image_area_data)
 		{
-			cudaFree(d_image_area_data);
-			d_image_area_data = nullptr;
+			cudaFree(context->d_image_area_data);
+			context->d_image_area_data = nullptr;
 		}
 
-		if (cuda_resource)
+		if (context->cuda_resource)
 		{
-			cudaGraphicsUnregisterResource(cuda_resource);
-			cuda_resource = nullptr;
+			cudaGraphicsUnregisterResource(context->cuda_resource);
+			context->cuda_resource = nullptr;
 		}
 
-		x_size = y_size = x_end = y_end = 0;
+		context->x_size = context->y_size = context->x_end = context->y_end = 0;
 
 		EmptyWorkingSet(GetCurrentProcess()); // Reduce memory usage
 	}
@@ -623,17 +630,17 @@ namespace process_layer_gpu
 		process_layer_cpu::texture = texture;
 		return load_frame(static_cast<byte*>(map_info.pData), map_info.RowPitch / 4,
 			map_info.DepthPitch / map_info.RowPitch,
-			x_end, y_end);
+			context->x_end, context->y_end);
 #endif
 
 		cudaError_t result;
-		const auto is_resized = capture_x_size != x_end || capture_y_size != y_end;
+		const auto is_resized = capture_x_size != context->x_end || capture_y_size != context->y_end;
 		if (is_resized)
 		{
 			free_resources();
 
-			x_end = capture_x_size;
-			y_end = capture_y_size;
+			context->x_end = capture_x_size;
+			context->y_end = capture_y_size;
 
 
 			D3D11_MAPPED_SUBRESOURCE map_info;
@@ -654,34 +661,34 @@ namespace process_layer_gpu
 				return false;
 			}
 
-			x_size = map_info.RowPitch / 4;
-			y_size = map_info.DepthPitch / map_info.RowPitch;
+			context->x_size = map_info.RowPitch / 4;
+			context->y_size = map_info.DepthPitch / map_info.RowPitch;
 
 			d3d_context->Unmap(texture, 0);
 
 
-			result = cudaGraphicsD3D11RegisterResource(&cuda_resource, texture, cudaGraphicsRegisterFlagsNone);
+			result = cudaGraphicsD3D11RegisterResource(&context->cuda_resource, texture, cudaGraphicsRegisterFlagsNone);
 			if (result != cudaSuccess)
 			{
 				CudaCheckError(result);
 				return false;
 			}
 
-			result = cudaMalloc(&d_pixels, x_size * y_size * 4 * sizeof(unsigned char));
+			result = cudaMalloc(&context->d_pixels, context->x_size * context->y_size * 4 * sizeof(unsigned char));
 			if (result != cudaSuccess)
 			{
 				CudaCheckError(result);
 				return false;
 			}
 
-			if (glass_effect::is_enabled)
+			if (context->glass_effect_enabled)
 				glass_effect::init();
 
 
 			EmptyWorkingSet(GetCurrentProcess()); // Reduce memory usage
 		}
 
-		result = cudaGraphicsMapResources(1, &cuda_resource, nullptr);
+		result = cudaGraphicsMapResources(1, &context->cuda_resource, nullptr);
 		if (result != cudaSuccess)
 		{
 			CudaCheckError(result);
@@ -689,42 +696,44 @@ namespace process_layer_gpu
 		}
 
 
-		result = cudaGraphicsSubResourceGetMappedArray(&cu_array, cuda_resource, 0, 0);
+		result = cudaGraphicsSubResourceGetMappedArray(&context->cu_array, context->cuda_resource, 0, 0);
 		if (result != cudaSuccess)
 		{
 			CudaCheckError(result);
-			cudaGraphicsUnmapResources(1, &cuda_resource, nullptr);
+			cudaGraphicsUnmapResources(1, &context->cuda_resource, nullptr);
 			return false;
 		}
 
-		result = cudaMemcpyFromArray(d_pixels, cu_array, 0, 0, x_end * y_end * 4 * sizeof(unsigned char),
+		result = cudaMemcpyFromArray(context->d_pixels, context->cu_array, 0, 0,
+		                             context->x_end * context->y_end * 4 * sizeof(unsigned char),
 		                             cudaMemcpyDeviceToDevice);
 		if (result != cudaSuccess)
 		{
 			CudaCheckError(result);
-			cudaGraphicsUnmapResources(1, &cuda_resource, nullptr);
+			cudaGraphicsUnmapResources(1, &context->cuda_resource, nullptr);
 			// TODO - Add unmap here
 			return false;
 		}
 
 
-		if (is_enable_cached_buffer && is_resized)
+		if (context->is_enable_cached_buffer && is_resized)
 		{
-			if (d_cached_pixels)
+			if (context->d_cached_pixels)
 			{
-				cudaFree(d_cached_pixels);
-				d_cached_pixels = nullptr;
+				cudaFree(context->d_cached_pixels);
+				context->d_cached_pixels = nullptr;
 			}
 
-			result = cudaMalloc(&d_cached_pixels, x_size * y_size * 4 * sizeof(unsigned char));
+			result = cudaMalloc(&context->d_cached_pixels,
+			                    context->x_size * context->y_size * 4 * sizeof(unsigned char));
 			if (result != cudaSuccess)
 			{
 				CudaCheckError(result);
 				return false;
 			}
 
-			result = cudaMemcpy(d_cached_pixels, d_pixels, x_size * y_size * 4 * sizeof(unsigned char),
-			                    cudaMemcpyDeviceToDevice);
+			result = cudaMemcpy(context->d_cached_pixels, context->d_pixels,
+			                    context->x_size * context->y_size * 4 * sizeof(unsigned char), cudaMemcpyDeviceToDevice);
 			if (result != cudaSuccess)
 			{
 				CudaCheckError(result);
@@ -738,7 +747,8 @@ namespace process_layer_gpu
 
 	bool end_process()
 	{
-		auto result = cudaMemcpyToArray(cu_array, 0, 0, d_pixels, x_end * y_end * 4 * sizeof(unsigned char),
+		auto result = cudaMemcpyToArray(context->cu_array, 0, 0, context->d_pixels,
+		                                context->x_end * context->y_end * 4 * sizeof(unsigned char),
 		                                cudaMemcpyDeviceToDevice);
 		if (result != cudaSuccess)
 		{
@@ -746,7 +756,7 @@ namespace process_layer_gpu
 			return false;
 		}
 
-		result = cudaGraphicsUnmapResources(1, &cuda_resource, nullptr);
+		result = cudaGraphicsUnmapResources(1, &context->cuda_resource, nullptr);
 		if (result != cudaSuccess)
 		{
 			CudaCheckError(result);
@@ -758,7 +768,7 @@ namespace process_layer_gpu
 	}
 
 
-	__global__ void kernel_is_new_pixels(bool* image_area_data, unsigned char* cached_pixels, unsigned char* pixels,
+	__global__ void kernel_is_new_pixels(const bit_mask::Word* image_area_data, unsigned char* cached_pixels, unsigned char* pixels,
 	                                     const int x_size, const int x_end, const int y_end, bool* is_new_pixels)
 	{
 		auto point = blockIdx.x * blockDim.x + threadIdx.x;
@@ -804,8 +814,9 @@ namespace process_layer_gpu
 		}
 
 		kernel_is_new_pixels
-			<< < (x_size * y_size) / DARK_MODE_WARP_SIZE, DARK_MODE_WARP_SIZE >> >
-			(d_image_area_data, d_cached_pixels, d_pixels, x_size, x_end, y_end, d_is_new_pixels);
+			<< < (context->x_size * context->y_size) / DARK_MODE_WARP_SIZE, DARK_MODE_WARP_SIZE >> >
+			(context->d_image_area_data, context->d_cached_pixels, context->d_pixels, context->x_size, context->x_end,
+			 context->y_end, d_is_new_pixels);
 
 		result = cudaDeviceSynchronize();
 		if (result != cudaSuccess)
@@ -827,21 +838,22 @@ namespace process_layer_gpu
 		return is_new_pixels;
 	}
 
-	bool set_image_area_data(bool* image_area_data)
+	bool set_image_area_data(const bit_mask::Word* image_area_data)
 	{
 		if (!image_area_data)
 		{
-			if (d_image_area_data)
+			if (context->d_image_area_data)
 			{
-				cudaFree(d_image_area_data);
-				d_image_area_data = nullptr;
+				cudaFree(context->d_image_area_data);
+				context->d_image_area_data = nullptr;
 			}
 			return true;
 		}
 
-		if (!d_image_area_data)
+		if (!context->d_image_area_data)
 		{
-			const auto result = cudaMalloc(&d_image_area_data, x_size * y_size * sizeof(bool));
+			const auto result = cudaMalloc(&context->d_image_area_data,
+			                               bit_mask::bytes_count(context->x_size * context->y_size));
 			if (result != cudaSuccess)
 			{
 				CudaCheckError(result);
@@ -849,8 +861,8 @@ namespace process_layer_gpu
 			}
 		}
 
-		const auto result = cudaMemcpy(d_image_area_data, image_area_data, x_size * y_size * sizeof(bool),
-		                               cudaMemcpyHostToDevice);
+		const auto result = cudaMemcpy(context->d_image_area_data, image_area_data,
+		                               bit_mask::bytes_count(context->x_size * context->y_size), cudaMemcpyHostToDevice);
 		if (result != cudaSuccess)
 		{
 			CudaCheckError(result);
@@ -860,7 +872,7 @@ namespace process_layer_gpu
 		return true;
 	}
 
-	__global__ void kernel_is_current_pixels_bright(unsigned char* pixels, bool* image_area_data, int* bright_count,
+	__global__ void kernel_is_current_pixels_bright(unsigned char* pixels, const bit_mask::Word* image_area_data, int* bright_count,
 	                                                const int x_size, const int x_end, const int y_end)
 	{
 		auto point = blockIdx.x * blockDim.x + +threadIdx.x;;
@@ -901,8 +913,9 @@ namespace process_layer_gpu
 
 
 		kernel_is_current_pixels_bright
-			<< < (x_size * y_size) / DARK_MODE_WARP_SIZE, DARK_MODE_WARP_SIZE >> >
-			(d_pixels, d_image_area_data, d_bright_pixels_count, x_size, x_end, y_end);
+			<< < (context->x_size * context->y_size) / DARK_MODE_WARP_SIZE, DARK_MODE_WARP_SIZE >> >
+			(context->d_pixels, context->d_image_area_data, d_bright_pixels_count, context->x_size, context->x_end,
+			 context->y_end);
 
 
 		result = cudaDeviceSynchronize();
@@ -924,12 +937,12 @@ namespace process_layer_gpu
 		}
 
 
-		return bright_pixels_count > x_end * y_end / 2;
+		return bright_pixels_count > context->x_end * context->y_end / 2;
 	}
 
 
 	__global__ void kernel_invert_colors
-	(bool* d_image_area_data, unsigned char* d_pixels, const int x_size, const int x_end, const int y_end)
+	(const bit_mask::Word* d_image_area_data, unsigned char* d_pixels, const int x_size, const int x_end, const int y_end)
 	{
 		const auto idx = blockIdx.x * blockDim.x + threadIdx.x;
 
@@ -941,7 +954,7 @@ namespace process_layer_gpu
 			return;
 
 
-		if (d_image_area_data && d_image_area_data[idx])
+		if (d_image_area_data && bit_mask::test(d_image_area_data, idx))
 			return;
 
 		const auto point = (y * x_end + x) * 4;
@@ -955,8 +968,8 @@ namespace process_layer_gpu
 	{
 		//return true;
 		kernel_invert_colors
-			<< < (x_size * y_size) / DARK_MODE_WARP_SIZE, DARK_MODE_WARP_SIZE >> >
-			(d_image_area_data, d_pixels, x_size, x_end, y_end);
+			<< < (context->x_size * context->y_size) / DARK_MODE_WARP_SIZE, DARK_MODE_WARP_SIZE >> >
+			(context->d_image_area_data, context->d_pixels, context->x_size, context->x_end, context->y_end);
 
 
 		const auto result = cudaDeviceSynchronize();
@@ -966,4 +979,24 @@ namespace process_layer_gpu
 		CudaCheckError(result);
 		return false;
 	}
+
+	Context* create_context()
+	{
+		return new Context();
+	}
+
+	void destroy_context(Context* destroyed)
+	{
+		select_context(destroyed);
+		free_resources();
+		glass_effect::dispose();
+
+		select_context(nullptr);
+		delete destroyed;
+	}
+
+	void select_context(Context* selected)
+	{
+		context = selected ? selected : &default_context;
+	}
 }
@@ -1,5 +1,6 @@
 ﻿#pragma once
 #include <d3d11.h>
+#include "bit_mask.h"
 
 
 namespace process_layer_gpu
@@ -31,8 +32,15 @@ namespace process_layer_gpu
 
 	bool is_new_pixels(bool& error);
 	bool end_process();
-	bool set_image_area_data(bool* image_area_data);
+	// Copy the images map of the CPU layer (a bit for each pixel) to the GPU, or free it when it is null
+	bool set_image_area_data(const bit_mask::Word* image_area_data);
 	bool is_current_pixels_bright(bool& error);
 
 	bool invert_colors();
+
+	// The state of one target window. All the functions above work on the selected context
+	struct Context;
+	Context* create_context();
+	void destroy_context(Context* context);
+	void select_context(Context* context);
 }
@@ -1,8 +1,11 @@
 #include <dwmapi.h>
 #include <psapi.h>
 #include <stdio.h>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
+#include <vector>
 #include <Windows.h>
 #include <d3d11.h>
 #pragma comment(lib, "D3D11.lib")
@@ -16,8 +19,12 @@
 #include "capture_layer_bitblt.h"
 #include "display_layer.h"
 #include "graphic_device.h"
+#include "metrics.h"
 #include "process_layer_cpu.h"
+#include "process_layer_cpu_d3d11.h"
 #include "process_layer_gpu.h"
+#include "thread_placement.h"
+#include "timers.h"
 
 #include "renderer.h"
 
@@ -26,167 +33,462 @@
 namespace renderer
 {
 	/**
-	 * \brief Indicates if we currently re rendering the window or not
+	 * \brief The number of staging textures of process_frame_in_cpu. The frame that is processed
+	 * and the copy of the frame after it
 	 */
-	bool rendering = false;
+	constexpr int cpu_textures_count = 2;
+	constexpr int cpu_texture_max_tries = 4;
 
 	/**
-	 * \brief The handle of the window to re render
+	 * \brief The rects of the processed frame that are different from the previous processed frame.
+	 * Empty when the whole frame should be presented. Valid only for the frame that was just processed
 	 */
-	HWND target_hwnd = nullptr;
+	std::vector<RECT> frame_dirty_rects;
 
 	/**
-	 * \brief The current WINDOWPLACEMENT structure of the window
-	 * (used inside process_window_placement function)
+	 * \brief Indicates if a frame was compared with the previous frame. Valid only for the frame that was
+	 * just processed, a frame that is still copied is compared later
 	 */
-	WINDOWPLACEMENT target_placement = {0};
+	bool frame_checked = false;
 
 	/**
-	 * \brief x_size and y_size of the frame that captured from the window
+	 * \brief The capture time of the processed frame when its content was changed, 0 otherwise. Used to
+	 * measure the latency from the capture until the present. Valid only for the frame that was just processed
 	 */
-	int x_size = 0, y_size = 0;
+	LONGLONG frame_capture_time = 0;
 
 	/**
-	 * \brief ID3D11Texture2D resource that used inside process_frame_in_cpu
-	 * for processing
+	 * \brief The maximum memory of the cache of the processed glass effect tiles
 	 */
-	ID3D11Texture2D* cpu_texture = nullptr;
+	constexpr size_t glass_tile_cache_max_bytes = 16 * 1024 * 1024;
 
 	/**
-	 * \brief ID3D11Texture2D resource that used inside process_frame_in_gpu
-	 * for processing
+	 * \brief Handle of the thread that runs function process_frame_thread.
+	 * One thread processes the frames of all the targets
 	 */
-	ID3D11Texture2D* gpu_texture = nullptr;
+	std::thread process_frame_thread_handle;
+	bool process_frame_thread_started = false;
 
-	/**
-	 * \brief Indicates if dark mode is enabled
-	 */
-	bool dark_mode = false;
+	constexpr int processing_speed_timer_interval = 1000;
 
 	/**
-	 * \brief Indicates if glass mode is enabled
+	 * \brief Indicates if there is some fatal error or not
 	 */
-	bool glass_mode = false;
+	bool fatal_error = false;
+
+	constexpr int resize_delay = 250;
+	constexpr int show_target_delay = 100;
+	constexpr int brightness_check_timer_interval = 1000;
+	constexpr int force_render_max_time = 4000;
+	constexpr int force_render_converge_frames = 3;
+	constexpr int force_render_converge_time = 200;
+	constexpr int was_maximized_delay = 250;
+	constexpr int was_minimized_delay = 500;
+	constexpr int was_restored_delay = 250;
 
 	/**
-	 * \brief Indicates the type of blur effect of the glass mode
+	 * \brief This flag is used by register_exit_event() to exit and dispose the renderer in thread-safe way
 	 */
-	GlassBlurType glass_blur_type;
+	bool exit_event_requested = false;
 
 	/**
-	 * \brief Other settings of the glass effect
+	 * \brief Signaled by the process frame thread when the main loop has to handle a fatal error. The main
+	 * loop waits on it (see get_loop_event)
 	 */
-	double glass_brightness_level, glass_background, glass_images, glass_texts;
-	bool glass_dark_background;
+	HANDLE loop_event = nullptr;
 
 	/**
-	 * \brief Handle of the thread that runs function process_frame_thread
+	 * \brief The main loop waits for these events of the windows instead of polling their placement. The
+	 * hook of the foreground window is shared by all the targets
 	 */
-	std::thread process_frame_thread_handle;
+	HWINEVENTHOOK foreground_hook = nullptr;
+	bool foreground_changed = false;
+	constexpr int window_hooks_count = 3;
 
 	/**
-	 * \brief Indicates if the target window is in use
+	 * \brief The longest time that the process frame thread waits for a new frame, a timer or a command
 	 */
-	bool is_target_window_in_use = false;
+	constexpr int frame_thread_max_wait = 100;
 
 	/**
-	 * \brief Flag to signal to the process frame thread to stop in case it is true
+	 * \brief The deadlines and the wakes of the process frame thread, that the main thread and the capture layer
+	 * wake when a target or a frame is ready
 	 */
-	auto run_process_frame_thread = false;
+	timers::Waiter frame_thread_waiter;
 
 	/**
-	 * \brief The process frame thread is setting this flag to true before exiting
-	 * to signal to the main thread if the process thread still doing some job or not
+	 * \brief Indicates if init_backend was called, after that graphic_device::is_cuda_adapter is valid
 	 */
-	bool process_frame_thread_exited = false;
+	bool backend_initialized = false;
+
 
 	/**
-	 * \brief Indicates if there is some fatal error or not
+	 * \brief The state of one target window, with the contexts of its layers
 	 */
-	bool fatal_error = false;
+	struct Target
+	{
+		/**
+		 * \brief Indicates if we currently re rendering the window or not
+		 */
+		bool rendering = false;
+
+		/**
+		 * \brief The handle of the window to re render
+		 */
+		HWND target_hwnd = nullptr;
+
+		/**
+		 * \brief The current WINDOWPLACEMENT structure of the window
+		 * (used inside process_window_placement function)
+		 */
+		WINDOWPLACEMENT target_placement = {0};
+
+		/**
+		 * \brief x_size and y_size of the frame that captured from the window
+		 */
+		int x_size = 0, y_size = 0;
+
+		/**
+		 * \brief Staging textures that process_frame_in_cpu uses as a ring. Each new frame is copied
+		 * to the next texture, so its copy is in flight while the process frame thread processes the
+		 * frame before it or works on the other targets
+		 */
+		ID3D11Texture2D* cpu_textures[cpu_textures_count] = {nullptr};
+		int cpu_textures_next = 0;
+
+		/**
+		 * \brief The textures of cpu_textures with copied frames that were not processed yet, the oldest
+		 * first, and how many times it was tried to map the newest one without waiting
+		 */
+		int cpu_textures_pending[cpu_textures_count] = {0};
+		int cpu_textures_pending_count = 0;
+		int cpu_texture_pending_tries = 0;
+
+		/**
+		 * \brief The capture time of the frame that was copied to each texture of cpu_textures
+		 */
+		LONGLONG cpu_textures_capture_time[cpu_textures_count] = {0};
+
+		/**
+		 * \brief The texture of cpu_textures with the last processed frame
+		 */
+		ID3D11Texture2D* cpu_texture = nullptr;
+
+		/**
+		 * \brief ID3D11Texture2D resource that used inside process_frame_in_gpu
+		 * for processing
+		 */
+		ID3D11Texture2D* gpu_texture = nullptr;
+
+		/**
+		 * \brief Indicates if dark mode is enabled
+		 */
+		bool dark_mode = false;
+
+		/**
+		 * \brief Indicates if glass mode is enabled
+		 */
+		bool glass_mode = false;
+
+		/**
+		 * \brief Indicates the type of blur effect of the glass mode
+		 */
+		GlassBlurType glass_blur_type = GlassBlurType::NONE;
+
+		/**
+		 * \brief Other settings of the glass effect
+		 */
+		double glass_brightness_level = 0, glass_background = 0, glass_images = 0, glass_texts = 0;
+		bool glass_dark_background = false;
+
+		/**
+		 * \brief The scale of the downsampled analysis of the frames (1, 2 or 4).
+		 * 0 means that it is selected from the DPI of the target window
+		 */
+		int analysis_scale = 0;
+
+		/**
+		 * \brief Indicates if the target window is in use
+		 */
+		bool is_target_window_in_use = false;
+
+		/**
+		 * \brief Flag to signal to the process frame thread to stop processing the target in case it is false
+		 */
+		bool run_process_frame_thread = false;
+
+		/**
+		 * \brief The process frame thread is setting this flag to true when it stops processing the target
+		 * to signal to the main thread if the process thread still doing some job or not
+		 */
+		bool process_frame_thread_exited = false;
+
+		/**
+		 * \brief When the process frame thread processed the last frame of the target.
+		 * Used to process the frames of a window that is not in use less often
+		 */
+		timers::Time process_frame_timer = 0;
+
+		/**
+		 * \brief Used inside adjust_processing_speed function
+		 */
+		timers::Time processing_speed_timer = 0;
+
+		/**
+		 * \brief Indicates if there is fatal error in the process frame thread
+		 */
+		bool frame_thread_fatal_error = false;
+
+		/**
+		 * \brief Used inside process_frame_thread function (internal usage)
+		 */
+		timers::Time resize_timer = 0;
+		bool window_temporary_hidden = false;
+
+		/**
+		 * \brief The target window that was hidden while it is resized is shown again when this timer is due,
+		 * a bit after the first frame of its new size was presented
+		 */
+		timers::Time show_target_timer = 0;
+
+		/**
+		 * \brief Used to know when to check if the window frame is bright
+		 * it will update the flag pixels_bright each time
+		 */
+		timers::Time brightness_check_timer = 0;
+
+		/**
+		 * \brief Indicates if the current frame of the window is bright
+		 */
+		bool pixels_bright = true;
+
+		/**
+		 * \brief Indicates if the window is currently hidden (minimized or not shown)
+		 */
+		bool window_hidden = false;
+
+		/**
+		 * \brief When the function init_for_target_hwnd will be called it will check
+		 * this flag. if it set to true, it will do more initialization actions
+		 * that should done when the user just enabled the rendering effect
+		 * (such as dark mode/glass mode)
+		 */
+		bool startup_rendering = false;
+
+		/**
+		 * \brief When this variable is set to non 0, it will signal the process_frame_thread
+		 * to call to process_frame_in_gpu or process_frame_in_cpu functions with
+		 * flag force_render = true for a given amount of time that defined in the
+		 * process_frame_thread function
+		 */
+		timers::Time force_render_timer = 0;
+
+		/**
+		 * \brief The forced re rendering ends before force_render_max_time when it converged: the frame
+		 * and the analysis state of the process layer were not changed in the last frames
+		 */
+		unsigned long long force_render_analysis_hash = 0;
+		int force_render_stable_frames = 0;
+		timers::Time force_render_stable_timer = 0;
+
+		/**
+		 * \brief While the window is maximized we use this timer to wait a bit before recreating/resizing
+		 * the frame
+		 */
+		timers::Time was_maximized_timer = 0;
+
+		/**
+		 * \brief While the window is minimized we use this timer to wait a little before stopping re-rendering
+		 * the window. this is to avoid bug with intellij that when minimizing the window become blank
+		 */
+		timers::Time was_minimized_timer = 0;
+
+		/**
+		 * \brief When the window is restored from minimized state we use this timer to wait a bit before
+		 * re rendering it again
+		 */
+		timers::Time was_restored_timer = 0;
+
+		/**
+		 * \brief Indicates if functions process_frame_in_gpu or process_frame_in_cpu should
+		 * apply filter image algorithms that implemented in process_layer_cpu or process_layer_gpu
+		 */
+		bool filter_images = false;
+
+		/**
+		 * \brief If this flag is true, it will signal to the process_frame_thread function
+		 * to wait a little before start processing the captured frames of the window
+		 */
+		bool start_processing_wait = false;
+
+		HWINEVENTHOOK window_hooks[window_hooks_count] = {nullptr};
+
+		/**
+		 * \brief Taken by the main thread and by the process frame thread while they work on the target. The
+		 * process frame thread skips the target when it was removed while the thread waited for it
+		 */
+		std::recursive_mutex mutex;
+		bool removed = false;
+
+		display_layer::Context* display_context = nullptr;
+		capture_layer::Context* capture_context = nullptr;
+		process_layer_cpu::Context* cpu_context = nullptr;
+		process_layer_gpu::Context* gpu_context = nullptr;
+	};
+
+	Target default_target;
 
 	/**
-	 * \brief Indicates if there is fatal error in the process frame thread
+	 * \brief The target that all the functions of the renderer work on, like the contexts of the layers. Each
+	 * thread selects its own, so the main thread works on a target while the process frame thread works on another
 	 */
-	bool frame_thread_fatal_error = false;
+	thread_local Target* target = &default_target;
 
 	/**
-	 * \brief Used inside process_frame_thread function (internal usage)
+	 * \brief All the windows that this process renders. They share the graphic device, the process
+	 * frame thread and the scratch buffers of the process layers
 	 */
-	clock_t resize_timer = 0;
-	bool window_temporary_hidden = false;
-
+	std::vector<std::shared_ptr<Target>> targets;
 
 	/**
-	 * \brief Used to know when to check if the window frame is bright
-	 * it will update the flag pixels_bright each time
+	 * \brief Taken only while the list of the targets is read or changed, never while waiting for the mutex of a
+	 * target
 	 */
-	clock_t brightness_check_timer = 0;
-	constexpr int brightness_check_timer_interval = 1000;
+	std::mutex targets_mutex;
 
 	/**
-	 * \brief Indicates if the current frame of the window is bright
+	 * \brief The main loop checks again after this delay a target that the process frame thread worked on
 	 */
-	bool pixels_bright = true;
+	constexpr int busy_target_retry_delay = 5;
 
 
-	/**
-	 * \brief Indicates if the window is currently hidden (minimized or not shown)
-	 */
-	bool window_hidden = false;
+	// Forward Declarations
+	void process_frame_thread();
+	void start_process_frame_thread();
+	void stop_process_frame_thread();
+	void un_init_for_target_hwnd();
+	void start_force_render();
+	void release_cpu_textures();
 
 	/**
-	 * \brief When the function init_for_target_hwnd will be called it will check
-	 * this flag. if it set to true, it will do more initialization actions
-	 * that should done when the user just enabled the rendering effect
-	 * (such as dark mode/glass mode)
+	 * \brief Select the target that all the functions of the renderer and of the layers work on in the calling
+	 * thread. Call it only while holding the mutex of the target
+	 * \param selected - The target to select, or nullptr
 	 */
-	bool startup_rendering = false;
+	void select_target(Target* selected)
+	{
+		target = selected ? selected : &default_target;
 
+		display_layer::select_context(target->display_context);
+		capture_layer::select_context(target->capture_context);
+		process_layer_cpu::select_context(target->cpu_context);
+		process_layer_gpu::select_context(target->gpu_context);
+	}
 
 	/**
-	 * \brief When this variable is set to non 0, it will signal the process_frame_thread
-	 * to call to process_frame_in_gpu or process_frame_in_cpu functions with
-	 * flag force_render = true for a given amount of time that defined in the
-	 * process_frame_thread function
+	 * \brief Find the target of the given window
+	 * \return The target or nullptr if the window was not attached
 	 */
-	clock_t force_render_timer = 0;
+	std::shared_ptr<Target> find_target(const HWND target_hwnd)
+	{
+		std::lock_guard<std::mutex> lock(targets_mutex);
 
-	/**
-	 * \brief While the window is maximized we use this timer to wait a bit before recreating/resizing
-	 * the frame
-	 */
-	clock_t was_maximized_timer = 0;
+		for (const auto& attached : targets)
+			if (attached->target_hwnd == target_hwnd)
+				return attached;
 
-	/**
-	 * \brief While the window is minimized we use this timer to wait a little before stopping re-rendering
-	 * the window. this is to avoid bug with intellij that when minimizing the window become blank
-	 */
-	clock_t was_minimized_timer = 0;
+		return nullptr;
+	}
 
 	/**
-	 * \brief Indicates if functions process_frame_in_gpu or process_frame_in_cpu should
-	 * apply filter image algorithms that implemented in process_layer_cpu or process_layer_gpu
+	 * \brief Called in the main thread while it dispatches the messages. The event itself wakes the main loop,
+	 * that checks the placement of all the targets
 	 */
-	bool filter_images = false;
+	void CALLBACK on_window_event(const HWINEVENTHOOK hook, const DWORD event, const HWND hwnd, const LONG id_object,
+	                              const LONG id_child, const DWORD event_thread, const DWORD event_time)
+	{
+		if (event == EVENT_SYSTEM_FOREGROUND)
+			foreground_changed = true;
+	}
 
 	/**
-	 * \brief If this flag is true, it will signal to the process_frame_thread function
-	 * to wait a little before start processing the captured frames of the window
+	 * \brief Wake the main loop when the window of the selected target is moved, resized, minimized, restored or
+	 * closed
 	 */
-	bool start_processing_wait = false;
+	void hook_window_events()
+	{
+		DWORD process_id = 0;
+		if (!GetWindowThreadProcessId(target->target_hwnd, &process_id))
+			return;
+
+		const DWORD events[window_hooks_count][2] = {
+			{EVENT_SYSTEM_MINIMIZESTART, EVENT_SYSTEM_MINIMIZEEND},
+			{EVENT_OBJECT_DESTROY, EVENT_OBJECT_HIDE},
+			{EVENT_OBJECT_LOCATIONCHANGE, EVENT_OBJECT_LOCATIONCHANGE}
+		};
 
+		for (auto i = 0; i < window_hooks_count; i++)
+		{
+			target->window_hooks[i] = SetWinEventHook(events[i][0], events[i][1], nullptr, on_window_event,
+			                                          process_id, 0, WINEVENT_OUTOFCONTEXT);
+			if (!target->window_hooks[i])
+				std::cout << "Failed to hook the events of the target window, its placement is checked less often\n";
+		}
+	}
+
+	void unhook_window_events()
+	{
+		for (auto& hook : target->window_hooks)
+		{
+			if (hook)
+				UnhookWinEvent(hook);
+			hook = nullptr;
+		}
+	}
 
 	/**
-	 * \brief This flag is used by register_exit_event() to exit and dispose the renderer in thread-safe way
+	 * \brief Shutdown the re rendering of the selected target and remove it. Call it while holding the mutex of the
+	 * target, through a reference to it that outlives the lock
 	 */
-	bool exit_event_requested = false;
+	void remove_selected_target()
+	{
+		if (target->rendering)
+			un_init_for_target_hwnd();
 
+		release_cpu_textures();
 
-	// Forward Declarations
-	void process_frame_thread();
-	void start_process_frame_thread();
-	void stop_process_frame_thread();
+		if (target->gpu_texture)
+		{
+			target->gpu_texture->Release();
+			target->gpu_texture = nullptr;
+		}
+
+		unhook_window_events();
+		display_layer::destroy_context(target->display_context);
+		capture_layer::destroy_context(target->capture_context);
+		process_layer_cpu::destroy_context(target->cpu_context);
+		process_layer_gpu::destroy_context(target->gpu_context);
+		target->removed = true;
+
+		auto targets_left = false;
+		{
+			std::lock_guard<std::mutex> lock(targets_mutex);
+			for (auto it = targets.begin(); it != targets.end(); ++it)
+				if (it->get() == target)
+				{
+					targets.erase(it);
+					break;
+				}
+
+			targets_left = !targets.empty();
+		}
+
+		select_target(nullptr);
+
+		// The process frame thread works only on the targets in the list, so it doesn't use the shared resources
+		if (!targets_left)
+			process_layer_cpu::free_shared_resources();
+	}
 
 	/**
 	 * \brief Indicates if there is fatal error
@@ -206,6 +508,29 @@ namespace renderer
 		exit_event_requested = true;
 	}
 
+	/**
+	 * \brief The event that the main loop waits on with the messages and the doorbell of the settings
+	 * \return The event, or nullptr before init
+	 */
+	HANDLE get_loop_event()
+	{
+		return loop_event;
+	}
+
+	/**
+	 * \brief Wake the main loop, so process_loop handles a fatal error at once
+	 */
+	void wake_loop()
+	{
+		if (loop_event)
+			SetEvent(loop_event);
+	}
+
+	void log_startup_phase(const char* phase, const timers::Time duration)
+	{
+		std::cout << "Startup phase " << phase << " took " << duration << " ms\n";
+	}
+
 	/**
 	 * \brief Init function that you should call at startup only.
 	 * It setup GPU acceleration if needed and other settings that never change during the
@@ -217,42 +542,98 @@ namespace renderer
 	{
 		std::cout << "Initializing renderer\n";
 
+		const auto init_timer = timers::now();
 		fatal_error = false;
 
-		if (!graphic_device::init_device(cuda_acceleration))
+		// The graphic device is created in another thread while the layers are initialized. The capture layer
+		// creates the dispatcher queue of the current thread, so it must be initialized here
+		auto device_created = false;
+		timers::Time device_time = 0;
+		std::thread device_thread([&]()
 		{
-			std::cout << "Failed to load_frame graphic device for rendering\n";
+			const auto timer = timers::now();
+			device_created = graphic_device::create_d3d_device(cuda_acceleration);
+			device_time = timers::now() - timer;
+		});
+
+		auto timer = timers::now();
+		const auto display_initialized = display_layer::init();
+		log_startup_phase("display layer", timers::now() - timer);
+
+		timer = timers::now();
+		const auto capture_initialized = capture_layer::init();
+		log_startup_phase("capture layer", timers::now() - timer);
+
+		device_thread.join();
+		log_startup_phase("graphic device", device_time);
+
+		if (!display_initialized)
+		{
+			std::cout << "Failed to load_frame display_layer\n";
 			return false;
 		}
 
-		process_layer_cpu::init(graphic_device::d3d_context);
-
-		if (graphic_device::is_cuda_adapter)
+		if (!capture_initialized)
 		{
-			process_layer_gpu::init(graphic_device::d3d_context); // TODO: Maybe remove this...
+			std::cout << "Failed to load_frame capture_layer\n";
+			return false;
 		}
 
-		if (!display_layer::init())
+		if (!device_created || !graphic_device::create_winrt_device())
 		{
-			std::cout << "Failed to load_frame display_layer\n";
+			std::cout << "Failed to load_frame graphic device for rendering\n";
 			return false;
 		}
 
-		if (!capture_layer::init())
+		process_layer_cpu::init(graphic_device::d3d_context);
+
+		loop_event = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+		if (!loop_event)
 		{
-			std::cout << "Failed to load_frame capture_layer\n";
+			std::cout << "Failed to create the event of the main loop\n";
 			return false;
 		}
 
+		// The main loop checks the use of the targets when another window comes to the foreground
+		foreground_hook = SetWinEventHook(EVENT_SYSTEM_FOREGROUND, EVENT_SYSTEM_FOREGROUND, nullptr, on_window_event,
+		                                  0, 0, WINEVENT_OUTOFCONTEXT);
+		if (!foreground_hook)
+			std::cout << "Failed to hook the changes of the foreground window\n";
+
+		log_startup_phase("renderer init", timers::now() - init_timer);
 		return true;
 	}
 
+	/**
+	 * \brief Wait for the CUDA probe that init started, and init the process layer of the selected backend.
+	 * It is done when the first window is attached, so the probe runs while the rest of the startup is done
+	 */
+	void init_backend()
+	{
+		if (backend_initialized)
+			return;
+
+		const auto timer = timers::now();
+		graphic_device::wait_for_cuda_probe();
+		metrics::set_backend(graphic_device::is_cuda_adapter);
+
+		if (graphic_device::is_cuda_adapter)
+		{
+			process_layer_gpu::init(graphic_device::d3d_context); // TODO: Maybe remove this...
+		}
+
+		log_startup_phase(graphic_device::is_cuda_adapter ? "CUDA backend" : "CPU backend", timers::now() - timer);
+		backend_initialized = true;
+	}
+
 	/**
 	 * \brief Set on the window the type of transparency-blur effect
 	 * \param blur_level
 	 */
 	void set_glass_blur_level(const GlassBlurType blur_level)
 	{
+		std::lock_guard<std::recursive_mutex> lock(target->mutex);
+
 		switch (blur_level)
 		{
 		case GlassBlurType::LOW:
@@ -267,11 +648,13 @@ namespace renderer
 			break;
 		}
 
-		glass_blur_type = blur_level;
+		target->glass_blur_type = blur_level;
 	}
 
 	void glass_set_background_level(const double glass_background)
 	{
+		std::lock_guard<std::recursive_mutex> lock(target->mutex);
+
 		if (graphic_device::is_cuda_adapter)
 			process_layer_gpu::glass_effect::set_background_level(glass_background);
 		else
@@ -280,6 +663,8 @@ namespace renderer
 
 	void glass_set_shapes_level(const double glass_shapes)
 	{
+		std::lock_guard<std::recursive_mutex> lock(target->mutex);
+
 		if (graphic_device::is_cuda_adapter)
 			process_layer_gpu::glass_effect::set_shapes_level(glass_shapes);
 		else
@@ -288,6 +673,8 @@ namespace renderer
 
 	void glass_set_dark_background_mode(const bool enable)
 	{
+		std::lock_guard<std::recursive_mutex> lock(target->mutex);
+
 		if (graphic_device::is_cuda_adapter)
 			process_layer_gpu::glass_effect::set_dark_background(enable);
 		else
@@ -296,22 +683,102 @@ namespace renderer
 
 	void glass_set_brightness_level(const double level)
 	{
+		std::lock_guard<std::recursive_mutex> lock(target->mutex);
+
 		display_layer::set_brightness_level(level * 255);
 	}
 
 	/**
-	 * \brief Set the target window for re rendering
-	 * \param target_hwnd - The handle of the window to set as target for re rendering
+	 * \brief Get the analysis scale to use for the target window. On high DPI one logical pixel
+	 * is made of few physical pixels, so it is enough to analyze one physical pixel of each logical pixel
+	 * \return 1, 2 or 4
+	 */
+	int get_analysis_scale()
+	{
+		if (target->analysis_scale)
+			return target->analysis_scale;
+
+		const auto dpi = target->target_hwnd ? GetDpiForWindow(target->target_hwnd) : 0;
+		if (dpi >= USER_DEFAULT_SCREEN_DPI * 4) return 4;
+		if (dpi >= USER_DEFAULT_SCREEN_DPI * 2) return 2;
+		return 1;
+	}
+
+	void set_analysis_scale(const int scale)
+	{
+		std::lock_guard<std::recursive_mutex> lock(target->mutex);
+
+		target->analysis_scale = scale == 1 || scale == 2 || scale == 4 ? scale : 0;
+
+		if (target->rendering && !graphic_device::is_cuda_adapter)
+			process_layer_cpu::set_analysis_scale(get_analysis_scale());
+	}
+
+	/**
+	 * \brief Set the target window that the next calls (enable_glass_mode, glass_set_background_level...) work on
+	 * \param target_hwnd - The handle of a window that was attached with attach_target
+	 * \return true on success and false if the window was not attached
 	 */
-	void set_target(const HWND target_hwnd)
+	bool set_target(const HWND target_hwnd)
 	{
+		const auto found = find_target(target_hwnd);
+		if (!found)
+			return false;
+
+		select_target(found.get());
+		return true;
+	}
+
+	/**
+	 * \brief Add a window for re rendering and set it as the target (see set_target).
+	 * All the attached windows are rendered by this process with the same graphic device
+	 * \param target_hwnd - The handle of the window to re render
+	 */
+	void attach_target(const HWND target_hwnd)
+	{
+		if (set_target(target_hwnd))
+			return;
+
+		init_backend();
+
+		const auto attached = std::make_shared<Target>();
+		attached->target_hwnd = target_hwnd;
+		attached->display_context = display_layer::create_context();
+		attached->capture_context = capture_layer::create_context();
+		attached->cpu_context = process_layer_cpu::create_context();
+		attached->gpu_context = process_layer_gpu::create_context();
+
+		std::lock_guard<std::recursive_mutex> lock(attached->mutex);
+		{
+			std::lock_guard<std::mutex> targets_lock(targets_mutex);
+			targets.push_back(attached);
+		}
+
+		select_target(attached.get());
+
 		fatal_error = false;
-		window_temporary_hidden = false;
-		renderer::target_hwnd = target_hwnd;
+		hook_window_events();
 		display_layer::set_target(target_hwnd);
 		capture_layer::set_target(target_hwnd);
 	}
 
+	/**
+	 * \brief Shutdown the re rendering of the given window and remove it
+	 * \param target_hwnd - The handle of a window that was attached with attach_target
+	 */
+	void detach_target(const HWND target_hwnd)
+	{
+		const auto detached = find_target(target_hwnd);
+		if (!detached)
+			return;
+
+		std::lock_guard<std::recursive_mutex> lock(detached->mutex);
+		select_target(detached.get());
+
+		std::cout << "Detaching target " << target_hwnd << std::endl;
+		remove_selected_target();
+	}
+
 	/**
 	 * \brief After the target window has been set, this function used to startup
 	 * the actual re rendering process
@@ -320,11 +787,11 @@ namespace renderer
 	 */
 	bool init_for_target_hwnd(const bool wait = false)
 	{
-		if (rendering) return true;
+		if (target->rendering) return true;
 
 		std::cout << "Init renderer target window\n";
 
-		if (!GetWindowPlacement(target_hwnd, &target_placement))
+		if (!GetWindowPlacement(target->target_hwnd, &target->target_placement))
 		{
 			std::stringstream ss;
 			ss << "Failed to get window placement, Error: " << GetLastError() << std::endl;;
@@ -340,7 +807,7 @@ namespace renderer
 		}
 
 
-		if (glass_mode)
+		if (target->glass_mode)
 		{
 			if (!display_layer::set_target_window_transparent())
 			{
@@ -349,9 +816,9 @@ namespace renderer
 				return false;
 			}
 
-			set_glass_blur_level(glass_blur_type);
-			if (glass_brightness_level < 1.0)
-				display_layer::set_brightness_level(glass_brightness_level * 255);
+			set_glass_blur_level(target->glass_blur_type);
+			if (target->glass_brightness_level < 1.0)
+				display_layer::set_brightness_level(target->glass_brightness_level * 255);
 		}
 
 
@@ -363,13 +830,13 @@ namespace renderer
 		}
 
 		// Need to do it (ugly workaround) to avoid bug in WinRT capture API
-		display_layer::target_rect.top -= 20;
-		display_layer::target_rect.left -= 20;
+		display_layer::get_target_rect().top -= 20;
+		display_layer::get_target_rect().left -= 20;
 		display_layer::move_layer_to_target();
-		if (startup_rendering)
+		if (target->startup_rendering)
 		{
 			display_layer::set_layer_to_foreground();
-			startup_rendering = false;
+			target->startup_rendering = false;
 		}
 
 
@@ -383,6 +850,7 @@ namespace renderer
 
 		process_layer_cpu::free_resources();
 		process_layer_cpu::set_default_settings();
+		process_layer_cpu::set_analysis_scale(get_analysis_scale());
 
 		if (graphic_device::is_cuda_adapter)
 		{
@@ -391,9 +859,10 @@ namespace renderer
 		}
 
 
-		if (filter_images)
+		if (target->filter_images)
 		{
-			process_layer_cpu::map_images::enable();
+			// The images are searched by the detection thread, so a slow search does not delay the frames
+			process_layer_cpu::map_images::enable(true);
 			process_layer_cpu::enable_cache_buffer(true);
 		}
 		else
@@ -414,19 +883,25 @@ namespace renderer
 			}
 		}
 
+		if (!graphic_device::is_cuda_adapter)
+		{
+			process_layer_cpu::scroll_detection::enable();
+			process_layer_cpu::glass_effect::tile_cache::enable(glass_tile_cache_max_bytes);
+		}
+
 		if (graphic_device::is_cuda_adapter)
 		{
-			if (glass_mode)
-				process_layer_gpu::glass_effect::enable(glass_background, glass_dark_background, glass_images,
-				                                        glass_texts);
+			if (target->glass_mode)
+				process_layer_gpu::glass_effect::enable(target->glass_background, target->glass_dark_background,
+				                                        target->glass_images, target->glass_texts);
 			else
 				process_layer_gpu::glass_effect::disable();
 		}
 		else
 		{
-			if (glass_mode)
-				process_layer_cpu::glass_effect::enable(glass_background, glass_dark_background, glass_images,
-				                                        glass_texts);
+			if (target->glass_mode)
+				process_layer_cpu::glass_effect::enable(target->glass_background, target->glass_dark_background,
+				                                        target->glass_images, target->glass_texts);
 			else
 				process_layer_cpu::glass_effect::disable();
 		}
@@ -434,14 +909,14 @@ namespace renderer
 
 		capture_layer::start_capture_session();
 
-		force_render_timer = clock();
-		x_size = y_size = 0;
-		start_processing_wait = wait;
+		start_force_render();
+		target->x_size = target->y_size = 0;
+		target->start_processing_wait = wait;
 		start_process_frame_thread();
 
 
-		is_target_window_in_use = true;
-		rendering = true;
+		target->is_target_window_in_use = true;
+		target->rendering = true;
 		return true;
 	}
 
@@ -453,16 +928,33 @@ namespace renderer
 		// Shutdown the frames thread if needed
 		stop_process_frame_thread();
 
-		if (glass_mode)
+		// The frame thread does not show the window that was hidden while it was resized anymore
+		if (target->window_temporary_hidden)
+		{
+			display_layer::show_target_hwnd();
+			target->window_temporary_hidden = false;
+			target->show_target_timer = 0;
+		}
+
+		if (target->glass_mode)
 			display_layer::un_set_target_window_transparent();
 		display_layer::dispose();
 		capture_layer::dispose();
 		capture_layer_bitblt::un_init_capture();
+
+		const auto tile_cache_stats = process_layer_cpu::glass_effect::tile_cache::get_stats();
+		if (tile_cache_stats.hits + tile_cache_stats.misses > 0)
+		{
+			std::cout << "Glass tile cache: " << tile_cache_stats.hits << " hits, " << tile_cache_stats.misses <<
+				" misses, " << tile_cache_stats.evictions << " evictions\n";
+			process_layer_cpu::glass_effect::tile_cache::reset_stats();
+		}
+
 		process_layer_cpu::free_resources();
 		process_layer_gpu::free_resources();
-		x_size = y_size = 0;
-		rendering = false;
-		is_target_window_in_use = false;
+		target->x_size = target->y_size = 0;
+		target->rendering = false;
+		target->is_target_window_in_use = false;
 	}
 
 	/**
@@ -471,11 +963,20 @@ namespace renderer
 	 */
 	void start_process_frame_thread()
 	{
-		run_process_frame_thread = true;
-		process_frame_thread_handle = std::thread(process_frame_thread);
-		process_frame_thread_handle.detach();
-		const auto timer = clock();
-		while (process_frame_thread_exited && clock() - timer < 2000);
+		target->run_process_frame_thread = true;
+		target->process_frame_thread_exited = false;
+		target->frame_thread_fatal_error = false;
+		target->process_frame_timer = timers::now();
+
+		if (!process_frame_thread_started)
+		{
+			process_frame_thread_handle = std::thread(process_frame_thread);
+			process_frame_thread_handle.detach();
+			process_frame_thread_started = true;
+		}
+
+		// The thread may wait for the frames of the other targets
+		timers::wake(&frame_thread_waiter);
 
 		EmptyWorkingSet(GetCurrentProcess()); // Reduce memory usage
 	}
@@ -485,82 +986,133 @@ namespace renderer
 	 */
 	void stop_process_frame_thread()
 	{
-		if (run_process_frame_thread && !process_frame_thread_exited)
+		// The thread processes a target only while it holds the mutex of the target, so it is stopped already
+		if (target->run_process_frame_thread && !target->process_frame_thread_exited)
 		{
-			const auto timer = clock();
-
-			// Send signal to the thread to close itself and wait until it closed
-			run_process_frame_thread = false;
-			while (!process_frame_thread_exited && clock() - timer <= 2000);
+			target->run_process_frame_thread = false;
+			target->process_frame_thread_exited = true;
 		}
 	}
 
 	/**
-	 * \brief This function is used when the size of the captured frame was changed
-	 * or it is the first frame and no frame was processed before.
-	 * This function is responsible to allocate memory and other resources
-	 * that used while processing the captured frame in CPU only
-	 * \param captured_texture - The texture (captured frame) of the window
-	 * \return true on success, false on failure
+	 * \brief Start to re render all the frames for force_render_max_time, or until the frames converged
+	 */
+	void start_force_render()
+	{
+		// The process frame thread checks the timer, also when the main thread starts it
+		target->force_render_timer = timers::start(force_render_max_time, &frame_thread_waiter);
+		target->force_render_stable_frames = 0;
+	}
+
+	/**
+	 * \brief Called for each frame that was rendered with force_render. Ends the forced re rendering when
+	 * the frame and the analysis state were not changed for force_render_converge_frames frames and
+	 * force_render_converge_time ms
+	 * \param frame_changed - If the captured frame was changed since the previous frame
+	 * \param analysis_hash - Hash of the analysis state of the process layer after the frame was processed. It is
+	 * of the context of the selected target only, so the targets converge each by its own frames
 	 */
-	bool init_cpu_process_mode(ID3D11Texture2D* captured_texture)
+	void update_force_render_convergence(const bool frame_changed, const unsigned long long analysis_hash)
 	{
-		if (cpu_texture)
+		if (frame_changed || target->force_render_stable_frames == 0 ||
+			analysis_hash != target->force_render_analysis_hash)
 		{
-			cpu_texture->Release();
-			cpu_texture = nullptr;
+			target->force_render_analysis_hash = analysis_hash;
+			target->force_render_stable_frames = 1;
+			target->force_render_stable_timer = timers::start(force_render_converge_time);
+			return;
 		}
 
-		if (!graphic_device::create_texture(&cpu_texture, D3D11_CPU_ACCESS_WRITE | D3D11_CPU_ACCESS_READ,
-		                                    D3D11_USAGE_STAGING))
+		target->force_render_stable_frames++;
+		if (target->force_render_stable_frames >= force_render_converge_frames &&
+			timers::is_due(target->force_render_stable_timer))
 		{
-			std::cout << "Failed to init cpu_texture\n";
-			return false;
+			target->force_render_timer = 0;
+		}
+	}
+
+	/**
+	 * \brief Release the staging textures of process_frame_in_cpu and forget the frame that was
+	 * copied to them
+	 */
+	void release_cpu_textures()
+	{
+		for (auto& texture : target->cpu_textures)
+		{
+			if (texture)
+			{
+				texture->Release();
+				texture = nullptr;
+			}
 		}
 
-		graphic_device::copy_texture(cpu_texture, captured_texture);
+		target->cpu_texture = nullptr;
+		target->cpu_textures_next = 0;
+		target->cpu_textures_pending_count = 0;
+		target->cpu_texture_pending_tries = 0;
+	}
 
-		return cpu_texture;
+	/**
+	 * \brief Forget the oldest frame that was copied to cpu_textures and was not processed
+	 */
+	void drop_pending_cpu_texture()
+	{
+		target->cpu_textures_pending_count--;
+		for (auto i = 0; i < target->cpu_textures_pending_count; i++)
+			target->cpu_textures_pending[i] = target->cpu_textures_pending[i + 1];
 	}
 
 	/**
 	 * \brief This function is used when the size of the captured frame was changed
 	 * or it is the first frame and no frame was processed before.
 	 * This function is responsible to allocate memory and other resources
-	 * that used while processing the captured frame in GPU in addition to CPU.
-	 * It may also decide to allocate memory and resources only for the GPU so
-	 * the all processing will be done in the GPU
-	 * \param captured_texture - The texture (captured frame) of the window
+	 * that used while processing the captured frame in CPU only.
+	 * The captured frame is copied later, by process_frame_in_cpu
 	 * \return true on success, false on failure
 	 */
-	bool init_gpu_process_mode(ID3D11Texture2D* captured_texture)
+	bool init_cpu_process_mode()
 	{
-		if (!init_cpu_process_mode(captured_texture))
+		release_cpu_textures();
+
+		for (auto& texture : target->cpu_textures)
 		{
-			std::cout << "init_cpu_process_mode(*) failed\n";
-			return false;
+			if (!graphic_device::create_texture(&texture, D3D11_CPU_ACCESS_WRITE | D3D11_CPU_ACCESS_READ,
+			                                    D3D11_USAGE_STAGING))
+			{
+				std::cout << "Failed to init cpu_textures\n";
+				release_cpu_textures();
+				return false;
+			}
 		}
 
-		if (gpu_texture)
+		return true;
+	}
+
+	/**
+	 * \brief This function is used when the size of the captured frame was changed
+	 * or it is the first frame and no frame was processed before.
+	 * This function is responsible to allocate memory and other resources
+	 * that used while processing the captured frame in GPU in addition to CPU.
+	 * The images are detected in CPU on the same texture before the GPU maps it,
+	 * so only one staging texture is allocated.
+	 * The captured frame is copied later, by process_frame_in_gpu
+	 * \return true on success, false on failure
+	 */
+	bool init_gpu_process_mode()
+	{
+		if (target->gpu_texture)
 		{
-			gpu_texture->Release();
-			gpu_texture = nullptr;
+			target->gpu_texture->Release();
+			target->gpu_texture = nullptr;
 		}
 
-		if (!graphic_device::create_texture(&gpu_texture, D3D11_CPU_ACCESS_WRITE | D3D11_CPU_ACCESS_READ,
+		if (!graphic_device::create_texture(&target->gpu_texture, D3D11_CPU_ACCESS_WRITE | D3D11_CPU_ACCESS_READ,
 		                                    D3D11_USAGE_STAGING))
 		{
 			std::cout << "Failed to init gpu_texture\n";
-			if (cpu_texture)
-			{
-				cpu_texture->Release();
-				cpu_texture = nullptr;
-			}
 			return false;
 		}
 
-		graphic_device::copy_texture(gpu_texture, captured_texture);
-
 		return true;
 	}
 
@@ -570,27 +1122,50 @@ namespace renderer
 	 * also in CPU if there is no other option to process everything in GPU.
 	 * This function will fail if you never called to init_gpu_process_mode
 	 * \param captured_texture - The given frame to process
+	 * \param capture_time - The time that the frame was captured, see capture_layer::TextureData
+	 * \param frame_arrived - Indicates if the capture layer got a new frame since the last call
 	 * \param force_render - Use this flag to force reprocessing even if the frame
 	 * is the exact frame as before
+	 * \param refresh_images - Reprocess the frame even if it was not changed, with
+	 * the images that the detection thread found since it was processed
 	 * \param new_frame - (OUT) This is output parameter that indicates if there
 	 * was a new frame
 	 * \return true in case no errors occurred, false in case there is error
 	 */
-	bool process_frame_in_gpu(ID3D11Texture2D* captured_texture, const bool force_render, bool& new_frame)
+	bool process_frame_in_gpu(ID3D11Texture2D* captured_texture, const LONGLONG capture_time,
+	                          const bool frame_arrived, const bool force_render, const bool refresh_images,
+	                          bool& new_frame)
 	{
-		bool* image_area_data = nullptr;
+		frame_checked = false;
+		frame_capture_time = 0;
 
-		if (filter_images)
-		{
-			graphic_device::copy_texture(cpu_texture, captured_texture);
+		// The captured texture is copied only when it may have a new frame
+		if (!frame_arrived && !force_render && !refresh_images)
+			return true;
+
+		const auto detect_start = metrics::now();
+		bit_mask::Word* image_area_data = nullptr;
+
+		// Checked also with force_render, to know when the forced re rendering converged
+		auto frame_changed = false;
 
-			if (!process_layer_cpu::begin_process(cpu_texture, x_size, y_size))
+		// The images are detected on the same texture that the GPU layer processes after it
+		graphic_device::copy_texture(target->gpu_texture, captured_texture);
+
+		if (target->filter_images)
+		{
+			const auto map_start = metrics::now();
+			if (!process_layer_cpu::begin_process(target->gpu_texture, target->x_size, target->y_size))
 			{
 				std::cout << "process_layer_cpu::begin_process(*) failed\n";
 				return false; // Signal fatal error
 			}
+			metrics::add_stage_time(metrics::Stage::MAP, map_start);
 
-			new_frame = force_render || process_layer_cpu::is_new_pixels();
+			frame_changed = process_layer_cpu::is_new_pixels();
+			new_frame = force_render || refresh_images || frame_changed;
+			frame_checked = true;
+			metrics::add_stage_time(metrics::Stage::DETECT, detect_start);
 
 			if (!new_frame)
 			{
@@ -599,32 +1174,32 @@ namespace renderer
 			}
 
 
-			image_area_data = process_layer_cpu::map_images::map_images(force_render);
+			if (refresh_images && !frame_changed)
+				image_area_data = process_layer_cpu::map_images::update_images();
+			else
+				image_area_data = process_layer_cpu::map_images::map_images(force_render);
 			process_layer_cpu::end_process(); 
-
-			graphic_device::copy_texture(gpu_texture, cpu_texture);
-		}
-		else
-		{
-			graphic_device::copy_texture(gpu_texture, captured_texture);
 		}
 
 
-		if (!process_layer_gpu::begin_process(gpu_texture, x_size, y_size))
+		if (!process_layer_gpu::begin_process(target->gpu_texture, target->x_size, target->y_size))
 		{
 			std::cout << "process_layer_gpu::begin_process(*) failed\n";
 			return false; // Signal fatal error
 		}
 
-		if (!filter_images)
+		if (!target->filter_images)
 		{ 
 			auto error = false;
-			new_frame = force_render || process_layer_gpu::is_new_pixels(error);
+			frame_changed = process_layer_gpu::is_new_pixels(error);
+			new_frame = force_render || frame_changed;
+			frame_checked = true;
 			if (error)
 			{
 				std::cout << "process_layer_gpu::is_new_pixels(error) failed\n";
 				return false; // Signal fatal error
 			}
+			metrics::add_stage_time(metrics::Stage::DETECT, detect_start);
 
 			if (!new_frame)
 			{
@@ -633,6 +1208,9 @@ namespace renderer
 			}
 		}
 
+		// With filter_images, the effect time includes also the copy of the images map to the GPU
+		const auto effect_start = metrics::now();
+
 		if (!process_layer_gpu::set_image_area_data(image_area_data))
 		{
 			std::cout << "process_layer_gpu::set_image_area_data(*) failed";
@@ -641,13 +1219,13 @@ namespace renderer
 		}
 
 
-		if (dark_mode)
+		if (target->dark_mode)
 		{
-			if (clock() - brightness_check_timer >= brightness_check_timer_interval)
+			if (timers::is_due(target->brightness_check_timer))
 			{
 				auto error = false;
-				pixels_bright = process_layer_gpu::is_current_pixels_bright(error);
-				brightness_check_timer = clock();
+				target->pixels_bright = process_layer_gpu::is_current_pixels_bright(error);
+				target->brightness_check_timer = timers::start(brightness_check_timer_interval);
 			}
 
 			if (!process_layer_gpu::invert_colors())
@@ -658,7 +1236,7 @@ namespace renderer
 			}
 		}
 
-		if (glass_mode)
+		if (target->glass_mode)
 		{ 
 			if (!process_layer_gpu::glass_effect::map_shapes())
 			{
@@ -669,30 +1247,135 @@ namespace renderer
 		}
 
 		process_layer_gpu::end_process();
+		metrics::add_stage_time(metrics::Stage::EFFECT, effect_start);
+
+		if (frame_changed)
+			frame_capture_time = capture_time;
+
+		// The analysis of the GPU layer stays in the GPU, so only the one of the CPU layer is compared
+		if (force_render)
+			update_force_render_convergence(frame_changed,
+			                                target->filter_images ? process_layer_cpu::get_analysis_hash() : 0);
 		return true;
 	}
 
 	/**
 	 * \brief This function will process any given frame in the CPU only
-	 * This function will fail if you never called to init_cpu_process_mode
+	 * This function will fail if you never called to init_cpu_process_mode.
+	 * The frame is copied to the next texture of cpu_textures and it is processed only
+	 * after the copy finished, maybe by one of the next calls. Meanwhile the frame before it
+	 * is processed, if it is still pending
 	 * \param captured_texture - The given frame to process
+	 * \param capture_time - The time that the frame was captured, see capture_layer::TextureData
+	 * \param frame_arrived - Indicates if the capture layer got a new frame since the last call
 	 * \param force_render - Use this flag to force reprocessing even if the frame
 	 * is the exact frame as before
+	 * \param refresh_images - Take the images that the detection thread found since the frame was processed,
+	 * and reprocess the tiles where they changed the images map even if the frame was not changed
 	 * \param new_frame - (OUT) This is output parameter that indicates if there
 	 * was a new frame
 	 * \return true in case no errors occurred, false in case there is error
 	 */
-	bool process_frame_in_cpu(ID3D11Texture2D* captured_texture, const bool force_render, bool& new_frame)
+	bool process_frame_in_cpu(ID3D11Texture2D* captured_texture, const LONGLONG capture_time,
+	                          const bool frame_arrived, const bool force_render, const bool refresh_images,
+	                          bool& new_frame)
 	{
-		graphic_device::copy_texture(cpu_texture, captured_texture);
+		frame_dirty_rects.clear();
+		frame_checked = false;
+		frame_capture_time = 0;
 
-		if (!process_layer_cpu::begin_process(cpu_texture, x_size, y_size))
+		const auto detect_start = metrics::now();
+
+		// A forced render copies the same frame again, unless a copy of it is already pending. The copy is
+		// submitted before a pending frame is processed, so the two overlap
+		if (frame_arrived || ((force_render || refresh_images) && target->cpu_textures_pending_count == 0))
+		{
+			if (target->cpu_textures_pending_count == cpu_textures_count)
+			{
+				drop_pending_cpu_texture();
+				metrics::add_frames(metrics::Counter::DROPPED);
+			}
+
+			const auto pending = target->cpu_textures_next;
+			target->cpu_textures_next = (target->cpu_textures_next + 1) % cpu_textures_count;
+			target->cpu_textures_pending[target->cpu_textures_pending_count++] = pending;
+			target->cpu_texture_pending_tries = 0;
+			graphic_device::copy_texture(target->cpu_textures[pending], captured_texture);
+			target->cpu_textures_capture_time[pending] = capture_time;
+
+			// Submit the copy now, so it is done when the texture is mapped
+			graphic_device::d3d_context->Flush();
+		}
+
+		if (target->cpu_textures_pending_count == 0)
+			return true;
+
+		// The newest frame is taken as soon as its copy is done. Until then the frame before it is processed,
+		// if it is pending. Without it the thread doesn't wait for the copy, it can process the other targets
+		// meanwhile. After few tries it waits, so a busy GPU can't delay the frame for long
+		auto ready = false;
+		const auto map_start = metrics::now();
+		const auto newest = target->cpu_textures_pending[target->cpu_textures_pending_count - 1];
+		const auto wait = target->cpu_textures_pending_count == 1 &&
+			++target->cpu_texture_pending_tries >= cpu_texture_max_tries;
+		if (!process_layer_cpu::begin_process(target->cpu_textures[newest], target->x_size, target->y_size, wait, ready))
 		{
 			std::cout << "process_layer_cpu::begin_process(*) failed\n";
 			return false; // Signal fatal error
 		}
 
-		new_frame = force_render || process_layer_cpu::is_new_pixels();
+		if (ready)
+		{
+			while (target->cpu_textures_pending_count > 1)
+			{
+				drop_pending_cpu_texture();
+				metrics::add_frames(metrics::Counter::DROPPED);
+			}
+		}
+		else if (target->cpu_textures_pending_count > 1)
+		{
+			// Its copy was submitted first, so it waits less than the newest would
+			if (!process_layer_cpu::begin_process(target->cpu_textures[target->cpu_textures_pending[0]], target->x_size,
+			                                      target->y_size, true, ready))
+			{
+				std::cout << "process_layer_cpu::begin_process(*) failed\n";
+				return false; // Signal fatal error
+			}
+		}
+
+		if (!ready)
+			return true;
+
+		metrics::add_stage_time(metrics::Stage::MAP, map_start);
+		auto* const texture = target->cpu_textures[target->cpu_textures_pending[0]];
+		const auto texture_capture_time = target->cpu_textures_capture_time[target->cpu_textures_pending[0]];
+		drop_pending_cpu_texture();
+		if (target->cpu_textures_pending_count == 0)
+			target->cpu_texture_pending_tries = 0;
+
+		// The hashes of the changed rows are updated while the frame is processed. It is checked also
+		// with force_render, to know when the forced re rendering converged
+		const auto frame_changed = process_layer_cpu::is_new_pixels(true);
+
+		// The images that the detection thread found are taken first. A frame that was not changed is processed
+		// again only in the tiles where they changed the images map
+		std::vector<process_layer_cpu::Rect> images_rects;
+		if (refresh_images)
+		{
+			process_layer_cpu::map_images::update_images();
+			images_rects = process_layer_cpu::map_images::get_changed_rects();
+		}
+
+		new_frame = force_render || frame_changed || !images_rects.empty();
+		frame_checked = true;
+		metrics::add_stage_time(metrics::Stage::DETECT, detect_start);
+
+		if (new_frame)
+			target->cpu_texture = texture;
+
+		// A forced render of the same frame is not a change that the user waits for
+		if (frame_changed)
+			frame_capture_time = texture_capture_time;
 
 		if (!new_frame)
 		{
@@ -700,166 +1383,308 @@ namespace renderer
 			return true;
 		}
 
-		if (filter_images)
-			process_layer_cpu::map_images::map_images(force_render);
+		const auto effect_start = metrics::now();
 
-		if (dark_mode)
+		if (target->dark_mode && timers::is_due(target->brightness_check_timer))
 		{
-			if (clock() - brightness_check_timer >= brightness_check_timer_interval)
-			{
-				pixels_bright = process_layer_cpu::is_current_pixels_bright();
-				brightness_check_timer = clock();
-			}
-
-			process_layer_cpu::invert_colors();
+			target->pixels_bright = process_layer_cpu::is_current_pixels_bright();
+			target->brightness_check_timer = timers::start(brightness_check_timer_interval);
 		}
 
+		// When the frame was scrolled or only a part of it was changed, process only the dirty tiles and the tiles
+		// of the changed images, and take the rest from the previous output
+		if (process_layer_cpu::scroll_detection::detect(force_render, images_rects))
+		{
+			const auto& dirty_rects = process_layer_cpu::scroll_detection::get_dirty_rects();
+			const auto& process_rects = process_layer_cpu::scroll_detection::get_process_rects();
+
+			process_layer_cpu::update_cached_rows();
+
+			if (target->filter_images)
+				for (const auto& rect : process_layer_cpu::scroll_detection::get_search_rects())
+					process_layer_cpu::map_images::map_images(false, rect);
 
-		if (glass_mode)
-			process_layer_cpu::glass_effect::map_shapes(glass_background);
+			if (target->dark_mode)
+				for (const auto& rect : process_rects)
+					process_layer_cpu::invert_colors(rect);
+
+			if (target->glass_mode)
+				process_layer_cpu::glass_effect::map_shapes(dirty_rects, process_rects, target->dark_mode);
+
+			process_layer_cpu::scroll_detection::apply();
+			process_layer_cpu::end_process();
+
+			// The output is changed only in the dirty and the shifted tiles, so only they are presented.
+			// If no tile was changed (forced render of the same frame), the whole frame is presented
+			for (const auto& rect : process_layer_cpu::scroll_detection::get_changed_rects())
+				frame_dirty_rects.push_back({rect.left, rect.top, rect.right, rect.bottom});
+			metrics::add_stage_time(metrics::Stage::EFFECT, effect_start);
+
+			if (force_render)
+				update_force_render_convergence(frame_changed, process_layer_cpu::get_analysis_hash());
+			return true;
+		}
+
+		// The images are searched in the whole frame, so it is done before the other stages. A frame that was not
+		// changed keeps the images that were taken from the detection thread
+		if (target->filter_images && (frame_changed || force_render))
+			process_layer_cpu::map_images::map_images(force_render);
 
+		process_layer_cpu::process_in_strips(target->dark_mode, target->glass_mode);
 		process_layer_cpu::end_process();
+		metrics::add_stage_time(metrics::Stage::EFFECT, effect_start);
+
+		if (force_render)
+			update_force_render_convergence(frame_changed, process_layer_cpu::get_analysis_hash());
 
 		return true;
 	}
 
 
 	/**
-	 * \brief This function is the implementation of the thread that working on
-	 * reprocessing each frame that captured from the window.
-	 * Never call directly to this function.
-	 * To start running it, call to start_process_frame_thread function.
-	 * To stop running it, call to stop_process_frame_thread function.
+	 * \brief Process the next captured frame of the selected target.
+	 * Never call directly to this function, it is called by process_frame_thread
+	 * \return false when the process frame thread should stop processing the target
 	 */
-	void process_frame_thread()
+	bool process_next_frame()
 	{
-		process_frame_thread_exited = false;
-		frame_thread_fatal_error = false;
-		auto continue_run = true;
+		// Only the last frame that arrived is processed, the ones before it are counted as dropped
+		const auto arrived_frames = capture_layer::take_arrived_frames();
+		metrics::add_frames(metrics::Counter::CAPTURED, arrived_frames);
 
-		if (start_processing_wait)
+		if (target->was_maximized_timer || target->was_minimized_timer)
 		{
-			Sleep(1000);
-			start_processing_wait = false;
+			metrics::add_frames(metrics::Counter::DROPPED, arrived_frames);
+			return false;
 		}
 
-		while (run_process_frame_thread && continue_run)
-		{
-			if (was_maximized_timer || was_minimized_timer)
-				break;
+		const auto frame_start = metrics::now();
 
-			if (is_target_window_in_use)
-				Sleep(1);
-			else
-				Sleep(500);
+		capture_layer::TextureData captured_frame = {nullptr};
+		if (!capture_layer::get_new_frame(&captured_frame))
+			return true;
 
-			capture_layer::TextureData captured_frame = {nullptr};
-			if (!capture_layer::get_new_frame(&captured_frame))
-				continue;
+		auto update_size = false;
+
+		if (target->x_size != captured_frame.x_size || target->y_size != captured_frame.y_size)
+		{
+			start_force_render();
 
-			auto update_size = false;
 
-			if (x_size != captured_frame.x_size || y_size != captured_frame.y_size)
+			if (target->resize_timer == 0)
 			{
-				force_render_timer = clock();
+				display_layer::hide_target_hwnd();
+				target->window_temporary_hidden = true;
+			}
+			target->resize_timer = timers::start(resize_delay);
+			target->show_target_timer = 0;
 
+			target->x_size = captured_frame.x_size;
+			target->y_size = captured_frame.y_size;
+		}
 
-				if (resize_timer == 0)
-				{
-					display_layer::hide_target_hwnd();
-					window_temporary_hidden = true;
-				}
-				resize_timer = clock();
 
-				x_size = captured_frame.x_size;
-				y_size = captured_frame.y_size;
+		if (target->resize_timer)
+		{
+			if (timers::is_due(target->resize_timer))
+			{
+				update_size = true;
+				target->resize_timer = 0;
 			}
+			else
+			{
+				metrics::add_frames(metrics::Counter::DROPPED, arrived_frames);
+				return true;
+			}
+		}
+
 
+		if (update_size)
+		{
+			// The swap chain belongs to the selected target, so it is resized here and not by the capture layer
+			graphic_device::resize_swap_chain(target->x_size, target->y_size);
 
-			if (resize_timer)
+			display_layer::update_target_rect();
+			display_layer::move_layer_to_target();
+
+			if (graphic_device::is_cuda_adapter)
 			{
-				if (clock() - resize_timer >= 250)
+				if (!init_gpu_process_mode())
 				{
-					update_size = true;
-					resize_timer = 0;
+					std::cout << "init_gpu_process_mode(*) failed\n";
+					fatal_error = true;
+					wake_loop();
 				}
-				else
+			}
+			else
+			{
+				if (!init_cpu_process_mode())
 				{
-					continue;
+					std::cout << "init_cpu_process_mode(*) failed\n";
+					fatal_error = true;
+					wake_loop();
 				}
 			}
 
+			metrics::add_frames(metrics::Counter::DROPPED, arrived_frames);
+			return true;
+		}
 
-			if (update_size)
-			{
-				display_layer::update_target_rect();
-				display_layer::move_layer_to_target();
 
-				if (graphic_device::is_cuda_adapter)
+		auto force_render = false;
+		if (target->force_render_timer)
+		{
+			if (!timers::is_due(target->force_render_timer))
+				force_render = true;
+			else
+				target->force_render_timer = 0;
+		}
+
+
+		// The frame is processed again when the detection thread found its images after it was processed, or
+		// when the detection thread is free to search it
+		const auto refresh_images = target->filter_images && !force_render &&
+			process_layer_cpu::map_images::is_refresh_needed();
+
+
+		// display_layer::draw_texture(captured_frame.textrue);
+
+		auto new_frame = false;
+		bool success;
+		if (graphic_device::is_cuda_adapter)
+			success = process_frame_in_gpu(captured_frame.textrue, captured_frame.capture_time, arrived_frames > 0,
+			                               force_render, refresh_images, new_frame);
+		else
+			success = process_frame_in_cpu(captured_frame.textrue, captured_frame.capture_time, arrived_frames > 0,
+			                               force_render, refresh_images, new_frame);
+
+		if (success && new_frame)
+		{
+			const auto present_start = metrics::now();
+			if (graphic_device::is_cuda_adapter)
+				display_layer::draw_texture(target->gpu_texture);
+			else
+				display_layer::draw_texture(target->cpu_texture, frame_dirty_rects);
+			metrics::add_stage_time(metrics::Stage::PRESENT, present_start);
+			metrics::add_stage_time(metrics::Stage::TOTAL, frame_start);
+			metrics::add_frames(metrics::Counter::PROCESSED);
+			if (frame_capture_time)
+				metrics::add_frame_latency(frame_capture_time, frame_start);
+		}
+		else if (success && frame_checked)
+		{
+			metrics::add_frames(metrics::Counter::UNCHANGED);
+		}
+
+		if (arrived_frames > 1)
+			metrics::add_frames(metrics::Counter::DROPPED, arrived_frames - 1);
+
+
+		if (!success)
+		{
+			target->frame_thread_fatal_error = true;
+			return false;
+		}
+
+		// The frame thread shows the window when the timer is due, so the frame of the new size is on the screen
+		if (target->window_temporary_hidden && !target->show_target_timer)
+			target->show_target_timer = timers::start(show_target_delay);
+
+		return true;
+	}
+
+	/**
+	 * \brief This function is the implementation of the thread that working on
+	 * reprocessing each frame that captured from the windows. It processes the
+	 * targets one after another, each one while holding its mutex.
+	 * A target that the main thread works on is processed on the next round.
+	 * Never call directly to this function.
+	 * To start processing a target, call to start_process_frame_thread function.
+	 * To stop processing a target, call to stop_process_frame_thread function.
+	 */
+	void process_frame_thread()
+	{
+		timers::set_thread_waiter(&frame_thread_waiter);
+
+		// The CUDA device is selected per thread
+		if (graphic_device::is_cuda_adapter)
+			cudaSetDevice(graphic_device::cuda_device);
+
+		while (true)
+		{
+			auto any_target_in_use = false;
+			auto any_target_polled = false;
+
+			for (size_t i = 0;; i++)
+			{
+				std::shared_ptr<Target> processed;
 				{
-					if (!init_gpu_process_mode(captured_frame.textrue))
-					{
-						std::cout << "init_gpu_process_mode(*) failed\n";
-						fatal_error = true;
-					}
+					std::lock_guard<std::mutex> targets_lock(targets_mutex);
+					if (i >= targets.size())
+						break;
+
+					processed = targets[i];
 				}
-				else
+
+				std::unique_lock<std::recursive_mutex> lock(processed->mutex, std::try_to_lock);
+				if (!lock.owns_lock())
 				{
-					if (!init_cpu_process_mode(captured_frame.textrue))
-					{
-						std::cout << "init_cpu_process_mode(*) failed\n";
-						fatal_error = true;
-					}
+					any_target_polled = true;
+					continue;
 				}
 
+				if (processed->removed)
+					continue;
 
-				continue;
-			}
+				select_target(processed.get());
 
+				if (target->show_target_timer && timers::is_due(target->show_target_timer))
+				{
+					display_layer::show_target_hwnd();
+					target->window_temporary_hidden = false;
+					target->show_target_timer = 0;
+				}
 
-			auto force_render = false;
-			if (force_render_timer)
-			{
-				if (clock() - force_render_timer < 4000)
-					force_render = true;
-				else
-					force_render_timer = 0;
-			}
+				if (target->run_process_frame_thread && !target->process_frame_thread_exited)
+				{
+					any_target_in_use = any_target_in_use || target->is_target_window_in_use;
 
+					auto interval = target->is_target_window_in_use ? 0 : 500;
+					if (target->start_processing_wait)
+						interval = 1000;
 
-			// display_layer::draw_texture(captured_frame.textrue);
+					// A frame that is copied is processed as soon as its copy finished
+					if (timers::is_due(target->process_frame_timer + interval) || target->cpu_textures_pending_count > 0)
+					{
+						target->start_processing_wait = false;
+						if (!process_next_frame())
+							target->process_frame_thread_exited = true;
 
-			auto new_frame = false;
-			bool success;
-			if (graphic_device::is_cuda_adapter)
-			{
-				success = process_frame_in_gpu(captured_frame.textrue, force_render, new_frame);
-				if (success && new_frame)
-					display_layer::draw_texture(gpu_texture);
-			}
-			else
-			{
-				success = process_frame_in_cpu(captured_frame.textrue, force_render, new_frame);
-				if (success && new_frame)
-					display_layer::draw_texture(cpu_texture);
+						target->process_frame_timer = timers::now();
+					}
+					else
+					{
+						timers::schedule(target->process_frame_timer + interval);
+					}
+
+					any_target_polled = any_target_polled || target->cpu_textures_pending_count > 0 ||
+						(target->force_render_timer && !interval);
+				}
 			}
 
+			// The thread keeps no target selected while it waits, since the main thread may remove it
+			select_target(nullptr);
 
-			if (!success)
-			{
-				frame_thread_fatal_error = true;
-				continue_run = false;
-			}
+			// The placement follows the use of the windows, and the cores that the thread ran on are published
+			thread_placement::set_in_use(any_target_in_use);
+			thread_placement::update_thread();
+			thread_placement::sample_core();
 
-			if (window_temporary_hidden)
-			{
-				Sleep(100);
-				display_layer::show_target_hwnd();
-				window_temporary_hidden = false;
-			}
+			// The capture layer wakes the thread when a frame arrived, and the main thread when a target is started or
+			// its use changed. Only the copies of the frames to the CPU and the forced re rendering are polled
+			metrics::publish();
+			timers::wait(any_target_polled ? 1 : frame_thread_max_wait);
 		}
-
-		process_frame_thread_exited = true;
 	}
 
 
@@ -870,11 +1695,13 @@ namespace renderer
 	 */
 	void enable_dark_mode(const bool filter_images)
 	{
+		std::lock_guard<std::recursive_mutex> lock(target->mutex);
+
 		std::cout << "Enabling dark mode\n";
-		startup_rendering = true;
-		renderer::filter_images = filter_images;
-		brightness_check_timer = clock();
-		dark_mode = true;
+		target->startup_rendering = true;
+		target->filter_images = filter_images;
+		target->brightness_check_timer = timers::start(brightness_check_timer_interval);
+		target->dark_mode = true;
 	}
 
 	/**
@@ -882,9 +1709,11 @@ namespace renderer
 	 */
 	void disable_dark_mode()
 	{
+		std::lock_guard<std::recursive_mutex> lock(target->mutex);
+
 		std::cout << "Disabling dark mode\n";
 		un_init_for_target_hwnd();
-		dark_mode = false;
+		target->dark_mode = false;
 	}
 
 
@@ -903,21 +1732,23 @@ namespace renderer
 	                       const bool dark_background, const double background_level, const double images_level,
 	                       const double texts_level)
 	{
+		std::lock_guard<std::recursive_mutex> lock(target->mutex);
+
 		std::cout << "Enabling glass mode\n";
 		// Set the variables
-		glass_mode = true;
-		glass_dark_background = dark_background; //dark_background;
-		renderer::filter_images = filter_images;
-		glass_blur_type = blur_level;
-		glass_brightness_level = brightness_level;
-		glass_background = background_level;
-		glass_images = images_level;
-		glass_texts = texts_level;
-		startup_rendering = true;
+		target->glass_mode = true;
+		target->glass_dark_background = dark_background; //dark_background;
+		target->filter_images = filter_images;
+		target->glass_blur_type = blur_level;
+		target->glass_brightness_level = brightness_level;
+		target->glass_background = background_level;
+		target->glass_images = images_level;
+		target->glass_texts = texts_level;
+		target->startup_rendering = true;
 
 		if (!init_for_target_hwnd())
 		{
-			glass_mode = false;
+			target->glass_mode = false;
 			std::cout << "Failed to enable glass mode\n";
 			return false;
 		}
@@ -930,9 +1761,11 @@ namespace renderer
 	 */
 	void disable_glass_mode()
 	{
-		std::cout << "Disabling glass mode for " << target_hwnd;
+		std::lock_guard<std::recursive_mutex> lock(target->mutex);
+
+		std::cout << "Disabling glass mode for " << target->target_hwnd;
 		un_init_for_target_hwnd();
-		glass_mode = false;
+		target->glass_mode = false;
 	}
 
 
@@ -942,10 +1775,7 @@ namespace renderer
 	 */
 	void adjust_processing_speed()
 	{
-		const auto timer_interval = 1000;
-		static clock_t timer = -timer_interval;
-
-		if (clock() - timer < timer_interval)
+		if (!timers::is_due(target->processing_speed_timer))
 			return;
 
 
@@ -959,17 +1789,22 @@ namespace renderer
 
 			hwnd = GetAncestor(hwnd, GA_ROOT);
 
-			return hwnd == target_hwnd;
+			return hwnd == target->target_hwnd;
 		};
 
 		auto is_target_window_active = []()
 		{
-			return GetForegroundWindow() == target_hwnd;
+			return GetForegroundWindow() == target->target_hwnd;
 		};
 
-		is_target_window_in_use = is_target_window_active() || is_mouse_above_target_hwnd();
+		const auto was_in_use = target->is_target_window_in_use;
+		target->is_target_window_in_use = is_target_window_active() || is_mouse_above_target_hwnd();
 
-		timer = clock();
+		// The process frame thread processes the frames of a window in use without a delay
+		if (target->is_target_window_in_use != was_in_use)
+			timers::wake(&frame_thread_waiter);
+
+		target->processing_speed_timer = timers::start(processing_speed_timer_interval);
 	}
 
 	/**
@@ -983,7 +1818,15 @@ namespace renderer
 	 */
 	bool process_window_placement(bool& placement_changed)
 	{
-		if (was_maximized_timer && clock() - was_maximized_timer >= 250)
+		if (target->was_restored_timer && timers::is_due(target->was_restored_timer))
+		{
+			target->was_restored_timer = 0;
+			init_for_target_hwnd();
+			target->window_hidden = false;
+			return true;
+		}
+
+		if (target->was_maximized_timer && timers::is_due(target->was_maximized_timer))
 		{
 			placement_changed = true;
 
@@ -993,39 +1836,39 @@ namespace renderer
 
 			// Need to do it (ugly workaround) to avoid bug in WinRT capture API
 			display_layer::update_target_rect();
-			display_layer::target_rect.top -= 20;
-			display_layer::target_rect.left -= 20;
+			display_layer::get_target_rect().top -= 20;
+			display_layer::get_target_rect().left -= 20;
 			display_layer::move_layer_to_target();
 
 			capture_layer::create_layer();
 			capture_layer::start_capture_session();
 
-			was_maximized_timer = 0;
-			x_size = y_size = 0;
+			target->was_maximized_timer = 0;
+			target->x_size = target->y_size = 0;
 			start_process_frame_thread();
 
 			return true;
 		}
 
-		if (was_minimized_timer && clock() - was_minimized_timer >= 500)
+		if (target->was_minimized_timer && timers::is_due(target->was_minimized_timer))
 		{
 			un_init_for_target_hwnd();
 			placement_changed = true;
-			window_hidden = true;
-			was_minimized_timer = 0;
+			target->window_hidden = true;
+			target->was_minimized_timer = 0;
 		}
 
 		WINDOWPLACEMENT placement_new = {0};
-		if (!GetWindowPlacement(target_hwnd, &placement_new))
+		if (!GetWindowPlacement(target->target_hwnd, &placement_new))
 		{
 			std::cout << "Failed to get window placement. Window may be deleted";
 			return false;
 		}
 
-		if (placement_new.showCmd != target_placement.showCmd)
+		if (placement_new.showCmd != target->target_placement.showCmd)
 		{
-			const auto old_show_cmd = target_placement.showCmd;
-			target_placement.showCmd = placement_new.showCmd;
+			const auto old_show_cmd = target->target_placement.showCmd;
+			target->target_placement.showCmd = placement_new.showCmd;
 
 			switch (placement_new.showCmd)
 			{
@@ -1033,39 +1876,40 @@ namespace renderer
 			case SW_MINIMIZE:
 			case SW_SHOWMINIMIZED:
 				std::cout << "Window is not on screen so suspending capturing\n";
-				was_minimized_timer = clock();
-				was_maximized_timer = 0;
+				target->was_minimized_timer = timers::start(was_minimized_delay);
+				target->was_maximized_timer = 0;
+				target->was_restored_timer = 0;
 				return true;
 
 			case SW_SHOWNORMAL:
 			case SW_RESTORE:
 			case SW_MAXIMIZE:
 
+				// Prevent some bug when the window restored from minimized state
 				if (old_show_cmd == SW_MINIMIZE || old_show_cmd == SW_SHOWMINIMIZED)
-					x_size = y_size = 0; // Prevent some bug when the window restored from minimized state
+					target->x_size = target->y_size = 0;
 
-				was_minimized_timer = 0;
+				target->was_minimized_timer = 0;
 				
-				if (!window_hidden)
+				if (!target->window_hidden)
 				{
-					was_maximized_timer = clock();	
+					target->was_maximized_timer = timers::start(was_maximized_delay);
 				}
 				else
 				{
-					Sleep(250);
-					init_for_target_hwnd();
-					window_hidden = false;
+					// The window is rendered again when the timer is due, without blocking the main loop
+					target->was_restored_timer = timers::start(was_restored_delay);
 				}
 				return true;
 			}
 		}
 
-		if (placement_new.rcNormalPosition.left != target_placement.rcNormalPosition.left ||
-			placement_new.rcNormalPosition.top != target_placement.rcNormalPosition.top)
+		if (placement_new.rcNormalPosition.left != target->target_placement.rcNormalPosition.left ||
+			placement_new.rcNormalPosition.top != target->target_placement.rcNormalPosition.top)
 		{
 			display_layer::update_target_rect();
 			display_layer::move_layer_to_target();
-			target_placement.rcNormalPosition = placement_new.rcNormalPosition;
+			target->target_placement.rcNormalPosition = placement_new.rcNormalPosition;
 		}
 
 		return true;
@@ -1080,17 +1924,17 @@ namespace renderer
 	void process_dark_mode_brightness_check()
 	{
 		// Don't capture in case we not rendering anything
-		if (window_hidden)
+		if (target->window_hidden)
 			return;
 
 		// If the process frame running then skip
-		if (process_frame_thread_exited)
+		if (target->process_frame_thread_exited)
 		{
 			// Check only few seconds
-			if (clock() - brightness_check_timer < brightness_check_timer_interval)
+			if (!timers::is_due(target->brightness_check_timer))
 				return;
 
-			if (target_hwnd == GetForegroundWindow())
+			if (target->target_hwnd == GetForegroundWindow())
 			{
 				// In this case we will capture the window each few seconds
 				// Using bitblt method, after that we will check if the pixels are bright
@@ -1098,7 +1942,7 @@ namespace renderer
 				// the dark mode effect
 
 				RECT target_rect = {0};
-				DwmGetWindowAttribute(target_hwnd, DWMWA_EXTENDED_FRAME_BOUNDS, &target_rect, sizeof(RECT));
+				DwmGetWindowAttribute(target->target_hwnd, DWMWA_EXTENDED_FRAME_BOUNDS, &target_rect, sizeof(RECT));
 
 				const int x_size = target_rect.right - target_rect.left + 1;
 				const int y_size = target_rect.bottom - target_rect.top + 1;
@@ -1106,21 +1950,22 @@ namespace renderer
 				if (!capture_layer_bitblt::capture(target_rect.left, target_rect.top, x_size, y_size))
 				{
 					std::cout << "Failed to capture window using BitBlt API\n";
-					brightness_check_timer = clock();
+					target->brightness_check_timer = timers::start(brightness_check_timer_interval);
 					return;
 				}
 
-				pixels_bright = process_layer_cpu::is_pixels_bright(capture_layer_bitblt::pixels, x_size, y_size);
+				target->pixels_bright = process_layer_cpu::is_pixels_bright(capture_layer_bitblt::pixels, x_size,
+				                                                            y_size);
 
-				if (pixels_bright)
+				if (target->pixels_bright)
 				{
 					init_for_target_hwnd(true);
 				}
 			}
 
-			brightness_check_timer = clock();
+			target->brightness_check_timer = timers::start(brightness_check_timer_interval);
 		}
-		else if (!pixels_bright || frame_thread_fatal_error)
+		else if (!target->pixels_bright || target->frame_thread_fatal_error)
 		{
 			un_init_for_target_hwnd();
 		}
@@ -1128,8 +1973,9 @@ namespace renderer
 
 	/**
 	 * \brief This function is used inside the main process thread where the
-	 * UI also created
-	 * \return true when there is no fatal error and false when there is fatal error.
+	 * UI also created. It handles the events of all the targets and removes the targets
+	 * that their window was closed
+	 * \return true when there is no fatal error and false when there is fatal error or no target left.
 	 * In case of false, the calling function should exit the whole program and/or at least
 	 * print logs.
 	 */
@@ -1138,21 +1984,63 @@ namespace renderer
 		if (fatal_error)
 			return false;
 
+		std::vector<std::shared_ptr<Target>> attached;
+		{
+			std::lock_guard<std::mutex> lock(targets_mutex);
+			attached = targets;
+		}
+
 		if (exit_event_requested)
 		{
-			if (rendering)
-				un_init_for_target_hwnd();
+			for (const auto& detached : attached)
+			{
+				std::lock_guard<std::recursive_mutex> lock(detached->mutex);
+				select_target(detached.get());
+				remove_selected_target();
+			}
 
 			exit_event_requested = false;
 			return false;
 		}
 
-		adjust_processing_speed();
+		auto* main_target = target;
 
-		auto placement_changed = false;
-		if (!process_window_placement(placement_changed))
-			return false;
+		// The use of the windows is checked at once when another window came to the foreground
+		const auto check_use = foreground_changed;
+		foreground_changed = false;
 
-		return true;
+		for (const auto& checked : attached)
+		{
+			// The loop doesn't wait for the frame that the process frame thread works on, the target is checked
+			// again soon
+			std::unique_lock<std::recursive_mutex> lock(checked->mutex, std::try_to_lock);
+			if (!lock.owns_lock())
+			{
+				timers::start(busy_target_retry_delay);
+				foreground_changed = foreground_changed || check_use;
+				continue;
+			}
+
+			select_target(checked.get());
+
+			if (check_use)
+				target->processing_speed_timer = 0;
+			adjust_processing_speed();
+
+			auto placement_changed = false;
+			if (!IsWindow(target->target_hwnd) || !process_window_placement(placement_changed))
+			{
+				std::cout << "Removing target " << target->target_hwnd << std::endl;
+				if (main_target == target)
+					main_target = nullptr;
+
+				remove_selected_target();
+			}
+		}
+
+		select_target(main_target);
+
+		std::lock_guard<std::mutex> lock(targets_mutex);
+		return !targets.empty();
 	}
 }
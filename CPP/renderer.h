@@ -4,7 +4,9 @@ namespace renderer
 {
 
 	bool init(const bool cuda_acceleration);  // Init the renderer stack memory
-	void set_target(HWND target_hwnd);
+	void attach_target(HWND target_hwnd);  // Add a window to re render and set it as the target
+	void detach_target(HWND target_hwnd);
+	bool set_target(HWND target_hwnd);  // Set the attached window that the functions below work on
 	void enable_dark_mode(bool filter_images);
 	void disable_dark_mode();
 	enum class GlassBlurType
@@ -20,7 +22,9 @@ namespace renderer
 	void glass_set_shapes_level(const double glass_shapes);
 	void glass_set_dark_background_mode(const bool enable);
 	void glass_set_brightness_level(const double level);
+	void set_analysis_scale(int scale);  // 0 - By the DPI of the target window, 1/2/4 - Fixed scale
 	bool process_loop();
 	bool have_fatal_error();
 	void register_exit_event();
+	HANDLE get_loop_event();  // Signaled when process_loop has work that is not a message or a timer
 }
\ No newline at end of file
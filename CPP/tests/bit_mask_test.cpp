@@ -0,0 +1,188 @@
+#include <iostream>
+#include <random>
+#include <vector>
+#include "bit_mask.h"
+
+// Compares the word-at-a-time functions of bit_mask.h with a map of one bool per bit, on random masks and ranges.
+// The masks are a few words long, so the ranges start and end in the middle of words and cross them
+namespace bit_mask_test
+{
+	constexpr size_t mask_bits = 64 * 7 + 19;
+	constexpr int rounds = 20000;
+
+	std::mt19937 random_engine(1);
+	int failures = 0;
+
+	size_t next_random(const size_t end)
+	{
+		return std::uniform_int_distribution<size_t>(0, end - 1)(random_engine);
+	}
+
+	struct Masks
+	{
+		// With one more word, as read_bits and write_bits may touch the word after the last bit
+		std::vector<bit_mask::Word> words = std::vector<bit_mask::Word>(bit_mask::words_count(mask_bits) + 1);
+		std::vector<bool> bools = std::vector<bool>(mask_bits);
+	};
+
+	// Runs of the same value, so the words are not all mixed
+	void fill_random(Masks& masks)
+	{
+		auto value = next_random(2) != 0;
+		for (size_t bit = 0; bit < mask_bits; bit++)
+		{
+			if (next_random(12) == 0)
+				value = !value;
+
+			bit_mask::assign(masks.words.data(), bit, value);
+			masks.bools[bit] = value;
+		}
+	}
+
+	void check(const bool condition, const char* name, const int round)
+	{
+		if (condition)
+			return;
+
+		if (failures++ < 10)
+			std::cout << name << " failed in round " << round << "\n";
+	}
+
+	bool is_same(const Masks& masks)
+	{
+		for (size_t bit = 0; bit < mask_bits; bit++)
+			if (bit_mask::test(masks.words.data(), bit) != masks.bools[bit])
+				return false;
+		return true;
+	}
+
+	void random_range(size_t& from, size_t& to)
+	{
+		from = next_random(mask_bits + 1);
+		to = from + next_random(mask_bits - from + 1);
+	}
+
+	void test_fill_range(const int round)
+	{
+		Masks masks;
+		fill_random(masks);
+
+		size_t from, to;
+		random_range(from, to);
+		const auto value = next_random(2) != 0;
+
+		bit_mask::fill_range(masks.words.data(), from, to, value);
+		for (auto bit = from; bit < to; bit++)
+			masks.bools[bit] = value;
+
+		check(is_same(masks), "fill_range", round);
+	}
+
+	void test_find_next(const int round)
+	{
+		Masks masks;
+		fill_random(masks);
+
+		size_t from, to;
+		random_range(from, to);
+		const auto value = next_random(2) != 0;
+
+		auto expected = from < to ? from : to;
+		while (expected < to && masks.bools[expected] != value)
+			expected++;
+
+		check(bit_mask::find_next(masks.words.data(), from, to, value) == expected, "find_next", round);
+		check(bit_mask::any_in_range(masks.words.data(), from, to) ==
+		      (bit_mask::find_next(masks.words.data(), from, to, true) < to), "any_in_range", round);
+	}
+
+	void test_for_each_clear_span(const int round)
+	{
+		Masks masks;
+		fill_random(masks);
+
+		size_t from, to;
+		random_range(from, to);
+
+		std::vector<size_t> spans, expected_spans;
+		bit_mask::for_each_clear_span(masks.words.data(), from, to, [&](const size_t span_from, const size_t span_to)
+		{
+			spans.push_back(span_from);
+			spans.push_back(span_to);
+		});
+
+		for (auto bit = from; bit < to;)
+		{
+			if (masks.bools[bit])
+			{
+				bit++;
+				continue;
+			}
+
+			const auto span_from = bit;
+			while (bit < to && !masks.bools[bit])
+				bit++;
+			expected_spans.push_back(span_from);
+			expected_spans.push_back(bit);
+		}
+
+		check(spans == expected_spans, "for_each_clear_span", round);
+	}
+
+	void test_read_write_bits(const int round)
+	{
+		Masks masks;
+		fill_random(masks);
+
+		const auto count = 1 + next_random(bit_mask::word_bits);
+		const auto bit = next_random(mask_bits - count + 1);
+
+		bit_mask::Word expected = 0;
+		for (size_t i = 0; i < count; i++)
+			expected |= bit_mask::Word(masks.bools[bit + i]) << i;
+		check(bit_mask::read_bits(masks.words.data(), bit, count) == expected, "read_bits", round);
+
+		const bit_mask::Word bits = (static_cast<bit_mask::Word>(random_engine()) << 32) ^ random_engine();
+		bit_mask::write_bits(masks.words.data(), bit, count, bits);
+		for (size_t i = 0; i < count; i++)
+			masks.bools[bit + i] = (bits >> i) & 1;
+		check(is_same(masks), "write_bits", round);
+	}
+
+	void test_move_bits(const int round)
+	{
+		Masks masks;
+		fill_random(masks);
+
+		// Both directions, with ranges that overlap and ranges that don't
+		const auto count = next_random(mask_bits + 1);
+		const auto from = next_random(mask_bits - count + 1);
+		const auto to = next_random(mask_bits - count + 1);
+
+		bit_mask::move_bits(masks.words.data(), to, from, count);
+		const std::vector<bool> source(masks.bools.begin() + from, masks.bools.begin() + from + count);
+		std::copy(source.begin(), source.end(), masks.bools.begin() + to);
+
+		check(is_same(masks), "move_bits", round);
+	}
+
+	int run()
+	{
+		for (auto round = 0; round < rounds; round++)
+		{
+			test_fill_range(round);
+			test_find_next(round);
+			test_for_each_clear_span(round);
+			test_read_write_bits(round);
+			test_move_bits(round);
+		}
+
+		std::cout << (failures ? "FAILED" : "OK") << ": " << failures << " failures in " << rounds << " rounds\n";
+		return failures ? 1 : 0;
+	}
+}
+
+int main()
+{
+	return bit_mask_test::run();
+}
@@ -0,0 +1,186 @@
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include "glass_engine.h"
+#include "workload.h"
+
+// Processes the same frames with two engines: one that processes only the dirty tiles of each frame (with the
+// cubes around them that the glass effect marks again), and one that is forced to process each whole frame. Both
+// must give the same output, on frames that scroll, that are typed in, and that have gradients and dense text for
+// the noise reduction
+namespace glass_engine_test
+{
+	constexpr int frames_count = 60;
+
+	int failures = 0;
+
+	void check(const bool condition, const char* name, const int frame_index)
+	{
+		if (condition)
+			return;
+
+		if (failures++ < 10)
+			std::cout << name << " failed in frame " << frame_index << "\n";
+	}
+
+	// A partial frame reports only the changed rects, less than the whole frame
+	bool is_partial_frame(const GlassEngine* engine, const int width, const int height)
+	{
+		GlassEngineRect rect;
+		const auto count = glass_engine_get_changed_rects(engine, &rect, 1);
+		return count != 1 || rect.left != 0 || rect.top != 0 || rect.right != width || rect.bottom != height;
+	}
+
+	GlassEngine* create_engine(const bool filter_images)
+	{
+		auto* const engine = glass_engine_create();
+		if (!engine)
+			return nullptr;
+
+		GlassEngineSettings settings;
+		glass_engine_get_default_settings(&settings);
+		settings.glass_mode = 1;
+		settings.glass_background = 0.5;
+		settings.filter_images = filter_images ? 1 : 0;
+		glass_engine_set_settings(engine, &settings);
+		return engine;
+	}
+
+	void test_preset(const workload::Preset preset, const bool filter_images)
+	{
+		auto* const partial_engine = create_engine(filter_images);
+		auto* const full_engine = create_engine(filter_images);
+		if (!partial_engine || !full_engine)
+		{
+			check(false, "glass_engine_create", 0);
+			glass_engine_destroy(partial_engine);
+			glass_engine_destroy(full_engine);
+			return;
+		}
+
+		auto settings = workload::get_preset(preset);
+		settings.scroll_probability = 0.03;
+		settings.typing_probability = 0.1;
+		workload::Generator generator;
+		workload::init(generator, settings);
+
+		std::vector<uint8_t> partial_output, full_output;
+		auto partial_frames = 0;
+
+		for (auto i = 0; i < frames_count; i++)
+		{
+			const auto& frame = workload::next_frame(generator);
+			const auto size = static_cast<size_t>(frame.stride) * frame.height;
+			partial_output.assign(frame.pixels, frame.pixels + size);
+			full_output.assign(frame.pixels, frame.pixels + size);
+
+			check(glass_engine_process(partial_engine, partial_output.data(), frame.width, frame.height, frame.stride,
+			                           0) == GLASS_ENGINE_OK, "glass_engine_process", i);
+			check(glass_engine_process(full_engine, full_output.data(), frame.width, frame.height, frame.stride, 1) ==
+			      GLASS_ENGINE_OK, "glass_engine_process(force)", i);
+
+			partial_frames += is_partial_frame(partial_engine, frame.width, frame.height);
+			check(partial_output == full_output, workload::get_preset_name(preset), i);
+		}
+
+		// Otherwise the test compares full frames with full frames
+		check(partial_frames >= frames_count / 3, "partial frames", frames_count);
+
+		glass_engine_destroy(partial_engine);
+		glass_engine_destroy(full_engine);
+	}
+
+	// A document of cubes with random colors of a small palette, where the noise reduction finds runs everywhere.
+	// The view is scrolled by whole cubes or by any amount of pixels, so the grid of the cubes moves with the
+	// content, or a few cubes of the document are changed. Most frames are partial
+	void test_noise()
+	{
+		constexpr int width = 640, height = 480, document_height = 1600, block_size = 5;
+		const uint8_t palette[] = {40, 90, 140};
+
+		uint32_t random_state = 1;
+		auto next_random = [&random_state](const int end)
+		{
+			random_state = random_state * 1103515245 + 12345;
+			return static_cast<int>((random_state >> 8) % end);
+		};
+
+		std::vector<uint8_t> document(static_cast<size_t>(width) * document_height);
+		for (auto& color : document)
+			color = palette[next_random(3)];
+
+		auto* const partial_engine = create_engine(false);
+		auto* const full_engine = create_engine(false);
+		if (!partial_engine || !full_engine)
+		{
+			check(false, "glass_engine_create", 0);
+			glass_engine_destroy(partial_engine);
+			glass_engine_destroy(full_engine);
+			return;
+		}
+
+		std::vector<uint8_t> partial_output, full_output;
+		auto scroll_y = 0;
+		auto partial_frames = 0;
+
+		for (auto i = 0; i < frames_count; i++)
+		{
+			if (i % 3 == 0 && scroll_y + height + 4 * block_size <= document_height)
+			{
+				scroll_y += i % 2 ? 1 + next_random(4 * block_size) : (1 + next_random(4)) * block_size;
+			}
+			else
+			{
+				const auto x = next_random(width / block_size - 2) * block_size;
+				const auto y = scroll_y + next_random(height / block_size - 2) * block_size;
+				for (auto y2 = y; y2 < y + 2 * block_size; y2++)
+					for (auto x2 = x; x2 < x + 2 * block_size; x2++)
+						document[static_cast<size_t>(y2) * width + x2] = palette[(x2 / block_size + i) % 3];
+			}
+
+			partial_output.resize(static_cast<size_t>(width) * height * 4);
+			for (auto y = 0; y < height; y++)
+				for (auto x = 0; x < width; x++)
+				{
+					auto* const pixel = &partial_output[(static_cast<size_t>(y) * width + x) * 4];
+					const auto color = document[static_cast<size_t>(y + scroll_y) / block_size * block_size * width +
+						x / block_size * block_size];
+					pixel[0] = pixel[1] = pixel[2] = color;
+					pixel[3] = 255;
+				}
+			full_output = partial_output;
+
+			check(glass_engine_process(partial_engine, partial_output.data(), width, height, width * 4, 0) ==
+			      GLASS_ENGINE_OK, "glass_engine_process", i);
+			check(glass_engine_process(full_engine, full_output.data(), width, height, width * 4, 1) ==
+			      GLASS_ENGINE_OK, "glass_engine_process(force)", i);
+			partial_frames += is_partial_frame(partial_engine, width, height);
+			check(partial_output == full_output, "noise", i);
+		}
+
+		check(partial_frames >= frames_count * 2 / 3, "partial frames", frames_count);
+
+		glass_engine_destroy(partial_engine);
+		glass_engine_destroy(full_engine);
+	}
+
+	int run()
+	{
+		const workload::Preset presets[] = {
+			workload::Preset::dark, workload::Preset::light, workload::Preset::dense, workload::Preset::gradient,
+			workload::Preset::scrolling, workload::Preset::typing
+		};
+
+		for (const auto preset : presets)
+			test_preset(preset, false);
+		test_noise();
+
+		std::cout << (failures ? "FAILED" : "OK") << ": " << failures << " failures\n";
+		return failures ? 1 : 0;
+	}
+}
+
+int main()
+{
+	return glass_engine_test::run();
+}
@@ -0,0 +1,287 @@
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+#include "process_layer_cpu.h"
+#include "workload.h"
+
+// Checks the paths of the process layer that skip the pixels of images with the bit mask of map_images, on the
+// frames of the images preset of workload.h. The pixels that the map marks as images must be left as they are by
+// the inversion and by the glass effect, and the rest of the pixels must be inverted exactly.
+// It checks also that is_new_pixels finds the changes of a frame by the hashes of its rows, and that a change of
+// the images map is processed again only in its tiles
+namespace process_layer_cpu_test
+{
+	constexpr int frames_count = 12;
+	constexpr int pixel_changes_count = 2000;
+	constexpr int row_changes_count = 500;
+
+	int failures = 0;
+
+	void check(const bool condition, const char* name, const int frame_index)
+	{
+		if (condition)
+			return;
+
+		if (failures++ < 10)
+			std::cout << name << " failed in frame " << frame_index << "\n";
+	}
+
+	struct Frame
+	{
+		std::vector<byte> pixels;
+		int x_size = 0, y_size = 0, width = 0;
+	};
+
+	Frame copy_frame(const workload::Frame& frame)
+	{
+		Frame copy;
+		copy.pixels.assign(frame.pixels, frame.pixels + static_cast<size_t>(frame.stride) * frame.height);
+		copy.x_size = frame.stride / 4;
+		copy.y_size = frame.height;
+		copy.width = frame.width;
+		return copy;
+	}
+
+	// Copy of the images map of the loaded frame, as the next stages may update it
+	std::vector<bit_mask::Word> map_images(Frame& frame, const int frame_index)
+	{
+		if (!process_layer_cpu::load_frame(frame.pixels.data(), frame.x_size, frame.y_size, frame.width,
+		                                   frame.y_size))
+		{
+			check(false, "load_frame", frame_index);
+			return {};
+		}
+
+		const auto* const mask = process_layer_cpu::map_images::map_images(true);
+		const auto words = bit_mask::words_count(static_cast<size_t>(frame.x_size) * frame.y_size);
+		return std::vector<bit_mask::Word>(mask, mask + words);
+	}
+
+	bool is_image(const std::vector<bit_mask::Word>& mask, const size_t pixel)
+	{
+		return bit_mask::test(mask.data(), pixel);
+	}
+
+	// The pixels of the images are the same, and (for the inversion) the rest are inverted
+	void check_output(const Frame& input, const Frame& output, const std::vector<bit_mask::Word>& mask,
+	                  const bool is_inverted, const char* name, const int frame_index)
+	{
+		auto is_ok = true;
+		for (size_t pixel = 0; pixel < input.pixels.size() / 4 && is_ok; pixel++)
+		{
+			const auto* const in = &input.pixels[pixel * 4];
+			const auto* const out = &output.pixels[pixel * 4];
+
+			if (is_image(mask, pixel))
+				is_ok = memcmp(in, out, 4) == 0;
+			else if (is_inverted)
+				is_ok = out[0] == 255 - in[0] && out[1] == 255 - in[1] && out[2] == 255 - in[2] && out[3] == in[3];
+		}
+
+		check(is_ok, name, frame_index);
+	}
+
+	void test_frame(const workload::Frame& frame, const int frame_index)
+	{
+		const auto input = copy_frame(frame);
+
+		// The inversion of the whole frame, band by band
+		auto output = input;
+		const auto mask = map_images(output, frame_index);
+		if (mask.empty())
+			return;
+
+		size_t image_pixels = 0;
+		for (size_t pixel = 0; pixel < input.pixels.size() / 4; pixel++)
+			image_pixels += is_image(mask, pixel);
+		check(image_pixels > 0 && image_pixels < input.pixels.size() / 4, "images map", frame_index);
+
+		process_layer_cpu::process_in_strips(true, false);
+		check_output(input, output, mask, true, "process_in_strips(invert)", frame_index);
+
+		// The inversion of rects, that crosses the words of the map in the middle
+		output = input;
+		check(map_images(output, frame_index) == mask, "map_images of the same frame", frame_index);
+		for (auto y = 0; y < input.y_size; y += 37)
+			for (auto x = 0; x < input.x_size; x += 53)
+			{
+				process_layer_cpu::Rect rect;
+				rect.left = x;
+				rect.top = y;
+				rect.right = x + 53 < input.x_size ? x + 53 : input.x_size;
+				rect.bottom = y + 37 < input.y_size ? y + 37 : input.y_size;
+				process_layer_cpu::invert_colors(rect);
+			}
+		check_output(input, output, mask, true, "invert_colors(rect)", frame_index);
+
+		// The reduced map and the mark pass of the glass effect
+		output = input;
+		map_images(output, frame_index);
+		process_layer_cpu::process_in_strips(false, true);
+		check(output.pixels != input.pixels, "process_in_strips(glass) changed the frame", frame_index);
+		check_output(input, output, mask, false, "process_in_strips(glass)", frame_index);
+	}
+
+	// A change of one pixel is always found, since it is inside one word of the hash. A change of more pixels of a
+	// row is missed only by a collision of the 64 bit hashes, so none of the random changes may be missed
+	void test_new_pixels()
+	{
+		auto* const context = process_layer_cpu::create_context();
+		process_layer_cpu::select_context(context);
+		process_layer_cpu::set_default_settings();
+		process_layer_cpu::enable_cache_buffer(true);
+
+		auto settings = workload::get_preset(workload::Preset::dense);
+		settings.width = 640;
+		settings.height = 400;
+		workload::Generator generator;
+		workload::init(generator, settings);
+		auto frame = copy_frame(workload::next_frame(generator));
+
+		// The hashes of the first frame are taken when it is loaded
+		if (!process_layer_cpu::load_frame(frame.pixels.data(), frame.x_size, frame.y_size, frame.width,
+		                                   frame.y_size))
+			check(false, "load_frame", 0);
+		check(!process_layer_cpu::is_new_pixels(), "is_new_pixels of the same frame", 0);
+
+		std::mt19937 random_engine(1);
+		const auto original = frame.pixels;
+		const auto restore = [&]() { memcpy(frame.pixels.data(), original.data(), original.size()); };
+
+		// The last pixel of a row is not compared
+		for (auto i = 0; i < pixel_changes_count; i++)
+		{
+			const auto y = static_cast<int>(random_engine() % frame.y_size);
+			const auto x = static_cast<int>(random_engine() % (frame.width - 1));
+			frame.pixels[(static_cast<size_t>(y) * frame.x_size + x) * 4 + random_engine() % 4] ^=
+				static_cast<byte>(1 + random_engine() % 255);
+			check(process_layer_cpu::is_new_pixels(), "is_new_pixels of a changed pixel", i);
+
+			restore();
+			check(process_layer_cpu::is_new_pixels(), "is_new_pixels of the restored pixel", i);
+		}
+
+		for (auto i = 0; i < row_changes_count; i++)
+		{
+			const auto y = static_cast<int>(random_engine() % frame.y_size);
+			const auto count = 2 + static_cast<int>(random_engine() % 63);
+			for (auto j = 0; j < count; j++)
+			{
+				const auto x = static_cast<int>(random_engine() % (frame.width - 1));
+				frame.pixels[(static_cast<size_t>(y) * frame.x_size + x) * 4 + random_engine() % 3] =
+					static_cast<byte>(random_engine());
+			}
+
+			check(frame.pixels == original || process_layer_cpu::is_new_pixels(), "is_new_pixels of a changed row",
+			      i);
+			restore();
+			process_layer_cpu::is_new_pixels();
+		}
+
+		process_layer_cpu::free_resources();
+		process_layer_cpu::destroy_context(context);
+	}
+
+	// The tiles where the images map was changed (by the images that the detection thread found) are processed
+	// again on the same frame, and the output must be the same as the whole frame processed with the new map
+	void test_images_refresh()
+	{
+		auto* const context = process_layer_cpu::create_context();
+		process_layer_cpu::select_context(context);
+		process_layer_cpu::set_default_settings();
+		process_layer_cpu::enable_cache_buffer(false);
+		process_layer_cpu::map_images::enable();
+		process_layer_cpu::scroll_detection::enable();
+		process_layer_cpu::glass_effect::enable(0.5, false, 1, 1);
+
+		auto settings = workload::get_preset(workload::Preset::images);
+		settings.width = 640;
+		settings.height = 400;
+		workload::Generator generator;
+		workload::init(generator, settings);
+		const auto input = copy_frame(workload::next_frame(generator));
+
+		// The output and the hashes of the first frame are kept for the next ones
+		auto output = input;
+		auto mask = map_images(output, 0);
+		if (mask.empty())
+			return;
+		check(!process_layer_cpu::scroll_detection::detect(false, {}), "detect of the first frame", 0);
+		process_layer_cpu::process_in_strips(true, true);
+
+		// New images, and images that are gone, in rects that cross the tiles and the words of the map
+		const std::vector<process_layer_cpu::Rect> images_rects = {
+			{203, 121, 331, 209}, {17, 300, 97, 333}, {43, 81, 81, 119}
+		};
+		for (const auto& rect : images_rects)
+			for (auto y = rect.top; y < rect.bottom; y++)
+				for (auto x = rect.left; x < rect.right; x++)
+				{
+					const auto bit = static_cast<size_t>(y) * input.x_size + x;
+					bit_mask::assign(mask.data(), bit, !bit_mask::test(mask.data(), bit));
+				}
+
+		// The map of the same frame is taken without a search
+		auto partial_output = input;
+		process_layer_cpu::load_frame(partial_output.pixels.data(), input.x_size, input.y_size, input.width,
+		                              input.y_size);
+		memcpy(process_layer_cpu::map_images::update_images(), mask.data(), mask.size() * sizeof(bit_mask::Word));
+
+		check(process_layer_cpu::scroll_detection::detect(false, images_rects), "detect of changed images", 0);
+		check(process_layer_cpu::scroll_detection::get_search_rects().empty(), "search rects of the same pixels", 0);
+		const auto& process_rects = process_layer_cpu::scroll_detection::get_process_rects();
+		for (const auto& rect : process_rects)
+			process_layer_cpu::invert_colors(rect);
+		process_layer_cpu::glass_effect::map_shapes(process_layer_cpu::scroll_detection::get_dirty_rects(),
+		                                            process_rects, true);
+		process_layer_cpu::scroll_detection::apply();
+
+		auto full_output = input;
+		process_layer_cpu::load_frame(full_output.pixels.data(), input.x_size, input.y_size, input.width,
+		                              input.y_size);
+		memcpy(process_layer_cpu::map_images::update_images(), mask.data(), mask.size() * sizeof(bit_mask::Word));
+		process_layer_cpu::process_in_strips(true, true);
+
+		check(partial_output.pixels != output.pixels, "output of the changed images", 0);
+		check(partial_output.pixels == full_output.pixels, "output of the tiles of the changed images", 0);
+
+		process_layer_cpu::free_resources();
+		process_layer_cpu::destroy_context(context);
+	}
+
+	int run()
+	{
+		test_new_pixels();
+		test_images_refresh();
+
+		auto* const context = process_layer_cpu::create_context();
+		process_layer_cpu::select_context(context);
+		process_layer_cpu::set_default_settings();
+		process_layer_cpu::enable_cache_buffer(false);
+		process_layer_cpu::map_images::enable();
+		// The buffers of the enabled stages are allocated by the first frame
+		process_layer_cpu::glass_effect::enable(0.5, false, 1, 1);
+
+		auto settings = workload::get_preset(workload::Preset::images);
+		settings.scroll_probability = 0.2;
+		workload::Generator generator;
+		workload::init(generator, settings);
+
+		for (auto i = 0; i < frames_count; i++)
+			test_frame(workload::next_frame(generator), i);
+
+		process_layer_cpu::free_resources();
+		process_layer_cpu::destroy_context(context);
+		process_layer_cpu::free_shared_resources();
+
+		std::cout << (failures ? "FAILED" : "OK") << ": " << failures << " failures in " << frames_count
+			<< " frames\n";
+		return failures ? 1 : 0;
+	}
+}
+
+int main()
+{
+	return process_layer_cpu_test::run();
+}
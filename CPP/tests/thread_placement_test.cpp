@@ -0,0 +1,136 @@
+#include <iostream>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "thread_placement.h"
+
+// Checks the modes, the policies and the affinity that update_thread gives to the calling thread. The hybrid CPU is
+// made of the processors that this process may run on, with the first of them as the efficiency core, so the test
+// runs on any machine. The performance cores are checked only when the process may run on more than one processor
+namespace thread_placement_test
+{
+	using thread_placement::Mode;
+	using thread_placement::Policy;
+
+	int failures = 0;
+
+	void check(const bool condition, const char* name)
+	{
+		if (condition)
+			return;
+
+		failures++;
+		std::cout << name << " failed\n";
+	}
+
+	std::vector<int> get_affinity()
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		std::vector<int> cpus;
+		if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+			return cpus;
+
+		for (auto cpu = 0; cpu < CPU_SETSIZE; cpu++)
+			if (CPU_ISSET(cpu, &set))
+				cpus.push_back(cpu);
+		return cpus;
+	}
+
+	int get_nice()
+	{
+		return getpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)));
+	}
+
+	void test_modes()
+	{
+		for (auto i = 0; i < static_cast<int>(Mode::COUNT); i++)
+		{
+			auto mode = Mode::COUNT;
+			check(thread_placement::parse_mode(thread_placement::get_mode_name(static_cast<Mode>(i)), mode) &&
+			      mode == static_cast<Mode>(i), "parse_mode");
+		}
+
+		auto mode = Mode::OFF;
+		check(!thread_placement::parse_mode("fast", mode) && mode == Mode::OFF, "parse_mode of an unknown name");
+
+		// Only the AUTO mode follows the use of the target windows
+		thread_placement::init(Mode::AUTO);
+		thread_placement::set_in_use(true);
+		check(thread_placement::get_policy() == Policy::PERFORMANCE, "AUTO mode in use");
+		thread_placement::set_in_use(false);
+		check(thread_placement::get_policy() == Policy::EFFICIENCY, "AUTO mode not in use");
+
+		thread_placement::init(Mode::PERFORMANCE);
+		thread_placement::set_in_use(false);
+		check(thread_placement::get_policy() == Policy::PERFORMANCE, "PERFORMANCE mode");
+		thread_placement::init(Mode::OFF);
+		thread_placement::set_in_use(true);
+		check(thread_placement::get_policy() == Policy::DEFAULT, "OFF mode");
+	}
+
+	void test_placement(const std::vector<int>& allowed)
+	{
+		// One more processor than the system has when the process may run on one only, so the CPU is hybrid
+		std::vector<int> classes(allowed.back() + 2, 1);
+		classes[allowed[0]] = 0;
+
+		thread_placement::init(Mode::EFFICIENCY, classes);
+		check(thread_placement::is_hybrid(), "is_hybrid");
+		check(thread_placement::update_thread(), "update_thread by the efficiency policy");
+		check(get_affinity() == std::vector<int>{allowed[0]}, "affinity of the efficiency policy");
+		check(get_nice() == 10, "nice value of the efficiency policy");
+
+		// The policy was not changed, so the thread is not placed again
+		check(thread_placement::update_thread(), "update_thread by the same policy");
+
+		thread_placement::take_core_usage();
+		thread_placement::sample_core();
+		const auto usage = thread_placement::take_core_usage();
+		check(usage.efficiency_samples == 1 && usage.performance_samples == 0, "samples of the efficiency core");
+		check(usage.cores_mask == 1ULL << allowed[0], "cores mask of the efficiency core");
+
+		// Raising the priority back needs CAP_SYS_NICE, so only the affinity is checked from here
+		if (allowed.size() > 1)
+		{
+			thread_placement::init(Mode::PERFORMANCE, classes);
+			thread_placement::update_thread();
+			check(get_affinity() == std::vector<int>(allowed.begin() + 1, allowed.end()),
+			      "affinity of the performance policy");
+
+			thread_placement::sample_core();
+			const auto performance_usage = thread_placement::take_core_usage();
+			check(performance_usage.performance_samples == 1 && performance_usage.efficiency_samples == 0,
+			      "samples of a performance core");
+		}
+
+		thread_placement::init(Mode::OFF, classes);
+		thread_placement::update_thread();
+		check(get_affinity() == allowed, "affinity of the default policy");
+	}
+
+	int run()
+	{
+		const auto allowed = get_affinity();
+		if (allowed.empty())
+		{
+			std::cout << "FAILED: the affinity of the thread is unknown\n";
+			return 1;
+		}
+
+		test_modes();
+		test_placement(allowed);
+
+		std::cout << (failures ? "FAILED" : "OK") << ": " << failures << " failures on " << allowed.size()
+			<< " processors\n";
+		return failures ? 1 : 0;
+	}
+}
+
+int main()
+{
+	return thread_placement_test::run();
+}
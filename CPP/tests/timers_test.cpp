@@ -0,0 +1,103 @@
+#include <iostream>
+#include <thread>
+#include "timers.h"
+
+// Checks that each waiter is woken by its own deadlines and wakes only. The bounds of the times are loose, so a
+// loaded machine does not fail the test
+namespace timers_test
+{
+	constexpr int long_wait = 400;
+	constexpr int short_delay = 20;
+
+	int failures = 0;
+
+	void check(const bool condition, const char* name)
+	{
+		if (condition)
+			return;
+
+		failures++;
+		std::cout << name << " failed\n";
+	}
+
+	// Milliseconds that the wait of the calling thread took
+	timers::Time measure_wait(const int max_wait)
+	{
+		const auto start = timers::now();
+		timers::wait(max_wait);
+		return timers::now() - start;
+	}
+
+	void test_own_deadline()
+	{
+		timers::start(short_delay);
+		check(measure_wait(long_wait) < long_wait / 2, "wait for an own deadline");
+
+		// The deadline was reached, so the next wait is not ended by it
+		check(measure_wait(short_delay * 2) >= short_delay * 2 - 1, "wait after the deadline was reached");
+	}
+
+	void test_other_deadline()
+	{
+		timers::Waiter other_waiter;
+		timers::start(short_delay, &other_waiter);
+
+		std::thread other([&]()
+		{
+			timers::set_thread_waiter(&other_waiter);
+			timers::wait(long_wait);
+		});
+
+		check(measure_wait(short_delay * 4) >= short_delay * 4 - 1, "wait with a deadline of another waiter");
+		other.join();
+	}
+
+	void test_wake()
+	{
+		auto* const waiter = timers::get_thread_waiter();
+		std::thread other([waiter]()
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(short_delay));
+			timers::wake(waiter);
+		});
+
+		check(measure_wait(long_wait) < long_wait / 2, "wait that is woken");
+		other.join();
+
+		// A wake while the thread does not wait ends its next wait at once
+		timers::wake(waiter);
+		check(measure_wait(long_wait) < long_wait / 2, "wait after a wake");
+	}
+
+	void test_wait_time()
+	{
+		timers::start(long_wait);
+		const auto wait_time = timers::get_wait_time(long_wait * 2);
+		check(wait_time > 0 && wait_time <= long_wait, "wait time until a deadline");
+		check(timers::get_wait_time(short_delay) == short_delay, "wait time before a later deadline");
+
+		// A passed deadline gives 0 once
+		timers::schedule(timers::now() - 1);
+		check(timers::get_wait_time(long_wait * 2) == 0, "wait time of a passed deadline");
+		check(timers::get_wait_time(long_wait * 2) > 0, "wait time after a passed deadline");
+	}
+
+	int run()
+	{
+		timers::Waiter waiter;
+		timers::set_thread_waiter(&waiter);
+
+		test_own_deadline();
+		test_other_deadline();
+		test_wake();
+		test_wait_time();
+
+		std::cout << (failures ? "FAILED" : "OK") << ": " << failures << " failures\n";
+		return failures ? 1 : 0;
+	}
+}
+
+int main()
+{
+	return timers_test::run();
+}
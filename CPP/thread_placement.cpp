@@ -0,0 +1,401 @@
+#include "thread_placement.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <fstream>
+#endif
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace thread_placement
+{
+	struct Core
+	{
+		int index = 0; // The index of the logical processor in all the groups
+		unsigned long id = 0; // The id of the CPU set on Windows
+		int efficiency_class = 0; // Higher is faster
+	};
+
+	const char* mode_names[] = {"auto", "performance", "efficiency", "off"};
+	const char* policy_names[] = {"default", "performance", "efficiency"};
+
+	std::vector<Core> cores;
+	int performance_class = 0;
+	bool hybrid = false;
+	Mode placement_mode = Mode::AUTO;
+
+	std::atomic<int> policy(static_cast<int>(Policy::DEFAULT));
+
+	std::atomic<uint64_t> performance_samples(0);
+	std::atomic<uint64_t> efficiency_samples(0);
+	std::atomic<uint64_t> cores_mask(0);
+
+	// The policy that the calling thread applied, set to COUNT until its first update
+	thread_local auto thread_policy = Policy::COUNT;
+#ifdef _WIN32
+	thread_local auto thread_background = false;
+#endif
+
+#ifdef _WIN32
+	bool find_cores()
+	{
+		ULONG length = 0;
+		GetSystemCpuSetInformation(nullptr, 0, &length, GetCurrentProcess(), 0);
+		if (!length)
+			return false;
+
+		std::vector<char> buffer(length);
+		auto* const information = reinterpret_cast<SYSTEM_CPU_SET_INFORMATION*>(buffer.data());
+		if (!GetSystemCpuSetInformation(information, length, &length, GetCurrentProcess(), 0))
+			return false;
+
+		for (ULONG offset = 0; offset < length;)
+		{
+			const auto* const entry = reinterpret_cast<SYSTEM_CPU_SET_INFORMATION*>(buffer.data() + offset);
+			if (entry->Type == CpuSetInformation)
+			{
+				Core core;
+				core.index = entry->CpuSet.Group * 64 + entry->CpuSet.LogicalProcessorIndex;
+				core.id = entry->CpuSet.Id;
+				core.efficiency_class = entry->CpuSet.EfficiencyClass;
+				cores.push_back(core);
+			}
+
+			offset += entry->Size;
+		}
+
+		return !cores.empty();
+	}
+
+	int get_current_core()
+	{
+		PROCESSOR_NUMBER number;
+		GetCurrentProcessorNumberEx(&number);
+		return number.Group * 64 + number.Number;
+	}
+#else
+	// A list of cpus of sysfs, like "0-7,16"
+	std::vector<int> parse_cpu_list(const std::string& list)
+	{
+		std::vector<int> cpus;
+		size_t position = 0;
+		while (position < list.size())
+		{
+			auto end = list.find(',', position);
+			if (end == std::string::npos)
+				end = list.size();
+
+			const auto range = list.substr(position, end - position);
+			const auto dash = range.find('-');
+			const auto first = atoi(range.c_str());
+			const auto last = dash == std::string::npos ? first : atoi(range.c_str() + dash + 1);
+			for (auto cpu = first; cpu <= last; cpu++)
+				cpus.push_back(cpu);
+
+			position = end + 1;
+		}
+
+		return cpus;
+	}
+
+	std::string read_line(const std::string& path)
+	{
+		std::ifstream file(path);
+		std::string line;
+		std::getline(file, line);
+		return line;
+	}
+
+	bool find_cores()
+	{
+		const auto count = static_cast<int>(sysconf(_SC_NPROCESSORS_CONF));
+		if (count <= 0)
+			return false;
+
+		for (auto i = 0; i < count; i++)
+		{
+			Core core;
+			core.index = i;
+			core.id = i;
+			core.efficiency_class = 1;
+
+			// The capacity of the cores on ARM, up to 1024 on the fastest cores
+			const auto capacity = read_line("/sys/devices/system/cpu/cpu" + std::to_string(i) + "/cpu_capacity");
+			if (!capacity.empty())
+				core.efficiency_class = atoi(capacity.c_str());
+
+			cores.push_back(core);
+		}
+
+		// The efficiency cores of Intel hybrid CPUs
+		for (const auto cpu : parse_cpu_list(read_line("/sys/devices/cpu_atom/cpus")))
+			if (cpu >= 0 && cpu < count)
+				cores[cpu].efficiency_class = 0;
+
+		return true;
+	}
+
+	int get_current_core()
+	{
+		return sched_getcpu();
+	}
+#endif
+
+	void set_mode(const Mode mode)
+	{
+		placement_mode = mode;
+		if (mode == Mode::PERFORMANCE)
+			policy = static_cast<int>(Policy::PERFORMANCE);
+		else if (mode == Mode::EFFICIENCY)
+			policy = static_cast<int>(Policy::EFFICIENCY);
+		else
+			policy = static_cast<int>(Policy::DEFAULT);
+	}
+
+	void classify_cores()
+	{
+		auto efficiency_class = cores[0].efficiency_class;
+		performance_class = cores[0].efficiency_class;
+		for (const auto& core : cores)
+		{
+			if (core.efficiency_class > performance_class)
+				performance_class = core.efficiency_class;
+			if (core.efficiency_class < efficiency_class)
+				efficiency_class = core.efficiency_class;
+		}
+
+		hybrid = performance_class != efficiency_class;
+
+		auto performance_count = 0;
+		for (const auto& core : cores)
+			if (core.efficiency_class == performance_class)
+				performance_count++;
+
+		std::cout << "Found " << performance_count << " performance cores and "
+			<< cores.size() - performance_count << " efficiency cores\n";
+	}
+
+	bool init(const Mode mode)
+	{
+		set_mode(mode);
+		cores.clear();
+		hybrid = false;
+		if (!find_cores())
+		{
+			std::cout << "Failed to find the cores of the CPU, the threads are placed by their priority only\n";
+			return false;
+		}
+
+		classify_cores();
+		return true;
+	}
+
+	bool init(const Mode mode, const std::vector<int>& efficiency_classes)
+	{
+		set_mode(mode);
+		cores.clear();
+		hybrid = false;
+		if (efficiency_classes.empty())
+			return false;
+
+		for (size_t i = 0; i < efficiency_classes.size(); i++)
+		{
+			Core core;
+			core.index = static_cast<int>(i);
+			core.id = static_cast<unsigned long>(i);
+			core.efficiency_class = efficiency_classes[i];
+			cores.push_back(core);
+		}
+
+		classify_cores();
+		return true;
+	}
+
+	bool is_hybrid()
+	{
+		return hybrid;
+	}
+
+	const char* get_mode_name(const Mode mode)
+	{
+		return mode_names[static_cast<int>(mode)];
+	}
+
+	bool parse_mode(const char* name, Mode& mode)
+	{
+		for (auto i = 0; i < static_cast<int>(Mode::COUNT); i++)
+		{
+			if (strcmp(name, mode_names[i]) == 0)
+			{
+				mode = static_cast<Mode>(i);
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	const char* get_policy_name(const Policy policy)
+	{
+		return policy_names[static_cast<int>(policy)];
+	}
+
+	void set_in_use(const bool in_use)
+	{
+		if (placement_mode == Mode::AUTO)
+			policy = static_cast<int>(in_use ? Policy::PERFORMANCE : Policy::EFFICIENCY);
+	}
+
+	Policy get_policy()
+	{
+		return static_cast<Policy>(policy.load());
+	}
+
+	// The cores that the threads of the policy may run on. Empty means all the cores
+	std::vector<const Core*> get_policy_cores(const Policy policy)
+	{
+		std::vector<const Core*> policy_cores;
+		if (!hybrid || policy == Policy::DEFAULT)
+			return policy_cores;
+
+		for (const auto& core : cores)
+			if ((core.efficiency_class == performance_class) == (policy == Policy::PERFORMANCE))
+				policy_cores.push_back(&core);
+
+		return policy_cores;
+	}
+
+#ifdef _WIN32
+	bool apply(const Policy policy)
+	{
+		const auto thread = GetCurrentThread();
+		auto success = true;
+
+		std::vector<ULONG> ids;
+		for (const auto* const core : get_policy_cores(policy))
+			ids.push_back(core->id);
+
+		// No CPU sets clears the selection of the thread
+		if (!SetThreadSelectedCpuSets(thread, ids.data(), static_cast<ULONG>(ids.size())))
+			success = false;
+
+		// The background mode lowers the CPU, I/O and memory priority of the thread
+		if (thread_background && policy != Policy::EFFICIENCY)
+		{
+			SetThreadPriority(thread, THREAD_MODE_BACKGROUND_END);
+			thread_background = false;
+		}
+
+		if (policy == Policy::EFFICIENCY)
+		{
+			if (!thread_background)
+				thread_background = SetThreadPriority(thread, THREAD_MODE_BACKGROUND_BEGIN) != FALSE;
+			success = success && thread_background;
+		}
+		else if (!SetThreadPriority(thread, policy == Policy::PERFORMANCE
+			                                    ? THREAD_PRIORITY_ABOVE_NORMAL
+			                                    : THREAD_PRIORITY_NORMAL))
+		{
+			success = false;
+		}
+
+		// EcoQoS keeps the thread on the efficiency cores at a low clock even without CPU sets. The default
+		// policy leaves the decision to the system
+		THREAD_POWER_THROTTLING_STATE throttling = {};
+		throttling.Version = THREAD_POWER_THROTTLING_CURRENT_VERSION;
+		throttling.ControlMask = policy == Policy::DEFAULT ? 0 : THREAD_POWER_THROTTLING_EXECUTION_SPEED;
+		throttling.StateMask = policy == Policy::EFFICIENCY ? THREAD_POWER_THROTTLING_EXECUTION_SPEED : 0;
+		SetThreadInformation(thread, ThreadPowerThrottling, &throttling, sizeof(throttling));
+
+		return success;
+	}
+#else
+	bool apply(const Policy policy)
+	{
+		auto success = true;
+
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		const auto policy_cores = get_policy_cores(policy);
+		for (const auto* const core : policy_cores)
+			CPU_SET(core->index, &set);
+		if (policy_cores.empty())
+			for (const auto& core : cores)
+				CPU_SET(core.index, &set);
+
+		// Without the cores (init was not called or failed) the affinity is left to the system
+		if (CPU_COUNT(&set) > 0 && pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+			success = false;
+
+		// The nice value of a thread on Linux. A negative one needs CAP_SYS_NICE, so without it the performance
+		// policy fails to raise the priority and keeps only its cores
+		const auto nice = policy == Policy::PERFORMANCE ? -5 : policy == Policy::EFFICIENCY ? 10 : 0;
+		if (setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), nice) != 0)
+			success = false;
+
+		return success;
+	}
+#endif
+
+	bool update_thread()
+	{
+		const auto new_policy = get_policy();
+		if (new_policy == thread_policy)
+			return true;
+
+		// A failed placement is not tried again until the policy is changed
+		thread_policy = new_policy;
+		if (!apply(new_policy))
+		{
+			std::cout << "Failed to place the thread by the " << get_policy_name(new_policy) << " policy\n";
+			return false;
+		}
+
+		return true;
+	}
+
+	void sample_core()
+	{
+		const auto index = get_current_core();
+		if (index < 0)
+			return;
+
+		if (index < 64)
+			cores_mask.fetch_or(1ULL << index);
+
+		auto is_efficiency_core = false;
+		for (const auto& core : cores)
+		{
+			if (core.index == index)
+			{
+				is_efficiency_core = core.efficiency_class != performance_class;
+				break;
+			}
+		}
+
+		if (is_efficiency_core)
+			++efficiency_samples;
+		else
+			++performance_samples;
+	}
+
+	CoreUsage take_core_usage()
+	{
+		CoreUsage usage;
+		usage.performance_samples = performance_samples.exchange(0);
+		usage.efficiency_samples = efficiency_samples.exchange(0);
+		usage.cores_mask = cores_mask.exchange(0);
+		return usage;
+	}
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+// Placement of the work threads on hybrid CPUs, that have performance and efficiency cores. The renderer sets the
+// policy by the use of the target window, and each work thread applies it to itself in its loop, so a pool of
+// threads follows the same policy. It uses the CPU sets of Windows, and the affinity of pthreads on Linux (for
+// testing). On a CPU that all its cores are of the same class, only the priority of the threads is changed
+namespace thread_placement
+{
+	enum class Policy
+	{
+		DEFAULT, // The affinity and the priority that the system gives
+		PERFORMANCE, // Performance cores and raised priority
+		EFFICIENCY, // Efficiency cores and background priority
+		COUNT
+	};
+
+	enum class Mode
+	{
+		AUTO, // PERFORMANCE while the target window is in use, EFFICIENCY otherwise
+		PERFORMANCE,
+		EFFICIENCY,
+		OFF, // Always DEFAULT
+		COUNT
+	};
+
+	// The cores that the work threads ran on, from the samples of sample_core
+	struct CoreUsage
+	{
+		uint64_t performance_samples = 0;
+		uint64_t efficiency_samples = 0;
+		uint64_t cores_mask = 0; // The logical processors (the first 64) that the threads ran on
+	};
+
+	// Find the classes of the cores. Without them the threads are placed by the priority only
+	bool init(Mode mode);
+	// With the given classes of the logical processors instead of the ones of the system, for the tests on Linux
+	bool init(Mode mode, const std::vector<int>& efficiency_classes);
+	bool is_hybrid();
+
+	const char* get_mode_name(Mode mode);
+	bool parse_mode(const char* name, Mode& mode);
+	const char* get_policy_name(Policy policy);
+
+	// Called when the use of the target windows changed, it sets the policy when the mode is AUTO
+	void set_in_use(bool in_use);
+	Policy get_policy();
+
+	// Apply the policy to the calling thread if it was changed since the last call of this thread
+	bool update_thread();
+
+	// Record the core that the calling thread runs on now
+	void sample_core();
+
+	// The samples since the last call
+	CoreUsage take_core_usage();
+}
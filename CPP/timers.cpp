@@ -0,0 +1,137 @@
+#include "timers.h"
+
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+namespace timers
+{
+	std::mutex mutex;
+
+	thread_local Waiter* thread_waiter = nullptr;
+
+	void set_thread_waiter(Waiter* waiter)
+	{
+		thread_waiter = waiter;
+	}
+
+	Waiter* get_thread_waiter()
+	{
+		return thread_waiter;
+	}
+
+	Time now()
+	{
+		return std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	Time start(const int delay)
+	{
+		return start(delay, thread_waiter);
+	}
+
+	Time start(const int delay, Waiter* waiter)
+	{
+		const auto deadline = now() + delay;
+		schedule(deadline, waiter);
+		return deadline;
+	}
+
+	bool is_due(const Time deadline)
+	{
+		return now() >= deadline;
+	}
+
+	void schedule(const Time deadline)
+	{
+		schedule(deadline, thread_waiter);
+	}
+
+	void schedule(const Time deadline, Waiter* waiter)
+	{
+		if (!waiter)
+			return;
+
+		std::lock_guard<std::mutex> lock(mutex);
+
+		// The waiter is woken only when the new deadline ends its wait earlier
+		if (waiter->deadlines.insert(deadline).second && waiter->wait_until && deadline < waiter->wait_until)
+			waiter->changed.notify_one();
+	}
+
+	// The first deadline of the waiter, or 0 if it has none. The deadlines up to the given time are removed when
+	// one of them passed. Call only while holding mutex
+	Time take_next_deadline(Waiter& waiter, const Time time)
+	{
+		if (waiter.deadlines.empty())
+			return 0;
+
+		const auto deadline = *waiter.deadlines.begin();
+		if (deadline <= time)
+			waiter.deadlines.erase(waiter.deadlines.begin(), waiter.deadlines.upper_bound(time));
+		return deadline;
+	}
+
+	int get_wait_time(const int max_wait)
+	{
+		if (!thread_waiter)
+			return max_wait;
+
+		std::lock_guard<std::mutex> lock(mutex);
+
+		const auto time = now();
+		const auto deadline = take_next_deadline(*thread_waiter, time);
+		if (deadline && deadline <= time)
+			return 0;
+
+		if (deadline && deadline - time < max_wait)
+			return static_cast<int>(deadline - time);
+		return max_wait;
+	}
+
+	void wait(const int max_wait)
+	{
+		if (!thread_waiter)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(max_wait));
+			return;
+		}
+
+		auto& waiter = *thread_waiter;
+		std::unique_lock<std::mutex> lock(mutex);
+
+		const auto end_time = now() + max_wait;
+
+		while (waiter.wakes_count == waiter.seen_wakes_count)
+		{
+			const auto time = now();
+			const auto deadline = take_next_deadline(waiter, time);
+			if (deadline && deadline <= time)
+				break;
+
+			waiter.wait_until = end_time;
+			if (deadline && deadline < waiter.wait_until)
+				waiter.wait_until = deadline;
+			if (time >= waiter.wait_until)
+				break;
+
+			waiter.changed.wait_until(lock, std::chrono::steady_clock::time_point(
+				                          std::chrono::milliseconds(waiter.wait_until)));
+		}
+
+		waiter.wait_until = 0;
+		waiter.seen_wakes_count = waiter.wakes_count;
+	}
+
+	void wake(Waiter* waiter)
+	{
+		if (!waiter)
+			return;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		waiter->wakes_count++;
+		if (waiter->wait_until)
+			waiter->changed.notify_one();
+	}
+}
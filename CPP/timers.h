@@ -0,0 +1,53 @@
+#pragma once
+#include <condition_variable>
+#include <set>
+
+// Monotonic timers of the renderer, on std::chrono::steady_clock (clock() is the CPU time of the process on POSIX).
+// A timer holds the time when it is due, and 0 when it is not armed (a timer of 0 is also due, like a clock()
+// timer that was never started). Each thread that waits for its timers (the process frame thread and the main loop)
+// has a waiter with its own deadlines, so a timer that is started wakes only the thread that checks it
+namespace timers
+{
+	typedef long long Time; // Milliseconds of std::chrono::steady_clock
+
+	// The deadlines and the wakes of one waiting thread. Its fields are guarded by the mutex of the timers
+	struct Waiter
+	{
+		std::condition_variable changed;
+		std::set<Time> deadlines; // The same deadline that is scheduled on every loop is kept once
+		Time wait_until = 0; // The end of the current wait, 0 when the thread does not wait
+		unsigned long long wakes_count = 0;
+		unsigned long long seen_wakes_count = 0; // A wake while the thread works ends its next wait at once
+	};
+
+	// The waiter of the calling thread, that start, schedule, get_wait_time and wait use. A thread without one
+	// does not schedule the timers that it starts
+	void set_thread_waiter(Waiter* waiter);
+	Waiter* get_thread_waiter();
+
+	Time now();
+
+	// The time in delay milliseconds from now, scheduled on the waiter of the calling thread
+	Time start(int delay);
+
+	// The time in delay milliseconds from now, scheduled on the given waiter (that may be nullptr)
+	Time start(int delay, Waiter* waiter);
+
+	bool is_due(Time deadline);
+
+	// Wake up the calling thread at the given time
+	void schedule(Time deadline);
+	void schedule(Time deadline, Waiter* waiter);
+
+	// Milliseconds until the next deadline of the calling thread, at most max_wait. 0 when a deadline passed, and
+	// then the deadlines up to now are removed
+	int get_wait_time(int max_wait);
+
+	// Block the calling thread until one of its deadlines is due, it is woken or max_wait milliseconds passed.
+	// Returns at once if it was woken since its last wait returned
+	void wait(int max_wait);
+
+	// End the wait of the thread of the waiter (that may be nullptr). A thread that does not wait now returns at
+	// once from its next wait
+	void wake(Waiter* waiter);
+}
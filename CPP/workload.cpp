@@ -0,0 +1,548 @@
+#include "workload.h"
+
+#include <cstring>
+
+namespace workload
+{
+	// The layout of the window in pixels
+	constexpr int cell_width = 8;
+	constexpr int line_height = 18;
+	constexpr int glyph_width = 6, glyph_height = 10;
+	constexpr int glyph_x = 1, glyph_y = 4; // The glyph in its cell
+	constexpr int max_panel_width = 260;
+	constexpr int gutter_width = 6 * cell_width;
+	constexpr int status_bar_height = 22;
+
+	// The rows of the textures are aligned like the staging textures of the renderer
+	constexpr int stride_alignment = 256;
+
+	const char* const preset_names[] = {
+		"dark", "light", "dense", "images", "gradient", "scrolling", "typing", "resizing", "mixed"
+	};
+
+	struct Color
+	{
+		uint8_t b, g, r;
+	};
+
+	struct Theme
+	{
+		Color background, panel, status_bar, selection;
+		Color line_number, identifier, keyword, string, symbol, caret;
+	};
+
+	const Theme dark_theme = {
+		{30, 30, 30}, {45, 43, 40}, {60, 60, 60}, {80, 60, 40},
+		{110, 110, 110}, {200, 200, 200}, {50, 120, 204}, {106, 135, 106}, {180, 180, 150}, {230, 230, 230}
+	};
+
+	const Theme light_theme = {
+		{255, 255, 255}, {242, 242, 242}, {230, 230, 230}, {255, 220, 190},
+		{160, 160, 160}, {20, 20, 20}, {128, 0, 0}, {0, 128, 0}, {100, 60, 60}, {0, 0, 0}
+	};
+
+	Settings get_preset(const Preset preset)
+	{
+		Settings settings;
+
+		switch (preset)
+		{
+		case Preset::light:
+			settings.light_theme = true;
+			break;
+		case Preset::dense:
+			settings.code_density = 0.95;
+			break;
+		case Preset::images:
+			settings.images_count = 6;
+			settings.scroll_probability = 0.02;
+			break;
+		case Preset::gradient:
+			settings.gradient_background = true;
+			break;
+		case Preset::scrolling:
+			settings.scroll_probability = 0.2;
+			break;
+		case Preset::typing:
+			settings.typing_probability = 0.1;
+			break;
+		case Preset::resizing:
+			settings.resize_probability = 0.25;
+			break;
+		case Preset::mixed:
+			settings.images_count = 3;
+			settings.typing_probability = 0.03;
+			settings.scroll_probability = 0.03;
+			settings.resize_probability = 0.01;
+			break;
+		default:
+			break;
+		}
+
+		return settings;
+	}
+
+	const char* get_preset_name(const Preset preset)
+	{
+		return preset < Preset::count ? preset_names[static_cast<int>(preset)] : "unknown";
+	}
+
+	bool parse_preset(const char* name, Preset& preset)
+	{
+		for (auto i = 0; i < static_cast<int>(Preset::count); i++)
+			if (strcmp(name, preset_names[i]) == 0)
+			{
+				preset = static_cast<Preset>(i);
+				return true;
+			}
+
+		return false;
+	}
+
+	// splitmix64, so the frames don't depend on the standard library of the platform
+	uint64_t hash(uint64_t value)
+	{
+		value += 0x9E3779B97F4A7C15ull;
+		value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+		value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+		return value ^ (value >> 31);
+	}
+
+	uint64_t next_random(Generator& generator)
+	{
+		generator.random_state += 0x9E3779B97F4A7C15ull;
+		return hash(generator.random_state);
+	}
+
+	// A number in [from, to]
+	int random_range(Generator& generator, const int from, const int to)
+	{
+		return from + static_cast<int>(next_random(generator) % static_cast<uint64_t>(to - from + 1));
+	}
+
+	bool random_chance(Generator& generator, const double probability)
+	{
+		return probability > 0 && (next_random(generator) >> 11) * (1.0 / 9007199254740992.0) < probability;
+	}
+
+	int get_panel_width(const int width)
+	{
+		const auto panel_width = width / 6;
+		return panel_width < max_panel_width ? panel_width : max_panel_width;
+	}
+
+	int get_text_columns(const Generator& generator)
+	{
+		const auto width = generator.frame.width - get_panel_width(generator.frame.width) - gutter_width;
+		return width > 0 ? width / cell_width : 0;
+	}
+
+	// The text of a line of the document. The class of the characters gives their color: lower case letters are
+	// identifiers, upper case are keywords, digits are strings and the rest are symbols
+	std::string generate_line(const Generator& generator, const int line, const uint64_t salt, const int columns)
+	{
+		std::string text;
+		auto state = hash(generator.settings.seed ^ salt ^ static_cast<uint64_t>(line) * 0x100000001B3ull);
+
+		if (state % 7 == 0)
+			return text; // Empty line
+
+		const auto indent = static_cast<int>((state >> 3) % 6) * 4;
+		const auto length_scale = 0.3 + static_cast<double>((state >> 8) % 1000) / 714.0; // 0.3 to 1.7
+		auto length = static_cast<int>(columns * generator.settings.code_density * length_scale);
+		if (length > columns) length = columns;
+
+		text.append(indent, ' ');
+		while (static_cast<int>(text.size()) < length)
+		{
+			state = hash(state);
+			const auto kind = state % 8;
+			const auto token_length = 2 + static_cast<int>((state >> 3) % 9);
+
+			for (auto i = 0; i < token_length && static_cast<int>(text.size()) < length; i++)
+			{
+				const auto value = static_cast<int>((state >> (8 + i * 5)) % 26);
+				if (kind == 0)
+					text.push_back(static_cast<char>('A' + value));
+				else if (kind == 1)
+					text.push_back(static_cast<char>('0' + value % 10));
+				else if (kind == 2)
+					text.push_back("(){};=+-*<>.,"[value % 13]);
+				else
+					text.push_back(static_cast<char>('a' + value));
+			}
+
+			text.push_back(' ');
+		}
+
+		return text;
+	}
+
+	const std::string& get_line(Generator& generator, const int line)
+	{
+		const auto edited = generator.edited_lines.find(line);
+		if (edited != generator.edited_lines.end())
+			return edited->second;
+
+		if (generator.cached_line_index != line)
+		{
+			generator.cached_line = generate_line(generator, line, 0, get_text_columns(generator));
+			generator.cached_line_index = line;
+		}
+
+		return generator.cached_line;
+	}
+
+	// The pixels of a row of a glyph, bit x is the pixel x. About a third of the pixels are set
+	uint8_t get_glyph_row(const char character, const int row)
+	{
+		if (character == ' ')
+			return 0;
+
+		const auto shape = hash(static_cast<uint8_t>(character));
+		const auto mask = hash(shape) | hash(shape + 1);
+		return static_cast<uint8_t>(((shape & mask) >> (row * glyph_width)) & ((1 << glyph_width) - 1));
+	}
+
+	const Color& get_text_color(const Theme& theme, const char character)
+	{
+		if (character >= 'a' && character <= 'z') return theme.identifier;
+		if (character >= 'A' && character <= 'Z') return theme.keyword;
+		if (character >= '0' && character <= '9') return theme.string;
+		return theme.symbol;
+	}
+
+	void set_pixel(uint8_t* row, const int x, const Color& color)
+	{
+		auto* const pixel = row + x * 4;
+		pixel[0] = color.b;
+		pixel[1] = color.g;
+		pixel[2] = color.r;
+		pixel[3] = 255;
+	}
+
+	// The pixel after the right edge of a glyph is half of the text color, like anti aliased text
+	void blend_pixel(uint8_t* row, const int x, const Color& color)
+	{
+		auto* const pixel = row + x * 4;
+		pixel[0] = static_cast<uint8_t>((pixel[0] + color.b) / 2);
+		pixel[1] = static_cast<uint8_t>((pixel[1] + color.g) / 2);
+		pixel[2] = static_cast<uint8_t>((pixel[2] + color.r) / 2);
+	}
+
+	void fill_row(uint8_t* row, const int x_from, const int x_to, const Color& color)
+	{
+		for (auto x = x_from; x < x_to; x++)
+			set_pixel(row, x, color);
+	}
+
+	// Draw the glyphs row of the text that starts at x, without passing x_end
+	void draw_text_row(uint8_t* row, int x, const int x_end, const std::string& text, const int glyph_row,
+	                   const Theme& theme, const Color* color = nullptr)
+	{
+		for (const auto character : text)
+		{
+			if (x + cell_width > x_end)
+				return;
+
+			const auto bits = get_glyph_row(character, glyph_row);
+			if (bits)
+			{
+				const auto& text_color = color ? *color : get_text_color(theme, character);
+				for (auto i = 0; i < glyph_width; i++)
+				{
+					if ((bits >> i) & 1)
+						set_pixel(row, x + glyph_x + i, text_color);
+					else if (i > 0 && (bits >> (i - 1)) & 1)
+						blend_pixel(row, x + glyph_x + i, text_color);
+				}
+			}
+
+			x += cell_width;
+		}
+	}
+
+	// Smooth gradients with noise, so the image has many colors like a photo or a screenshot
+	void draw_image_row(uint8_t* row, const int x_from, const int x_to, const Image& image, const int image_y)
+	{
+		for (auto x = x_from; x < x_to; x++)
+		{
+			const auto ix = x - x_from;
+			const auto noise = hash(image.seed ^ static_cast<uint64_t>(image_y) << 20 ^ static_cast<uint64_t>(ix));
+			const auto* const n = reinterpret_cast<const uint8_t*>(&noise);
+			const Color color = {
+				static_cast<uint8_t>(ix * 255 / image.width / 2 + (n[0] & 63) + 32),
+				static_cast<uint8_t>(image_y * 255 / image.height / 2 + (n[1] & 63) + 32),
+				static_cast<uint8_t>((ix + image_y) * 127 / (image.width + image.height) + (n[2] & 127))
+			};
+			set_pixel(row, x, color);
+		}
+	}
+
+	Color get_background(const Generator& generator, const Theme& theme, const int y)
+	{
+		if (!generator.settings.gradient_background)
+			return theme.background;
+
+		// Up to 48 levels from the top to the bottom, away from the text color
+		const auto level = y * 48 / (generator.frame.height > 1 ? generator.frame.height : 1);
+		const auto sign = generator.settings.light_theme ? -1 : 1;
+		return {
+			static_cast<uint8_t>(theme.background.b + sign * level),
+			static_cast<uint8_t>(theme.background.g + sign * level / 2),
+			static_cast<uint8_t>(theme.background.r + sign * level / 3)
+		};
+	}
+
+	std::string to_digits(const int value)
+	{
+		std::string digits;
+		auto rest = value;
+		do
+		{
+			digits.insert(digits.begin(), static_cast<char>('0' + rest % 10));
+			rest /= 10;
+		}
+		while (rest);
+		return digits;
+	}
+
+	void render_editor_row(Generator& generator, const Theme& theme, uint8_t* row, const int y, const int x_from,
+	                       const int x_to)
+	{
+		const auto document_y = generator.scroll_y + y;
+		const auto line = document_y / line_height;
+		const auto line_y = document_y % line_height;
+
+		fill_row(row, x_from, x_to, get_background(generator, theme, y));
+
+		const auto text_x = x_from + gutter_width;
+		const auto glyph_row = line_y - glyph_y;
+		if (glyph_row >= 0 && glyph_row < glyph_height)
+		{
+			const auto line_number = to_digits(line + 1);
+			const auto number_x = text_x - cell_width * (static_cast<int>(line_number.size()) + 1);
+			if (number_x >= x_from)
+				draw_text_row(row, number_x, text_x, line_number, glyph_row, theme, &theme.line_number);
+
+			draw_text_row(row, text_x, x_to, get_line(generator, line), glyph_row, theme);
+		}
+
+		// The caret is shown while typing, and blinks otherwise
+		const auto& settings = generator.settings;
+		const auto caret_visible = generator.typing_frames_left > 0 ||
+			(settings.caret_blink_frames > 0 && generator.frame_index / settings.caret_blink_frames % 2 == 0);
+		if (caret_visible && line == generator.caret_line && line_y >= 2 && line_y < line_height - 2)
+		{
+			const auto caret_x = text_x + generator.caret_column * cell_width;
+			if (caret_x + 2 <= x_to)
+				fill_row(row, caret_x, caret_x + 2, theme.caret);
+		}
+
+		for (const auto& image : generator.images)
+		{
+			const auto image_y = document_y - image.y;
+			if (image_y < 0 || image_y >= image.height)
+				continue;
+
+			const auto image_from = text_x + image.x;
+			auto image_to = image_from + image.width;
+			if (image_to > x_to) image_to = x_to;
+			if (image_from < image_to)
+				draw_image_row(row, image_from, image_to, image, image_y);
+		}
+	}
+
+	void render_panel_row(Generator& generator, const Theme& theme, uint8_t* row, const int y, const int x_to)
+	{
+		const auto item = y / line_height;
+		const auto item_y = y % line_height;
+		const auto selected = item == 3;
+
+		fill_row(row, 0, x_to, selected ? theme.selection : theme.panel);
+
+		const auto glyph_row = item_y - glyph_y;
+		if (glyph_row < 0 || glyph_row >= glyph_height)
+			return;
+
+		// The files and the folders of the project, a level of the tree is indented by 2 cells
+		const auto state = hash(generator.settings.seed ^ 0x5A17E1ull ^ static_cast<uint64_t>(item));
+		std::string name(static_cast<size_t>(state % 4) * 2, ' ');
+		const auto length = 4 + static_cast<int>((state >> 2) % 11);
+		for (auto i = 0; i < length; i++)
+			name.push_back(static_cast<char>('a' + (state >> (8 + i * 4)) % 16));
+		draw_text_row(row, cell_width, x_to, name, glyph_row, theme, &theme.identifier);
+	}
+
+	void render_status_row(const Generator& generator, const Theme& theme, uint8_t* row, const int y)
+	{
+		fill_row(row, 0, generator.frame.width, theme.status_bar);
+
+		const auto glyph_row = y - glyph_y;
+		if (glyph_row < 0 || glyph_row >= glyph_height)
+			return;
+
+		const auto position = to_digits(generator.caret_line + 1) + ":" + to_digits(generator.caret_column + 1);
+		const auto x = generator.frame.width - cell_width * (static_cast<int>(position.size()) + 2);
+		if (x >= 0)
+			draw_text_row(row, x, generator.frame.width, position, glyph_row, theme, &theme.line_number);
+	}
+
+	void render(Generator& generator)
+	{
+		const auto& theme = generator.settings.light_theme ? light_theme : dark_theme;
+		const auto& frame = generator.frame;
+		const auto panel_width = get_panel_width(frame.width);
+		const auto editor_height = frame.height - status_bar_height;
+
+		for (auto y = 0; y < frame.height; y++)
+		{
+			auto* const row = frame.pixels + static_cast<size_t>(y) * frame.stride;
+			if (y >= editor_height)
+			{
+				render_status_row(generator, theme, row, y - editor_height);
+				continue;
+			}
+
+			render_panel_row(generator, theme, row, y, panel_width);
+			render_editor_row(generator, theme, row, y, panel_width, frame.width);
+		}
+	}
+
+	int get_visible_lines(const Generator& generator)
+	{
+		const auto lines = (generator.frame.height - status_bar_height) / line_height;
+		return lines > 1 ? lines : 1;
+	}
+
+	void start_typing(Generator& generator)
+	{
+		generator.typing_frames_left = random_range(generator, 5, 30);
+		generator.caret_line = generator.scroll_y / line_height +
+			random_range(generator, 0, get_visible_lines(generator) - 1);
+		generator.caret_column = static_cast<int>(get_line(generator, generator.caret_line).size());
+	}
+
+	void type_character(Generator& generator)
+	{
+		auto edited = generator.edited_lines.find(generator.caret_line);
+		if (edited == generator.edited_lines.end())
+			edited = generator.edited_lines.emplace(generator.caret_line,
+			                                         get_line(generator, generator.caret_line)).first;
+
+		auto& text = edited->second;
+		if (generator.caret_column > static_cast<int>(text.size()))
+			generator.caret_column = static_cast<int>(text.size());
+
+		// Mostly letters, with spaces between the words
+		const auto character = random_range(generator, 0, 5) == 0
+			                       ? ' '
+			                       : static_cast<char>('a' + random_range(generator, 0, 25));
+		text.insert(text.begin() + generator.caret_column, character);
+		generator.caret_column++;
+	}
+
+	void start_scrolling(Generator& generator)
+	{
+		generator.scroll_frames_left = random_range(generator, 5, 40);
+
+		// Not always whole lines, like the smooth scrolling of the IDE
+		generator.scroll_step = random_range(generator, line_height / 2, line_height * 3);
+		if (random_range(generator, 0, 2) == 0)
+			generator.scroll_step = -generator.scroll_step;
+	}
+
+	void random_resize(Generator& generator)
+	{
+		const auto& settings = generator.settings;
+		if (random_range(generator, 0, 15) == 0)
+		{
+			resize(generator, random_range(generator, settings.min_width, settings.max_width),
+			       random_range(generator, settings.min_height, settings.max_height));
+			return;
+		}
+
+		resize(generator, generator.frame.width + random_range(generator, -40, 40),
+		       generator.frame.height + random_range(generator, -20, 20));
+	}
+
+	void simulate_events(Generator& generator)
+	{
+		const auto& settings = generator.settings;
+
+		if (random_chance(generator, settings.resize_probability))
+			random_resize(generator);
+
+		if (generator.scroll_frames_left == 0 && random_chance(generator, settings.scroll_probability))
+			start_scrolling(generator);
+
+		if (generator.scroll_frames_left > 0)
+		{
+			generator.scroll_frames_left--;
+			generator.scroll_y += generator.scroll_step;
+			if (generator.scroll_y < 0)
+			{
+				generator.scroll_y = 0;
+				generator.scroll_frames_left = 0;
+			}
+		}
+
+		if (generator.typing_frames_left == 0 && random_chance(generator, settings.typing_probability))
+			start_typing(generator);
+
+		if (generator.typing_frames_left > 0)
+		{
+			generator.typing_frames_left--;
+			type_character(generator);
+		}
+	}
+
+	void init(Generator& generator, const Settings& settings)
+	{
+		generator = Generator();
+		generator.settings = settings;
+		generator.random_state = hash(settings.seed);
+
+		const auto max_stride = (settings.max_width * 4 + stride_alignment - 1) / stride_alignment * stride_alignment;
+		generator.buffer.assign(static_cast<size_t>(max_stride) * settings.max_height, 0);
+		generator.frame.pixels = generator.buffer.data();
+		resize(generator, settings.width, settings.height);
+
+		for (auto i = 0; i < settings.images_count; i++)
+		{
+			Image image;
+			image.width = random_range(generator, 120, 400);
+			image.height = random_range(generator, 80, 300);
+			image.x = random_range(generator, 0, 40) * cell_width;
+			image.y = random_range(generator, 0, 200) * line_height;
+			image.seed = next_random(generator);
+			generator.images.push_back(image);
+		}
+
+		generator.caret_line = random_range(generator, 0, get_visible_lines(generator) - 1);
+	}
+
+	void resize(Generator& generator, int width, int height)
+	{
+		const auto& settings = generator.settings;
+		if (width < settings.min_width) width = settings.min_width;
+		if (width > settings.max_width) width = settings.max_width;
+		if (height < settings.min_height) height = settings.min_height;
+		if (height > settings.max_height) height = settings.max_height;
+
+		generator.frame.width = width;
+		generator.frame.height = height;
+		generator.frame.stride = (width * 4 + stride_alignment - 1) / stride_alignment * stride_alignment;
+
+		// The generated lines depend on the width of the editor
+		generator.cached_line_index = -1;
+	}
+
+	const Frame& next_frame(Generator& generator)
+	{
+		simulate_events(generator);
+		render(generator);
+		generator.frame_index++;
+		return generator.frame;
+	}
+}
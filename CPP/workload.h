@@ -0,0 +1,96 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Deterministic generator of synthetic IDE frames (BGRA) for the benchmarks: a project panel, an editor with
+// lines of glyphs and line numbers, images in the document, a status bar, and events of caret blinks, typing
+// bursts, scrolling and resizes. The same seed and settings give the same frames on any platform (it uses only
+// its own random numbers), and it does not depend on Windows.h
+namespace workload
+{
+	enum class Preset
+	{
+		dark, // Flat dark theme with a blinking caret
+		light,
+		dense, // Long lines of code that fill the editor
+		images,
+		gradient, // The background of the editor is a gradient
+		scrolling,
+		typing,
+		resizing,
+		mixed,
+		count
+	};
+
+	struct Settings
+	{
+		unsigned int seed = 1;
+		int width = 1280, height = 800;
+		int min_width = 320, max_width = 2560;
+		int min_height = 240, max_height = 1440;
+		bool light_theme = false;
+		bool gradient_background = false;
+		double code_density = 0.5; // How much of the width of the editor the lines fill, 0 to 1
+		int images_count = 0; // Images in the document, they scroll with the text
+		int caret_blink_frames = 30; // Frames between the blinks of the caret, 0 for no caret
+		double typing_probability = 0; // The chance of each frame to start a typing burst
+		double scroll_probability = 0; // The chance of each frame to start scrolling
+		double resize_probability = 0; // The chance of each frame to resize the window
+	};
+
+	struct Frame
+	{
+		uint8_t* pixels = nullptr;
+		int width = 0, height = 0;
+		int stride = 0; // The distance between the rows in bytes
+	};
+
+	struct Image
+	{
+		int x = 0, y = 0; // In the document, x from the start of the text
+		int width = 0, height = 0;
+		uint64_t seed = 0;
+	};
+
+	// The state of one sequence of frames
+	struct Generator
+	{
+		Settings settings;
+		uint64_t random_state = 0;
+		std::vector<uint8_t> buffer; // For the biggest frame, so the frames are not allocated
+		Frame frame;
+		int frame_index = 0;
+
+		int scroll_y = 0; // The top of the view in the document, in pixels
+		int scroll_step = 0;
+		int scroll_frames_left = 0;
+
+		int typing_frames_left = 0;
+		int caret_line = 0, caret_column = 0;
+		std::unordered_map<int, std::string> edited_lines;
+
+		std::vector<Image> images;
+
+		// The text of the last line that was rendered, the same line is rendered for several rows
+		int cached_line_index = -1;
+		std::string cached_line;
+	};
+
+	Settings get_preset(Preset preset);
+	const char* get_preset_name(Preset preset);
+	bool parse_preset(const char* name, Preset& preset);
+
+	void init(Generator& generator, const Settings& settings);
+
+	// Set the size of the next frames. It is clamped to the limits of the settings
+	void resize(Generator& generator, int width, int height);
+
+	// A random step of the size, mostly small like dragging the border of the window and sometimes a jump
+	// (maximize, restore)
+	void random_resize(Generator& generator);
+
+	// Simulate the events of the next frame and render it. The frame is valid until the next call
+	const Frame& next_frame(Generator& generator);
+}
@@ -2,21 +2,29 @@ package glasscode;
 
 import com.intellij.ide.plugins.IdeaPluginDescriptor;
 import com.intellij.ide.plugins.PluginManager;
+import com.sun.jna.Native;
 import com.sun.jna.Pointer;
 import com.sun.jna.Structure;
 import com.sun.jna.platform.win32.BaseTSD;
+import com.sun.jna.platform.win32.Kernel32;
 import com.sun.jna.platform.win32.User32;
+import com.sun.jna.platform.win32.WinBase;
 import com.sun.jna.platform.win32.WinDef;
+import com.sun.jna.platform.win32.WinError;
+import com.sun.jna.platform.win32.WinNT;
 import com.sun.jna.platform.win32.WinUser;
 import glasscode.helpers.WindowsHelpers;
 
 import java.io.BufferedReader;
 import java.io.IOException;
 import java.io.InputStreamReader;
+import java.lang.invoke.VarHandle;
 import java.nio.file.Path;
 import java.nio.file.Paths;
 import java.util.Arrays;
+import java.util.HashSet;
 import java.util.List;
+import java.util.Set;
 
 public class Renderer {
 
@@ -25,10 +33,25 @@ public class Renderer {
     private static Path rendererPath = null;
     private final long windowId;
     private final WinDef.HWND windowHwnd;
-    private Process rendererProcess = null;
-    private WinDef.HWND rendererMsgHwnd = null;
     private int osBuildNumber = 0;
 
+    // One renderer process renders the windows of all the projects. It is started with the first window
+    // and the next windows are attached to it
+    private static Process rendererProcess = null;
+    private static WinDef.HWND rendererMsgHwnd = null;
+    private static final Set<Long> attachedWindowIds = new HashSet<>();
+    private static WinNT.HANDLE rendererDoorbell = null;
+    private static long rendererMsgWindowId = 0;
+
+    // Read only view of the metrics that the renderer publishes
+    private static WinNT.HANDLE metricsMapping = null;
+    private static Pointer metricsMemory = null;
+
+    // The settings of the window are written to a shared memory block that the renderer reads, so moving a
+    // slider does not wait for the renderer to handle a message
+    private WinNT.HANDLE controlBlockMapping = null;
+    private Pointer controlBlock = null;
+
     public Renderer(long windowId) {
         this.windowId = windowId;
         this.windowHwnd = new WinDef.HWND(Pointer.createConstant(windowId));
@@ -42,6 +65,20 @@ public class Renderer {
         public static int SET_BRIGHTNESS = 2;
         public static int SET_TEXT_BRIGHTNESS = 3;
         public static int SET_BLUR_TYPE = 4;
+        public static int SET_ANALYSIS_SCALE = 5;
+        public static int ATTACH_TARGET = 6;
+        public static int DETACH_TARGET = 7;
+    }
+
+    // The layout of the control block. It must match SharedBlock in control_block.cpp
+    private static class ControlBlockOffset {
+        public static final int SEQUENCE = 0;
+        public static final int OPACITY = 4;
+        public static final int BRIGHTNESS = 8;
+        public static final int TEXT_BRIGHTNESS = 12;
+        public static final int BLUR_TYPE = 16;
+        public static final int ANALYSIS_SCALE = 20;
+        public static final int SIZE = 24;
     }
 
 
@@ -60,6 +97,85 @@ public class Renderer {
                     + System.lineSeparator() + System.lineSeparator() +
                     "Minimum required OS build number: " + MINIMUM_REQUIRED_OS_BUILD_NUMBER);
 
+        synchronized (Renderer.class) {
+            // The renderer opens the block when it attaches the window, so it must exist before
+            openControlBlock(opacityLevel, brightnessLevel, textExtraBrightnessLevel, blurType);
+
+            try {
+                if (isRendererProcessAlive()) {
+                    sendMessage(CommandId.ATTACH_TARGET, opacityLevel, brightnessLevel, textExtraBrightnessLevel,
+                            blurType);
+                    attachedWindowIds.add(windowId);
+                    return;
+                }
+
+                attachedWindowIds.clear();
+                startRendererProcess(isCudaEnabled, opacityLevel, brightnessLevel, textExtraBrightnessLevel, blurType);
+                attachedWindowIds.add(windowId);
+            } catch (RuntimeException e) {
+                closeControlBlock();
+                throw e;
+            }
+        }
+    }
+
+    private synchronized void openControlBlock(int opacityLevel, int brightnessLevel, int textExtraBrightnessLevel,
+                                               int blurType) {
+        closeControlBlock();
+
+        controlBlockMapping = Kernel32.INSTANCE.CreateFileMapping(WinBase.INVALID_HANDLE_VALUE, null,
+                WinNT.PAGE_READWRITE, 0, ControlBlockOffset.SIZE, "Local\\GlassCode_Control_" + windowId);
+        if (controlBlockMapping == null)
+            throw new RuntimeException("Failed to create the settings block of the renderer");
+
+        controlBlock = Kernel32.INSTANCE.MapViewOfFile(controlBlockMapping,
+                WinNT.SECTION_MAP_READ | WinNT.SECTION_MAP_WRITE, 0, 0, ControlBlockOffset.SIZE);
+        if (controlBlock == null) {
+            closeControlBlock();
+            throw new RuntimeException("Failed to map the settings block of the renderer");
+        }
+
+        controlBlock.setInt(ControlBlockOffset.SEQUENCE, 0);
+        controlBlock.setInt(ControlBlockOffset.OPACITY, opacityLevel);
+        controlBlock.setInt(ControlBlockOffset.BRIGHTNESS, brightnessLevel);
+        controlBlock.setInt(ControlBlockOffset.TEXT_BRIGHTNESS, textExtraBrightnessLevel);
+        controlBlock.setInt(ControlBlockOffset.BLUR_TYPE, blurType);
+        controlBlock.setInt(ControlBlockOffset.ANALYSIS_SCALE, 0);
+    }
+
+    private synchronized void closeControlBlock() {
+        if (controlBlock != null) {
+            Kernel32.INSTANCE.UnmapViewOfFile(controlBlock);
+            controlBlock = null;
+        }
+
+        if (controlBlockMapping != null) {
+            Kernel32.INSTANCE.CloseHandle(controlBlockMapping);
+            controlBlockMapping = null;
+        }
+    }
+
+    // Seqlock write: the renderer retries to read while the sequence is odd or was changed during the read
+    private synchronized void writeControlBlock(int offset, int value) {
+        if (controlBlock == null)
+            throw new RuntimeException("The settings block of the renderer is not open");
+
+        // The stores to the block are plain native stores, that the JIT and a CPU without the store order of
+        // x86 (ARM) may reorder. The fences keep the value after the odd sequence and before the even one
+        int sequence = controlBlock.getInt(ControlBlockOffset.SEQUENCE);
+        controlBlock.setInt(ControlBlockOffset.SEQUENCE, sequence + 1);
+        VarHandle.releaseFence();
+        controlBlock.setInt(offset, value);
+        VarHandle.releaseFence();
+        controlBlock.setInt(ControlBlockOffset.SEQUENCE, sequence + 2);
+
+        WinNT.HANDLE doorbell = rendererDoorbell;
+        if (doorbell != null)
+            Kernel32.INSTANCE.SetEvent(doorbell);
+    }
+
+    private void startRendererProcess(boolean isCudaEnabled, int opacityLevel, int brightnessLevel,
+                                      int textExtraBrightnessLevel, int blurType) {
         try {
 
             rendererMsgHwnd = null;
@@ -120,6 +236,9 @@ public class Renderer {
                             "Renderer Logs: " + getRendererLogs());
                 } else {
                     rendererMsgHwnd = new WinDef.HWND(Pointer.createConstant(rendererMsgWindow));
+                    rendererMsgWindowId = rendererMsgWindow;
+                    rendererDoorbell = Kernel32.INSTANCE.CreateEvent(null, false, false,
+                            "Local\\GlassCode_Doorbell_" + rendererMsgWindow);
                 }
             }
 
@@ -135,9 +254,9 @@ public class Renderer {
             }
 
         } catch (Exception e) {
-            if (isGlassEffectRunning()) {
+            if (isRendererProcessAlive()) {
                 try {
-                    disableGlassEffect();
+                    stopRendererProcess();
                 } catch (Exception ignored) {
                 }
             }
@@ -150,7 +269,27 @@ public class Renderer {
 
     public void disableGlassEffect() {
 
-        if (isGlassEffectRunning()) {
+        synchronized (Renderer.class) {
+            boolean wasAttached = attachedWindowIds.remove(windowId);
+            if (isRendererProcessAlive() && !attachedWindowIds.isEmpty()) {
+                // Other windows are still rendered by the process
+                if (wasAttached)
+                    sendMessage(CommandId.DETACH_TARGET, 0);
+            } else {
+                stopRendererProcess();
+            }
+        }
+
+        closeControlBlock();
+
+        // Get the current transparency of the window. if it is not 100%, recover it now using JNA
+        int transparency = WindowsHelpers.getWindowTransparency(windowHwnd);
+        if (transparency < 255)
+            WindowsHelpers.setWindowTransparency(windowHwnd, 255);
+    }
+
+    private void stopRendererProcess() {
+        if (isRendererProcessAlive()) {
             sendMessage(CommandId.EXIT, 0);
 
             if (rendererMsgHwnd != null) {
@@ -167,19 +306,77 @@ public class Renderer {
             }
         }
 
-        // Get the current transparency of the window. if it is not 100%, recover it now using JNA
-        int transparency = WindowsHelpers.getWindowTransparency(windowHwnd);
-        if (transparency < 255)
-            WindowsHelpers.setWindowTransparency(windowHwnd, 255);
-
+        attachedWindowIds.clear();
         rendererProcess = null;
         rendererMsgHwnd = null;
+
+        rendererMsgWindowId = 0;
+
+        if (rendererDoorbell != null) {
+            Kernel32.INSTANCE.CloseHandle(rendererDoorbell);
+            rendererDoorbell = null;
+        }
+
+        closeMetricsMemory();
     }
 
-    public boolean isGlassEffectRunning() {
+    private static boolean isRendererProcessAlive() {
         return rendererProcess != null && rendererProcess.isAlive();
     }
 
+    // Returns the last metrics that the renderer published, or null if the renderer is not running
+    public static RendererMetrics getMetrics() {
+        synchronized (Renderer.class) {
+            if (!isRendererProcessAlive() || rendererMsgWindowId == 0)
+                return null;
+
+            if (metricsMemory == null && !openMetricsMemory())
+                return null;
+
+            return RendererMetrics.read(metricsMemory);
+        }
+    }
+
+    private static boolean openMetricsMemory() {
+        // The renderer created the memory, so this returns the existing one, and it is mapped as read only
+        metricsMapping = Kernel32.INSTANCE.CreateFileMapping(WinBase.INVALID_HANDLE_VALUE, null,
+                WinNT.PAGE_READONLY, 0, RendererMetrics.HEADER_SIZE,
+                "Local\\GlassCode_Metrics_" + rendererMsgWindowId);
+        if (metricsMapping == null)
+            return false;
+
+        if (Native.getLastError() != WinError.ERROR_ALREADY_EXISTS) {
+            closeMetricsMemory();
+            return false;
+        }
+
+        metricsMemory = Kernel32.INSTANCE.MapViewOfFile(metricsMapping, WinNT.SECTION_MAP_READ, 0, 0, 0);
+        if (metricsMemory == null) {
+            closeMetricsMemory();
+            return false;
+        }
+
+        return true;
+    }
+
+    private static void closeMetricsMemory() {
+        if (metricsMemory != null) {
+            Kernel32.INSTANCE.UnmapViewOfFile(metricsMemory);
+            metricsMemory = null;
+        }
+
+        if (metricsMapping != null) {
+            Kernel32.INSTANCE.CloseHandle(metricsMapping);
+            metricsMapping = null;
+        }
+    }
+
+    public boolean isGlassEffectRunning() {
+        synchronized (Renderer.class) {
+            return attachedWindowIds.contains(windowId) && isRendererProcessAlive();
+        }
+    }
+
     private void abortIfNotEnabled() {
         if (!isGlassEffectRunning())
             throw new RuntimeException("Renderer process is not running. Can't processed");
@@ -187,22 +384,27 @@ public class Renderer {
 
     public void setBlurType(int blurType) {
         abortIfNotEnabled();
-        sendMessage(CommandId.SET_BLUR_TYPE, blurType);
+        writeControlBlock(ControlBlockOffset.BLUR_TYPE, blurType);
     }
 
     public void setOpacityLevel(int opacityLevel) {
         abortIfNotEnabled();
-        sendMessage(CommandId.SET_OPACITY, opacityLevel);
+        writeControlBlock(ControlBlockOffset.OPACITY, opacityLevel);
     }
 
     public void setBrightnessLevel(int brightnessLevel) {
         abortIfNotEnabled();
-        sendMessage(CommandId.SET_BRIGHTNESS, brightnessLevel);
+        writeControlBlock(ControlBlockOffset.BRIGHTNESS, brightnessLevel);
     }
 
     public void setTextExtraBrightnessLevel(int textExtraBrightnessLevel) {
         abortIfNotEnabled();
-        sendMessage(CommandId.SET_TEXT_BRIGHTNESS, textExtraBrightnessLevel);
+        writeControlBlock(ControlBlockOffset.TEXT_BRIGHTNESS, textExtraBrightnessLevel);
+    }
+
+    public void setAnalysisScale(int analysisScale) {
+        abortIfNotEnabled();
+        writeControlBlock(ControlBlockOffset.ANALYSIS_SCALE, analysisScale);
     }
 
     // endregion
@@ -213,21 +415,32 @@ public class Renderer {
     public static class MsgStruct extends Structure {
         public int commandId;
         public int commandValue;
+        public int commandValue2;
+        public int commandValue3;
+        public int commandValue4;
 
-        public MsgStruct(int commandId, int commandValue) {
+        public MsgStruct(int commandId, int commandValue, int commandValue2, int commandValue3, int commandValue4) {
             this.commandId = commandId;
             this.commandValue = commandValue;
+            this.commandValue2 = commandValue2;
+            this.commandValue3 = commandValue3;
+            this.commandValue4 = commandValue4;
             write();
         }
 
         protected List<String> getFieldOrder() {
-            return Arrays.asList("commandId", "commandValue");
+            return Arrays.asList("commandId", "commandValue", "commandValue2", "commandValue3", "commandValue4");
         }
     }
 
     private void sendMessage(int commandId, int commandValue) {
+        sendMessage(commandId, commandValue, 0, 0, 0);
+    }
+
+    private void sendMessage(int commandId, int commandValue, int commandValue2, int commandValue3,
+                             int commandValue4) {
 
-        MsgStruct myData = new MsgStruct(commandId, commandValue);
+        MsgStruct myData = new MsgStruct(commandId, commandValue, commandValue2, commandValue3, commandValue4);
 
         WinUser.COPYDATASTRUCT copyDataStruct = new WinUser.COPYDATASTRUCT();
         copyDataStruct.dwData = new BaseTSD.ULONG_PTR(0);
@@ -0,0 +1,157 @@
+package glasscode;
+
+import com.sun.jna.Pointer;
+
+// Snapshot of the metrics that the renderer process publishes once per second
+public class RendererMetrics {
+
+    // The layout of the metrics memory. It must match SharedHeader and SharedSlot in metrics.cpp
+    private static final long LAYOUT_VERSION = 4;
+    private static final int HEADER_LAYOUT_VERSION = 0;
+    private static final int HEADER_SLOTS_COUNT = 8;
+    private static final int HEADER_SLOT_SIZE = 16;
+    private static final int HEADER_PUBLISHED_COUNT = 24;
+    public static final int HEADER_SIZE = 32;
+
+    private static final int SLOT_SEQUENCE = 0;
+    private static final int SLOT_BACKEND = 16;
+    private static final int SLOT_FRAMES = 24;
+    private static final int SLOT_FPS_X100 = 56;
+    private static final int SLOT_RESIDENT_BYTES = 64;
+    private static final int SLOT_STAGE_P50 = 72;
+    private static final int SLOT_STAGE_P99 = 112;
+    private static final int SLOT_COPIES_PER_FRAME_X100 = 152;
+    private static final int SLOT_LATENCY_P50 = 160;
+    private static final int SLOT_LATENCY_P95 = 184;
+    private static final int SLOT_LATENCY_P99 = 208;
+    private static final int SLOT_THREAD_POLICY = 232;
+    private static final int SLOT_PERFORMANCE_CORES_PERCENT = 240;
+    private static final int SLOT_CORES_MASK = 248;
+
+    public static final String[] STAGE_NAMES = {"Detect", "Effect", "Present", "Total", "Map"};
+
+    // From the capture of a changed frame until its present ended, and its split to the wait and the work
+    public static final String[] LATENCY_NAMES = {"Latency", "Queue", "Compute"};
+
+    // The placement of the process frame thread, by thread_placement::Policy
+    public static final String[] THREAD_POLICY_NAMES = {"Default", "Performance cores", "Efficiency cores"};
+
+    private static final int MAX_READ_RETRIES = 10;
+
+    public boolean isCudaBackend;
+    public long framesCaptured;
+    public long framesProcessed;
+    public long framesUnchanged;
+    public long framesDropped;
+    public double fps;
+    public long residentBytes;
+    public double copiesPerFrame;
+    public final long[] stageP50Micros = new long[STAGE_NAMES.length];
+    public final long[] stageP99Micros = new long[STAGE_NAMES.length];
+    public final long[] latencyP50Micros = new long[LATENCY_NAMES.length];
+    public final long[] latencyP95Micros = new long[LATENCY_NAMES.length];
+    public final long[] latencyP99Micros = new long[LATENCY_NAMES.length];
+    public int threadPolicy;
+    public long performanceCoresPercent; // -1 if the CPU has no efficiency cores
+    public long coresMask;
+
+    // Read the last published slot. Returns null if nothing was published yet
+    static RendererMetrics read(Pointer memory) {
+        if (memory.getLong(HEADER_LAYOUT_VERSION) != LAYOUT_VERSION)
+            return null;
+
+        long publishedCount = memory.getLong(HEADER_PUBLISHED_COUNT);
+        if (publishedCount == 0)
+            return null;
+
+        long slotsCount = memory.getLong(HEADER_SLOTS_COUNT);
+        long slotSize = memory.getLong(HEADER_SLOT_SIZE);
+        long slot = HEADER_SIZE + ((publishedCount - 1) % slotsCount) * slotSize;
+
+        // The renderer makes the sequence odd while it writes the slot
+        for (int retry = 0; retry < MAX_READ_RETRIES; retry++) {
+            long sequence = memory.getLong(slot + SLOT_SEQUENCE);
+            if ((sequence & 1) != 0)
+                continue;
+
+            RendererMetrics metrics = new RendererMetrics();
+            metrics.isCudaBackend = memory.getLong(slot + SLOT_BACKEND) == 1;
+            metrics.framesCaptured = memory.getLong(slot + SLOT_FRAMES);
+            metrics.framesProcessed = memory.getLong(slot + SLOT_FRAMES + 8);
+            metrics.framesUnchanged = memory.getLong(slot + SLOT_FRAMES + 16);
+            metrics.framesDropped = memory.getLong(slot + SLOT_FRAMES + 24);
+            metrics.fps = memory.getLong(slot + SLOT_FPS_X100) / 100.0;
+            metrics.residentBytes = memory.getLong(slot + SLOT_RESIDENT_BYTES);
+            metrics.copiesPerFrame = memory.getLong(slot + SLOT_COPIES_PER_FRAME_X100) / 100.0;
+            for (int i = 0; i < STAGE_NAMES.length; i++) {
+                metrics.stageP50Micros[i] = memory.getLong(slot + SLOT_STAGE_P50 + i * 8);
+                metrics.stageP99Micros[i] = memory.getLong(slot + SLOT_STAGE_P99 + i * 8);
+            }
+            for (int i = 0; i < LATENCY_NAMES.length; i++) {
+                metrics.latencyP50Micros[i] = memory.getLong(slot + SLOT_LATENCY_P50 + i * 8);
+                metrics.latencyP95Micros[i] = memory.getLong(slot + SLOT_LATENCY_P95 + i * 8);
+                metrics.latencyP99Micros[i] = memory.getLong(slot + SLOT_LATENCY_P99 + i * 8);
+            }
+
+            metrics.threadPolicy = (int) memory.getLong(slot + SLOT_THREAD_POLICY);
+            metrics.performanceCoresPercent = memory.getLong(slot + SLOT_PERFORMANCE_CORES_PERCENT);
+            metrics.coresMask = memory.getLong(slot + SLOT_CORES_MASK);
+
+            if (memory.getLong(slot + SLOT_SEQUENCE) == sequence)
+                return metrics;
+        }
+
+        return null;
+    }
+
+    public String toHtml() {
+        StringBuilder html = new StringBuilder("<html>");
+        html.append("Backend: ").append(isCudaBackend ? "CUDA" : "CPU").append("<br>");
+        html.append(String.format("FPS: %.1f", fps)).append("<br>");
+        html.append("Frames: ").append(framesCaptured).append(" captured, ")
+                .append(framesProcessed).append(" processed, ")
+                .append(framesUnchanged).append(" unchanged, ")
+                .append(framesDropped).append(" dropped<br>");
+        for (int i = 0; i < STAGE_NAMES.length; i++) {
+            html.append(String.format("%s: p50 %.2f ms, p99 %.2f ms", STAGE_NAMES[i],
+                    stageP50Micros[i] / 1000.0, stageP99Micros[i] / 1000.0)).append("<br>");
+        }
+        for (int i = 0; i < LATENCY_NAMES.length; i++) {
+            html.append(String.format("%s: p50 %.2f ms, p95 %.2f ms, p99 %.2f ms", LATENCY_NAMES[i],
+                    latencyP50Micros[i] / 1000.0, latencyP95Micros[i] / 1000.0,
+                    latencyP99Micros[i] / 1000.0)).append("<br>");
+        }
+        html.append("Threads: ").append(threadPolicy >= 0 && threadPolicy < THREAD_POLICY_NAMES.length
+                ? THREAD_POLICY_NAMES[threadPolicy] : "Unknown");
+        html.append(", ran on cores ").append(formatCores(coresMask));
+        if (performanceCoresPercent >= 0)
+            html.append(" (").append(performanceCoresPercent).append("% on performance cores)");
+        html.append("<br>");
+        html.append(String.format("Texture copies per frame: %.2f", copiesPerFrame)).append("<br>");
+        html.append("Memory: ").append(residentBytes / (1024 * 1024)).append(" MB");
+        html.append("</html>");
+        return html.toString();
+    }
+
+    // The cores of the mask as ranges, like "0-3, 6"
+    private static String formatCores(long mask) {
+        StringBuilder cores = new StringBuilder();
+        for (int core = 0; core < 64; core++) {
+            if ((mask >>> core & 1) == 0)
+                continue;
+
+            int last = core;
+            while (last + 1 < 64 && (mask >>> (last + 1) & 1) != 0)
+                last++;
+
+            if (cores.length() > 0)
+                cores.append(", ");
+            cores.append(core);
+            if (last > core)
+                cores.append('-').append(last);
+            core = last;
+        }
+
+        return cores.length() > 0 ? cores.toString() : "none";
+    }
+}
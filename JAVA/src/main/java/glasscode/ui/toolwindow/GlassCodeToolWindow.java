@@ -6,6 +6,8 @@ import com.intellij.openapi.components.ServiceManager;
 import com.intellij.openapi.project.Project;
 import glasscode.GlassCodeStorage;
 import glasscode.PluginMain;
+import glasscode.Renderer;
+import glasscode.RendererMetrics;
 import glasscode.helpers.PluginUiHelpers;
 
 import javax.swing.*;
@@ -26,6 +28,9 @@ public class GlassCodeToolWindow {
     private JCheckBox enableOnStartupCheckBox;
     private JSlider textExtraBrightness;
     private JLabel textExtraBrightnessLabel;
+    private JLabel metricsLabel;
+
+    private static final int METRICS_UPDATE_INTERVAL_MS = 1000;
 
     private boolean isUiUpdating = false;
     private final PluginMain pluginMain;
@@ -69,6 +74,9 @@ public class GlassCodeToolWindow {
 
         saveAsDefaultsButton.addActionListener(e -> onSaveSettingsEvent());
 
+        // The renderer publishes the metrics once per second
+        Timer metricsTimer = new Timer(METRICS_UPDATE_INTERVAL_MS, e -> updateMetrics());
+        metricsTimer.start();
     }
 
 
@@ -184,6 +192,14 @@ public class GlassCodeToolWindow {
     }
 
 
+    private void updateMetrics() {
+        if (!metricsLabel.isShowing())
+            return;
+
+        RendererMetrics metrics = Renderer.getMetrics();
+        metricsLabel.setText(metrics != null ? metrics.toHtml() : "Renderer is not running");
+    }
+
     private void setOpacityLabelText(int level) {
         opacityLabel.setText(level + "%");
     }